@@ -150,8 +150,10 @@ sub build_pgprobackup
 		'help.c',
 		'init.c',
 		'merge.c',
+		'pagemap.c',
 		'parsexlog.c',
 		'pg_probackup.c',
+		'progress.c',
 		'restore.c',
 		'show.c',
 		'util.c',
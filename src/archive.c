@@ -12,9 +12,23 @@
 
 #include <unistd.h>
 
+#include "utils/thread.h"
+
+/* Directory next to the requested file, where WAL segments are prefetched */
+#define PREFETCH_DIR "pbk_prefetch"
+
 static void push_wal_file(const char *from_path, const char *to_path,
 						  bool is_compress, bool overwrite);
 static void get_wal_file(const char *from_path, const char *to_path);
+static void push_ready_wal_files(const char *pg_xlog_dir,
+								 const char *wal_file_name, int max_files,
+								 bool is_compress, bool overwrite,
+								 bool wal_summary);
+static bool get_prefetched_wal_file(const char *prefetch_dir,
+									const char *wal_file_name,
+									const char *to_path);
+static void prefetch_wal_files(const char *prefetch_dir,
+							   const char *wal_file_name, int max_files);
 #ifdef HAVE_LIBZ
 static const char *get_gz_error(gzFile gzf, int errnum);
 #endif
@@ -35,7 +49,8 @@ static void copy_file_attributes(const char *from_path,
  * compute and validate checksums.
  */
 int
-do_archive_push(char *wal_file_path, char *wal_file_name, bool overwrite)
+do_archive_push(char *wal_file_path, char *wal_file_name, bool overwrite,
+				uint32 batch_size, bool wal_summary)
 {
 	char		backup_wal_file_path[MAXPGPATH];
 	char		absolute_wal_file_path[MAXPGPATH];
@@ -77,8 +92,11 @@ do_archive_push(char *wal_file_path, char *wal_file_name, bool overwrite)
 
 	elog(INFO, "pg_probackup archive-push from %s to %s", absolute_wal_file_path, backup_wal_file_path);
 
-	if (instance_config.compress_alg == PGLZ_COMPRESS)
-		elog(ERROR, "pglz compression is not supported");
+	if (instance_config.compress_alg == PGLZ_COMPRESS ||
+		instance_config.compress_alg == ZSTD_COMPRESS ||
+		instance_config.compress_alg == LZ4_COMPRESS)
+		elog(ERROR, "%s compression is not supported",
+			 deparse_compress_alg(instance_config.compress_alg));
 
 #ifdef HAVE_LIBZ
 	if (instance_config.compress_alg == ZLIB_COMPRESS)
@@ -87,6 +105,21 @@ do_archive_push(char *wal_file_path, char *wal_file_name, bool overwrite)
 
 	push_wal_file(absolute_wal_file_path, backup_wal_file_path, is_compress,
 				  overwrite);
+	if (wal_summary && IsXLogFileName(wal_file_name))
+		write_wal_segment_summary(arclog_path, wal_file_name,
+								  instance_config.xlog_seg_size);
+
+	/* Push other WAL segments, which are ready to be archived */
+	if (batch_size > 1 && IsXLogFileName(wal_file_name))
+	{
+		char		pg_xlog_dir[MAXPGPATH];
+
+		strlcpy(pg_xlog_dir, absolute_wal_file_path, sizeof(pg_xlog_dir));
+		get_parent_directory(pg_xlog_dir);
+		push_ready_wal_files(pg_xlog_dir, wal_file_name, batch_size - 1,
+							 is_compress, overwrite, wal_summary);
+	}
+
 	elog(INFO, "pg_probackup archive-push completed successfully");
 
 	return 0;
@@ -97,11 +130,13 @@ do_archive_push(char *wal_file_path, char *wal_file_name, bool overwrite)
  * Move files from arclog_path to pgdata/wal_file_path.
  */
 int
-do_archive_get(char *wal_file_path, char *wal_file_name)
+do_archive_get(char *wal_file_path, char *wal_file_name, uint32 batch_size)
 {
 	char		backup_wal_file_path[MAXPGPATH];
 	char		absolute_wal_file_path[MAXPGPATH];
 	char		current_dir[MAXPGPATH];
+	char		prefetch_dir[MAXPGPATH];
+	bool		prefetch;
 
 	if (wal_file_name == NULL && wal_file_path == NULL)
 		elog(ERROR, "required parameters are not specified: --wal-file-name %%f --wal-file-path %%p");
@@ -122,7 +157,28 @@ do_archive_get(char *wal_file_path, char *wal_file_name)
 
 	elog(INFO, "pg_probackup archive-get from %s to %s",
 		 backup_wal_file_path, absolute_wal_file_path);
+
+	/* Prefetched segments are kept in the directory next to the target */
+	prefetch = batch_size > 1 && IsXLogFileName(wal_file_name);
+	if (prefetch)
+	{
+		strlcpy(prefetch_dir, absolute_wal_file_path, sizeof(prefetch_dir));
+		get_parent_directory(prefetch_dir);
+		join_path_components(prefetch_dir, prefetch_dir, PREFETCH_DIR);
+
+		if (get_prefetched_wal_file(prefetch_dir, wal_file_name,
+									absolute_wal_file_path))
+		{
+			elog(INFO, "pg_probackup archive-get used prefetched WAL segment");
+			return 0;
+		}
+	}
+
 	get_wal_file(backup_wal_file_path, absolute_wal_file_path);
+
+	if (prefetch)
+		prefetch_wal_files(prefetch_dir, wal_file_name, batch_size - 1);
+
 	elog(INFO, "pg_probackup archive-get completed successfully");
 
 	return 0;
@@ -460,6 +516,318 @@ get_wal_file(const char *from_path, const char *to_path)
 #endif
 }
 
+/* WAL segment copied by push_ready_wal_files() or prefetch_wal_files() */
+typedef struct
+{
+	char		name[MAXFNAMELEN];
+	char		from_path[MAXPGPATH];
+	char		to_path[MAXPGPATH];
+	bool		done;			/* segment is copied successfully */
+
+	volatile pg_atomic_flag lock;
+} wal_batch_item;
+
+typedef struct
+{
+	wal_batch_item *items;
+	int			nitems;
+
+	/* archive-push options */
+	const char *archive_status_dir;
+	bool		is_compress;
+	bool		overwrite;
+} wal_batch_arg;
+
+/*
+ * Run "worker" in min(num_threads, nitems) threads. Worker threads are used
+ * even for a single segment, so that an error in a batch doesn't fail
+ * the whole command: the segment requested by the server is already
+ * copied at this point.
+ */
+static int
+run_wal_batch(void *(*worker) (void *), wal_batch_arg *arg)
+{
+	int			nthreads = Min(num_threads, arg->nitems);
+	pthread_t  *threads;
+	int			ndone = 0;
+	int			i;
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * nthreads);
+	thread_interrupted = false;
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, arg);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pfree(threads);
+	thread_interrupted = false;
+
+	for (i = 0; i < arg->nitems; i++)
+		if (arg->items[i].done)
+			ndone++;
+
+	return ndone;
+}
+
+/* Worker of push_ready_wal_files() */
+static void *
+push_wal_files_worker(void *arg)
+{
+	wal_batch_arg *arguments = (wal_batch_arg *) arg;
+	int			i;
+
+	for (i = 0; i < arguments->nitems; i++)
+	{
+		wal_batch_item *item = &arguments->items[i];
+		char		ready_path[MAXPGPATH];
+		char		done_path[MAXPGPATH];
+
+		if (!pg_atomic_test_set_flag(&item->lock))
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "interrupted during WAL archiving");
+
+		push_wal_file(item->from_path, item->to_path, arguments->is_compress,
+					  arguments->overwrite);
+
+		/* Tell the archiver, that the segment has been archived already */
+		snprintf(ready_path, MAXPGPATH, "%s/%s.ready",
+				 arguments->archive_status_dir, item->name);
+		snprintf(done_path, MAXPGPATH, "%s/%s.done",
+				 arguments->archive_status_dir, item->name);
+		if (fio_rename(ready_path, done_path, FIO_DB_HOST) < 0)
+			elog(WARNING, "Cannot rename \"%s\" to \"%s\": %s",
+				 ready_path, done_path, strerror(errno));
+		else
+			item->done = true;
+	}
+
+	return NULL;
+}
+
+static int
+compare_wal_file_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Push up to "max_files" oldest WAL segments, which are marked as ready in
+ * archive_status, using num_threads threads. Pushed segments are marked as
+ * done, so the archiver doesn't call archive_command for them.
+ */
+static void
+push_ready_wal_files(const char *pg_xlog_dir, const char *wal_file_name,
+					 int max_files, bool is_compress, bool overwrite,
+					 bool wal_summary)
+{
+	char		archive_status_dir[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *ent;
+	parray	   *ready = parray_new();
+	wal_batch_arg arg;
+	int			ndone;
+	int			i;
+
+	join_path_components(archive_status_dir, pg_xlog_dir, "archive_status");
+
+	dir = fio_opendir(archive_status_dir, FIO_DB_HOST);
+	if (dir == NULL)
+	{
+		elog(WARNING, "Cannot open directory \"%s\": %s",
+			 archive_status_dir, strerror(errno));
+		parray_free(ready);
+		return;
+	}
+
+	while ((ent = fio_readdir(dir)) != NULL)
+	{
+		char		name[MAXFNAMELEN];
+		size_t		len = strlen(ent->d_name);
+
+		if (len != XLOG_FNAME_LEN + strlen(".ready") ||
+			strcmp(ent->d_name + XLOG_FNAME_LEN, ".ready") != 0)
+			continue;
+
+		strlcpy(name, ent->d_name, XLOG_FNAME_LEN + 1);
+		if (!IsXLogFileName(name) || strcmp(name, wal_file_name) == 0)
+			continue;
+
+		parray_append(ready, pgut_strdup(name));
+	}
+	fio_closedir(dir);
+
+	if (parray_num(ready) == 0)
+	{
+		parray_free(ready);
+		return;
+	}
+
+	/* The archiver pushes the oldest segments first, so do we */
+	parray_qsort(ready, compare_wal_file_names);
+
+	arg.nitems = Min(parray_num(ready), max_files);
+	arg.items = (wal_batch_item *) palloc0(sizeof(wal_batch_item) * arg.nitems);
+	arg.archive_status_dir = archive_status_dir;
+	arg.is_compress = is_compress;
+	arg.overwrite = overwrite;
+
+	for (i = 0; i < arg.nitems; i++)
+	{
+		wal_batch_item *item = &arg.items[i];
+
+		strlcpy(item->name, (char *) parray_get(ready, i), sizeof(item->name));
+		join_path_components(item->from_path, pg_xlog_dir, item->name);
+		join_path_components(item->to_path, arclog_path, item->name);
+		pg_atomic_clear_flag(&item->lock);
+	}
+
+	ndone = run_wal_batch(push_wal_files_worker, &arg);
+	elog(INFO, "pg_probackup archive-push pushed %d of %d ready WAL segments",
+		 ndone, arg.nitems);
+
+	/*
+	 * WAL reader isn't thread-safe, so summaries are written here in the
+	 * order of segments.
+	 */
+	if (wal_summary)
+	{
+		for (i = 0; i < arg.nitems; i++)
+			if (arg.items[i].done)
+				write_wal_segment_summary(arclog_path, arg.items[i].name,
+										  instance_config.xlog_seg_size);
+	}
+
+	pfree(arg.items);
+	parray_walk(ready, pfree);
+	parray_free(ready);
+}
+
+/*
+ * Move WAL segment "wal_file_name" prefetched by previous archive-get call
+ * to "to_path". Return false if the segment is not prefetched.
+ */
+static bool
+get_prefetched_wal_file(const char *prefetch_dir, const char *wal_file_name,
+						const char *to_path)
+{
+	char		prefetched_path[MAXPGPATH];
+
+	join_path_components(prefetched_path, prefetch_dir, wal_file_name);
+	if (fio_access(prefetched_path, F_OK, FIO_DB_HOST) != 0)
+		return false;
+
+	if (fio_rename(prefetched_path, to_path, FIO_DB_HOST) < 0)
+	{
+		elog(WARNING, "Cannot rename WAL file \"%s\" to \"%s\": %s",
+			 prefetched_path, to_path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/* Worker of prefetch_wal_files() */
+static void *
+get_wal_files_worker(void *arg)
+{
+	wal_batch_arg *arguments = (wal_batch_arg *) arg;
+	int			i;
+
+	for (i = 0; i < arguments->nitems; i++)
+	{
+		wal_batch_item *item = &arguments->items[i];
+		char		gz_from_path[MAXPGPATH];
+
+		if (!pg_atomic_test_set_flag(&item->lock))
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "interrupted during WAL prefetching");
+
+		/* Segment may be not archived yet */
+		snprintf(gz_from_path, sizeof(gz_from_path), "%s.gz", item->from_path);
+		if (fio_access(item->from_path, F_OK, FIO_BACKUP_HOST) != 0 &&
+			fio_access(gz_from_path, F_OK, FIO_BACKUP_HOST) != 0)
+			continue;
+
+		get_wal_file(item->from_path, item->to_path);
+		item->done = true;
+	}
+
+	return NULL;
+}
+
+/*
+ * Fetch up to "max_files" WAL segments following "wal_file_name" into
+ * "prefetch_dir" using num_threads threads, so that next archive-get calls
+ * take them from there. The call waits for the whole batch: running it in
+ * background would leave the connection with the agent and worker threads
+ * to a process nobody waits for. Previously prefetched segments are removed: the
+ * server asks for a segment which is not prefetched only if it has gone
+ * another way, e.g. switched to another timeline.
+ */
+static void
+prefetch_wal_files(const char *prefetch_dir, const char *wal_file_name,
+				   int max_files)
+{
+	DIR		   *dir;
+	struct dirent *ent;
+	TimeLineID	tli;
+	XLogSegNo	segno;
+	wal_batch_arg arg;
+	int			ndone;
+	int			i;
+
+	fio_mkdir(prefetch_dir, DIR_PERMISSION, FIO_DB_HOST);
+
+	dir = fio_opendir(prefetch_dir, FIO_DB_HOST);
+	if (dir == NULL)
+	{
+		elog(WARNING, "Cannot open directory \"%s\": %s",
+			 prefetch_dir, strerror(errno));
+		return;
+	}
+	while ((ent = fio_readdir(dir)) != NULL)
+	{
+		char		path[MAXPGPATH];
+
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		join_path_components(path, prefetch_dir, ent->d_name);
+		if (fio_unlink(path, FIO_DB_HOST) != 0)
+			elog(WARNING, "Cannot remove file \"%s\": %s",
+				 path, strerror(errno));
+	}
+	fio_closedir(dir);
+
+	GetXLogFromFileName(wal_file_name, &tli, &segno,
+						instance_config.xlog_seg_size);
+
+	arg.nitems = max_files;
+	arg.items = (wal_batch_item *) palloc0(sizeof(wal_batch_item) * arg.nitems);
+	arg.archive_status_dir = NULL;
+
+	for (i = 0; i < arg.nitems; i++)
+	{
+		wal_batch_item *item = &arg.items[i];
+
+		GetXLogFileName(item->name, tli, segno + i + 1,
+						instance_config.xlog_seg_size);
+		join_path_components(item->from_path, arclog_path, item->name);
+		join_path_components(item->to_path, prefetch_dir, item->name);
+		pg_atomic_clear_flag(&item->lock);
+	}
+
+	ndone = run_wal_batch(get_wal_files_worker, &arg);
+	elog(INFO, "pg_probackup archive-get prefetched %d WAL segments", ndone);
+
+	pfree(arg.items);
+}
+
 #ifdef HAVE_LIBZ
 /*
  * Show error during work with compressed file
@@ -492,37 +860,14 @@ fileEqualCRC(const char *path1, const char *path2, bool path2_is_compressed)
 #ifdef HAVE_LIBZ
 	if (path2_is_compressed)
 	{
-		char 		buf [1024];
-		gzFile		gz_in = NULL;
-
-		INIT_FILE_CRC32(true, crc2);
-		gz_in = fio_gzopen(path2, PG_BINARY_R, Z_DEFAULT_COMPRESSION, FIO_BACKUP_HOST);
-		if (gz_in == NULL)
-			/* File cannot be read */
-			elog(ERROR,
-					 "Cannot compare WAL file \"%s\" with compressed \"%s\"",
-					 path1, path2);
-
-		for (;;)
+		if (fio_get_crc32(path2, true, true, &crc2, NULL, FIO_BACKUP_HOST) < 0)
 		{
-			int read_len = fio_gzread(gz_in, buf, sizeof(buf));
-			if (read_len <= 0 && !fio_gzeof(gz_in))
-			{
-				/* An error occurred while reading the file */
-				elog(WARNING,
-					 "Cannot compare WAL file \"%s\" with compressed \"%s\": %d",
-					 path1, path2, read_len);
-				return false;
-			}
-			COMP_FILE_CRC32(true, crc2, buf, read_len);
-			if (fio_gzeof(gz_in) || read_len == 0)
-				break;
+			/* An error occurred while reading the file */
+			elog(WARNING,
+				 "Cannot compare WAL file \"%s\" with compressed \"%s\": %s",
+				 path1, path2, strerror(errno));
+			return false;
 		}
-		FIN_FILE_CRC32(true, crc2);
-
-		if (fio_gzclose(gz_in) != 0)
-			elog(ERROR, "Cannot close compressed WAL file \"%s\": %s",
-				 path2, get_gz_error(gz_in, errno));
 	}
 	else
 #endif
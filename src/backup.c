@@ -50,8 +50,30 @@ const char *progname = "pg_probackup";
 /* list of files contained in backup */
 static parray *backup_files_list = NULL;
 
-/* We need critical section for datapagemap_add() in case of using threads */
-static pthread_mutex_t backup_pagemap_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Hash table of data files from backup_files_list by RelFileNode and segment
+ * number. It is used by process_block_change() to find the file without
+ * building its path.
+ */
+typedef struct DataFileHashEntry
+{
+	Oid			tblspcOid;
+	Oid			dbOid;
+	Oid			relOid;
+	int			segno;
+	pgFile	   *file;			/* NULL if the entry is empty */
+} DataFileHashEntry;
+
+static DataFileHashEntry *data_file_hash = NULL;
+static uint32 data_file_hash_mask = 0;
+
+/*
+ * We need critical section for pagemap_add() in case of using threads.
+ * Files are spread among several locks by their hash, so threads parsing
+ * WAL rarely wait for each other.
+ */
+#define PAGEMAP_LOCKS_NUM	64
+static pthread_mutex_t backup_pagemap_locks[PAGEMAP_LOCKS_NUM];
 
 /*
  * We need to wait end of WAL streaming before execute pg_stop_backup().
@@ -74,6 +96,35 @@ typedef struct
 static pthread_t stream_thread;
 static StreamThreadArg stream_thread_arg = {"", NULL, 1};
 
+/*
+ * Finished segments of streamed WAL are finalized by a helper thread, so that
+ * WAL receiver doesn't wait for them: the segment summary is written, the
+ * segment is compressed if required and CRC of the result is calculated for
+ * the backup file list.
+ */
+typedef struct
+{
+	char		name[MAXFNAMELEN];
+	bool		summarize;		/* write summary of the segment */
+} StreamSegment;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	const char *basedir;
+	parray	   *queue;			/* StreamSegment to finalize */
+	parray	   *files;			/* finalized segments with calculated CRC */
+	char		last_name[MAXFNAMELEN];	/* the last queued segment */
+	bool		finish;			/* no more segments will be queued */
+	bool		compress;		/* compress segments with zlib */
+} StreamFinalizeState;
+
+static pthread_t stream_finalize_thread;
+static StreamFinalizeState stream_finalize = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
 static int is_ptrack_enable = false;
 bool is_ptrack_support = false;
 bool exclusive_backup = false;
@@ -86,6 +137,8 @@ static char server_version_str[100] = "";
 static bool backup_in_progress = false;
 /* Is pg_stop_backup() was sent */
 static bool pg_stop_backup_is_sent = false;
+/* Are summaries of streamed WAL segments written, see --wal-summary */
+static bool stream_wal_summary = false;
 
 /*
  * Backup routines
@@ -108,21 +161,43 @@ static XLogRecPtr wait_wal_lsn(XLogRecPtr lsn, bool is_start_lsn,
 static void wait_replica_wal_lsn(XLogRecPtr lsn, bool is_start_backup, PGconn *backup_conn);
 static void make_pagemap_from_ptrack(parray* files, PGconn* backup_conn);
 static void *StreamLog(void *arg);
+static void start_stream_finalize(const char *basedir);
+static void queue_stream_segment(const char *wal_file_name, bool summarize);
+static void stop_stream_finalize(void);
+static void *StreamFinalize(void *arg);
+static pgFile *finalize_stream_segment(StreamSegment *segment);
+#ifdef HAVE_LIBZ
+static void compress_stream_segment(const char *path, const char *gz_path);
+#endif
 
 static void check_external_for_tablespaces(parray *external_list,
 										   PGconn *backup_conn);
 
+/* Ptrack maps of relations of one database, see fetch_ptrack_maps() */
+typedef struct PtrackMaps
+{
+	Oid			tblspcOid;
+	Oid			dbOid;
+	int			nrels;
+	Oid		   *relOids;	/* sorted */
+	char	  **maps;		/* NULL if ptrack file is missing */
+	size_t	   *sizes;
+} PtrackMaps;
+
+/* Maximal number of relations in one pg_ptrack_get_and_clear query */
+#define PTRACK_RELS_BATCH	1024
+
 /* Ptrack functions */
 static void pg_ptrack_clear(PGconn *backup_conn);
 static bool pg_ptrack_support(PGconn *backup_conn);
 static bool pg_ptrack_enable(PGconn *backup_conn);
 static bool pg_ptrack_get_and_clear_db(Oid dbOid, Oid tblspcOid,
 									   PGconn *backup_conn);
-static char *pg_ptrack_get_and_clear(Oid tablespace_oid,
-									 Oid db_oid,
-									 Oid rel_oid,
-									 size_t *result_size,
-									 PGconn *backup_conn);
+static void pg_ptrack_get_and_clear_rels(PtrackMaps *maps,
+										 PGconn *backup_conn);
+static void fetch_ptrack_maps(parray *files, size_t start, PtrackMaps *maps,
+							  PGconn *backup_conn);
+static void free_ptrack_maps(PtrackMaps *maps);
 static XLogRecPtr get_last_ptrack_lsn(PGconn *backup_conn);
 
 /* Check functions */
@@ -131,6 +206,8 @@ static bool pg_is_in_recovery(PGconn *conn);
 static void check_server_version(PGconn *conn);
 static void confirm_block_size(PGconn *conn, const char *name, int blcksz);
 static void set_cfs_datafiles(parray *files, const char *root, char *relative, size_t i);
+static void build_data_file_hash(parray *files);
+static void free_data_file_hash(void);
 
 static void
 backup_stopbackup_callback(bool fatal, void *userdata)
@@ -163,6 +240,7 @@ do_backup_instance(PGconn *backup_conn)
 	/* arrays with meta info for multi threaded backup */
 	pthread_t	*threads;
 	backup_files_arg *threads_args;
+	ThreadTasks *tasks;
 	bool		backup_isok = true;
 
 	pgBackup   *prev_backup = NULL;
@@ -387,8 +465,10 @@ do_backup_instance(PGconn *backup_conn)
 		 * reading WAL segments present in archives up to the point
 		 * where this backup has started.
 		 */
+		build_data_file_hash(backup_files_list);
 		extractPageMap(arclog_path, current.tli, instance_config.xlog_seg_size,
 					   prev_backup->start_lsn, current.start_lsn);
+		free_data_file_hash();
 	}
 	else if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
 	{
@@ -431,25 +511,22 @@ do_backup_instance(PGconn *backup_conn)
 				join_path_components(dirpath, database_path, dir_name);
 			fio_mkdir(dirpath, DIR_PERMISSION, FIO_BACKUP_HOST);
 		}
-
-		/* setup threads */
-		pg_atomic_clear_flag(&file->lock);
 	}
 
-	/* Sort by size for load balancing */
-	parray_qsort(backup_files_list, pgFileCompareSize);
 	/* Sort the array for binary search */
 	if (prev_backup_filelist)
 		parray_qsort(prev_backup_filelist, pgFileComparePathWithExternal);
 
 	/* write initial backup_content.control file and update backup.control  */
 	write_backup_filelist(&current, backup_files_list,
-						  instance_config.pgdata, external_dirs);
+						  instance_config.pgdata, external_dirs, false);
 	write_backup(&current);
 
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (backup_files_arg *) palloc(sizeof(backup_files_arg)*num_threads);
+	/* Largest files go first, tablespaces are read in parallel */
+	tasks = pgFileTasksCreate(backup_files_list, false);
 
 	for (i = 0; i < num_threads; i++)
 	{
@@ -462,6 +539,7 @@ do_backup_instance(PGconn *backup_conn)
 		arg->files_list = backup_files_list;
 		arg->prev_filelist = prev_backup_filelist;
 		arg->prev_start_lsn = prev_backup_start_lsn;
+		arg->tasks = tasks;
 		arg->conn_arg.conn = NULL;
 		arg->conn_arg.cancel_conn = NULL;
 		arg->thread_num = i+1;
@@ -472,6 +550,7 @@ do_backup_instance(PGconn *backup_conn)
 	/* Run threads */
 	thread_interrupted = false;
 	elog(INFO, "Start transfering data files");
+	progress_start("backup", backup_files_list, false);
 	for (i = 0; i < num_threads; i++)
 	{
 		backup_files_arg *arg = &(threads_args[i]);
@@ -487,6 +566,9 @@ do_backup_instance(PGconn *backup_conn)
 		if (threads_args[i].ret == 1)
 			backup_isok = false;
 	}
+	thread_tasks_free(tasks);
+	progress_stop();
+	progress_summary(&current);
 	if (backup_isok)
 		elog(INFO, "Data files are transfered");
 	else
@@ -555,7 +637,19 @@ do_backup_instance(PGconn *backup_conn)
 		for (i = 0; i < parray_num(xlog_files_list); i++)
 		{
 			pgFile	   *file = (pgFile *) parray_get(xlog_files_list, i);
-			if (S_ISREG(file->mode))
+			pgFile	  **finalized;
+
+			/* CRC of finalized segments has been calculated during streaming */
+			finalized = S_ISREG(file->mode) ?
+				(pgFile **) parray_bsearch(stream_finalize.files, file,
+										   pgFileCompareName) : NULL;
+			if (finalized)
+			{
+				file->crc = (*finalized)->crc;
+				file->read_size = (*finalized)->read_size;
+				file->write_size = (*finalized)->write_size;
+			}
+			else if (S_ISREG(file->mode))
 			{
 				file->crc = pgFileGetCRC(file->path, true, false,
 										 &file->read_size, FIO_BACKUP_HOST);
@@ -573,11 +667,15 @@ do_backup_instance(PGconn *backup_conn)
 		/* Add xlog files into the list of backed up files */
 		parray_concat(backup_files_list, xlog_files_list);
 		parray_free(xlog_files_list);
+
+		parray_walk(stream_finalize.files, pgFileFree);
+		parray_free(stream_finalize.files);
+		stream_finalize.files = NULL;
 	}
 
 	/* Print the list of files to backup catalog */
 	write_backup_filelist(&current, backup_files_list, instance_config.pgdata,
-						  external_dirs);
+						  external_dirs, true);
 	/* update backup control file to update size info */
 	write_backup(&current);
 
@@ -660,10 +758,12 @@ pgdata_basic_setup(ConnectionOptions conn_opt, PGNodeInfo *nodeInfo)
  * Entry point of pg_probackup BACKUP subcommand.
  */
 int
-do_backup(time_t start_time, bool no_validate)
+do_backup(time_t start_time, bool no_validate, bool wal_summary)
 {
 	PGconn *backup_conn = NULL;
 
+	stream_wal_summary = wal_summary;
+
 	if (!instance_config.pgdata)
 		elog(ERROR, "required parameter not specified: PGDATA "
 						 "(-D, --pgdata)");
@@ -1198,32 +1298,39 @@ pg_ptrack_get_and_clear_db(Oid dbOid, Oid tblspcOid, PGconn *backup_conn)
 	return result;
 }
 
-/* Read and clear ptrack files of the target relation.
- * Result is a bytea ptrack map of all segments of the target relation.
- * case 1: we know a tablespace_oid, db_oid, and rel_filenode
- * case 2: we know db_oid and rel_filenode (no tablespace_oid, because file in pg_default)
- * case 3: we know only rel_filenode (because file in pg_global)
+/* Read and clear ptrack files of relations maps->relOids of one database.
+ * Result is a bytea ptrack map of all segments of every relation, NULL is
+ * stored if ptrack file of the relation is missing.
+ * All maps are fetched by a single query in binary format, so we avoid
+ * connecting to the database and unescaping bytea for every relation.
+ * case 1: we know a tablespace_oid, db_oid, and rel_filenodes
+ * case 2: we know db_oid and rel_filenodes (no tablespace_oid, because files in pg_default)
+ * case 3: we know only rel_filenodes (because files in pg_global)
  */
-static char *
-pg_ptrack_get_and_clear(Oid tablespace_oid, Oid db_oid, Oid rel_filenode,
-						size_t *result_size, PGconn *backup_conn)
+static void
+pg_ptrack_get_and_clear_rels(PtrackMaps *maps, PGconn *backup_conn)
 {
-	PGconn	   *tmp_conn;
-	PGresult   *res_db,
+	PGconn	   *tmp_conn = NULL;
+	PGresult   *res_db = NULL,
 			   *res;
 	char	   *params[2];
-	char	   *result;
-	char	   *val;
+	char	   *dbname = NULL;
+	size_t		len = 0;
+	int			i;
+
+	maps->maps = pgut_newarray(char *, maps->nrels);
+	maps->sizes = pgut_newarray(size_t, maps->nrels);
+	memset(maps->maps, 0, sizeof(char *) * maps->nrels);
+	memset(maps->sizes, 0, sizeof(size_t) * maps->nrels);
 
 	params[0] = palloc(64);
-	params[1] = palloc(64);
+	/* Array literal of relation oids: "{oid,oid,...}" */
+	params[1] = palloc(maps->nrels * 11 + 3);
 
-	/* regular file (not in directory 'global') */
-	if (db_oid != 0)
+	/* regular files (not in directory 'global') */
+	if (maps->dbOid != 0)
 	{
-		char	   *dbname;
-
-		sprintf(params[0], "%i", db_oid);
+		sprintf(params[0], "%i", maps->dbOid);
 		res_db = pgut_execute(backup_conn,
 							  "SELECT datname FROM pg_database WHERE oid=$1",
 							  1, (const char **) params);
@@ -1232,66 +1339,128 @@ pg_ptrack_get_and_clear(Oid tablespace_oid, Oid db_oid, Oid rel_filenode,
 		 * It could have been deleted since previous backup.
 		 */
 		if (PQntuples(res_db) != 1 || PQnfields(res_db) != 1)
-			return NULL;
+			goto cleanup;
 
 		dbname = PQgetvalue(res_db, 0, 0);
 
 		if (strcmp(dbname, "template0") == 0)
-		{
-			PQclear(res_db);
-			return NULL;
-		}
+			goto cleanup;
 
 		tmp_conn = pgut_connect(instance_config.conn_opt.pghost, instance_config.conn_opt.pgport,
 								dbname,
 								instance_config.conn_opt.pguser);
-		sprintf(params[0], "%i", tablespace_oid);
-		sprintf(params[1], "%i", rel_filenode);
-		res = pgut_execute(tmp_conn, "SELECT pg_catalog.pg_ptrack_get_and_clear($1, $2)",
-						   2, (const char **)params);
+	}
 
-		if (PQnfields(res) != 1)
-			elog(ERROR, "cannot get ptrack file from database \"%s\" by tablespace oid %u and relation oid %u",
-				 dbname, tablespace_oid, rel_filenode);
-		PQclear(res_db);
-		pgut_disconnect(tmp_conn);
+	sprintf(params[0], "%i", maps->tblspcOid);
+	params[1][len++] = '{';
+	for (i = 0; i < maps->nrels; i++)
+		len += sprintf(params[1] + len, i == 0 ? "%u" : ",%u", maps->relOids[i]);
+	params[1][len++] = '}';
+	params[1][len] = '\0';
+
+	/*
+	 * Execute ptrack_get_and_clear for every relation in one query. Relations
+	 * in pg_global are processed using backup_conn, cause we can do it from
+	 * any database.
+	 */
+	res = pgut_execute_extended(tmp_conn ? tmp_conn : backup_conn,
+						"SELECT pg_catalog.pg_ptrack_get_and_clear($1, r) "
+						"FROM pg_catalog.unnest($2::pg_catalog.oid[]) WITH ORDINALITY AS u(r, n) "
+						"ORDER BY n",
+						2, (const char **) params, false, false);
+
+	if (PQnfields(res) != 1 || PQntuples(res) != maps->nrels)
+	{
+		if (dbname)
+			elog(ERROR, "cannot get ptrack files from database \"%s\" by tablespace oid %u",
+				 dbname, maps->tblspcOid);
+		else
+			elog(ERROR, "cannot get ptrack files from pg_global tablespace");
 	}
-	/* file in directory 'global' */
-	else
+
+	for (i = 0; i < maps->nrels; i++)
 	{
+		size_t		size;
+
 		/*
-		 * execute ptrack_get_and_clear for relation in pg_global
-		 * Use backup_conn, cause we can do it from any database.
+		 * Empty bytea means that ptrack file of the relation is missing.
 		 */
-		sprintf(params[0], "%i", tablespace_oid);
-		sprintf(params[1], "%i", rel_filenode);
-		res = pgut_execute(backup_conn, "SELECT pg_catalog.pg_ptrack_get_and_clear($1, $2)",
-						   2, (const char **)params);
+		if (PQgetisnull(res, i, 0) || PQgetlength(res, i, 0) == 0)
+			continue;
 
-		if (PQnfields(res) != 1)
-			elog(ERROR, "cannot get ptrack file from pg_global tablespace and relation oid %u",
-			 rel_filenode);
+		size = PQgetlength(res, i, 0);
+		maps->maps[i] = pgut_malloc(size);
+		memcpy(maps->maps[i], PQgetvalue(res, i, 0), size);
+		maps->sizes[i] = size;
 	}
 
-	val = PQgetvalue(res, 0, 0);
+	PQclear(res);
 
-	/* TODO Now pg_ptrack_get_and_clear() returns bytea ending with \x.
-	 * It should be fixed in future ptrack releases, but till then we
-	 * can parse it.
-	 */
-	if (strcmp("x", val+1) == 0)
+cleanup:
+	if (res_db)
+		PQclear(res_db);
+	if (tmp_conn)
+		pgut_disconnect(tmp_conn);
+	pfree(params[0]);
+	pfree(params[1]);
+}
+
+static int
+pgOidCompare(const void *a, const void *b)
+{
+	Oid			oid1 = *(const Oid *) a;
+	Oid			oid2 = *(const Oid *) b;
+
+	if (oid1 < oid2)
+		return -1;
+	return oid1 > oid2 ? 1 : 0;
+}
+
+/*
+ * Fetch ptrack maps of the first segments of data files, which belong to the
+ * same database as files[start], starting from files[start]. Since the list
+ * is sorted by path, files of one database are adjacent.
+ */
+static void
+fetch_ptrack_maps(parray *files, size_t start, PtrackMaps *maps,
+				  PGconn *backup_conn)
+{
+	pgFile	   *first = (pgFile *) parray_get(files, start);
+	size_t		i;
+
+	maps->tblspcOid = first->tblspcOid;
+	maps->dbOid = first->dbOid;
+	maps->nrels = 0;
+	maps->relOids = pgut_newarray(Oid, PTRACK_RELS_BATCH);
+
+	for (i = start; i < parray_num(files) && maps->nrels < PTRACK_RELS_BATCH; i++)
 	{
-		/* Ptrack file is missing */
-		return NULL;
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (!file->is_datafile)
+			continue;
+		if (file->tblspcOid != maps->tblspcOid || file->dbOid != maps->dbOid)
+			break;
+		if (file->segno == 0)
+			maps->relOids[maps->nrels++] = file->relOid;
 	}
 
-	result = (char *) PQunescapeBytea((unsigned char *) PQgetvalue(res, 0, 0),
-									  result_size);
-	PQclear(res);
-	pfree(params[0]);
-	pfree(params[1]);
+	qsort(maps->relOids, maps->nrels, sizeof(Oid), pgOidCompare);
 
-	return result;
+	pg_ptrack_get_and_clear_rels(maps, backup_conn);
+}
+
+static void
+free_ptrack_maps(PtrackMaps *maps)
+{
+	int			i;
+
+	for (i = 0; i < maps->nrels; i++)
+		pg_free(maps->maps[i]);
+	pg_free(maps->maps);
+	pg_free(maps->sizes);
+	pg_free(maps->relOids);
+	memset(maps, 0, sizeof(PtrackMaps));
 }
 
 /*
@@ -1976,20 +2145,21 @@ backup_cleanup(bool fatal, void *userdata)
 static void *
 backup_files(void *arg)
 {
-	int			i;
+	int			i = -1;
 	backup_files_arg *arguments = (backup_files_arg *) arg;
 	int			n_backup_files_list = parray_num(arguments->files_list);
 	static time_t prev_time;
 
 	prev_time = current.start_time;
+	progress_thread_init();
 
 	/* backup a file */
-	for (i = 0; i < n_backup_files_list; i++)
+	while ((i = thread_tasks_next(arguments->tasks, i)) >= 0)
 	{
-		int			ret;
-		struct stat	buf;
 		pgFile	   *file = (pgFile *) parray_get(arguments->files_list, i);
 
+		progress_file_start(file);
+
 		if (arguments->thread_num == 1)
 		{
 			/* update backup_content.control every 10 seconds */
@@ -1998,14 +2168,12 @@ backup_files(void *arg)
 				prev_time = time(NULL);
 
 				write_backup_filelist(&current, arguments->files_list, arguments->from_root,
-									  arguments->external_dirs);
+									  arguments->external_dirs, false);
 				/* update backup control file to update size info */
 				write_backup(&current);
 			}
 		}
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
 		elog(VERBOSE, "Copying file:  \"%s\" ", file->path);
 
 		/* check for interrupt */
@@ -2016,33 +2184,18 @@ backup_files(void *arg)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
 				 i + 1, n_backup_files_list, file->path);
 
-		/* stat file to check its current state */
-		ret = fio_stat(file->path, &buf, true, FIO_DB_HOST);
-		if (ret == -1)
-		{
-			if (errno == ENOENT)
-			{
-				/*
-				 * If file is not found, this is not en error.
-				 * It could have been deleted by concurrent postgres transaction.
-				 */
-				file->write_size = FILE_NOT_FOUND;
-				elog(LOG, "File \"%s\" is not found", file->path);
-				continue;
-			}
-			else
-			{
-				elog(ERROR,
-					"can't stat file to backup \"%s\": %s",
-					file->path, strerror(errno));
-			}
-		}
-
-		/* We have already copied all directories */
-		if (S_ISDIR(buf.st_mode))
+		/*
+		 * Type and modification time of the file are taken from the listing
+		 * made after backup start, so there is no need to stat it once again,
+		 * which costs a round trip to remote agent per file. File removed
+		 * concurrently since listing is caught when opened for copying.
+		 *
+		 * We have already copied all directories.
+		 */
+		if (S_ISDIR(file->mode))
 			continue;
 
-		if (S_ISREG(buf.st_mode))
+		if (S_ISREG(file->mode))
 		{
 			pgFile	  **prev_file = NULL;
 			char	   *external_path = NULL;
@@ -2091,6 +2244,9 @@ backup_files(void *arg)
 					elog(VERBOSE, "File \"%s\" was not copied to backup", file->path);
 					continue;
 				}
+
+				if (dedup)
+					dedup_backup_file(to_path, file);
 			}
 			else if (!file->external_dir_num &&
 					 strcmp(file->name, "pg_control") == 0)
@@ -2105,7 +2261,7 @@ backup_files(void *arg)
 
 				/* If non-data file has not changed since last backup... */
 				if (prev_file && file->exists_in_prev &&
-					buf.st_mtime < current.parent_backup)
+					file->mtime < current.parent_backup)
 				{
 					file->crc = pgFileGetCRC(file->path, true, false,
 											 &file->read_size, FIO_DB_HOST);
@@ -2140,9 +2296,12 @@ backup_files(void *arg)
 				 file->path, file->write_size);
 		}
 		else
-			elog(WARNING, "unexpected file type %d", buf.st_mode);
+			elog(WARNING, "unexpected file type %d", file->mode);
 	}
 
+	/* No more files to take, help other threads with their large files */
+	help_backup_data_files(arguments);
+
 	/* Close connection */
 	if (arguments->conn_arg.conn)
 		pgut_disconnect(arguments->conn_arg.conn);
@@ -2289,6 +2448,90 @@ set_cfs_datafiles(parray *files, const char *root, char *relative, size_t i)
 	free(cfs_tblspc_path);
 }
 
+static uint32
+data_file_hash_key(Oid tblspcOid, Oid dbOid, Oid relOid, int segno)
+{
+	uint32		h;
+
+	h = tblspcOid;
+	h = h * 0x9E3779B1 ^ dbOid;
+	h = h * 0x9E3779B1 ^ relOid;
+	h = h * 0x9E3779B1 ^ (uint32) segno;
+
+	/* final mix to spread close OIDs */
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/*
+ * Build data_file_hash for the data files of the "files" list.
+ * Only main fork segments are data files, so other forks are not added.
+ */
+static void
+build_data_file_hash(parray *files)
+{
+	size_t		nfiles = 0;
+	size_t		size = 16;
+	size_t		i;
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (file->is_datafile && file->external_dir_num == 0)
+			nfiles++;
+	}
+
+	/* keep load factor below 0.5 */
+	while (size < nfiles * 2)
+		size *= 2;
+
+	data_file_hash = pgut_newarray(DataFileHashEntry, size);
+	MemSet(data_file_hash, 0, size * sizeof(DataFileHashEntry));
+	data_file_hash_mask = (uint32) (size - 1);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		uint32		pos;
+
+		if (!file->is_datafile || file->external_dir_num != 0)
+			continue;
+
+		pos = data_file_hash_key(file->tblspcOid, file->dbOid, file->relOid,
+								 file->segno) & data_file_hash_mask;
+		while (data_file_hash[pos].file != NULL)
+			pos = (pos + 1) & data_file_hash_mask;
+
+		data_file_hash[pos].tblspcOid = file->tblspcOid;
+		data_file_hash[pos].dbOid = file->dbOid;
+		data_file_hash[pos].relOid = file->relOid;
+		data_file_hash[pos].segno = file->segno;
+		data_file_hash[pos].file = file;
+	}
+
+	for (i = 0; i < PAGEMAP_LOCKS_NUM; i++)
+		pthread_mutex_init(&backup_pagemap_locks[i], NULL);
+}
+
+static void
+free_data_file_hash(void)
+{
+	int			i;
+
+	pg_free(data_file_hash);
+	data_file_hash = NULL;
+	data_file_hash_mask = 0;
+
+	for (i = 0; i < PAGEMAP_LOCKS_NUM; i++)
+		pthread_mutex_destroy(&backup_pagemap_locks[i]);
+}
+
 /*
  * Find pgfile by given rnode in the backup_files_list
  * and add given blkno to its pagemap.
@@ -2296,48 +2539,48 @@ set_cfs_datafiles(parray *files, const char *root, char *relative, size_t i)
 void
 process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
 {
-	char	   *path;
-	char	   *rel_path;
 	BlockNumber blkno_inseg;
 	int			segno;
-	pgFile	  **file_item;
-	pgFile		f;
+	uint32		hash;
+	uint32		pos;
+
+	/* Only main fork files are backed up page by page */
+	if (forknum != MAIN_FORKNUM || data_file_hash == NULL)
+		return;
 
 	segno = blkno / RELSEG_SIZE;
 	blkno_inseg = blkno % RELSEG_SIZE;
 
-	rel_path = relpathperm(rnode, forknum);
-	if (segno > 0)
-		path = psprintf("%s/%s.%u", instance_config.pgdata, rel_path, segno);
-	else
-		path = psprintf("%s/%s", instance_config.pgdata, rel_path);
+	hash = data_file_hash_key(rnode.spcNode, rnode.dbNode, rnode.relNode,
+							  segno);
 
-	pg_free(rel_path);
+	for (pos = hash & data_file_hash_mask;
+		 data_file_hash[pos].file != NULL;
+		 pos = (pos + 1) & data_file_hash_mask)
+	{
+		DataFileHashEntry *entry = &data_file_hash[pos];
 
-	f.path = path;
-	/* backup_files_list should be sorted before */
-	file_item = (pgFile **) parray_bsearch(backup_files_list, &f,
-										   pgFileComparePath);
+		if (entry->relOid != rnode.relNode || entry->segno != segno ||
+			entry->dbOid != rnode.dbNode || entry->tblspcOid != rnode.spcNode)
+			continue;
 
-	/*
-	 * If we don't have any record of this file in the file map, it means
-	 * that it's a relation that did not have much activity since the last
-	 * backup. We can safely ignore it. If it is a new relation file, the
-	 * backup would simply copy it as-is.
-	 */
-	if (file_item)
-	{
 		/* We need critical section only we use more than one threads */
 		if (num_threads > 1)
-			pthread_lock(&backup_pagemap_mutex);
+			pthread_lock(&backup_pagemap_locks[hash % PAGEMAP_LOCKS_NUM]);
 
-		datapagemap_add(&(*file_item)->pagemap, blkno_inseg);
+		pagemap_add(&entry->file->pagemap, blkno_inseg);
 
 		if (num_threads > 1)
-			pthread_mutex_unlock(&backup_pagemap_mutex);
+			pthread_mutex_unlock(&backup_pagemap_locks[hash % PAGEMAP_LOCKS_NUM]);
+		break;
 	}
 
-	pg_free(path);
+	/*
+	 * If we don't have any record of this file in the file map, it means
+	 * that it's a relation that did not have much activity since the last
+	 * backup. We can safely ignore it. If it is a new relation file, the
+	 * backup would simply copy it as-is.
+	 */
 }
 
 /*
@@ -2353,6 +2596,9 @@ make_pagemap_from_ptrack(parray *files, PGconn *backup_conn)
 	Oid tblspcOid_with_ptrack_init = 0;
 	char	   *ptrack_nonparsed = NULL;
 	size_t		ptrack_nonparsed_size = 0;
+	PtrackMaps	maps;
+
+	memset(&maps, 0, sizeof(maps));
 
 	elog(LOG, "Compiling pagemap");
 	for (i = 0; i < parray_num(files); i++)
@@ -2399,12 +2645,36 @@ make_pagemap_from_ptrack(parray *files, PGconn *backup_conn)
 			/* get ptrack bitmap once for all segments of the file */
 			if (file->segno == 0)
 			{
+				Oid		   *found = NULL;
+				int			k;
+
 				/* release previous value */
 				pg_free(ptrack_nonparsed);
+				ptrack_nonparsed = NULL;
 				ptrack_nonparsed_size = 0;
 
-				ptrack_nonparsed = pg_ptrack_get_and_clear(file->tblspcOid, file->dbOid,
-											   file->relOid, &ptrack_nonparsed_size, backup_conn);
+				/*
+				 * Ptrack maps are fetched for the whole database at once,
+				 * fetch the next portion if this relation is not there.
+				 */
+				if (maps.nrels > 0 &&
+					maps.tblspcOid == file->tblspcOid && maps.dbOid == file->dbOid)
+					found = bsearch(&file->relOid, maps.relOids, maps.nrels,
+									sizeof(Oid), pgOidCompare);
+				if (found == NULL)
+				{
+					free_ptrack_maps(&maps);
+					fetch_ptrack_maps(files, i, &maps, backup_conn);
+					found = bsearch(&file->relOid, maps.relOids, maps.nrels,
+									sizeof(Oid), pgOidCompare);
+					Assert(found != NULL);
+				}
+
+				/* take ownership of the map */
+				k = found - maps.relOids;
+				ptrack_nonparsed = maps.maps[k];
+				ptrack_nonparsed_size = maps.sizes[k];
+				maps.maps[k] = NULL;
 			}
 
 			if (ptrack_nonparsed != NULL)
@@ -2432,19 +2702,17 @@ make_pagemap_from_ptrack(parray *files, PGconn *backup_conn)
 				else
 				{
 
+					uint32		bitmapsize;
+
 					if (start_addr + RELSEG_SIZE/HEAPBLOCKS_PER_BYTE > ptrack_nonparsed_size)
-					{
-						file->pagemap.bitmapsize = ptrack_nonparsed_size - start_addr;
-						elog(VERBOSE, "pagemap size: %i", file->pagemap.bitmapsize);
-					}
+						bitmapsize = ptrack_nonparsed_size - start_addr;
 					else
-					{
-						file->pagemap.bitmapsize = RELSEG_SIZE/HEAPBLOCKS_PER_BYTE;
-						elog(VERBOSE, "pagemap size: %i", file->pagemap.bitmapsize);
-					}
+						bitmapsize = RELSEG_SIZE/HEAPBLOCKS_PER_BYTE;
 
-					file->pagemap.bitmap = pg_malloc(file->pagemap.bitmapsize);
-					memcpy(file->pagemap.bitmap, ptrack_nonparsed+start_addr, file->pagemap.bitmapsize);
+					pagemap_set_bitmap(&file->pagemap, ptrack_nonparsed + start_addr,
+									   bitmapsize);
+					elog(VERBOSE, "pagemap size: %u, changed blocks: %u",
+						 bitmapsize, pagemap_count(&file->pagemap));
 				}
 			}
 			else
@@ -2462,6 +2730,10 @@ make_pagemap_from_ptrack(parray *files, PGconn *backup_conn)
 			}
 		}
 	}
+
+	pg_free(ptrack_nonparsed);
+	free_ptrack_maps(&maps);
+
 	elog(LOG, "Pagemap compiled");
 }
 
@@ -2482,9 +2754,20 @@ stop_streaming(XLogRecPtr xlogpos, uint32 timeline, bool segment_finished)
 
 	/* we assume that we get called once at the end of each segment */
 	if (segment_finished)
+	{
+		XLogSegNo	segno;
+		char		wal_file_name[MAXFNAMELEN];
+
 		elog(VERBOSE, _("finished segment at %X/%X (timeline %u)"),
 			 (uint32) (xlogpos >> 32), (uint32) xlogpos, timeline);
 
+		/* xlogpos points to the beginning of the next segment */
+		GetXLogSegNo(xlogpos - 1, segno, instance_config.xlog_seg_size);
+		GetXLogFileName(wal_file_name, timeline, segno,
+						instance_config.xlog_seg_size);
+		queue_stream_segment(wal_file_name, stream_wal_summary);
+	}
+
 	/*
 	 * Note that we report the previous, not current, position here. After a
 	 * timeline switch, xlogpos points to the beginning of the segment because
@@ -2557,6 +2840,8 @@ StreamLog(void *arg)
 			NULL, temp_slot, true, true, false);
 #endif
 
+	start_stream_finalize(stream_arg->basedir);
+
 	/*
 	 * Start the replication
 	 */
@@ -2607,6 +2892,8 @@ StreamLog(void *arg)
 		elog(ERROR, "Problem in receivexlog");
 #endif
 
+	stop_stream_finalize();
+
 	elog(LOG, _("finished streaming WAL at %X/%X (timeline %u)"),
 		 (uint32) (stop_stream_lsn >> 32), (uint32) stop_stream_lsn, stream_arg->starttli);
 	stream_arg->ret = 0;
@@ -2617,6 +2904,244 @@ StreamLog(void *arg)
 	return NULL;
 }
 
+/*
+ * Start the thread finalizing segments of WAL streamed into "basedir".
+ */
+static void
+start_stream_finalize(const char *basedir)
+{
+	stream_finalize.basedir = basedir;
+	stream_finalize.queue = parray_new();
+	stream_finalize.files = parray_new();
+	stream_finalize.last_name[0] = '\0';
+	stream_finalize.finish = false;
+	stream_finalize.compress = false;
+
+	/* Only zlib is supported for WAL, see also do_archive_push() */
+	if (instance_config.compress_alg == ZLIB_COMPRESS)
+	{
+#ifdef HAVE_LIBZ
+		stream_finalize.compress = true;
+#endif
+	}
+	else if (instance_config.compress_alg != NONE_COMPRESS &&
+			 instance_config.compress_alg != NOT_DEFINED_COMPRESS)
+		/* Readers of WAL, including restore_command, understand gzip only */
+		elog(WARNING, "Streamed WAL is not compressed: compression algorithm "
+			 "%s is supported for data files only, use zlib to compress WAL",
+			 deparse_compress_alg(instance_config.compress_alg));
+
+	pthread_create(&stream_finalize_thread, NULL, StreamFinalize, NULL);
+}
+
+/* Queue finished segment of streamed WAL for finalization */
+static void
+queue_stream_segment(const char *wal_file_name, bool summarize)
+{
+	StreamSegment *segment = pgut_new(StreamSegment);
+
+	strlcpy(segment->name, wal_file_name, MAXFNAMELEN);
+	segment->summarize = summarize;
+
+	pthread_lock(&stream_finalize.mutex);
+	parray_append(stream_finalize.queue, segment);
+	strlcpy(stream_finalize.last_name, wal_file_name, MAXFNAMELEN);
+	pthread_cond_signal(&stream_finalize.cond);
+	pthread_mutex_unlock(&stream_finalize.mutex);
+}
+
+static int
+compare_wal_file_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Finalize segments left after streaming is finished and wait for all
+ * segments to be finalized. Segment names grow during streaming, so the
+ * segment containing the stop LSN follows the last queued one. It is not
+ * summarized, since it ends with incomplete record and is decoded by
+ * validation anyway. Unfinished segments of switched timelines precede the
+ * last queued one and are left as is, their CRC is calculated by
+ * do_backup_instance().
+ */
+static void
+stop_stream_finalize(void)
+{
+	parray	   *names = parray_new();
+	DIR		   *dir;
+	struct dirent *dent;
+	int			i;
+
+	dir = fio_opendir(stream_finalize.basedir, FIO_BACKUP_HOST);
+	if (dir == NULL)
+		elog(ERROR, "Cannot open directory \"%s\": %s",
+			 stream_finalize.basedir, strerror(errno));
+
+	while ((dent = fio_readdir(dir)))
+	{
+		if (IsXLogFileName(dent->d_name) &&
+			strcmp(dent->d_name, stream_finalize.last_name) > 0)
+			parray_append(names, pgut_strdup(dent->d_name));
+	}
+	fio_closedir(dir);
+
+	parray_qsort(names, compare_wal_file_names);
+	for (i = 0; i < parray_num(names); i++)
+		queue_stream_segment((char *) parray_get(names, i), false);
+	parray_walk(names, pfree);
+	parray_free(names);
+
+	pthread_lock(&stream_finalize.mutex);
+	stream_finalize.finish = true;
+	pthread_cond_signal(&stream_finalize.cond);
+	pthread_mutex_unlock(&stream_finalize.mutex);
+
+	pthread_join(stream_finalize_thread, NULL);
+	if (thread_interrupted)
+		elog(ERROR, "Finalization of streamed WAL failed");
+
+	parray_walk(stream_finalize.queue, pfree);
+	parray_free(stream_finalize.queue);
+	stream_finalize.queue = NULL;
+
+	/* Sort finalized segments for lookup in do_backup_instance() */
+	parray_qsort(stream_finalize.files, pgFileCompareName);
+}
+
+/*
+ * Finalize queued segments of streamed WAL in the order of streaming, which
+ * is required to chain their summaries.
+ */
+static void *
+StreamFinalize(void *arg)
+{
+	while (true)
+	{
+		StreamSegment *segment = NULL;
+		pgFile	   *file;
+
+		pthread_lock(&stream_finalize.mutex);
+		while (parray_num(stream_finalize.queue) == 0 && !stream_finalize.finish)
+			pthread_cond_wait(&stream_finalize.cond, &stream_finalize.mutex);
+		if (parray_num(stream_finalize.queue) > 0)
+			segment = (StreamSegment *) parray_remove(stream_finalize.queue, 0);
+		pthread_mutex_unlock(&stream_finalize.mutex);
+
+		/* All segments are finalized */
+		if (segment == NULL)
+			break;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during finalization of streamed WAL");
+
+		file = finalize_stream_segment(segment);
+		if (file)
+			parray_append(stream_finalize.files, file);
+		pfree(segment);
+	}
+
+	return NULL;
+}
+
+/*
+ * Write summary of streamed WAL segment, compress it and calculate CRC of the
+ * resulting file. Returns NULL if the segment is not found.
+ */
+static pgFile *
+finalize_stream_segment(StreamSegment *segment)
+{
+	char		path[MAXPGPATH];
+	pgFile	   *file;
+
+	join_path_components(path, stream_finalize.basedir, segment->name);
+
+	/* Summary is written before compression to decode plain segment */
+	if (segment->summarize)
+		write_wal_segment_summary(stream_finalize.basedir, segment->name,
+								  instance_config.xlog_seg_size);
+
+#ifdef HAVE_LIBZ
+	if (stream_finalize.compress)
+	{
+		char		gz_path[MAXPGPATH];
+
+		snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+		compress_stream_segment(path, gz_path);
+		strlcpy(path, gz_path, MAXPGPATH);
+	}
+#endif
+
+	file = pgFileNew(path, last_dir_separator(path) + 1, true, 0,
+					 FIO_BACKUP_HOST);
+	if (file == NULL)
+		return NULL;
+
+	file->crc = pgFileGetCRC(file->path, true, false, &file->read_size,
+							 FIO_BACKUP_HOST);
+	file->write_size = file->read_size;
+
+	elog(VERBOSE, "Streamed WAL segment \"%s\" is finalized", file->path);
+
+	return file;
+}
+
+#ifdef HAVE_LIBZ
+/*
+ * Compress streamed WAL segment "path" into "gz_path" and remove the plain
+ * segment. Compressed segment gets its name by atomic rename, so readers of
+ * streamed WAL always find either plain or complete compressed segment.
+ */
+static void
+compress_stream_segment(const char *path, const char *gz_path)
+{
+	char		gz_path_temp[MAXPGPATH];
+	char		buf[XLOG_BLCKSZ];
+	gzFile		gz_out;
+	int			fd;
+	ssize_t		read_len;
+
+	snprintf(gz_path_temp, sizeof(gz_path_temp), "%s.partial", gz_path);
+
+	fd = fio_open(path, O_RDONLY | PG_BINARY, FIO_BACKUP_HOST);
+	if (fd < 0)
+		elog(ERROR, "Cannot open streamed WAL segment \"%s\": %s",
+			 path, strerror(errno));
+
+	gz_out = fio_gzopen(gz_path_temp, PG_BINARY_W,
+						instance_config.compress_level, FIO_BACKUP_HOST);
+	if (gz_out == NULL)
+		elog(ERROR, "Cannot open compressed WAL segment \"%s\": %s",
+			 gz_path_temp, strerror(errno));
+
+	while ((read_len = fio_read(fd, buf, sizeof(buf))) > 0)
+	{
+		if (fio_gzwrite(gz_out, buf, read_len) != read_len)
+		{
+			int			errnum;
+
+			elog(ERROR, "Cannot write to compressed WAL segment \"%s\": %s",
+				 gz_path_temp, fio_gzerror(gz_out, &errnum));
+		}
+	}
+	if (read_len < 0)
+		elog(ERROR, "Cannot read streamed WAL segment \"%s\": %s",
+			 path, strerror(errno));
+	fio_close(fd);
+
+	if (fio_gzclose(gz_out) != 0)
+		elog(ERROR, "Cannot write compressed WAL segment \"%s\": %s",
+			 gz_path_temp, strerror(errno));
+
+	if (fio_rename(gz_path_temp, gz_path, FIO_BACKUP_HOST) < 0)
+		elog(ERROR, "Cannot rename \"%s\" to \"%s\": %s",
+			 gz_path_temp, gz_path, strerror(errno));
+	if (fio_unlink(path, FIO_BACKUP_HOST) < 0)
+		elog(ERROR, "Cannot remove streamed WAL segment \"%s\": %s",
+			 path, strerror(errno));
+}
+#endif
+
 /*
  * Get lsn of the moment when ptrack was enabled the last time.
  */
@@ -2711,6 +3236,84 @@ pg_ptrack_get_block(ConnectionArgs *arguments,
 	return result;
 }
 
+/*
+ * Fetch blocks "blknums" of the relation from shared buffers by one query.
+ * Results are requested in binary format, so pages are received as is.
+ * Block which cannot be read (e.g. truncated one) is marked as not found,
+ * caller should fall back to pg_ptrack_get_block() for it.
+ */
+void
+pg_ptrack_get_blocks(ConnectionArgs *arguments,
+					 Oid dbOid,
+					 Oid tblsOid,
+					 Oid relOid,
+					 BlockNumber *blknums,
+					 int nblocks,
+					 PtrackBlocks *blocks)
+{
+	PGresult   *res;
+	char	   *params[3];
+	char	   *query;
+	size_t		len;
+	int			i;
+
+	Assert(nblocks > 0 && nblocks <= PTRACK_BLOCKS_BATCH);
+
+	params[0] = palloc(64);
+	params[1] = palloc(64);
+	params[2] = palloc(64);
+
+	sprintf(params[0], "%i", tblsOid);
+	sprintf(params[1], "%i", dbOid);
+	sprintf(params[2], "%i", relOid);
+
+	/* Block numbers are passed as literals to get one row with all pages */
+	query = palloc(32 + nblocks * 64);
+	len = sprintf(query, "SELECT ");
+	for (i = 0; i < nblocks; i++)
+		len += sprintf(query + len,
+					   "%spg_catalog.pg_ptrack_get_block_2($1, $2, $3, '%u')",
+					   i == 0 ? "" : ", ", blknums[i]);
+
+	/*
+	 * Use tmp_conn, since we may work in parallel threads.
+	 * We can connect to any database.
+	 */
+	if (arguments->conn == NULL)
+	{
+		arguments->conn = pgut_connect(instance_config.conn_opt.pghost,
+											  instance_config.conn_opt.pgport,
+											  instance_config.conn_opt.pgdatabase,
+											  instance_config.conn_opt.pguser);
+	}
+
+	if (arguments->cancel_conn == NULL)
+		arguments->cancel_conn = PQgetCancel(arguments->conn);
+
+	res = pgut_execute_parallel(arguments->conn,
+								arguments->cancel_conn,
+								query, 3, (const char **)params,
+								false, false, false);
+
+	blocks->nblocks = nblocks;
+	for (i = 0; i < nblocks; i++)
+	{
+		blocks->blknums[i] = blknums[i];
+		blocks->found[i] = PQntuples(res) == 1 && PQnfields(res) == nblocks &&
+			!PQgetisnull(res, 0, i) && PQgetlength(res, 0, i) == BLCKSZ;
+
+		if (blocks->found[i])
+			memcpy(blocks->pages + (size_t) i * BLCKSZ, PQgetvalue(res, 0, i), BLCKSZ);
+	}
+
+	PQclear(res);
+
+	pfree(query);
+	pfree(params[0]);
+	pfree(params[1]);
+	pfree(params[2]);
+}
+
 static void
 check_external_for_tablespaces(parray *external_list, PGconn *backup_conn)
 {
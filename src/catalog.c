@@ -17,9 +17,14 @@
 
 #include "utils/file.h"
 #include "utils/configuration.h"
+#include "utils/thread.h"
 
 static const char *backupModes[] = {"", "PAGE", "PTRACK", "DELTA", "FULL"};
 static pgBackup *readBackupControlFile(const char *path);
+static pgBackup *parseBackupControl(const char *path, const char *data,
+									size_t len);
+static void write_catalog_summary(void);
+static void write_catalog_summary_callback(bool fatal, void *userdata);
 
 static bool exit_hook_registered = false;
 static parray *lock_files = NULL;
@@ -301,11 +306,388 @@ IsDir(const char *dirpath, const char *entry, fio_location location)
 	return fio_stat(path, &st, false, location) == 0 && S_ISDIR(st.st_mode);
 }
 
+/*
+ * Catalog summary is a cache of contents of BACKUP_CONTROL_FILE of all
+ * backups of the instance, stored in a single file BACKUP_CATALOG_SUMMARY.
+ * It consists of the header line, then for every backup the line
+ *   <backup directory> <inode> <size> <mtime>
+ * followed by <size> bytes of its control file, and the trailer containing
+ * CRC of all the preceding data.
+ *
+ * Summary entry is used only if stat() of the control file still matches it.
+ * Control files are replaced by rename(), so inode changes on every write.
+ * As in git index, an entry is not trusted if the control file was modified
+ * in the same second as the summary was, since its mtime may have not changed
+ * since then.
+ */
+#define CATALOG_SUMMARY_HEADER	"#pg_probackup catalog summary 1\n"
+#define CATALOG_SUMMARY_TRAILER	"end %08X\n"
+#define CATALOG_SUMMARY_TRAILER_LEN	(sizeof("end 00000000\n") - 1)
+
+typedef struct CatalogSummaryEntry
+{
+	const char *backup_id;		/* name of the backup directory */
+	uint64		ino;
+	int64		size;
+	int64		mtime;
+	const char *data;			/* contents of the control file */
+} CatalogSummaryEntry;
+
+typedef struct CatalogSummary
+{
+	char	   *buf;
+	CatalogSummaryEntry *entries;
+	int			nentries;
+	time_t		mtime;			/* modification time of the summary file */
+} CatalogSummary;
+
+static int
+compare_catalog_summary_entries(const void *a, const void *b)
+{
+	return strcmp(((const CatalogSummaryEntry *) a)->backup_id,
+				  ((const CatalogSummaryEntry *) b)->backup_id);
+}
+
+/*
+ * Load BACKUP_CATALOG_SUMMARY of the current instance.
+ * Return false if there is no usable summary.
+ */
+static bool
+read_catalog_summary(CatalogSummary *summary)
+{
+	char		path[MAXPGPATH];
+	struct stat	st;
+	char	   *ptr;
+	char	   *end;
+	size_t		len;
+	int			allocated = 0;
+	pg_crc32	crc;
+	unsigned int stored_crc;
+
+	memset(summary, 0, sizeof(CatalogSummary));
+
+	join_path_components(path, backup_instance_path, BACKUP_CATALOG_SUMMARY);
+	if (fio_stat(path, &st, true, FIO_BACKUP_HOST) != 0)
+		return false;
+
+	summary->buf = slurpFile(backup_instance_path, BACKUP_CATALOG_SUMMARY,
+							 &len, true, FIO_BACKUP_HOST);
+	if (summary->buf == NULL)
+		return false;
+	summary->mtime = st.st_mtime;
+
+	if (len < strlen(CATALOG_SUMMARY_HEADER) + CATALOG_SUMMARY_TRAILER_LEN ||
+		strncmp(summary->buf, CATALOG_SUMMARY_HEADER,
+				strlen(CATALOG_SUMMARY_HEADER)) != 0)
+		goto corrupted;
+
+	end = summary->buf + len - CATALOG_SUMMARY_TRAILER_LEN;
+	if (sscanf(end, CATALOG_SUMMARY_TRAILER, &stored_crc) != 1)
+		goto corrupted;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, summary->buf, end - summary->buf);
+	FIN_FILE_CRC32(true, crc);
+	if (crc != stored_crc)
+		goto corrupted;
+
+	ptr = summary->buf + strlen(CATALOG_SUMMARY_HEADER);
+	while (ptr < end)
+	{
+		CatalogSummaryEntry *entry;
+		char	   *eol = memchr(ptr, '\n', end - ptr);
+		char	   *sep;
+
+		if (eol == NULL)
+			goto corrupted;
+		*eol = '\0';
+
+		if (summary->nentries == allocated)
+		{
+			allocated = allocated ? allocated * 2 : 64;
+			summary->entries = pgut_realloc(summary->entries,
+									allocated * sizeof(CatalogSummaryEntry));
+		}
+		entry = &summary->entries[summary->nentries];
+
+		sep = strchr(ptr, ' ');
+		if (sep == NULL)
+			goto corrupted;
+		*sep = '\0';
+		entry->backup_id = ptr;
+
+		if (sscanf(sep + 1, UINT64_FORMAT " " INT64_FORMAT " " INT64_FORMAT,
+				   &entry->ino, &entry->size, &entry->mtime) != 3 ||
+			entry->size < 0 || entry->size > end - (eol + 1))
+			goto corrupted;
+
+		entry->data = eol + 1;
+		ptr = eol + 1 + entry->size;
+		summary->nentries++;
+	}
+
+	qsort(summary->entries, summary->nentries, sizeof(CatalogSummaryEntry),
+		  compare_catalog_summary_entries);
+	return true;
+
+corrupted:
+	elog(LOG, "Catalog summary file \"%s\" is corrupted, ignore it", path);
+	pg_free(summary->buf);
+	pg_free(summary->entries);
+	memset(summary, 0, sizeof(CatalogSummary));
+	return false;
+}
+
+/*
+ * Find contents of the control file of backup "backup_id" in the summary.
+ * "st" is the current stat() of the control file.
+ * Return NULL if there is no valid entry for the backup.
+ */
+static const char *
+catalog_summary_lookup(CatalogSummary *summary, const char *backup_id,
+					   struct stat *st)
+{
+	CatalogSummaryEntry key;
+	CatalogSummaryEntry *entry;
+
+	if (summary->nentries == 0)
+		return NULL;
+
+	key.backup_id = backup_id;
+	entry = bsearch(&key, summary->entries, summary->nentries,
+					sizeof(CatalogSummaryEntry),
+					compare_catalog_summary_entries);
+
+	if (entry == NULL ||
+		entry->ino != (uint64) st->st_ino ||
+		entry->size != (int64) st->st_size ||
+		entry->mtime != (int64) st->st_mtime ||
+		entry->mtime >= (int64) summary->mtime)
+		return NULL;
+
+	return entry->data;
+}
+
+static void
+free_catalog_summary(CatalogSummary *summary)
+{
+	pg_free(summary->buf);
+	pg_free(summary->entries);
+}
+
+/* Set if a control file has been written and the summary is out of date */
+static bool catalog_summary_stale = false;
+
+/*
+ * Rewrite BACKUP_CATALOG_SUMMARY of the current instance. Valid entries of
+ * the existing summary are reused, so only changed control files are read.
+ * Summary is just a cache, so failure to write it is not an error.
+ *
+ * Temporary file name contains PID, so concurrent processes, which have
+ * modified different backups of the instance, do not overwrite each other's
+ * file. The last rename wins, and stale entries are detected by stat().
+ */
+static void
+write_catalog_summary(void)
+{
+	CatalogSummary summary;
+	DIR		   *data_dir;
+	struct dirent *data_ent;
+	FILE	   *out = NULL;
+	char		path[MAXPGPATH];
+	char		path_temp[MAXPGPATH];
+	char		line[MAXPGPATH + 128];
+	pg_crc32	crc;
+	int			errno_temp;
+
+	join_path_components(path, backup_instance_path, BACKUP_CATALOG_SUMMARY);
+	snprintf(path_temp, sizeof(path_temp), "%s.tmp.%d", path, (int) getpid());
+
+	data_dir = fio_opendir(backup_instance_path, FIO_BACKUP_HOST);
+	if (data_dir == NULL)
+	{
+		/* The instance may have been deleted by the command */
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open directory \"%s\": %s",
+				 backup_instance_path, strerror(errno));
+		return;
+	}
+
+	out = fio_fopen(path_temp, PG_BINARY_W, FIO_BACKUP_HOST);
+	if (out == NULL)
+	{
+		elog(WARNING, "Cannot open catalog summary file \"%s\": %s",
+			 path_temp, strerror(errno));
+		fio_closedir(data_dir);
+		return;
+	}
+
+	read_catalog_summary(&summary);
+
+	INIT_FILE_CRC32(true, crc);
+	if (fio_fwrite(out, CATALOG_SUMMARY_HEADER,
+				   strlen(CATALOG_SUMMARY_HEADER)) != strlen(CATALOG_SUMMARY_HEADER))
+		goto write_error;
+	COMP_FILE_CRC32(true, crc, CATALOG_SUMMARY_HEADER,
+					strlen(CATALOG_SUMMARY_HEADER));
+
+	while ((data_ent = fio_readdir(data_dir)) != NULL)
+	{
+		char		data_path[MAXPGPATH];
+		char		conf_path[MAXPGPATH];
+		struct stat	st;
+		const char *data;
+		char	   *owned = NULL;
+		size_t		len;
+
+		if (data_ent->d_name[0] == '.' || strchr(data_ent->d_name, ' ') ||
+			!IsDir(backup_instance_path, data_ent->d_name, FIO_BACKUP_HOST))
+			continue;
+
+		join_path_components(data_path, backup_instance_path, data_ent->d_name);
+		join_path_components(conf_path, data_path, BACKUP_CONTROL_FILE);
+		if (fio_stat(conf_path, &st, true, FIO_BACKUP_HOST) != 0)
+			continue;
+
+		data = catalog_summary_lookup(&summary, data_ent->d_name, &st);
+		if (data == NULL)
+		{
+			owned = slurpFile(data_path, BACKUP_CONTROL_FILE, &len, true,
+							  FIO_BACKUP_HOST);
+			/* Skip the file if it has been changed since stat() */
+			if (owned == NULL || len != (size_t) st.st_size)
+			{
+				pg_free(owned);
+				continue;
+			}
+			data = owned;
+		}
+
+		snprintf(line, sizeof(line), "%s " UINT64_FORMAT " " INT64_FORMAT
+				 " " INT64_FORMAT "\n", data_ent->d_name, (uint64) st.st_ino,
+				 (int64) st.st_size, (int64) st.st_mtime);
+		COMP_FILE_CRC32(true, crc, line, strlen(line));
+		COMP_FILE_CRC32(true, crc, data, st.st_size);
+
+		if (fio_fwrite(out, line, strlen(line)) != strlen(line) ||
+			fio_fwrite(out, data, st.st_size) != st.st_size)
+		{
+			pg_free(owned);
+			goto write_error;
+		}
+		pg_free(owned);
+	}
+	FIN_FILE_CRC32(true, crc);
+
+	snprintf(line, sizeof(line), CATALOG_SUMMARY_TRAILER, crc);
+	if (fio_fwrite(out, line, strlen(line)) != strlen(line))
+		goto write_error;
+
+	fio_closedir(data_dir);
+	data_dir = NULL;
+	free_catalog_summary(&summary);
+
+	if (fio_fflush(out) || fio_fclose(out))
+	{
+		out = NULL;
+		goto write_error;
+	}
+	out = NULL;
+
+	if (fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
+	{
+		errno_temp = errno;
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		elog(WARNING, "Cannot rename catalog summary file \"%s\" to \"%s\": %s",
+			 path_temp, path, strerror(errno_temp));
+	}
+	return;
+
+write_error:
+	errno_temp = errno;
+	if (data_dir)
+	{
+		fio_closedir(data_dir);
+		free_catalog_summary(&summary);
+	}
+	if (out)
+		fio_fclose(out);
+	fio_unlink(path_temp, FIO_BACKUP_HOST);
+	elog(WARNING, "Cannot write catalog summary file \"%s\": %s",
+		 path_temp, strerror(errno_temp));
+}
+
+/*
+ * Control file of a running backup is rewritten every few seconds, so the
+ * summary is written only once, when the command exits.
+ */
+static void
+write_catalog_summary_callback(bool fatal, void *userdata)
+{
+	if (!catalog_summary_stale)
+		return;
+
+	catalog_summary_stale = false;
+	write_catalog_summary();
+}
+
+/* Backup directory found by catalog_get_backup_list() */
+typedef struct
+{
+	char		name[MAXPGPATH];	/* name of the backup directory */
+	char		conf_path[MAXPGPATH];
+	const char *data;			/* contents of the control file */
+	size_t		len;
+	char	   *owned;			/* data, if it was read from the file */
+	int			read_errno;		/* errno of failed read, 0 on success */
+
+	volatile pg_atomic_flag lock;
+} catalog_list_item;
+
+typedef struct
+{
+	catalog_list_item *items;
+	int			nitems;
+} read_control_files_arg;
+
+/* Read control files, which are not found in the catalog summary */
+static void *
+read_control_files(void *arg)
+{
+	read_control_files_arg *arguments = (read_control_files_arg *) arg;
+	int			i;
+
+	for (i = 0; i < arguments->nitems; i++)
+	{
+		catalog_list_item *item = &arguments->items[i];
+		char		data_path[MAXPGPATH];
+
+		if (item->data || !pg_atomic_test_set_flag(&item->lock))
+			continue;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during reading backup catalog");
+
+		join_path_components(data_path, backup_instance_path, item->name);
+		errno = 0;
+		item->owned = slurpFile(data_path, BACKUP_CONTROL_FILE, &item->len,
+								true, FIO_BACKUP_HOST);
+		if (item->owned == NULL)
+			item->read_errno = errno ? errno : EIO;
+		item->data = item->owned;
+	}
+
+	return NULL;
+}
+
 /*
  * Create list of backups.
  * If 'requested_backup_id' is INVALID_BACKUP_ID, return list of all backups.
  * The list is sorted in order of descending start time.
  * If valid backup id is passed only matching backup will be added to the list.
+ *
+ * Control files are taken from the catalog summary if it is up to date,
+ * the rest of them are read using num_threads threads.
  */
 parray *
 catalog_get_backup_list(time_t requested_backup_id)
@@ -313,6 +695,11 @@ catalog_get_backup_list(time_t requested_backup_id)
 	DIR		   *data_dir = NULL;
 	struct dirent *data_ent = NULL;
 	parray	   *backups = NULL;
+	CatalogSummary summary;
+	catalog_list_item *items = NULL;
+	int			nitems = 0;
+	int			allocated = 0;
+	int			nstale = 0;
 	int			i;
 
 	/* open backup instance backups directory */
@@ -324,38 +711,118 @@ catalog_get_backup_list(time_t requested_backup_id)
 		goto err_proc;
 	}
 
+	read_catalog_summary(&summary);
+
 	/* scan the directory and list backups */
 	backups = parray_new();
 	for (; (data_ent = fio_readdir(data_dir)) != NULL; errno = 0)
 	{
-		char		backup_conf_path[MAXPGPATH];
+		catalog_list_item *item;
 		char		data_path[MAXPGPATH];
-		pgBackup   *backup = NULL;
+		struct stat	st;
 
 		/* skip not-directory entries and hidden entries */
 		if (!IsDir(backup_instance_path, data_ent->d_name, FIO_BACKUP_HOST)
 			|| data_ent->d_name[0] == '.')
 			continue;
 
+		if (nitems == allocated)
+		{
+			allocated = allocated ? allocated * 2 : 64;
+			items = pgut_realloc(items, allocated * sizeof(catalog_list_item));
+		}
+		item = &items[nitems++];
+		memset(item, 0, sizeof(catalog_list_item));
+		pg_atomic_clear_flag(&item->lock);
+
 		/* open subdirectory of specific backup */
+		strlcpy(item->name, data_ent->d_name, sizeof(item->name));
 		join_path_components(data_path, backup_instance_path, data_ent->d_name);
+		snprintf(item->conf_path, MAXPGPATH, "%s/%s", data_path, BACKUP_CONTROL_FILE);
 
-		/* read backup information from BACKUP_CONTROL_FILE */
-		snprintf(backup_conf_path, MAXPGPATH, "%s/%s", data_path, BACKUP_CONTROL_FILE);
-		backup = readBackupControlFile(backup_conf_path);
+		if (fio_stat(item->conf_path, &st, true, FIO_BACKUP_HOST) == 0)
+		{
+			item->data = catalog_summary_lookup(&summary, item->name, &st);
+			item->len = st.st_size;
+		}
+		else
+			item->read_errno = errno;
+
+		if (item->data == NULL && item->read_errno == 0)
+			nstale++;
+
+		if (errno && errno != ENOENT)
+		{
+			elog(WARNING, "cannot read data directory \"%s\": %s",
+				 data_ent->d_name, strerror(errno));
+			goto err_proc;
+		}
+	}
+	if (errno)
+	{
+		elog(WARNING, "cannot read backup root directory \"%s\": %s",
+			backup_instance_path, strerror(errno));
+		goto err_proc;
+	}
+
+	/* read control files, which are missing in the summary */
+	if (nstale > 0)
+	{
+		read_control_files_arg arg;
+
+		arg.items = items;
+		arg.nitems = nitems;
+
+		if (num_threads > 1 && nstale > 1)
+		{
+			int			nthreads = Min(num_threads, nstale);
+			pthread_t  *threads;
+
+			threads = (pthread_t *) palloc(sizeof(pthread_t) * nthreads);
+			thread_interrupted = false;
+
+			for (i = 0; i < nthreads; i++)
+				pthread_create(&threads[i], NULL, read_control_files, &arg);
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+
+			pfree(threads);
+
+			if (thread_interrupted)
+				elog(ERROR, "Failed to read backup catalog");
+		}
+		else
+			read_control_files(&arg);
+	}
+
+	/* create backups in the order of the directory listing */
+	for (i = 0; i < nitems; i++)
+	{
+		catalog_list_item *item = &items[i];
+		pgBackup   *backup = NULL;
+
+		if (item->data)
+			backup = parseBackupControl(item->conf_path, item->data, item->len);
+		else if (item->read_errno == ENOENT)
+			elog(WARNING, "Control file \"%s\" doesn't exist", item->conf_path);
+		else
+			elog(ERROR, "Cannot read control file \"%s\": %s",
+				 item->conf_path, strerror(item->read_errno));
 
 		if (!backup)
 		{
 			backup = pgut_new(pgBackup);
 			pgBackupInit(backup);
-			backup->start_time = base36dec(data_ent->d_name);
+			backup->start_time = base36dec(item->name);
 		}
-		else if (strcmp(base36enc(backup->start_time), data_ent->d_name) != 0)
+		else if (strcmp(base36enc(backup->start_time), item->name) != 0)
 		{
 			elog(WARNING, "backup ID in control file \"%s\" doesn't match name of the backup folder \"%s\"",
-				 base36enc(backup->start_time), backup_conf_path);
+				 base36enc(backup->start_time), item->conf_path);
 		}
 
+		pg_free(item->owned);
+
 		backup->backup_id = backup->start_time;
 		if (requested_backup_id != INVALID_BACKUP_ID
 			&& requested_backup_id != backup->start_time)
@@ -364,21 +831,11 @@ catalog_get_backup_list(time_t requested_backup_id)
 			continue;
 		}
 		parray_append(backups, backup);
-
-		if (errno && errno != ENOENT)
-		{
-			elog(WARNING, "cannot read data directory \"%s\": %s",
-				 data_ent->d_name, strerror(errno));
-			goto err_proc;
-		}
-	}
-	if (errno)
-	{
-		elog(WARNING, "cannot read backup root directory \"%s\": %s",
-			backup_instance_path, strerror(errno));
-		goto err_proc;
 	}
 
+	pg_free(items);
+	free_catalog_summary(&summary);
+
 	fio_closedir(data_dir);
 	data_dir = NULL;
 
@@ -572,6 +1029,20 @@ pgBackupWriteControl(FILE *out, pgBackup *backup)
 	if (backup->wal_bytes != BYTES_INVALID)
 		fio_fprintf(out, "wal-bytes = " INT64_FORMAT "\n", backup->wal_bytes);
 
+	/* Statistics of copying, times are in milliseconds */
+	if (backup->read_bytes != BYTES_INVALID)
+		fio_fprintf(out, "read-bytes = " INT64_FORMAT "\n", backup->read_bytes);
+	if (backup->skipped_pages != BYTES_INVALID)
+		fio_fprintf(out, "skipped-pages = " INT64_FORMAT "\n", backup->skipped_pages);
+	if (backup->scanned_pages != BYTES_INVALID)
+		fio_fprintf(out, "scanned-pages = " INT64_FORMAT "\n", backup->scanned_pages);
+	if (backup->compress_time != BYTES_INVALID)
+		fio_fprintf(out, "compress-time = " INT64_FORMAT "\n", backup->compress_time);
+	if (backup->network_wait != BYTES_INVALID)
+		fio_fprintf(out, "network-wait = " INT64_FORMAT "\n", backup->network_wait);
+	if (backup->fsync_time != BYTES_INVALID)
+		fio_fprintf(out, "fsync-time = " INT64_FORMAT "\n", backup->fsync_time);
+
 	fio_fprintf(out, "status = %s\n", status2str(backup->status));
 
 	/* 'parent_backup' is set if it is incremental backup */
@@ -623,33 +1094,179 @@ write_backup(pgBackup *backup)
 		elog(ERROR, "Cannot rename configuration file \"%s\" to \"%s\": %s",
 			 path_temp, path, strerror(errno_temp));
 	}
+
+	if (!catalog_summary_stale)
+	{
+		catalog_summary_stale = true;
+		pgut_atexit_push(write_catalog_summary_callback, NULL);
+	}
+}
+
+/* File entry as it is going to be stored in DATABASE_FILE_LIST_BIN */
+typedef struct FileListBinItem
+{
+	const char *path;
+	pgFile	   *file;
+} FileListBinItem;
+
+static int
+compare_file_list_bin_items(const void *a, const void *b)
+{
+	const FileListBinItem *ia = (const FileListBinItem *) a;
+	const FileListBinItem *ib = (const FileListBinItem *) b;
+	int			res;
+
+	res = strcmp(ia->path, ib->path);
+	if (res == 0)
+	{
+		if (ia->file->external_dir_num > ib->file->external_dir_num)
+			return 1;
+		else if (ia->file->external_dir_num < ib->file->external_dir_num)
+			return -1;
+	}
+	return res;
+}
+
+/* Append string to the string table and return its offset */
+static uint32
+file_list_bin_add_string(char **strings, size_t *size, size_t *allocated,
+						 const char *str)
+{
+	size_t		len = strlen(str) + 1;
+	size_t		offset = *size;
+
+	if (*size + len > *allocated)
+	{
+		*allocated = Max(*allocated * 2, *size + len);
+		*strings = pgut_realloc(*strings, *allocated);
+	}
+	memcpy(*strings + offset, str, len);
+	*size += len;
+
+	return (uint32) offset;
+}
+
+/*
+ * Write DATABASE_FILE_LIST_BIN into the temporary file "path_temp".
+ * "text_size" and "text_crc" describe the text file list written along.
+ */
+static void
+write_backup_filelist_bin(const char *path_temp, FileListBinItem *items,
+						  size_t nitems, int64 text_size, pg_crc32 text_crc)
+{
+	FILE	   *out;
+	FileListBinHeader header;
+	FileListBinRecord *records;
+	char	   *strings;
+	size_t		strings_size = 0;
+	size_t		strings_allocated = nitems * 64 + 1;
+	size_t		i;
+	int			errno_temp;
+
+	qsort(items, nitems, sizeof(FileListBinItem), compare_file_list_bin_items);
+
+	records = pgut_newarray(FileListBinRecord, Max(nitems, 1));
+	strings = pgut_malloc(strings_allocated);
+	/* offset 0 is reserved for an empty string */
+	file_list_bin_add_string(&strings, &strings_size, &strings_allocated, "");
+
+	for (i = 0; i < nitems; i++)
+	{
+		pgFile	   *file = items[i].file;
+		FileListBinRecord *rec = &records[i];
+
+		MemSet(rec, 0, sizeof(FileListBinRecord));
+		rec->write_size = file->write_size;
+		rec->mode = (uint32) file->mode;
+		rec->crc = file->crc;
+		rec->path = file_list_bin_add_string(&strings, &strings_size,
+											 &strings_allocated, items[i].path);
+		if (file->linked)
+			rec->linked = file_list_bin_add_string(&strings, &strings_size,
+												   &strings_allocated,
+												   file->linked);
+		rec->segno = file->is_datafile ? file->segno : 0;
+		rec->n_blocks = file->n_blocks;
+		rec->external_dir_num = file->external_dir_num;
+		rec->is_datafile = file->is_datafile ? 1 : 0;
+		rec->is_cfs = file->is_cfs ? 1 : 0;
+		rec->compress_alg = (uint8) file->compress_alg;
+	}
+
+	MemSet(&header, 0, sizeof(header));
+	header.magic = FILE_LIST_BIN_MAGIC;
+	header.version = FILE_LIST_BIN_VERSION;
+	header.nfiles = (uint32) nitems;
+	header.strings_size = (uint32) strings_size;
+	header.text_size = text_size;
+	header.text_crc = text_crc;
+
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, records, nitems * sizeof(FileListBinRecord));
+	COMP_FILE_CRC32(true, header.crc, strings, strings_size);
+	FIN_FILE_CRC32(true, header.crc);
+
+	out = fio_fopen(path_temp, PG_BINARY_W, FIO_BACKUP_HOST);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file list \"%s\": %s", path_temp,
+			 strerror(errno));
+
+	if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header) ||
+		fio_fwrite(out, records, nitems * sizeof(FileListBinRecord)) !=
+			nitems * sizeof(FileListBinRecord) ||
+		fio_fwrite(out, strings, strings_size) != strings_size ||
+		fio_fflush(out) || fio_fclose(out))
+	{
+		errno_temp = errno;
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot write file list \"%s\": %s",
+			 path_temp, strerror(errno_temp));
+	}
+
+	pg_free(records);
+	pg_free(strings);
 }
 
 /*
- * Output the list of files to backup catalog DATABASE_FILE_LIST
+ * Output the list of files to backup catalog DATABASE_FILE_LIST.
+ * If "write_bin" is true, its binary copy DATABASE_FILE_LIST_BIN is written
+ * as well. It is done once the list is final, the text list written while
+ * the backup is running is not read by anyone else.
  */
 void
 write_backup_filelist(pgBackup *backup, parray *files, const char *root,
-					  parray *external_list)
+					  parray *external_list, bool write_bin)
 {
 	FILE	   *out;
 	char		path[MAXPGPATH];
 	char		path_temp[MAXPGPATH];
+	char		bin_path[MAXPGPATH];
+	char		bin_path_temp[MAXPGPATH];
 	int			errno_temp;
 	size_t		i = 0;
 	#define BUFFERSZ BLCKSZ*500
 	char		buf[BUFFERSZ];
 	size_t		write_len = 0;
 	int64 		backup_size_on_disk = 0;
+	int64		text_size = 0;
+	pg_crc32	text_crc;
+	FileListBinItem *items = NULL;
 
 	pgBackupGetPath(backup, path, lengthof(path), DATABASE_FILE_LIST);
 	snprintf(path_temp, sizeof(path_temp), "%s.tmp", path);
+	pgBackupGetPath(backup, bin_path, lengthof(bin_path), DATABASE_FILE_LIST_BIN);
+	snprintf(bin_path_temp, sizeof(bin_path_temp), "%s.tmp", bin_path);
 
 	out = fio_fopen(path_temp, PG_BINARY_W, FIO_BACKUP_HOST);
 	if (out == NULL)
 		elog(ERROR, "Cannot open file list \"%s\": %s", path_temp,
 			 strerror(errno));
 
+	if (write_bin)
+		items = pgut_newarray(FileListBinItem, Max(parray_num(files), 1));
+	/* binary copy remembers CRC of the text file it matches */
+	INIT_FILE_CRC32(true, text_crc);
+
 	/* print each file in the list */
 	while(i < parray_num(files))
 	{
@@ -658,8 +1275,6 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 		char	line[BLCKSZ];
 		int 	len = 0;
 
-		i++;
-
 		if (S_ISDIR(file->mode))
 			backup_size_on_disk += 4096;
 
@@ -675,6 +1290,13 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			(file->external_dir_num && external_list))
 				path = file->rel_path;
 
+		if (items)
+		{
+			items[i].path = path;
+			items[i].file = file;
+		}
+		i++;
+
 		len = sprintf(line, "{\"path\":\"%s\", \"size\":\"" INT64_FORMAT "\", "
 					 "\"mode\":\"%u\", \"is_datafile\":\"%u\", "
 					 "\"is_cfs\":\"%u\", \"crc\":\"%u\", "
@@ -697,13 +1319,11 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 
 		len += sprintf(line+len, "}\n");
 
-		if (write_len + len <= BUFFERSZ)
-		{
-			memcpy(buf+write_len, line, len);
-			write_len += len;
-		}
-		else
+		if (write_len + len > BUFFERSZ)
 		{
+			COMP_FILE_CRC32(true, text_crc, buf, write_len);
+			text_size += write_len;
+
 			/* write buffer to file */
 			if (fio_fwrite(out, buf, write_len) != write_len)
 			{
@@ -715,10 +1335,17 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			/* reset write_len */
 			write_len = 0;
 		}
+
+		memcpy(buf+write_len, line, len);
+		write_len += len;
 	}
 
 	/* write what is left in the buffer to file */
 	if (write_len > 0)
+	{
+		COMP_FILE_CRC32(true, text_crc, buf, write_len);
+		text_size += write_len;
+
 		if (fio_fwrite(out, buf, write_len) != write_len)
 		{
 			errno_temp = errno;
@@ -726,6 +1353,8 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			elog(ERROR, "Cannot write file list \"%s\": %s",
 				path_temp, strerror(errno));
 		}
+	}
+	FIN_FILE_CRC32(true, text_crc);
 
 	if (fio_fflush(out) || fio_fclose(out))
 	{
@@ -735,14 +1364,31 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			 path_temp, strerror(errno));
 	}
 
+	if (items)
+	{
+		write_backup_filelist_bin(bin_path_temp, items, parray_num(files),
+								  text_size, text_crc);
+		pg_free(items);
+	}
+
 	if (fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
 	{
 		errno_temp = errno;
 		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		if (write_bin)
+			fio_unlink(bin_path_temp, FIO_BACKUP_HOST);
 		elog(ERROR, "Cannot rename configuration file \"%s\" to \"%s\": %s",
 			 path_temp, path, strerror(errno_temp));
 	}
 
+	if (write_bin && fio_rename(bin_path_temp, bin_path, FIO_BACKUP_HOST) < 0)
+	{
+		errno_temp = errno;
+		fio_unlink(bin_path_temp, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot rename file list \"%s\" to \"%s\": %s",
+			 bin_path_temp, bin_path, strerror(errno_temp));
+	}
+
 	/* use extra variable to avoid reset of previous data_bytes value in case of error */
 	backup->data_bytes = backup_size_on_disk;
 }
@@ -754,6 +1400,34 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
  */
 static pgBackup *
 readBackupControlFile(const char *path)
+{
+	pgBackup   *backup;
+	char		dir[MAXPGPATH];
+	char	   *data;
+	size_t		len;
+
+	if (fio_access(path, F_OK, FIO_BACKUP_HOST) != 0)
+	{
+		elog(WARNING, "Control file \"%s\" doesn't exist", path);
+		return NULL;
+	}
+
+	strlcpy(dir, path, sizeof(dir));
+	get_parent_directory(dir);
+	data = slurpFile(dir, last_dir_separator(path) + 1, &len, false,
+					 FIO_BACKUP_HOST);
+	backup = parseBackupControl(path, data, len);
+	pg_free(data);
+
+	return backup;
+}
+
+/*
+ * Create pgBackup from the contents of BACKUP_CONTROL_FILE "path" which
+ * is already loaded into memory.
+ */
+static pgBackup *
+parseBackupControl(const char *path, const char *data, size_t len)
 {
 	pgBackup   *backup = pgut_new(pgBackup);
 	char	   *backup_mode = NULL;
@@ -779,6 +1453,12 @@ readBackupControlFile(const char *path)
 		{'t', 0, "recovery-time",		&backup->recovery_time, SOURCE_FILE_STRICT},
 		{'I', 0, "data-bytes",			&backup->data_bytes, SOURCE_FILE_STRICT},
 		{'I', 0, "wal-bytes",			&backup->wal_bytes, SOURCE_FILE_STRICT},
+		{'I', 0, "read-bytes",			&backup->read_bytes, SOURCE_FILE_STRICT},
+		{'I', 0, "skipped-pages",		&backup->skipped_pages, SOURCE_FILE_STRICT},
+		{'I', 0, "scanned-pages",		&backup->scanned_pages, SOURCE_FILE_STRICT},
+		{'I', 0, "compress-time",		&backup->compress_time, SOURCE_FILE_STRICT},
+		{'I', 0, "network-wait",		&backup->network_wait, SOURCE_FILE_STRICT},
+		{'I', 0, "fsync-time",			&backup->fsync_time, SOURCE_FILE_STRICT},
 		{'u', 0, "block-size",			&backup->block_size, SOURCE_FILE_STRICT},
 		{'u', 0, "xlog-block-size",		&backup->wal_block_size, SOURCE_FILE_STRICT},
 		{'u', 0, "checksum-version",	&backup->checksum_version, SOURCE_FILE_STRICT},
@@ -796,14 +1476,9 @@ readBackupControlFile(const char *path)
 	};
 
 	pgBackupInit(backup);
-	if (fio_access(path, F_OK, FIO_BACKUP_HOST) != 0)
-	{
-		elog(WARNING, "Control file \"%s\" doesn't exist", path);
-		pgBackupFree(backup);
-		return NULL;
-	}
 
-	parsed_options = config_read_opt(path, options, WARNING, true, true);
+	parsed_options = config_parse_opt_buf(data, len, path, options,
+										  WARNING, true);
 
 	if (parsed_options == 0)
 	{
@@ -962,6 +1637,10 @@ parse_compress_alg(const char *arg)
 		return ZLIB_COMPRESS;
 	else if (pg_strncasecmp("pglz", arg, len) == 0)
 		return PGLZ_COMPRESS;
+	else if (pg_strncasecmp("zstd", arg, len) == 0)
+		return ZSTD_COMPRESS;
+	else if (pg_strncasecmp("lz4", arg, len) == 0)
+		return LZ4_COMPRESS;
 	else if (pg_strncasecmp("none", arg, len) == 0)
 		return NONE_COMPRESS;
 	else
@@ -982,11 +1661,22 @@ deparse_compress_alg(int alg)
 			return "zlib";
 		case PGLZ_COMPRESS:
 			return "pglz";
+		case ZSTD_COMPRESS:
+			return "zstd";
+		case LZ4_COMPRESS:
+			return "lz4";
 	}
 
 	return NULL;
 }
 
+/* Check if data files are stored as compressed page records */
+bool
+is_compressed_alg(CompressAlg alg)
+{
+	return alg != NONE_COMPRESS && alg != NOT_DEFINED_COMPRESS;
+}
+
 /*
  * Fill pgBackup struct with default values.
  */
@@ -1007,6 +1697,12 @@ pgBackupInit(pgBackup *backup)
 
 	backup->data_bytes = BYTES_INVALID;
 	backup->wal_bytes = BYTES_INVALID;
+	backup->read_bytes = BYTES_INVALID;
+	backup->skipped_pages = BYTES_INVALID;
+	backup->scanned_pages = BYTES_INVALID;
+	backup->compress_time = BYTES_INVALID;
+	backup->network_wait = BYTES_INVALID;
+	backup->fsync_time = BYTES_INVALID;
 
 	backup->compress_alg = COMPRESS_ALG_DEFAULT;
 	backup->compress_level = COMPRESS_LEVEL_DEFAULT;
@@ -28,6 +28,8 @@ typedef struct
 {
 	/* list of files to validate */
 	parray	   *files_list;
+	/* queue of files_list entries */
+	ThreadTasks *tasks;
 	/* if page checksums are enabled in this postgres instance? */
 	uint32 checksum_version;
 	/*
@@ -49,19 +51,50 @@ typedef struct
 } check_files_arg;
 
 
+/* Database of the cluster whose indexes are amchecked */
+typedef struct amcheck_db
+{
+	char	   *dbname;
+	/* connections to the database which are not used by threads now */
+	parray	   *idle_conns;
+	/* true if some index of the database is not valid */
+	bool		failed;
+} amcheck_db;
+
+/*
+ * Connections to databases shared by amcheck threads.
+ * A thread takes a connection to the database of the index being checked
+ * and gives it back after the check, so the next index of the same database
+ * does not cost a new connection. If max_conns connections are already open,
+ * an idle connection to another database is closed to open a new one.
+ */
+typedef struct amcheck_pool
+{
+	/* list of amcheck_db, indexed by pg_indexEntry.dbnum */
+	parray	   *dbs;
+	/* number of open connections, both idle and used */
+	int			nconns;
+	int			max_conns;
+	pthread_mutex_t lock;
+} amcheck_pool;
+
 typedef struct
 {
 	/* list of indexes to amcheck */
 	parray	   *index_list;
+	/* queue of index_list entries */
+	ThreadTasks *tasks;
 	/*
 	 * credentials to connect to postgres instance
 	 * used for compatibility checks of blocksize,
 	 * server version and so on
 	 */
 	ConnectionOptions conn_opt;
+	/* connections to databases */
+	amcheck_pool *pool;
 	/*
-	 * conn and cancel_conn
-	 * to use in threads to connect to databases
+	 * conn and cancel_conn taken from the pool
+	 * to check the current index
 	 */
 	ConnectionArgs conn_arg;
 	/* number of thread for debugging */
@@ -75,6 +108,19 @@ typedef struct
 	int			ret;
 } check_indexes_arg;
 
+/* checkdb --amcheck running concurrently with validation of data files */
+typedef struct amcheck_state
+{
+	/* indexes of all databases */
+	parray	   *index_list;
+	ThreadTasks *tasks;
+	amcheck_pool pool;
+	pthread_t  *threads;
+	check_indexes_arg *threads_args;
+	/* true if amcheck is not installed in some database */
+	bool		db_skipped;
+} amcheck_state;
+
 typedef struct pg_indexEntry
 {
 	Oid indexrelid;
@@ -82,8 +128,11 @@ typedef struct pg_indexEntry
 	bool heapallindexed_is_supported;
 	/* schema where amcheck extention is located */
 	char *amcheck_nspname;
-	/* lock for synchronization of parallel threads  */
-	volatile pg_atomic_flag lock;
+	/* estimated size and tablespace of the index, used for scheduling */
+	int64 relpages;
+	Oid reltablespace;
+	/* database of the index in amcheck_pool.dbs */
+	int dbnum;
 } pg_indexEntry;
 
 static void
@@ -106,14 +155,17 @@ pg_indexEntry_free(void *index)
 
 
 static void *check_files(void *arg);
-static void do_block_validation(char *pgdata, uint32 checksum_version);
+static bool do_block_validation(char *pgdata, uint32 checksum_version);
 
 static void *check_indexes(void *arg);
 static parray* get_index_list(const char *dbname, bool first_db_with_amcheck,
-							  PGconn *db_conn);
+							  PGconn *db_conn, int dbnum);
 static bool amcheck_one_index(check_indexes_arg *arguments,
 				 pg_indexEntry *ind);
-static void do_amcheck(ConnectionOptions conn_opt, PGconn *conn);
+static void amcheck_start(amcheck_state *state, ConnectionOptions conn_opt,
+						  PGconn *conn);
+static bool amcheck_wait(amcheck_state *state);
+static void amcheck_report(amcheck_state *state, bool check_isok);
 
 /*
  * Check files in PGDATA.
@@ -124,7 +176,7 @@ static void do_amcheck(ConnectionOptions conn_opt, PGconn *conn);
 static void *
 check_files(void *arg)
 {
-	int			i;
+	int			i = -1;
 	check_files_arg *arguments = (check_files_arg *) arg;
 	int			n_files_list = 0;
 
@@ -132,15 +184,12 @@ check_files(void *arg)
 		n_files_list = parray_num(arguments->files_list);
 
 	/* check a file */
-	for (i = 0; i < n_files_list; i++)
+	while ((i = thread_tasks_next(arguments->tasks, i)) >= 0)
 	{
 		int			ret;
 		struct stat	buf;
 		pgFile	   *file = (pgFile *) parray_get(arguments->files_list, i);
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		elog(VERBOSE, "Checking file:  \"%s\" ", file->path);
 
 		/* check for interrupt */
@@ -206,14 +255,18 @@ check_files(void *arg)
 	return NULL;
 }
 
-/* collect list of files and run threads to check files in the instance */
-static void
+/*
+ * Collect list of files and run threads to check files in the instance.
+ * Returns false if corruption is found.
+ */
+static bool
 do_block_validation(char *pgdata, uint32 checksum_version)
 {
 	int			i;
 	/* arrays with meta info for multi threaded check */
 	pthread_t	*threads;
 	check_files_arg *threads_args;
+	ThreadTasks *tasks;
 	bool		check_isok = true;
 	parray *files_list = NULL;
 
@@ -236,14 +289,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	parse_filelist_filenames(files_list, pgdata);
 
 	/* setup threads */
-	for (i = 0; i < parray_num(files_list); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files_list, i);
-		pg_atomic_init_flag(&file->lock);
-	}
-
-	/* Sort by size for load balancing */
-	parray_qsort(files_list, pgFileCompareSize);
+	tasks = pgFileTasksCreate(files_list, false);
 
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
@@ -254,6 +300,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 		check_files_arg *arg = &(threads_args[i]);
 
 		arg->files_list = files_list;
+		arg->tasks = tasks;
 		arg->checksum_version = checksum_version;
 
 		arg->conn_arg.conn = NULL;
@@ -283,6 +330,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 		if (threads_args[i].ret > 0)
 			check_isok = false;
 	}
+	thread_tasks_free(tasks);
 
 	/* cleanup */
 	if (files_list)
@@ -294,27 +342,101 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 
 	if (check_isok)
 		elog(INFO, "Data files are valid");
+
+	return check_isok;
+}
+
+/*
+ * Take connection to database "db" from the pool or open a new one.
+ */
+static void
+amcheck_pool_acquire(amcheck_pool *pool, amcheck_db *db,
+					 ConnectionOptions *conn_opt, ConnectionArgs *conn_arg)
+{
+	ConnectionArgs *conn = NULL;
+	ConnectionArgs *victim = NULL;
+	int			i;
+
+	pthread_lock(&pool->lock);
+	if (parray_num(db->idle_conns) > 0)
+		conn = (ConnectionArgs *) parray_remove(db->idle_conns,
+												parray_num(db->idle_conns) - 1);
 	else
-		elog(ERROR, "Checkdb failed");
+	{
+		/*
+		 * Every thread uses one connection at most, so there are idle
+		 * connections if the limit is reached.
+		 */
+		if (pool->nconns >= pool->max_conns)
+		{
+			for (i = 0; i < parray_num(pool->dbs) && victim == NULL; i++)
+			{
+				amcheck_db *other = (amcheck_db *) parray_get(pool->dbs, i);
+
+				if (parray_num(other->idle_conns) > 0)
+					victim = (ConnectionArgs *) parray_remove(other->idle_conns,
+															  parray_num(other->idle_conns) - 1);
+			}
+			Assert(victim != NULL);
+			pool->nconns--;
+		}
+		pool->nconns++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (victim)
+	{
+		PQfreeCancel(victim->cancel_conn);
+		pgut_disconnect(victim->conn);
+		pg_free(victim);
+	}
+
+	if (conn)
+	{
+		*conn_arg = *conn;
+		pg_free(conn);
+		return;
+	}
+
+	conn_arg->conn = pgut_connect(conn_opt->pghost, conn_opt->pgport,
+								  db->dbname, conn_opt->pguser);
+	conn_arg->cancel_conn = PQgetCancel(conn_arg->conn);
+}
+
+/* Give connection to database "db" back to the pool */
+static void
+amcheck_pool_release(amcheck_pool *pool, amcheck_db *db,
+					 ConnectionArgs *conn_arg, bool index_isok)
+{
+	ConnectionArgs *conn = pgut_new(ConnectionArgs);
+
+	*conn = *conn_arg;
+	conn_arg->conn = NULL;
+	conn_arg->cancel_conn = NULL;
+
+	pthread_lock(&pool->lock);
+	parray_append(db->idle_conns, conn);
+	if (!index_isok)
+		db->failed = true;
+	pthread_mutex_unlock(&pool->lock);
 }
 
 /* Check indexes with amcheck */
 static void *
 check_indexes(void *arg)
 {
-	int			i;
+	int			i = -1;
 	check_indexes_arg *arguments = (check_indexes_arg *) arg;
 	int			n_indexes = 0;
 
 	if (arguments->index_list)
 		n_indexes = parray_num(arguments->index_list);
 
-	for (i = 0; i < n_indexes; i++)
+	while ((i = thread_tasks_next(arguments->tasks, i)) >= 0)
 	{
 		pg_indexEntry *ind = (pg_indexEntry *) parray_get(arguments->index_list, i);
-
-		if (!pg_atomic_test_set_flag(&ind->lock))
-			continue;
+		amcheck_db *db = (amcheck_db *) parray_get(arguments->pool->dbs, ind->dbnum);
+		bool		index_isok;
 
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
@@ -326,24 +448,18 @@ check_indexes(void *arg)
 				 arguments->thread_num, i + 1, n_indexes,
 				 ind->amcheck_nspname, ind->name);
 
-		if (arguments->conn_arg.conn == NULL)
-		{
-
-			arguments->conn_arg.conn = pgut_connect(arguments->conn_opt.pghost,
-												arguments->conn_opt.pgport,
-												arguments->conn_opt.pgdatabase,
-												arguments->conn_opt.pguser);
-			arguments->conn_arg.cancel_conn = PQgetCancel(arguments->conn_arg.conn);
-		}
+		arguments->conn_opt.pgdatabase = db->dbname;
+		amcheck_pool_acquire(arguments->pool, db, &arguments->conn_opt,
+							 &arguments->conn_arg);
 
 		/* remember that we have a failed check */
-		if (!amcheck_one_index(arguments, ind))
+		index_isok = amcheck_one_index(arguments, ind);
+		if (!index_isok)
 			arguments->ret = 2; /* corruption found */
-	}
 
-	/* Close connection. */
-	if (arguments->conn_arg.conn)
-		pgut_disconnect(arguments->conn_arg.conn);
+		amcheck_pool_release(arguments->pool, db, &arguments->conn_arg,
+							 index_isok);
+	}
 
 	/* Ret values:
 	 * 0 everything is ok
@@ -359,7 +475,7 @@ check_indexes(void *arg)
 /* Get index list for given database */
 static parray*
 get_index_list(const char *dbname, bool first_db_with_amcheck,
-			   PGconn *db_conn)
+			   PGconn *db_conn, int dbnum)
 {
 	PGresult   *res;
 	char *nspname = NULL;
@@ -419,7 +535,7 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 	if (first_db_with_amcheck)
 	{
 
-		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname "
+		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, cls.relpages, cls.reltablespace "
 									"FROM pg_index idx "
 									"JOIN pg_class cls ON idx.indexrelid=cls.oid "
 									"JOIN pg_am am ON cls.relam=am.oid "
@@ -429,7 +545,7 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 	else
 	{
 
-		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname "
+		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, cls.relpages, cls.reltablespace "
 									"FROM pg_index idx "
 									"JOIN pg_class cls ON idx.indexrelid=cls.oid "
 									"JOIN pg_am am ON cls.relam=am.oid "
@@ -454,7 +570,9 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 		ind->heapallindexed_is_supported = heapallindexed_is_supported;
 		ind->amcheck_nspname = pgut_malloc(strlen(nspname) + 1);
 		strcpy(ind->amcheck_nspname, nspname);
-		pg_atomic_clear_flag(&ind->lock);
+		ind->relpages = atol(PQgetvalue(res, i, 2));
+		ind->reltablespace = atooid(PQgetvalue(res, i, 3));
+		ind->dbnum = dbnum;
 
 		if (index_list == NULL)
 			index_list = parray_new();
@@ -533,26 +651,33 @@ amcheck_one_index(check_indexes_arg *arguments,
  * Connect to all databases in the cluster
  * and get list of persistent indexes,
  * then run parallel threads to perform bt_index_check()
- * for all indexes from the list.
+ * for all indexes of all databases, largest first.
+ * Threads are not waited for, so the caller may validate
+ * data files meanwhile, see amcheck_wait().
  *
  * If amcheck extension is not installed in the database,
  * skip this database and report it via warning message.
  */
 static void
-do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
+amcheck_start(amcheck_state *state, ConnectionOptions conn_opt, PGconn *conn)
 {
 	int			i;
-	/* arrays with meta info for multi threaded amcheck */
-	pthread_t	*threads;
-	check_indexes_arg *threads_args;
-	bool		check_isok = true;
 	PGresult   *res_db;
 	int n_databases = 0;
 	bool first_db_with_amcheck = true;
-	bool db_skipped = false;
+	int64		*sizes;
+	uint32		*groups;
 
 	elog(INFO, "Start amchecking PostgreSQL instance");
 
+	state->index_list = parray_new();
+	state->db_skipped = false;
+	state->pool.dbs = parray_new();
+	state->pool.nconns = 0;
+	/* let threads keep connections to a few databases at once */
+	state->pool.max_conns = 2 * num_threads;
+	pthread_mutex_init(&state->pool.lock, NULL);
+
 	res_db = pgut_execute(conn,
 						"SELECT datname, oid, dattablespace "
 						"FROM pg_database "
@@ -565,20 +690,26 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 
 	n_databases =  PQntuples(res_db);
 
-	/* For each database check indexes. In parallel. */
+	/* Collect indexes of all databases */
 	for(i = 0; i < n_databases; i++)
 	{
 		int j;
 		const char 	*dbname;
+		Oid			dattablespace;
 		PGconn 		*db_conn = NULL;
 		parray 		*index_list = NULL;
+		amcheck_db	*db;
+
+		if (interrupted)
+			elog(ERROR, "checkdb --amcheck is interrupted.");
 
 		dbname = PQgetvalue(res_db, i, 0);
+		dattablespace = atooid(PQgetvalue(res_db, i, 2));
 		db_conn = pgut_connect(conn_opt.pghost, conn_opt.pgport,
 								dbname, conn_opt.pguser);
 
 		index_list = get_index_list(dbname, first_db_with_amcheck,
-									db_conn);
+									db_conn, parray_num(state->pool.dbs));
 
 		/* we don't need this connection anymore */
 		if (db_conn)
@@ -586,66 +717,140 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 
 		if (index_list == NULL)
 		{
-			db_skipped = true;
+			state->db_skipped = true;
 			continue;
 		}
 
 		first_db_with_amcheck = false;
 
-		/* init thread args with own index lists */
-		threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
-		threads_args = (check_indexes_arg *) palloc(sizeof(check_indexes_arg)*num_threads);
+		db = pgut_new(amcheck_db);
+		db->dbname = pgut_strdup(dbname);
+		db->idle_conns = parray_new();
+		db->failed = false;
+		parray_append(state->pool.dbs, db);
 
-		for (j = 0; j < num_threads; j++)
+		for (j = 0; j < parray_num(index_list); j++)
 		{
-			check_indexes_arg *arg = &(threads_args[j]);
+			pg_indexEntry *ind = (pg_indexEntry *) parray_get(index_list, j);
 
-			arg->index_list = index_list;
-			arg->conn_arg.conn = NULL;
-			arg->conn_arg.cancel_conn = NULL;
+			/* index in default tablespace of its database */
+			if (ind->reltablespace == InvalidOid)
+				ind->reltablespace = dattablespace;
+			parray_append(state->index_list, ind);
+		}
+		parray_free(index_list);
+	}
 
-			arg->conn_opt.pghost = conn_opt.pghost;
-			arg->conn_opt.pgport = conn_opt.pgport;
-			arg->conn_opt.pgdatabase = dbname;
-			arg->conn_opt.pguser = conn_opt.pguser;
+	/* cleanup */
+	PQclear(res_db);
 
-			arg->thread_num = j + 1;
-			/* By default there are some error */
-			arg->ret = 1;
-		}
+	/* Largest indexes go first, tablespaces are checked in parallel */
+	sizes = pgut_newarray(int64, parray_num(state->index_list) + 1);
+	groups = pgut_newarray(uint32, parray_num(state->index_list) + 1);
+	for (i = 0; i < parray_num(state->index_list); i++)
+	{
+		pg_indexEntry *ind = (pg_indexEntry *) parray_get(state->index_list, i);
 
-		/* Run threads */
-		for (j = 0; j < num_threads; j++)
-		{
-			check_indexes_arg *arg = &(threads_args[j]);
-			elog(VERBOSE, "Start thread num: %i", j);
-			pthread_create(&threads[j], NULL, check_indexes, arg);
-		}
+		sizes[i] = ind->relpages;
+		groups[i] = ind->reltablespace;
+	}
+	state->tasks = thread_tasks_create(parray_num(state->index_list),
+									   sizes, groups);
+	pg_free(sizes);
+	pg_free(groups);
+
+	/* init thread args with the common index list */
+	state->threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	state->threads_args = (check_indexes_arg *) palloc(sizeof(check_indexes_arg)*num_threads);
+
+	for (i = 0; i < num_threads; i++)
+	{
+		check_indexes_arg *arg = &(state->threads_args[i]);
+
+		arg->index_list = state->index_list;
+		arg->tasks = state->tasks;
+		arg->pool = &state->pool;
+		arg->conn_arg.conn = NULL;
+		arg->conn_arg.cancel_conn = NULL;
+
+		arg->conn_opt.pghost = conn_opt.pghost;
+		arg->conn_opt.pgport = conn_opt.pgport;
+		arg->conn_opt.pgdatabase = NULL;
+		arg->conn_opt.pguser = conn_opt.pguser;
 
-		/* Wait threads */
-		for (j = 0; j < num_threads; j++)
+		arg->thread_num = i + 1;
+		/* By default there are some error */
+		arg->ret = 1;
+	}
+
+	/* Run threads */
+	for (i = 0; i < num_threads; i++)
+	{
+		check_indexes_arg *arg = &(state->threads_args[i]);
+		elog(VERBOSE, "Start amcheck thread num: %i", i);
+		pthread_create(&state->threads[i], NULL, check_indexes, arg);
+	}
+}
+
+/*
+ * Wait for amcheck threads started by amcheck_start(), close connections
+ * and report results of every database.
+ * Returns false if some index is not valid.
+ */
+static bool
+amcheck_wait(amcheck_state *state)
+{
+	int			i;
+	bool		check_isok = true;
+
+	for (i = 0; i < num_threads; i++)
+	{
+		pthread_join(state->threads[i], NULL);
+		if (state->threads_args[i].ret > 0)
+			check_isok = false;
+	}
+	thread_tasks_free(state->tasks);
+
+	for (i = 0; i < parray_num(state->pool.dbs); i++)
+	{
+		amcheck_db *db = (amcheck_db *) parray_get(state->pool.dbs, i);
+		int			j;
+
+		if (!interrupted)
 		{
-			pthread_join(threads[j], NULL);
-			if (threads_args[j].ret > 0)
-				check_isok = false;
+			if (db->failed)
+				elog(WARNING, "Amcheck failed for database %s", db->dbname);
+			else
+				elog(INFO, "Amcheck succeeded for database '%s'", db->dbname);
 		}
 
-		if (check_isok)
-			elog(INFO, "Amcheck succeeded for database '%s'", dbname);
-		else
-			elog(WARNING, "Amcheck failed for database %s", dbname);
-
-		parray_walk(index_list, pg_indexEntry_free);
-		parray_free(index_list);
+		for (j = 0; j < parray_num(db->idle_conns); j++)
+		{
+			ConnectionArgs *conn = (ConnectionArgs *) parray_get(db->idle_conns, j);
 
-		if (interrupted)
-			break;
+			PQfreeCancel(conn->cancel_conn);
+			pgut_disconnect(conn->conn);
+			pg_free(conn);
+		}
+		parray_free(db->idle_conns);
+		pg_free(db->dbname);
+		pg_free(db);
 	}
+	parray_free(state->pool.dbs);
+	pthread_mutex_destroy(&state->pool.lock);
 
-	/* cleanup */
-	PQclear(res_db);
+	parray_walk(state->index_list, pg_indexEntry_free);
+	parray_free(state->index_list);
+	pfree(state->threads);
+	pfree(state->threads_args);
+
+	return check_isok;
+}
 
-	/* Inform user about amcheck results */
+/* Inform user about amcheck results */
+static void
+amcheck_report(amcheck_state *state, bool check_isok)
+{
 	if (interrupted)
 		elog(ERROR, "checkdb --amcheck is interrupted.");
 
@@ -654,7 +859,7 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 		elog(INFO, "checkdb --amcheck finished successfully. "
 					   "All checked indexes are valid.");
 
-		if (db_skipped)
+		if (state->db_skipped)
 			elog(ERROR, "Some databases were not amchecked.");
 		else
 			elog(INFO, "All databases were amchecked.");
@@ -662,17 +867,23 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 	else
 		elog(ERROR, "checkdb --amcheck finished with failure. "
 					"Not all checked indexes are valid. %s",
-					db_skipped?"Some databases were not amchecked.":
+					state->db_skipped?"Some databases were not amchecked.":
 							   "All databases were amchecked.");
 }
 
-/* Entry point of pg_probackup CHECKDB subcommand */
+/*
+ * Entry point of pg_probackup CHECKDB subcommand.
+ * Indexes are amchecked while data files are validated.
+ */
 void
 do_checkdb(bool need_amcheck,
 		   ConnectionOptions conn_opt, char *pgdata)
 {
 	PGNodeInfo nodeInfo;
 	PGconn *cur_conn;
+	amcheck_state amcheck;
+	bool		amcheck_isok = true;
+	bool		blocks_isok = true;
 
 	if (skip_block_validation && !need_amcheck)
 		elog(ERROR, "Option '--skip-block-validation' must be used with '--amcheck' option");
@@ -697,13 +908,23 @@ do_checkdb(bool need_amcheck,
 		 */
 		if (cur_conn)
 			pgut_disconnect(cur_conn);
-
-		do_block_validation(pgdata, nodeInfo.checksum_version);
 	}
 
 	if (need_amcheck)
 	{
 		cur_conn = pgdata_basic_setup(conn_opt, &nodeInfo);
-		do_amcheck(conn_opt, cur_conn);
+		amcheck_start(&amcheck, conn_opt, cur_conn);
 	}
+
+	if (!skip_block_validation)
+		blocks_isok = do_block_validation(pgdata, nodeInfo.checksum_version);
+
+	if (need_amcheck)
+		amcheck_isok = amcheck_wait(&amcheck);
+
+	if (!blocks_isok)
+		elog(ERROR, "Checkdb failed");
+
+	if (need_amcheck)
+		amcheck_report(&amcheck, amcheck_isok);
 }
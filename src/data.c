@@ -17,13 +17,34 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
 #include "utils/thread.h"
 
+#ifdef WIN32
+#define __thread __declspec(thread)
+#endif
+
 /* Union to ease operations on relation pages */
 typedef union DataPage
 {
@@ -31,6 +52,11 @@ typedef union DataPage
 	char		data[BLCKSZ];
 } DataPage;
 
+static void block_map_start(pgFile *file);
+static void block_map_free(pgFile *file);
+static void block_map_add_entry(BlockMapBuilder *builder, BlockNumber block,
+								int32 compressed_size, int64 offset);
+
 #ifdef HAVE_LIBZ
 /* Implementation of zlib compression method */
 static int32
@@ -55,6 +81,85 @@ zlib_decompress(void *dst, size_t dst_size, void const *src, size_t src_size)
 }
 #endif
 
+#ifdef HAVE_LIBZSTD
+/*
+ * Contexts are reused for all pages processed by the thread, because
+ * their allocation is much more expensive than compression of one page.
+ */
+static __thread ZSTD_CCtx *zstd_cctx = NULL;
+static __thread ZSTD_DCtx *zstd_dctx = NULL;
+
+/* Implementation of zstd compression method */
+static int32
+zstd_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			  int level, const char **errormsg)
+{
+	size_t		rc;
+
+	if (zstd_cctx == NULL)
+		zstd_cctx = ZSTD_createCCtx();
+
+	rc = ZSTD_compressCCtx(zstd_cctx, dst, dst_size, src, src_size, level);
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+
+/* Implementation of zstd decompression method */
+static int32
+zstd_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
+				const char **errormsg)
+{
+	size_t		rc;
+
+	if (zstd_dctx == NULL)
+		zstd_dctx = ZSTD_createDCtx();
+
+	rc = ZSTD_decompressDCtx(zstd_dctx, dst, dst_size, src, src_size);
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+#endif
+
+#ifdef HAVE_LIBLZ4
+/*
+ * Implementation of lz4 compression method.
+ * Levels above 1 use slower high compression mode.
+ */
+static int32
+lz4_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			 int level)
+{
+	int			rc;
+
+	if (level <= 1)
+		rc = LZ4_compress_default(src, dst, src_size, dst_size);
+	else
+		rc = LZ4_compress_HC(src, dst, src_size, dst_size, level);
+
+	/* Zero result means that compression failed */
+	return rc > 0 ? rc : -1;
+}
+
+/* Implementation of lz4 decompression method */
+static int32
+lz4_decompress(void *dst, size_t dst_size, void const *src, size_t src_size)
+{
+	int			rc = LZ4_decompress_safe(src, dst, src_size, dst_size);
+
+	return rc >= 0 ? rc : -1;
+}
+#endif
+
 /*
  * Compresses source into dest using algorithm. Returns the number of bytes
  * written in the destination buffer, or -1 if compression fails.
@@ -80,6 +185,18 @@ do_compress(void* dst, size_t dst_size, void const* src, size_t src_size,
 #endif
 		case PGLZ_COMPRESS:
 			return pglz_compress(src, src_size, dst, PGLZ_strategy_always);
+#ifdef HAVE_LIBZSTD
+		case ZSTD_COMPRESS:
+			return zstd_compress(dst, dst_size, src, src_size, level, errormsg);
+#endif
+#ifdef HAVE_LIBLZ4
+		case LZ4_COMPRESS:
+			return lz4_compress(dst, dst_size, src, src_size, level);
+#endif
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support the compression algorithm";
+			break;
 	}
 
 	return -1;
@@ -112,6 +229,18 @@ do_decompress(void* dst, size_t dst_size, void const* src, size_t src_size,
 #endif
 		case PGLZ_COMPRESS:
 			return pglz_decompress(src, src_size, dst, dst_size);
+#ifdef HAVE_LIBZSTD
+		case ZSTD_COMPRESS:
+			return zstd_decompress(dst, dst_size, src, src_size, errormsg);
+#endif
+#ifdef HAVE_LIBLZ4
+		case LZ4_COMPRESS:
+			return lz4_decompress(dst, dst_size, src, src_size);
+#endif
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support the compression algorithm";
+			break;
 	}
 
 	return -1;
@@ -187,41 +316,48 @@ parse_page(Page page, XLogRecPtr *lsn)
 	return false;
 }
 
-/* Read one page from file directly accessing disk
- * return value:
- * 0  - if the page is not found
- * 1  - if the page is found and valid
- * -1 - if the page is found but invalid
+/*
+ * Check that the page consists of zero bytes only.
+ * The page is compared by machine words, several words at a time without
+ * branches, so that the compiler can vectorize the inner loop. Unaligned
+ * head and tail of the buffer are checked byte by byte.
  */
-static int
-read_page_from_file(pgFile *file, BlockNumber blknum,
-					FILE *in, Page page, XLogRecPtr *page_lsn,
-					uint32 checksum_version)
+bool
+page_is_zeroed(const char *page)
 {
-	off_t		offset = blknum * BLCKSZ;
-	ssize_t		read_len = 0;
+	const char *p = page;
+	const char *end = page + BLCKSZ;
 
-	/* read the block */
-	read_len = fio_pread(in, page, offset);
+	for (; p < end && (uintptr_t) p % sizeof(size_t) != 0; p++)
+		if (*p != 0)
+			return false;
 
-	if (read_len != BLCKSZ)
+	for (; p + 8 * sizeof(size_t) <= end; p += 8 * sizeof(size_t))
 	{
-		/* The block could have been truncated. It is fine. */
-		if (read_len == 0)
-		{
-			elog(LOG, "File %s, block %u, file was truncated",
-					file->path, blknum);
-			return 0;
-		}
-		else
-		{
-			elog(WARNING, "File: %s, block %u, expected block size %u,"
-					  "but read %zu, try again",
-					   file->path, blknum, BLCKSZ, read_len);
-			return -1;
-		}
+		const size_t *words = (const size_t *) p;
+
+		if ((words[0] | words[1] | words[2] | words[3] |
+			 words[4] | words[5] | words[6] | words[7]) != 0)
+			return false;
 	}
 
+	for (; p < end; p++)
+		if (*p != 0)
+			return false;
+
+	return true;
+}
+
+/*
+ * Verify header and checksum of page "blknum" read from file
+ * return value:
+ * 1  - if the page is valid
+ * -1 - if the page is invalid
+ */
+static int
+check_page_from_file(pgFile *file, BlockNumber blknum, Page page,
+					 XLogRecPtr *page_lsn, uint32 checksum_version)
+{
 	/*
 	 * If we found page with invalid header, at first check if it is zeroed,
 	 * which is a valid state for page. If it is not, read it and check header
@@ -231,12 +367,8 @@ read_page_from_file(pgFile *file, BlockNumber blknum,
 	 */
 	if (!parse_page(page, page_lsn))
 	{
-		int i;
-		/* Check if the page is zeroed. */
-		for(i = 0; i < BLCKSZ && page[i] == 0; i++);
-
 		/* Page is zeroed. No need to check header and checksum. */
-		if (i == BLCKSZ)
+		if (page_is_zeroed(page))
 		{
 			elog(LOG, "File: %s blknum %u, empty page", file->path, blknum);
 			return 1;
@@ -278,10 +410,129 @@ read_page_from_file(pgFile *file, BlockNumber blknum,
 	}
 }
 
+/* Read one page from file directly accessing disk
+ * return value:
+ * 0  - if the page is not found
+ * 1  - if the page is found and valid
+ * -1 - if the page is found but invalid
+ */
+static int
+read_page_from_file(pgFile *file, BlockNumber blknum,
+					FILE *in, Page page, XLogRecPtr *page_lsn,
+					uint32 checksum_version)
+{
+	off_t		offset = blknum * BLCKSZ;
+	ssize_t		read_len = 0;
+
+	/* read the block */
+	read_len = fio_pread(in, page, offset);
+
+	if (read_len != BLCKSZ)
+	{
+		/* The block could have been truncated. It is fine. */
+		if (read_len == 0)
+		{
+			elog(LOG, "File %s, block %u, file was truncated",
+					file->path, blknum);
+			return 0;
+		}
+		else
+		{
+			elog(WARNING, "File: %s, block %u, expected block size %u,"
+					  "but read %zu, try again",
+					   file->path, blknum, BLCKSZ, read_len);
+			return -1;
+		}
+	}
+
+	return check_page_from_file(file, blknum, page, page_lsn, checksum_version);
+}
+
+/*
+ * Allocate buffer for blocks prefetched by prefetch_ptrack_blocks().
+ */
+static PtrackBlocks *
+ptrack_blocks_alloc(void)
+{
+	PtrackBlocks *blocks = pgut_new(PtrackBlocks);
+
+	blocks->nblocks = 0;
+	blocks->pages = pgut_malloc((size_t) PTRACK_BLOCKS_BATCH * BLCKSZ);
+	return blocks;
+}
+
+static void
+ptrack_blocks_free(PtrackBlocks *blocks)
+{
+	if (blocks == NULL)
+		return;
+	pg_free(blocks->pages);
+	pg_free(blocks);
+}
+
+/*
+ * Fetch blocks "blknums" of the data file segment from shared buffers in
+ * one query instead of a query per block.
+ */
+static void
+prefetch_ptrack_blocks(ConnectionArgs *arguments, pgFile *file,
+					   BlockNumber *blknums, int n, PtrackBlocks *blocks)
+{
+	BlockNumber	absolute_blknums[PTRACK_BLOCKS_BATCH];
+	int			i;
+
+	for (i = 0; i < n; i++)
+		absolute_blknums[i] = file->segno * RELSEG_SIZE + blknums[i];
+
+	pg_ptrack_get_blocks(arguments, file->dbOid, file->tblspcOid, file->relOid,
+						 absolute_blknums, n, blocks);
+}
+
+/* Fetch blocks [start, end) of the data file segment, see above */
+static void
+prefetch_ptrack_range(ConnectionArgs *arguments, pgFile *file,
+					  BlockNumber start, BlockNumber end, PtrackBlocks *blocks)
+{
+	BlockNumber	blknums[PTRACK_BLOCKS_BATCH];
+	int			n = 0;
+
+	while (start < end && n < PTRACK_BLOCKS_BATCH)
+		blknums[n++] = start++;
+
+	if (n > 0)
+		prefetch_ptrack_blocks(arguments, file, blknums, n, blocks);
+}
+
+/*
+ * Copy prefetched block "absolute_blknum" into "page".
+ * Returns false if the block is not prefetched or cannot be read.
+ */
+static bool
+ptrack_blocks_lookup(PtrackBlocks *blocks, BlockNumber absolute_blknum, Page page)
+{
+	int			i;
+
+	if (blocks == NULL)
+		return false;
+
+	for (i = 0; i < blocks->nblocks; i++)
+	{
+		if (blocks->blknums[i] != absolute_blknum)
+			continue;
+		if (!blocks->found[i])
+			return false;
+		memcpy(page, blocks->pages + (size_t) i * BLCKSZ, BLCKSZ);
+		return true;
+	}
+	return false;
+}
+
 /*
  * Retrieves a page taking the backup mode into account
  * and writes it into argument "page". Argument "page"
  * should be a pointer to allocated BLCKSZ of bytes.
+ * In PTRACK mode the page is taken from "ptrack_blocks" if it was
+ * prefetched, otherwise it is requested separately.
  *
  * Prints appropriate warnings/errors/etc into log.
  * Returns 0 if page was successfully retrieved
@@ -290,7 +541,7 @@ read_page_from_file(pgFile *file, BlockNumber blknum,
  *         PageIsCorrupted(-4) if the page check mismatch
  */
 static int32
-prepare_page(ConnectionArgs *arguments,
+prepare_page(ConnectionArgs *arguments, PtrackBlocks *ptrack_blocks,
 			 pgFile *file, XLogRecPtr prev_backup_start_lsn,
 			 BlockNumber blknum, BlockNumber nblocks,
 			 FILE *in, BlockNumber *n_skipped,
@@ -378,10 +629,15 @@ prepare_page(ConnectionArgs *arguments,
 	{
 		size_t page_size = 0;
 		Page ptrack_page = NULL;
-		ptrack_page = (Page) pg_ptrack_get_block(arguments, file->dbOid, file->tblspcOid,
-										  file->relOid, absolute_blknum, &page_size);
 
-		if (ptrack_page == NULL)
+		if (ptrack_blocks_lookup(ptrack_blocks, absolute_blknum, page))
+		{
+			/* Checksum is outdated in the block from shared buffers */
+			if (checksum_version)
+				((PageHeader) page)->pd_checksum = pg_checksum_page(page, absolute_blknum);
+		}
+		else if ((ptrack_page = (Page) pg_ptrack_get_block(arguments, file->dbOid, file->tblspcOid,
+										  file->relOid, absolute_blknum, &page_size)) == NULL)
 		{
 			/* This block was truncated.*/
 			page_is_truncated = true;
@@ -458,14 +714,25 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 		*/
 		memcpy(write_buffer, &header, sizeof(header));
 	}
+	else if (omit_zero_pages && page_is_zeroed(page))
+	{
+		/* Zeroed page is restored from the header alone */
+		header.compressed_size = PageIsZeroed;
+		memcpy(write_buffer, &header, sizeof(header));
+
+		file->read_size += BLCKSZ;
+		progress_add(PROGRESS_READ_BYTES, BLCKSZ);
+	}
 	else
 	{
 		const char *errormsg = NULL;
+		int64		compress_start = progress_clock();
 
 		/* The page was not truncated, so we need to compress it */
 		header.compressed_size = do_compress(compressed_page, sizeof(compressed_page),
 											 page, BLCKSZ, calg, clevel,
 											 &errormsg);
+		progress_add_time(PROGRESS_COMPRESS_TIME, compress_start);
 		/* Something went wrong and errormsg was assigned, throw a warning */
 		if (header.compressed_size < 0 && errormsg != NULL)
 			elog(WARNING, "An error occured during compressing block %u of file \"%s\": %s",
@@ -473,6 +740,7 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 
 		file->compress_alg = calg;
 		file->read_size += BLCKSZ;
+		progress_add(PROGRESS_READ_BYTES, BLCKSZ);
 
 		/* The page was successfully compressed. */
 		if (header.compressed_size > 0 && header.compressed_size < BLCKSZ)
@@ -509,62 +777,775 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 			 file->path, blknum, strerror(errno_tmp));
 	}
 
+	block_map_add(file, write_buffer, write_buffer_size);
 	file->write_size += write_buffer_size;
+	progress_add(PROGRESS_WRITTEN_BYTES, write_buffer_size);
 }
 
 /*
- * Backup data file in the from_root directory to the to_root directory with
- * same relative path. If prev_backup_start_lsn is not NULL, only pages with
- * higher lsn will be copied.
- * Not just copy file, but read it block by block (use bitmap in case of
- * incremental backup), validate checksum, optionally compress and write to
- * backup with special header.
+ * Page cache hints for sequential reads and writes of data files. With
+ * --drop-cache pages read from PGDATA by backup and pages written by restore
+ * are dropped from the page cache as soon as they are processed, so backup
+ * doesn't evict the working set of the database. Writeback of restored data
+ * is started every FIO_CACHE_ADVISE_BLOCKS blocks anyway, so fsync of the
+ * file doesn't have to write all of it at once.
  */
-bool
-backup_data_file(backup_files_arg* arguments,
-				 const char *to_path, pgFile *file,
-				 XLogRecPtr prev_backup_start_lsn, BackupMode backup_mode,
-				 CompressAlg calg, int clevel, bool missing_ok)
+static void
+advise_read_pages(FILE *in, BlockNumber blknum)
 {
-	FILE		*in;
-	FILE		*out;
-	BlockNumber	blknum = 0;
-	BlockNumber	nblocks = 0;
-	BlockNumber	n_blocks_skipped = 0;
-	BlockNumber	n_blocks_read = 0;
-	int			page_state;
-	char		curr_page[BLCKSZ];
+	if (drop_cache && (blknum + 1) % FIO_CACHE_ADVISE_BLOCKS == 0)
+		fio_cache_advise(in, (off_t) (blknum + 1 - FIO_CACHE_ADVISE_BLOCKS) * BLCKSZ,
+						 (off_t) FIO_CACHE_ADVISE_BLOCKS * BLCKSZ,
+						 FIO_ADVISE_DONTNEED);
+}
 
-	/*
-	 * Skip unchanged file only if it exists in previous backup.
-	 * This way we can correctly handle null-sized files which are
-	 * not tracked by pagemap and thus always marked as unchanged.
-	 */
-	if ((backup_mode == BACKUP_MODE_DIFF_PAGE ||
-		backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
-		file->pagemap.bitmapsize == PageBitmapIsEmpty &&
-		file->exists_in_prev && !file->pagemap_isabsent)
+static void
+advise_written_pages(FILE *out, BlockNumber blknum)
+{
+	if ((blknum + 1) % FIO_CACHE_ADVISE_BLOCKS == 0)
+		fio_cache_advise(out, (off_t) (blknum + 1 - FIO_CACHE_ADVISE_BLOCKS) * BLCKSZ,
+						 (off_t) FIO_CACHE_ADVISE_BLOCKS * BLCKSZ,
+						 FIO_ADVISE_WRITEBACK);
+}
+
+/*
+ * Limit I/O rate of the database host device to --max-rate. Transferred
+ * pages are accounted every FIO_CACHE_ADVISE_BLOCKS blocks, 'npages' is
+ * the sequential number of the page. Stat of remote file is a round trip,
+ * so device of the file "f" is looked up once and kept in "file".
+ */
+static void
+lookup_file_dev(pgFile *file, FILE *f)
+{
+	struct stat st;
+
+	if (max_rate && file->dev == 0 && fio_ffstat(f, &st) == 0)
+		file->dev = st.st_dev;
+}
+
+static void
+throttle_pages(pgFile *file, FILE *f, BlockNumber npages)
+{
+	if (max_rate == 0 || (npages + 1) % FIO_CACHE_ADVISE_BLOCKS != 0)
+		return;
+
+	lookup_file_dev(file, f);
+	fio_throttle(file->dev, (size_t) FIO_CACHE_ADVISE_BLOCKS * BLCKSZ);
+}
+
+/*
+ * Check LSNs of "n" pages read from data file at once, before their
+ * checksums are verified. skip[i] is set if the page header is valid and
+ * its LSN is older than horizon_lsn, DELTA backup doesn't copy such pages.
+ * It is used both by backup of local files and by remote agent.
+ * Returns number of pages to skip.
+ */
+int
+delta_prescan_pages(const char *pages, int n, XLogRecPtr horizon_lsn,
+					bool *skip)
+{
+	int			nskip = 0;
+	int			i;
+
+	for (i = 0; i < n; i++)
 	{
-		/*
-		 * There are no changed blocks since last backup. We want make
-		 * incremental backup, so we should exit.
-		 */
-		elog(VERBOSE, "Skipping the unchanged file: %s", file->path);
-		return false;
+		XLogRecPtr	page_lsn;
+
+		skip[i] = parse_page((Page) (pages + (size_t) i * BLCKSZ), &page_lsn) &&
+			page_lsn != InvalidXLogRecPtr && page_lsn < horizon_lsn;
+		if (skip[i])
+			nskip++;
 	}
+	return nskip;
+}
 
-	/* reset size summary */
-	file->read_size = 0;
-	file->write_size = 0;
-	INIT_FILE_CRC32(true, file->crc);
+/*
+ * Backup blocks [start, end) of data file without ptrack.
+ * Local file is read by DATA_FILE_READ_BLOCKS blocks into "buf", for DELTA
+ * backup unchanged pages are filtered out by delta_prescan_pages() and only
+ * the rest ones are verified. Pages which are failed to read or verify are
+ * reread one by one by prepare_page(). "buf" is NULL for remote file, which
+ * is read page by page.
+ * Returns true if the file is truncated.
+ */
+static bool
+backup_page_range(backup_files_arg *arguments, pgFile *file,
+				  FILE *in, FILE *out, BlockNumber start, BlockNumber end,
+				  BlockNumber nblocks, XLogRecPtr prev_backup_start_lsn,
+				  BackupMode backup_mode, CompressAlg calg, int clevel,
+				  char *buf, BlockNumber *n_blocks_read,
+				  BlockNumber *n_blocks_skipped)
+{
+	BlockNumber	blknum = start;
+	char		curr_page[BLCKSZ];
+	bool		skip[DATA_FILE_READ_BLOCKS];
+	XLogRecPtr	horizon_lsn = InvalidXLogRecPtr;
 
-	/* open backup mode file for read */
-	in = fio_fopen(file->path, PG_BINARY_R, FIO_DB_HOST);
-	if (in == NULL)
+	if (backup_mode == BACKUP_MODE_DIFF_DELTA && file->exists_in_prev)
+		horizon_lsn = prev_backup_start_lsn;
+
+	while (blknum < end)
 	{
-		FIN_FILE_CRC32(true, file->crc);
+		BlockNumber	n = Min(end - blknum, DATA_FILE_READ_BLOCKS);
+		BlockNumber	n_read = 0;
+		BlockNumber	k;
 
-		/*
+		if (buf)
+		{
+			ssize_t		read_len = pread(fileno(in), buf, (size_t) n * BLCKSZ,
+										 (off_t) blknum * BLCKSZ);
+
+			if (read_len > 0)
+				n_read = read_len / BLCKSZ;
+		}
+
+		if (n_read > 0 && horizon_lsn != InvalidXLogRecPtr)
+			delta_prescan_pages(buf, n_read, horizon_lsn, skip);
+		else
+			MemSet(skip, 0, sizeof(skip));
+
+		for (k = 0; k < n; k++, blknum++)
+		{
+			XLogRecPtr	page_lsn;
+			Page		page = curr_page;
+			int			page_state;
+
+			if (interrupted || thread_interrupted)
+				elog(ERROR, "Interrupted during page reading");
+
+			if (k < n_read && skip[k])
+			{
+				(*n_blocks_skipped)++;
+				page_state = SkipCurrentPage;
+			}
+			else if (k < n_read &&
+					 check_page_from_file(file, blknum, buf + (size_t) k * BLCKSZ,
+										  &page_lsn, current.checksum_version) == 1)
+			{
+				page = buf + (size_t) k * BLCKSZ;
+				page_state = 0;
+			}
+			else
+				page_state = prepare_page(&(arguments->conn_arg), NULL, file,
+										  prev_backup_start_lsn, blknum, nblocks,
+										  in, n_blocks_skipped, backup_mode,
+										  curr_page, true, current.checksum_version);
+
+			compress_and_backup_page(file, blknum, in, out, &(file->crc),
+									 page_state, page, calg, clevel);
+			advise_read_pages(in, blknum);
+			throttle_pages(file, in, *n_blocks_read);
+			(*n_blocks_read)++;
+			if (page_state == PageIsTruncated)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Maximal number of blocks of a file which the agent failed to verify and
+ * which are taken one by one. The rest of the file is read page by page.
+ */
+#define PAGE_RETRY_MAX_BLOCKS	64
+
+/*
+ * Backup blocks [start, end) of remote data file by fio_send_pages_range().
+ * If the agent fails to verify a page, pages received before it are kept,
+ * the failed block is taken by prepare_page(), via ptrack if possible, and
+ * sending is resumed from the next block. So a torn page costs one block of
+ * extra I/O. "n_retries" counts such blocks of the file.
+ * Returns true if the file is truncated.
+ */
+static bool
+backup_remote_page_range(backup_files_arg *arguments, pgFile *file,
+						 FILE *in, FILE *out, BlockNumber start, BlockNumber end,
+						 BlockNumber nblocks, XLogRecPtr prev_backup_start_lsn,
+						 BackupMode backup_mode, CompressAlg calg, int clevel,
+						 int *n_retries, BlockNumber *n_blocks_read,
+						 BlockNumber *n_blocks_skipped)
+{
+	BlockNumber	blknum = start;
+	XLogRecPtr	horizon_lsn = InvalidXLogRecPtr;
+
+	if (backup_mode == BACKUP_MODE_DIFF_DELTA && file->exists_in_prev)
+		horizon_lsn = prev_backup_start_lsn;
+
+	while (blknum < end)
+	{
+		bool		truncated = false;
+		BlockNumber	skipped = 0;
+		BlockNumber	bad_block = blknum;
+		int			rc;
+
+		/*
+		 * Read the rest page by page if there are too many invalid pages or
+		 * if older agent cannot send the file starting from the middle.
+		 */
+		if (*n_retries >= PAGE_RETRY_MAX_BLOCKS ||
+			(blknum != 0 &&
+			 fio_get_agent_version() < AGENT_SEND_PAGES_RANGE_VERSION))
+			return backup_page_range(arguments, file, in, out, blknum, end,
+									 nblocks, prev_backup_start_lsn,
+									 backup_mode, calg, clevel, NULL,
+									 n_blocks_read, n_blocks_skipped);
+
+		rc = fio_send_pages_range(in, out, file, blknum, end, horizon_lsn,
+								  &skipped, &truncated, &bad_block,
+								  calg, clevel);
+		if (rc >= 0)
+		{
+			*n_blocks_read += rc - blknum;
+			*n_blocks_skipped += skipped;
+			return truncated;
+		}
+		if (rc != PAGE_CHECKSUM_MISMATCH || !is_ptrack_support)
+			elog(ERROR, "Failed to read file %s: %s",
+				 file->path, rc == PAGE_CHECKSUM_MISMATCH ? "data file checksum mismatch" : strerror(-rc));
+
+		/* Keep what is received and take the failed block separately */
+		*n_blocks_read += bad_block - blknum;
+		*n_blocks_skipped += skipped;
+		(*n_retries)++;
+		elog(VERBOSE, "File %s, block %u failed verification on remote host",
+			 file->path, bad_block);
+
+		if (backup_page_range(arguments, file, in, out, bad_block, bad_block + 1,
+							  nblocks, prev_backup_start_lsn, backup_mode,
+							  calg, clevel, NULL, n_blocks_read,
+							  n_blocks_skipped))
+			return true;
+		blknum = bad_block + 1;
+	}
+
+	return false;
+}
+
+/*
+ * Large data files are split into parts, which are backed up in parallel by
+ * the thread owning the file and by threads which have no more files to take.
+ * Backup of each part is accumulated in memory and appended to the backup file
+ * by the owner strictly in order of blocks.
+ */
+#define DATA_FILE_PART_BLOCKS	1024
+
+typedef enum DataFilePartState
+{
+	PART_FREE = 0,
+	PART_IN_PROGRESS,
+	PART_DONE
+} DataFilePartState;
+
+typedef struct DataFilePart
+{
+	BlockNumber	start;
+	BlockNumber	end;
+	DataFilePartState state;
+	char	   *data;			/* backup of part in backup file format */
+	size_t		size;
+	int64		read_size;
+	BlockNumber	n_blocks_read;
+	BlockNumber	n_blocks_skipped;
+	bool		truncated;		/* file ends inside of this part */
+} DataFilePart;
+
+typedef struct DataFileJob
+{
+	pgFile	   *file;
+	BlockNumber	nblocks;
+	XLogRecPtr	prev_backup_start_lsn;
+	BackupMode	backup_mode;
+	CompressAlg	calg;
+	int			clevel;
+	DataFilePart *parts;
+	int			nparts;
+	int			next_part;		/* first part which is not taken yet */
+	int			written_parts;	/* number of parts written by owner */
+} DataFileJob;
+
+/* Data files whose parts may be taken by any thread */
+static parray *data_file_jobs = NULL;
+static pthread_mutex_t data_file_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled when a part is done or written and when the list is changed */
+static pthread_cond_t data_file_jobs_cond = PTHREAD_COND_INITIALIZER;
+
+/* Waiting threads check for interrupt at this interval, in milliseconds */
+#define DATA_FILE_JOBS_WAIT_MS	100
+
+/*
+ * Wait for a change of data file jobs.
+ * Must be called with data_file_jobs_mutex held.
+ */
+static void
+wait_data_file_jobs(void)
+{
+	struct timeval now;
+	struct timespec timeout;
+
+	gettimeofday(&now, NULL);
+	timeout.tv_sec = now.tv_sec;
+	timeout.tv_nsec = now.tv_usec * 1000L + DATA_FILE_JOBS_WAIT_MS * 1000000L;
+	timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+	timeout.tv_nsec %= 1000000000L;
+
+	pthread_cond_timedwait(&data_file_jobs_cond, &data_file_jobs_mutex,
+						   &timeout);
+}
+
+/*
+ * Remove job from the shared list, so no one else can take its parts.
+ * Must be called with data_file_jobs_mutex held.
+ */
+static void
+forget_data_file_job(DataFileJob *job)
+{
+	int			i;
+
+	for (i = 0; i < parray_num(data_file_jobs); i++)
+	{
+		if (parray_get(data_file_jobs, i) == job)
+		{
+			parray_remove(data_file_jobs, i);
+			break;
+		}
+	}
+	pthread_cond_broadcast(&data_file_jobs_cond);
+}
+
+/*
+ * Take next part of the file. Parts are kept in memory until the owner
+ * writes them, so do not let them go too far ahead of the owner.
+ * Must be called with data_file_jobs_mutex held.
+ */
+static DataFilePart *
+take_data_file_part(DataFileJob *job)
+{
+	DataFilePart *part;
+
+	if (job->next_part >= job->nparts ||
+		job->next_part >= job->written_parts + num_threads)
+		return NULL;
+
+	part = &job->parts[job->next_part++];
+	part->state = PART_IN_PROGRESS;
+
+	if (job->next_part == job->nparts)
+		forget_data_file_job(job);
+
+	return part;
+}
+
+static FILE *
+open_data_file_part(DataFileJob *job, DataFilePart *part)
+{
+	FILE	   *out;
+
+#ifdef WIN32
+	out = tmpfile();
+#else
+	out = open_memstream(&part->data, &part->size);
+#endif
+	if (out == NULL)
+		elog(ERROR, "File: %s, cannot allocate buffer for block %u: %s",
+			 job->file->path, part->start, strerror(errno));
+	return out;
+}
+
+static void
+close_data_file_part(DataFileJob *job, DataFilePart *part, FILE *out)
+{
+#ifdef WIN32
+	part->size = ftell(out);
+	part->data = pgut_malloc(part->size + 1);
+	rewind(out);
+	if (fread(part->data, 1, part->size, out) != part->size)
+		elog(ERROR, "File: %s, cannot read buffer for block %u: %s",
+			 job->file->path, part->start, strerror(errno));
+	fclose(out);
+#else
+	if (fclose(out) != 0)
+		elog(ERROR, "File: %s, cannot write buffer for block %u: %s",
+			 job->file->path, part->start, strerror(errno));
+#endif
+}
+
+/*
+ * Backup blocks of one part of data file into memory.
+ * If "in" is NULL, data file is opened by this function.
+ */
+static void
+backup_data_file_part(backup_files_arg *arguments, DataFileJob *job,
+					  DataFilePart *part, FILE *in)
+{
+	/* Copy of file is used to collect sizes and CRC of this part only */
+	pgFile		part_file = *job->file;
+	FILE	   *file_in = in;
+	FILE	   *out;
+	BlockNumber	blknum;
+	char		curr_page[BLCKSZ];
+
+	part_file.read_size = 0;
+	part_file.write_size = 0;
+	/* Block map of the part is collected when the owner appends it */
+	part_file.block_map = NULL;
+	INIT_FILE_CRC32(true, part_file.crc);
+
+	out = open_data_file_part(job, part);
+
+	if (file_in == NULL)
+	{
+		file_in = fio_fopen(part_file.path, PG_BINARY_R, FIO_DB_HOST);
+		if (file_in == NULL)
+		{
+			BackupPageHeader header;
+
+			if (errno != ENOENT)
+				elog(ERROR, "cannot open file \"%s\": %s",
+					 part_file.path, strerror(errno));
+
+			/* File was removed by concurrent transaction, treat it as truncated */
+			header.block = part->start;
+			header.compressed_size = PageIsTruncated;
+			if (fwrite(&header, 1, sizeof(header), out) != sizeof(header))
+				elog(ERROR, "File: %s, cannot write backup at block %u: %s",
+					 part_file.path, part->start, strerror(errno));
+			part->n_blocks_read = 1;
+			part->truncated = true;
+			close_data_file_part(job, part, out);
+			goto done;
+		}
+	}
+
+	if (job->backup_mode != BACKUP_MODE_DIFF_PTRACK &&
+		fio_is_remote_file(file_in))
+	{
+		int		n_retries = 0;
+
+		part->truncated = backup_remote_page_range(arguments, &part_file,
+												   file_in, out,
+												   part->start, part->end,
+												   job->nblocks,
+												   job->prev_backup_start_lsn,
+												   job->backup_mode,
+												   job->calg, job->clevel,
+												   &n_retries,
+												   &part->n_blocks_read,
+												   &part->n_blocks_skipped);
+	}
+	else if (job->backup_mode != BACKUP_MODE_DIFF_PTRACK)
+	{
+		char	   *buf = pgut_malloc((size_t) DATA_FILE_READ_BLOCKS * BLCKSZ);
+
+		part->truncated = backup_page_range(arguments, &part_file, file_in, out,
+											part->start, part->end,
+											job->nblocks,
+											job->prev_backup_start_lsn,
+											job->backup_mode,
+											job->calg, job->clevel, buf,
+											&part->n_blocks_read,
+											&part->n_blocks_skipped);
+		pg_free(buf);
+	}
+	else
+	{
+		PtrackBlocks *ptrack_blocks = ptrack_blocks_alloc();
+
+		for (blknum = part->start; blknum < part->end; blknum++)
+		{
+			int		page_state;
+
+			if ((blknum - part->start) % PTRACK_BLOCKS_BATCH == 0)
+				prefetch_ptrack_range(&(arguments->conn_arg), &part_file,
+									  blknum, part->end, ptrack_blocks);
+
+			page_state = prepare_page(&(arguments->conn_arg), ptrack_blocks, &part_file,
+									  job->prev_backup_start_lsn,
+									  blknum, job->nblocks, file_in,
+									  &part->n_blocks_skipped,
+									  job->backup_mode, curr_page, true,
+									  current.checksum_version);
+			compress_and_backup_page(&part_file, blknum, file_in, out,
+									 &(part_file.crc), page_state, curr_page,
+									 job->calg, job->clevel);
+			advise_read_pages(file_in, blknum);
+			throttle_pages(&part_file, file_in, blknum);
+			part->n_blocks_read++;
+			if (page_state == PageIsTruncated)
+			{
+				part->truncated = true;
+				break;
+			}
+		}
+
+		ptrack_blocks_free(ptrack_blocks);
+	}
+
+	close_data_file_part(job, part, out);
+	part->read_size = part_file.read_size;
+
+	if (in == NULL)
+	{
+		if (drop_cache)
+			fio_cache_advise(file_in, (off_t) part->start * BLCKSZ,
+							 (off_t) (part->end - part->start) * BLCKSZ,
+							 FIO_ADVISE_DONTNEED);
+		fio_fclose(file_in);
+	}
+
+done:
+	pthread_lock(&data_file_jobs_mutex);
+	part->state = PART_DONE;
+	pthread_cond_broadcast(&data_file_jobs_cond);
+	pthread_mutex_unlock(&data_file_jobs_mutex);
+}
+
+/*
+ * Backup data file by parts. Blocks are written to "out" in the same format
+ * as sequential backup produces.
+ */
+static void
+backup_data_file_parts(backup_files_arg *arguments, pgFile *file,
+					   FILE *in, FILE *out, BlockNumber nblocks,
+					   XLogRecPtr prev_backup_start_lsn, BackupMode backup_mode,
+					   CompressAlg calg, int clevel,
+					   BlockNumber *n_blocks_read, BlockNumber *n_blocks_skipped)
+{
+	/* Allocated in heap, because other threads may use it after our error */
+	DataFileJob *job = pgut_new(DataFileJob);
+	int			i;
+
+	job->file = file;
+	job->nblocks = nblocks;
+	job->prev_backup_start_lsn = prev_backup_start_lsn;
+	job->backup_mode = backup_mode;
+	job->calg = calg;
+	job->clevel = clevel;
+	job->nparts = (nblocks + DATA_FILE_PART_BLOCKS - 1) / DATA_FILE_PART_BLOCKS;
+	job->parts = pgut_newarray(DataFilePart, job->nparts);
+	job->next_part = 0;
+	job->written_parts = 0;
+	for (i = 0; i < job->nparts; i++)
+	{
+		DataFilePart *part = &job->parts[i];
+
+		MemSet(part, 0, sizeof(DataFilePart));
+		part->start = i * DATA_FILE_PART_BLOCKS;
+		part->end = Min(part->start + DATA_FILE_PART_BLOCKS, nblocks);
+	}
+
+	file->compress_alg = calg;
+
+	pthread_lock(&data_file_jobs_mutex);
+	if (data_file_jobs == NULL)
+		data_file_jobs = parray_new();
+	parray_append(data_file_jobs, job);
+	pthread_cond_broadcast(&data_file_jobs_cond);
+	pthread_mutex_unlock(&data_file_jobs_mutex);
+
+	while (job->written_parts < job->nparts)
+	{
+		DataFilePart *part = &job->parts[job->written_parts];
+		DataFilePart *next_part = NULL;
+		bool		part_is_done;
+
+		pthread_lock(&data_file_jobs_mutex);
+		while (part->state != PART_DONE)
+		{
+			next_part = take_data_file_part(job);
+			if (next_part || interrupted || thread_interrupted)
+				break;
+			/* Part is processed by another thread, wait for it */
+			wait_data_file_jobs();
+		}
+		part_is_done = part->state == PART_DONE;
+		pthread_mutex_unlock(&data_file_jobs_mutex);
+
+		if (next_part)
+		{
+			backup_data_file_part(arguments, job, next_part, in);
+			continue;
+		}
+		else if (!part_is_done)
+			elog(ERROR, "Interrupted during backup");
+
+		/* Append part to the backup file */
+		if (part->size > 0)
+		{
+			COMP_FILE_CRC32(true, file->crc, part->data, part->size);
+
+			if (fio_fwrite(out, part->data, part->size) != part->size)
+			{
+				int			errno_tmp = errno;
+
+				fio_fclose(out);
+				elog(ERROR, "File: %s, cannot write backup at block %u: %s",
+					 file->path, part->start, strerror(errno_tmp));
+			}
+			block_map_add(file, part->data, part->size);
+		}
+		file->write_size += part->size;
+		file->read_size += part->read_size;
+		*n_blocks_read += part->n_blocks_read;
+		*n_blocks_skipped += part->n_blocks_skipped;
+		free(part->data);
+		part->data = NULL;
+
+		pthread_lock(&data_file_jobs_mutex);
+		job->written_parts++;
+		/* Helpers may take the parts which were too far ahead */
+		pthread_cond_broadcast(&data_file_jobs_cond);
+		if (part->truncated && job->next_part < job->nparts)
+		{
+			/* File is truncated, following parts are not needed */
+			job->next_part = job->nparts;
+			forget_data_file_job(job);
+		}
+		pthread_mutex_unlock(&data_file_jobs_mutex);
+
+		if (part->truncated)
+			break;
+	}
+
+	/* Wait for parts which were taken before truncation was found */
+	for (i = job->written_parts; i < job->nparts; i++)
+	{
+		DataFilePart *part = &job->parts[i];
+		DataFilePartState state;
+
+		pthread_lock(&data_file_jobs_mutex);
+		while ((state = part->state) == PART_IN_PROGRESS &&
+			   !interrupted && !thread_interrupted)
+			wait_data_file_jobs();
+		pthread_mutex_unlock(&data_file_jobs_mutex);
+
+		if (state == PART_IN_PROGRESS)
+			elog(ERROR, "Interrupted during backup");
+		free(part->data);
+	}
+
+	pg_free(job->parts);
+	pg_free(job);
+}
+
+/*
+ * Take parts of large data files which are backed up by other threads.
+ * It is called by backup thread, when there are no more files to take.
+ */
+void
+help_backup_data_files(backup_files_arg *arguments)
+{
+	while (true)
+	{
+		DataFileJob *job = NULL;
+		DataFilePart *part = NULL;
+		int			i;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "interrupted during backup");
+
+		pthread_lock(&data_file_jobs_mutex);
+		if (data_file_jobs == NULL || parray_num(data_file_jobs) == 0)
+		{
+			pthread_mutex_unlock(&data_file_jobs_mutex);
+			break;
+		}
+		for (i = 0; i < parray_num(data_file_jobs) && part == NULL; i++)
+		{
+			job = (DataFileJob *) parray_get(data_file_jobs, i);
+			part = take_data_file_part(job);
+		}
+		/* All parts are taken or too far ahead of their owners */
+		if (part == NULL)
+			wait_data_file_jobs();
+		pthread_mutex_unlock(&data_file_jobs_mutex);
+
+		if (part)
+			backup_data_file_part(arguments, job, part, NULL);
+	}
+}
+
+/*
+ * Backup run of changed blocks [start, end) of PAGE backup.
+ * Remote agent sends the whole run in response to one request, local file
+ * is read by backup_page_range().
+ * Returns true if the file is truncated.
+ */
+static bool
+backup_pagemap_run(backup_files_arg *arguments, pgFile *file,
+				   FILE *in, FILE *out, BlockNumber start, BlockNumber end,
+				   BlockNumber nblocks, XLogRecPtr prev_backup_start_lsn,
+				   CompressAlg calg, int clevel, char *buf, int *n_retries,
+				   BlockNumber *n_blocks_read, BlockNumber *n_blocks_skipped)
+{
+	if (fio_is_remote_file(in) &&
+		fio_get_agent_version() >= AGENT_SEND_PAGES_RANGE_VERSION)
+		return backup_remote_page_range(arguments, file, in, out, start, end,
+										nblocks, prev_backup_start_lsn,
+										BACKUP_MODE_DIFF_PAGE, calg, clevel,
+										n_retries, n_blocks_read,
+										n_blocks_skipped);
+
+	return backup_page_range(arguments, file, in, out, start, end, nblocks,
+							 prev_backup_start_lsn, BACKUP_MODE_DIFF_PAGE,
+							 calg, clevel, buf, n_blocks_read, n_blocks_skipped);
+}
+
+/*
+ * Backup data file in the from_root directory to the to_root directory with
+ * same relative path. If prev_backup_start_lsn is not NULL, only pages with
+ * higher lsn will be copied.
+ * Not just copy file, but read it block by block (use bitmap in case of
+ * incremental backup), validate checksum, optionally compress and write to
+ * backup with special header.
+ */
+bool
+backup_data_file(backup_files_arg* arguments,
+				 const char *to_path, pgFile *file,
+				 XLogRecPtr prev_backup_start_lsn, BackupMode backup_mode,
+				 CompressAlg calg, int clevel, bool missing_ok)
+{
+	FILE		*in;
+	FILE		*out;
+	BlockNumber	blknum = 0;
+	BlockNumber	nblocks = 0;
+	BlockNumber	n_blocks_skipped = 0;
+	BlockNumber	n_blocks_read = 0;
+	int			page_state;
+	char		curr_page[BLCKSZ];
+	PtrackBlocks *ptrack_blocks = NULL;
+	int			n_retries = 0;	/* blocks failed verification on agent */
+
+	/*
+	 * Skip unchanged file only if it exists in previous backup.
+	 * This way we can correctly handle null-sized files which are
+	 * not tracked by pagemap and thus always marked as unchanged.
+	 */
+	if ((backup_mode == BACKUP_MODE_DIFF_PAGE ||
+		backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
+		pagemap_is_empty(&file->pagemap) &&
+		file->exists_in_prev && !file->pagemap_isabsent)
+	{
+		/*
+		 * There are no changed blocks since last backup. We want make
+		 * incremental backup, so we should exit.
+		 */
+		elog(VERBOSE, "Skipping the unchanged file: %s", file->path);
+		return false;
+	}
+
+	/* reset size summary */
+	file->read_size = 0;
+	file->write_size = 0;
+	INIT_FILE_CRC32(true, file->crc);
+
+	/* open backup mode file for read */
+	in = fio_fopen(file->path, PG_BINARY_R, FIO_DB_HOST);
+	if (in == NULL)
+	{
+		FIN_FILE_CRC32(true, file->crc);
+
+		/*
 		 * If file is not found, this is not en error.
 		 * It could have been deleted by concurrent postgres transaction.
 		 */
@@ -587,6 +1568,9 @@ backup_data_file(backup_files_arg* arguments,
 	if (file->size % BLCKSZ != 0)
 		elog(WARNING, "File: %s, invalid file size %zu", file->path, file->size);
 
+	/* Pages received from agent and parts of the file are throttled too */
+	lookup_file_dev(file, in);
+
 	/*
 	 * Compute expected number of blocks in the file.
 	 * NOTE This is a normal situation, if the file size has changed
@@ -604,6 +1588,13 @@ backup_data_file(backup_files_arg* arguments,
 			 to_path, strerror(errno_tmp));
 	}
 
+	/* Offsets of page records are collected while they are written */
+	block_map_start(file);
+
+	/* In PTRACK mode pages are fetched from shared buffers by batches */
+	if (backup_mode == BACKUP_MODE_DIFF_PTRACK)
+		ptrack_blocks = ptrack_blocks_alloc();
+
 	/*
 	 * Read each page, verify checksum and write it to backup.
 	 * If page map is empty or file is not present in previous backup
@@ -611,31 +1602,53 @@ backup_data_file(backup_files_arg* arguments,
 	 *
 	 * We will enter here if backup_mode is FULL or DELTA.
 	 */
-	if (file->pagemap.bitmapsize == PageBitmapIsEmpty ||
+	if (pagemap_is_empty(&file->pagemap) ||
 		file->pagemap_isabsent || !file->exists_in_prev)
 	{
-		if (backup_mode != BACKUP_MODE_DIFF_PTRACK && fio_is_remote_file(in))
+		if (drop_cache)
+			fio_cache_advise(in, 0, 0, FIO_ADVISE_SEQUENTIAL);
+
+		/* Let other threads help with large file */
+		if (num_threads > 1 && nblocks >= 2 * DATA_FILE_PART_BLOCKS &&
+			(backup_mode == BACKUP_MODE_DIFF_PTRACK || !fio_is_remote_file(in) ||
+			 fio_get_agent_version() >= AGENT_SEND_PAGES_RANGE_VERSION))
 		{
-			int rc = fio_send_pages(in, out, file,
-									backup_mode == BACKUP_MODE_DIFF_DELTA && file->exists_in_prev ? prev_backup_start_lsn : InvalidXLogRecPtr,
-									&n_blocks_skipped, calg, clevel);
-			if (rc == PAGE_CHECKSUM_MISMATCH && is_ptrack_support)
-				goto RetryUsingPtrack;
-			if (rc < 0)
-				elog(ERROR, "Failed to read file %s: %s",
-					 file->path, rc == PAGE_CHECKSUM_MISMATCH ? "data file checksum mismatch" : strerror(-rc));
-			n_blocks_read = rc;
+			backup_data_file_parts(arguments, file, in, out, nblocks,
+								   prev_backup_start_lsn, backup_mode,
+								   calg, clevel,
+								   &n_blocks_read, &n_blocks_skipped);
+		}
+		else if (backup_mode != BACKUP_MODE_DIFF_PTRACK && fio_is_remote_file(in))
+		{
+			backup_remote_page_range(arguments, file, in, out, 0, nblocks,
+									 prev_backup_start_lsn, backup_mode,
+									 calg, clevel, &n_retries,
+									 &n_blocks_read, &n_blocks_skipped);
+		}
+		else if (ptrack_blocks == NULL)
+		{
+			char	   *buf = pgut_malloc((size_t) DATA_FILE_READ_BLOCKS * BLCKSZ);
+
+			backup_page_range(arguments, file, in, out, 0, nblocks,
+							  prev_backup_start_lsn, backup_mode, calg, clevel,
+							  buf, &n_blocks_read, &n_blocks_skipped);
+			pg_free(buf);
 		}
 		else
 		{
-		  RetryUsingPtrack:
 			for (blknum = 0; blknum < nblocks; blknum++)
 			{
-				page_state = prepare_page(&(arguments->conn_arg), file, prev_backup_start_lsn,
+				if (blknum % PTRACK_BLOCKS_BATCH == 0)
+					prefetch_ptrack_range(&(arguments->conn_arg), file,
+										  blknum, nblocks, ptrack_blocks);
+
+				page_state = prepare_page(&(arguments->conn_arg), ptrack_blocks, file, prev_backup_start_lsn,
 										  blknum, nblocks, in, &n_blocks_skipped,
 										  backup_mode, curr_page, true, current.checksum_version);
 				compress_and_backup_page(file, blknum, in, out, &(file->crc),
 										  page_state, curr_page, calg, clevel);
+				advise_read_pages(in, blknum);
+				throttle_pages(file, in, blknum);
 				n_blocks_read++;
 				if (page_state == PageIsTruncated)
 					break;
@@ -649,24 +1662,67 @@ backup_data_file(backup_files_arg* arguments,
 	 *
 	 * We will enter here if backup_mode is PAGE or PTRACK.
 	 */
-	else
+	else if (backup_mode == BACKUP_MODE_DIFF_PAGE)
 	{
-		datapagemap_iterator_t *iter;
-		iter = datapagemap_iterate(&file->pagemap);
-		while (datapagemap_next(iter, &blknum))
-		{
-			page_state = prepare_page(&(arguments->conn_arg), file, prev_backup_start_lsn,
-									  blknum, nblocks, in, &n_blocks_skipped,
-									  backup_mode, curr_page, true, current.checksum_version);
-			compress_and_backup_page(file, blknum, in, out, &(file->crc),
-									  page_state, curr_page, calg, clevel);
-			n_blocks_read++;
-			if (page_state == PageIsTruncated)
+		PageMapIterator iter;
+		BlockNumber	start;
+		BlockNumber	end;
+		char	   *buf = NULL;
+
+		if (!fio_is_remote_file(in))
+			buf = pgut_malloc((size_t) DATA_FILE_READ_BLOCKS * BLCKSZ);
+
+		pagemap_iterate(&iter, &file->pagemap);
+		while (pagemap_next_run(&iter, &start, &end))
+		{
+			if (backup_pagemap_run(arguments, file, in, out, start, end,
+								   nblocks, prev_backup_start_lsn, calg, clevel,
+								   buf, &n_retries, &n_blocks_read,
+								   &n_blocks_skipped))
 				break;
 		}
 
-		pg_free(file->pagemap.bitmap);
-		pg_free(iter);
+		pg_free(buf);
+		pagemap_free(&file->pagemap);
+	}
+	else
+	{
+		PageMapIterator iter;
+		BlockNumber	blknums[PTRACK_BLOCKS_BATCH];
+		int			n;
+		int			k;
+
+		pagemap_iterate(&iter, &file->pagemap);
+		page_state = 0;
+		while (page_state != PageIsTruncated)
+		{
+			/* Take next batch of changed blocks */
+			for (n = 0; n < PTRACK_BLOCKS_BATCH; n++)
+				if (!pagemap_next(&iter, &blknums[n]))
+					break;
+			if (n == 0)
+				break;
+
+			if (ptrack_blocks)
+				prefetch_ptrack_blocks(&(arguments->conn_arg), file,
+									   blknums, n, ptrack_blocks);
+
+			for (k = 0; k < n; k++)
+			{
+				blknum = blknums[k];
+				page_state = prepare_page(&(arguments->conn_arg), ptrack_blocks, file, prev_backup_start_lsn,
+										  blknum, nblocks, in, &n_blocks_skipped,
+										  backup_mode, curr_page, true, current.checksum_version);
+				compress_and_backup_page(file, blknum, in, out, &(file->crc),
+										  page_state, curr_page, calg, clevel);
+				throttle_pages(file, in, n_blocks_read);
+				n_blocks_read++;
+				if (page_state == PageIsTruncated)
+					break;
+			}
+		}
+
+		pagemap_free(&file->pagemap);
 	}
 
 	/* update file permission */
@@ -683,22 +1739,32 @@ backup_data_file(backup_files_arg* arguments,
 		fio_fclose(out))
 		elog(ERROR, "cannot write backup file \"%s\": %s",
 			 to_path, strerror(errno));
+	if (drop_cache)
+		fio_cache_advise(in, 0, 0, FIO_ADVISE_DONTNEED);
 	fio_fclose(in);
 
+	ptrack_blocks_free(ptrack_blocks);
+
 	FIN_FILE_CRC32(true, file->crc);
 
+	progress_add(PROGRESS_SKIPPED_PAGES, n_blocks_skipped);
+	progress_add(PROGRESS_SCANNED_PAGES, n_blocks_read);
+
 	/*
 	 * If we have pagemap then file in the backup can't be a zero size.
 	 * Otherwise, we will clear the last file.
 	 */
 	if (n_blocks_read != 0 && n_blocks_read == n_blocks_skipped)
 	{
+		block_map_free(file);
 		if (fio_unlink(to_path, FIO_BACKUP_HOST) == -1)
 			elog(ERROR, "cannot remove file \"%s\": %s", to_path,
 				 strerror(errno));
 		return false;
 	}
 
+	write_block_map(to_path, file);
+
 	return true;
 }
 
@@ -814,36 +1880,49 @@ restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
 
 		Assert(header.compressed_size <= BLCKSZ);
 
-		/* read a page from file */
-		read_len = fread(compressed_page.data, 1,
-			MAXALIGN(header.compressed_size), in);
-		if (read_len != MAXALIGN(header.compressed_size))
-			elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
-				blknum, file->path, read_len, header.compressed_size);
-
-		/*
-		 * if page size is smaller than BLCKSZ, decompress the page.
-		 * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
-		 * we have to check, whether it is compressed or not using
-		 * page_may_be_compressed() function.
-		 */
-		if (header.compressed_size != BLCKSZ
-			|| page_may_be_compressed(compressed_page.data, file->compress_alg,
-									  backup_version))
+		if (header.compressed_size == PageIsZeroed)
 		{
-			const char *errormsg = NULL;
-
-			uncompressed_size = do_decompress(page.data, BLCKSZ,
-											  compressed_page.data,
-											  header.compressed_size,
-											  file->compress_alg, &errormsg);
-			if (uncompressed_size < 0 && errormsg != NULL)
-				elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
-					 blknum, file->path, errormsg);
+			/* page data is not stored */
+			MemSet(page.data, 0, BLCKSZ);
+			uncompressed_size = BLCKSZ;
+			progress_add(PROGRESS_READ_BYTES, sizeof(header));
+		}
+		else
+		{
+			/* read a page from file */
+			read_len = fread(compressed_page.data, 1,
+				MAXALIGN(header.compressed_size), in);
+			if (read_len != MAXALIGN(header.compressed_size))
+				elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
+					blknum, file->path, read_len, header.compressed_size);
+			progress_add(PROGRESS_READ_BYTES, sizeof(header) + read_len);
 
-			if (uncompressed_size != BLCKSZ)
-				elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
-					 file->path, uncompressed_size);
+			/*
+			 * if page size is smaller than BLCKSZ, decompress the page.
+			 * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
+			 * we have to check, whether it is compressed or not using
+			 * page_may_be_compressed() function.
+			 */
+			if (header.compressed_size != BLCKSZ
+				|| page_may_be_compressed(compressed_page.data, file->compress_alg,
+										  backup_version))
+			{
+				const char *errormsg = NULL;
+				int64		decompress_start = progress_clock();
+
+				uncompressed_size = do_decompress(page.data, BLCKSZ,
+												  compressed_page.data,
+												  header.compressed_size,
+												  file->compress_alg, &errormsg);
+				progress_add_time(PROGRESS_COMPRESS_TIME, decompress_start);
+				if (uncompressed_size < 0 && errormsg != NULL)
+					elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
+						 blknum, file->path, errormsg);
+
+				if (uncompressed_size != BLCKSZ)
+					elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
+						 file->path, uncompressed_size);
+			}
 		}
 
 		write_pos = (write_header) ? blknum * (BLCKSZ + sizeof(header)) :
@@ -865,82 +1944,1088 @@ restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
 					 blknum, file->path, strerror(errno));
 		}
 
-		/* if we uncompressed the page - write page.data,
-		 * if page wasn't compressed -
-		 * write what we've read - compressed_page.data
+		/* if we uncompressed the page - write page.data,
+		 * if page wasn't compressed -
+		 * write what we've read - compressed_page.data
+		 */
+		if (uncompressed_size == BLCKSZ)
+		{
+			if (fio_fwrite(out, page.data, BLCKSZ) != BLCKSZ)
+				elog(ERROR, "Cannot write block %u of \"%s\": %s",
+					 blknum, file->path, strerror(errno));
+		}
+		else
+		{
+			if (fio_fwrite(out, compressed_page.data, BLCKSZ) != BLCKSZ)
+				elog(ERROR, "Cannot write block %u of \"%s\": %s",
+					 blknum, file->path, strerror(errno));
+		}
+		progress_add(PROGRESS_WRITTEN_BYTES,
+					 write_header ? BLCKSZ + sizeof(header) : BLCKSZ);
+	}
+
+	/*
+	 * DELTA backup have no knowledge about truncated blocks as PAGE or PTRACK do
+	 * But during DELTA backup we read every file in PGDATA and thus DELTA backup
+	 * knows exact size of every file at the time of backup.
+	 * So when restoring file from DELTA backup we, knowning it`s size at
+	 * a time of a backup, can truncate file to this size.
+	 */
+	if (allow_truncate && file->n_blocks != BLOCKNUM_INVALID && !need_truncate)
+	{
+		struct stat st;
+		if (fio_ffstat(out, &st) == 0 && st.st_size > file->n_blocks * BLCKSZ)
+		{
+			truncate_from = file->n_blocks;
+			need_truncate = true;
+		}
+	}
+
+	if (need_truncate)
+	{
+		off_t		write_pos;
+
+		write_pos = (write_header) ? truncate_from * (BLCKSZ + sizeof(header)) :
+									 truncate_from * BLCKSZ;
+
+		/*
+		 * Truncate file to this length.
+		 */
+		if (fio_ftruncate(out, write_pos) != 0)
+			elog(ERROR, "Cannot truncate \"%s\": %s",
+				 file->path, strerror(errno));
+		elog(VERBOSE, "Delta truncate file %s to block %u",
+			 file->path, truncate_from);
+	}
+
+	/* update file permission */
+	if (fio_chmod(to_path, file->mode, FIO_DB_HOST) == -1)
+	{
+		int errno_tmp = errno;
+
+		if (in)
+			fclose(in);
+		fio_fclose(out);
+		elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
+			 strerror(errno_tmp));
+	}
+
+	if (fio_fflush(out) != 0 ||
+		fio_fclose(out))
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+
+	if (in)
+		fclose(in);
+}
+
+/* Sequential reader of page records of a data file in backup format */
+typedef struct BackupPageReader
+{
+	FILE	   *in;
+	const char *path;
+	BackupPageHeader header;
+	char		data[BLCKSZ];
+	bool		eof;
+	BlockNumber	truncated;		/* block of truncation record, if any */
+} BackupPageReader;
+
+/*
+ * Read the next page record, its data is read as is including MAXALIGN
+ * padding. Sets reader->eof at the end of the file or at the truncation
+ * record.
+ */
+static void
+read_backup_page(BackupPageReader *reader)
+{
+	size_t		read_len;
+
+	for (;;)
+	{
+		if (reader->in == NULL)
+		{
+			reader->eof = true;
+			return;
+		}
+
+		read_len = fread(&reader->header, 1, sizeof(BackupPageHeader), reader->in);
+		if (read_len != sizeof(BackupPageHeader))
+		{
+			if (read_len == 0 && feof(reader->in))
+			{
+				reader->eof = true;
+				return;
+			}
+			else if (read_len != 0 && feof(reader->in))
+				elog(ERROR, "Odd size page found in \"%s\"", reader->path);
+			else
+				elog(ERROR, "Cannot read header from \"%s\": %s",
+					 reader->path, strerror(errno));
+		}
+
+		if (reader->header.block == 0 && reader->header.compressed_size == 0)
+			continue;
+
+		if (reader->header.compressed_size == PageIsTruncated)
+		{
+			reader->truncated = reader->header.block;
+			reader->eof = true;
+			return;
+		}
+
+		/* zeroed page has no data */
+		if (reader->header.compressed_size == PageIsZeroed)
+			return;
+
+		if (reader->header.compressed_size <= 0 ||
+			reader->header.compressed_size > BLCKSZ)
+			elog(ERROR, "Invalid size %d of block %u of \"%s\"",
+				 reader->header.compressed_size, reader->header.block,
+				 reader->path);
+
+		read_len = fread(reader->data, 1,
+						 MAXALIGN(reader->header.compressed_size), reader->in);
+		if (read_len != MAXALIGN(reader->header.compressed_size))
+			elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
+				 reader->header.block, reader->path, read_len,
+				 reader->header.compressed_size);
+		return;
+	}
+}
+
+static void
+open_backup_page_reader(BackupPageReader *reader, const char *path)
+{
+	reader->path = path;
+	reader->eof = false;
+	reader->truncated = InvalidBlockNumber;
+	reader->in = NULL;
+
+	if (path)
+	{
+		reader->in = fopen(path, PG_BINARY_R);
+		if (reader->in == NULL)
+			elog(ERROR, "Cannot open backup file \"%s\": %s", path,
+				 strerror(errno));
+	}
+
+	read_backup_page(reader);
+}
+
+/*
+ * Merge data file "from_file" of an incremental backup into the file
+ * "to_path" of its parent backup at the block level.
+ *
+ * Both files are read in the order of blocks and the newest version of
+ * every block is written to the temporary file as is, so pages are neither
+ * decompressed nor compressed again. Both files have to be compressed by
+ * the same algorithm. Then the temporary file replaces "to_path".
+ * "to_path" is NULL if the parent backup doesn't have the file.
+ *
+ * write_size and crc of "from_file" are set to the values of the result.
+ */
+void
+merge_data_file(const char *to_path, const char *result_path,
+				pgFile *from_file, bool allow_truncate)
+{
+	BackupPageReader *to_reader = pgut_new(BackupPageReader);
+	BackupPageReader *from_reader = pgut_new(BackupPageReader);
+	char		tmp_path[MAXPGPATH];
+	FILE	   *out;
+	BlockNumber	limit = InvalidBlockNumber;
+	int64		write_size = 0;
+	pg_crc32	crc;
+
+	/* DELTA backup knows the exact size of the file */
+	if (allow_truncate && from_file->n_blocks != BLOCKNUM_INVALID)
+		limit = from_file->n_blocks;
+
+	open_backup_page_reader(to_reader, to_path);
+	/* BYTES_INVALID means that the file didn't change since the parent */
+	open_backup_page_reader(from_reader,
+							from_file->write_size == BYTES_INVALID ?
+							NULL : from_file->path);
+
+	snprintf(tmp_path, MAXPGPATH, "%s_tmp", result_path);
+	out = fopen(tmp_path, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open merge target file \"%s\": %s",
+			 tmp_path, strerror(errno));
+
+	INIT_FILE_CRC32(true, crc);
+	block_map_start(from_file);
+
+	while (!to_reader->eof || !from_reader->eof)
+	{
+		BackupPageReader *reader;
+		size_t		len;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during merging backups");
+
+		/* Blocks after truncation in the newer backup are removed */
+		if (from_reader->eof && from_reader->truncated < limit)
+			limit = from_reader->truncated;
+
+		/* Take the block from the newer backup if both have it */
+		if (to_reader->eof ||
+			(!from_reader->eof &&
+			 from_reader->header.block <= to_reader->header.block))
+			reader = from_reader;
+		else
+			reader = to_reader;
+
+		if (reader->header.block >= limit)
+			break;
+
+		len = reader->header.compressed_size == PageIsZeroed ? 0 :
+			MAXALIGN(reader->header.compressed_size);
+		if (fwrite(&reader->header, 1, sizeof(BackupPageHeader), out) != sizeof(BackupPageHeader) ||
+			fwrite(reader->data, 1, len, out) != len)
+			elog(ERROR, "Cannot write block %u of \"%s\": %s",
+				 reader->header.block, tmp_path, strerror(errno));
+
+		COMP_FILE_CRC32(true, crc, &reader->header, sizeof(BackupPageHeader));
+		COMP_FILE_CRC32(true, crc, reader->data, len);
+		block_map_add_entry(from_file->block_map, reader->header.block,
+							reader->header.compressed_size,
+							write_size + sizeof(BackupPageHeader));
+		write_size += sizeof(BackupPageHeader) + len;
+
+		if (reader == from_reader && !to_reader->eof &&
+			to_reader->header.block == from_reader->header.block)
+			read_backup_page(to_reader);
+		read_backup_page(reader);
+	}
+
+	FIN_FILE_CRC32(true, crc);
+
+	if (fflush(out) != 0 || fclose(out) != 0)
+		elog(ERROR, "Cannot write merge target file \"%s\": %s",
+			 tmp_path, strerror(errno));
+
+	if (to_reader->in)
+		fclose(to_reader->in);
+	if (from_reader->in)
+		fclose(from_reader->in);
+
+	if (rename(tmp_path, result_path) != 0)
+		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+			 tmp_path, result_path, strerror(errno));
+
+	from_file->write_size = write_size;
+	from_file->crc = crc;
+
+	pg_free(to_reader);
+	pg_free(from_reader);
+}
+
+/* Block map of a data file, collected while the file is written */
+struct BlockMapBuilder
+{
+	BlockMapHeader map;
+	BlockMapEntry *entries;
+	uint32		allocated;
+};
+
+/* Start collecting block map of "file", which is written from scratch */
+static void
+block_map_start(pgFile *file)
+{
+	BlockMapBuilder *builder = pgut_new(BlockMapBuilder);
+
+	MemSet(builder, 0, sizeof(BlockMapBuilder));
+	builder->map.magic = BLOCK_MAP_MAGIC;
+	builder->map.truncated = InvalidBlockNumber;
+	file->block_map = builder;
+}
+
+static void
+block_map_free(pgFile *file)
+{
+	if (file->block_map == NULL)
+		return;
+
+	pg_free(file->block_map->entries);
+	pg_free(file->block_map);
+	file->block_map = NULL;
+}
+
+/* Add page record of "block", data of which is at "offset" of the file */
+static void
+block_map_add_entry(BlockMapBuilder *builder, BlockNumber block,
+					int32 compressed_size, int64 offset)
+{
+	BlockMapEntry *entry;
+
+	if (builder->map.nentries >= builder->allocated)
+	{
+		builder->allocated = Max(builder->allocated * 2, 1024);
+		builder->entries = pgut_realloc(builder->entries,
+							builder->allocated * sizeof(BlockMapEntry));
+	}
+	entry = &builder->entries[builder->map.nentries++];
+	entry->block = block;
+	entry->compressed_size = compressed_size;
+	entry->offset = offset;
+}
+
+/*
+ * Add page records of "data", which is going to be appended to the backup
+ * file of "file" at offset file->write_size, to its block map. "data" must
+ * contain whole page records. Does nothing if the map is not collected.
+ */
+void
+block_map_add(pgFile *file, const char *data, size_t size)
+{
+	BlockMapBuilder *builder = file->block_map;
+	size_t		pos = 0;
+
+	if (builder == NULL)
+		return;
+
+	while (pos + sizeof(BackupPageHeader) <= size)
+	{
+		BackupPageHeader *header = (BackupPageHeader *) (data + pos);
+
+		pos += sizeof(BackupPageHeader);
+
+		if (header->block == 0 && header->compressed_size == 0)
+			continue;
+
+		if (header->compressed_size == PageIsTruncated)
+		{
+			builder->map.truncated = header->block;
+			break;
+		}
+
+		block_map_add_entry(builder, header->block, header->compressed_size,
+							file->write_size + pos);
+
+		if (header->compressed_size > 0)
+			pos += MAXALIGN(header->compressed_size);
+	}
+}
+
+/*
+ * Write block map of the data file "path" in backup, see BlockMapHeader.
+ * The map is collected while the file is written, "file" provides CRC and
+ * size of the file. Stale map of a small file is removed.
+ */
+void
+write_block_map(const char *path, pgFile *file)
+{
+	char		map_path[MAXPGPATH];
+	FILE	   *out;
+	BlockMapBuilder *builder = file->block_map;
+
+	snprintf(map_path, MAXPGPATH, "%s%s", path, BLOCK_MAP_SUFFIX);
+
+	if (builder == NULL || builder->map.nentries < BLOCK_MAP_MIN_BLOCKS)
+	{
+		if (unlink(map_path) != 0 && errno != ENOENT)
+			elog(ERROR, "Cannot remove file \"%s\": %s", map_path,
+				 strerror(errno));
+		block_map_free(file);
+		return;
+	}
+
+	builder->map.file_crc = file->crc;
+	builder->map.file_size = file->write_size;
+
+	INIT_FILE_CRC32(true, builder->map.crc);
+	COMP_FILE_CRC32(true, builder->map.crc, &builder->map,
+					offsetof(BlockMapHeader, crc));
+	COMP_FILE_CRC32(true, builder->map.crc, builder->entries,
+					builder->map.nentries * sizeof(BlockMapEntry));
+	FIN_FILE_CRC32(true, builder->map.crc);
+
+	out = fopen(map_path, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open block map file \"%s\": %s", map_path,
+			 strerror(errno));
+	if (fwrite(&builder->map, 1, sizeof(BlockMapHeader), out) != sizeof(BlockMapHeader) ||
+		fwrite(builder->entries, sizeof(BlockMapEntry), builder->map.nentries,
+			   out) != builder->map.nentries ||
+		fflush(out) != 0 || fclose(out) != 0)
+		elog(ERROR, "Cannot write block map file \"%s\": %s", map_path,
+			 strerror(errno));
+
+	block_map_free(file);
+}
+
+/*
+ * Write block map of the uncompressed data file "path" merged in place by
+ * restore_data_file(). Page records of such file are at fixed positions, so
+ * the map is derived from its size.
+ */
+void
+write_dense_block_map(const char *path, pgFile *file)
+{
+	BlockNumber	nblocks = file->write_size / (BLCKSZ + sizeof(BackupPageHeader));
+	BlockNumber	blknum;
+
+	block_map_start(file);
+	for (blknum = 0; blknum < nblocks; blknum++)
+		block_map_add_entry(file->block_map, blknum, BLCKSZ,
+							(int64) blknum * (BLCKSZ + sizeof(BackupPageHeader)) +
+							sizeof(BackupPageHeader));
+
+	write_block_map(path, file);
+}
+
+/*
+ * Read block map of the data file in backup. Returns NULL if there is no
+ * map or it doesn't match the file, then page headers have to be read.
+ */
+static BlockMapEntry *
+read_block_map(pgFile *file, BlockMapHeader *map)
+{
+	char		map_path[MAXPGPATH];
+	FILE	   *in;
+	BlockMapEntry *entries = NULL;
+	pg_crc32	crc;
+	struct stat	st;
+
+	snprintf(map_path, MAXPGPATH, "%s%s", file->path, BLOCK_MAP_SUFFIX);
+
+	in = fopen(map_path, PG_BINARY_R);
+	if (in == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open block map file \"%s\": %s",
+				 map_path, strerror(errno));
+		return NULL;
+	}
+
+	if (fread(map, 1, sizeof(BlockMapHeader), in) != sizeof(BlockMapHeader) ||
+		map->magic != BLOCK_MAP_MAGIC)
+		goto invalid;
+
+	if (map->file_crc != file->crc ||
+		stat(file->path, &st) != 0 || st.st_size != map->file_size)
+	{
+		elog(VERBOSE, "Block map \"%s\" doesn't match the data file", map_path);
+		fclose(in);
+		return NULL;
+	}
+
+	/* every entry has a page header in the data file */
+	if ((int64) map->nentries * sizeof(BackupPageHeader) > map->file_size)
+		goto invalid;
+
+	entries = pgut_newarray(BlockMapEntry, Max(map->nentries, 1));
+	if (fread(entries, sizeof(BlockMapEntry), map->nentries, in) != map->nentries)
+		goto invalid;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, map, offsetof(BlockMapHeader, crc));
+	COMP_FILE_CRC32(true, crc, entries, map->nentries * sizeof(BlockMapEntry));
+	FIN_FILE_CRC32(true, crc);
+	if (crc != map->crc)
+		goto invalid;
+
+	fclose(in);
+	return entries;
+
+invalid:
+	elog(WARNING, "Block map \"%s\" is corrupted, page headers are read instead",
+		 map_path);
+	fclose(in);
+	pg_free(entries);
+	return NULL;
+}
+
+/*
+ * Get the next page record of the backup file, either from its block map or
+ * by reading the page header. "offset" is set to the offset of page data.
+ * Returns false at the end of the file.
+ */
+static bool
+next_backup_page_header(FILE *in, pgFile *file, BlockMapHeader *map,
+						BlockMapEntry *entries, uint32 *pos,
+						BackupPageHeader *header, off_t *offset)
+{
+	size_t		read_len;
+
+	if (entries)
+	{
+		if (*pos < map->nentries)
+		{
+			header->block = entries[*pos].block;
+			header->compressed_size = entries[*pos].compressed_size;
+			*offset = entries[*pos].offset;
+		}
+		else if (*pos == map->nentries && map->truncated != InvalidBlockNumber)
+		{
+			header->block = map->truncated;
+			header->compressed_size = PageIsTruncated;
+			*offset = 0;
+		}
+		else
+			return false;
+
+		(*pos)++;
+		return true;
+	}
+
+	for (;;)
+	{
+		read_len = fread(header, 1, sizeof(BackupPageHeader), in);
+		if (read_len != sizeof(BackupPageHeader))
+		{
+			int errno_tmp = errno;
+			if (read_len == 0 && feof(in))
+				return false;		/* EOF found */
+			else if (read_len != 0 && feof(in))
+				elog(ERROR, "Odd size page found in \"%s\"", file->path);
+			else
+				elog(ERROR, "Cannot read header from \"%s\": %s",
+					 file->path, strerror(errno_tmp));
+		}
+
+		if (header->block == 0 && header->compressed_size == 0)
+			continue;
+
+		*offset = ftell(in);
+
+		/* skip page data, it is read later if this version is the newest */
+		if (header->compressed_size > 0 && header->compressed_size <= BLCKSZ &&
+			fseek(in, MAXALIGN(header->compressed_size), SEEK_CUR) != 0)
+			elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+				 header->block, file->path, strerror(errno));
+		return true;
+	}
+}
+
+/* CRC of the page filled with zeroes */
+static pg_crc32
+zero_page_crc(void)
+{
+	static pg_crc32 crc;
+	static bool crc_calculated = false;
+
+	if (!crc_calculated)
+	{
+		char	   *zeroes = pgut_malloc(BLCKSZ);
+
+		MemSet(zeroes, 0, BLCKSZ);
+		INIT_FILE_CRC32(true, crc);
+		COMP_FILE_CRC32(true, crc, zeroes, BLCKSZ);
+		FIN_FILE_CRC32(true, crc);
+		pg_free(zeroes);
+		crc_calculated = true;
+	}
+	return crc;
+}
+
+/*
+ * Deallocate blocks [start, end) of the restored file. Zeroes are written
+ * through the stream if the agent can't do it, "write_pos" is the position
+ * of the stream.
+ */
+static void
+punch_hole(FILE *out, const char *to_path, BlockNumber start, BlockNumber end,
+		   off_t *write_pos)
+{
+	static const char zeroes[BLCKSZ];
+	BlockNumber	blknum;
+
+	if (start >= end)
+		return;
+
+	if (fio_punch_hole(out, (off_t) start * BLCKSZ,
+					   (off_t) (end - start) * BLCKSZ) == 0)
+		return;
+
+	if (errno != ENOTSUP)
+		elog(ERROR, "Cannot deallocate blocks %u-%u of \"%s\": %s",
+			 start, end - 1, to_path, strerror(errno));
+
+	if (fio_fseek(out, (off_t) start * BLCKSZ) < 0)
+		elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+			 start, to_path, strerror(errno));
+	for (blknum = start; blknum < end; blknum++)
+	{
+		if (fio_fwrite(out, zeroes, BLCKSZ) != BLCKSZ)
+			elog(ERROR, "Cannot write block %u of \"%s\": %s",
+				 blknum, to_path, strerror(errno));
+	}
+	*write_pos = (off_t) end * BLCKSZ;
+}
+
+/* Location of the newest version of a block in the backup chain */
+typedef struct DataBlockSource
+{
+	int			backup;			/* index in the chain, -1 if there is none */
+	int32		compressed_size;
+	off_t		offset;			/* offset of the page data in the backup file */
+} DataBlockSource;
+
+/*
+ * Restore data file "to_path" from the chain of backups in one pass.
+ *
+ * "files" and "backups" are ordered from FULL backup to the newest one,
+ * files[i] is NULL if backups[i] doesn't contain the file.
+ *
+ * First we read only page headers of every backup file, or its block map if
+ * there is one, and find out which backup holds the newest version of each
+ * block, following the same rules as sequential restore_data_file() calls
+ * from the oldest backup to the newest would. Then each block is read from that backup and written to
+ * the destination exactly once.
+ *
+ * In case of incremental restore the destination file may already exist.
+ * CRC of its blocks is calculated on the destination host and only blocks
+ * which differ from the backup are written.
+ */
+void
+restore_data_file_chain(const char *to_path, pgFile **files,
+						pgBackup **backups, int nbackups, bool incremental)
+{
+	FILE	  **in;
+	FILE	   *out;
+	DataBlockSource *blocks = NULL;
+	BlockNumber	nblocks = 0;		/* size of the resulting file */
+	BlockNumber	allocated = 0;
+	BlockNumber	blknum;
+	mode_t		mode = 0;
+	off_t		write_pos = 0;
+	pg_crc32   *dest_crcs = NULL;
+	int			dest_nblocks = 0;
+	BlockNumber	nwritten = 0;
+	BlockNumber	hole_start = 0;		/* blocks to be deallocated */
+	BlockNumber	hole_end = 0;
+	int			i;
+
+	in = pgut_newarray(FILE *, nbackups);
+
+	for (i = 0; i < nbackups; i++)
+	{
+		pgFile	   *file = files[i];
+		BackupPageHeader header;
+		BlockMapHeader map;
+		BlockMapEntry *map_entries;
+		uint32		map_pos;
+		BlockNumber	truncate_from = 0;
+		bool		need_truncate = false;
+		bool		allow_truncate;
+
+		in[i] = NULL;
+		if (file == NULL)
+			continue;
+
+		allow_truncate = backups[i]->backup_mode == BACKUP_MODE_DIFF_DELTA;
+
+		/* For PAGE and PTRACK backups unchanged data file is not restored */
+		if (file->write_size == BYTES_INVALID &&
+			(backups[i]->backup_mode == BACKUP_MODE_DIFF_PAGE ||
+			 backups[i]->backup_mode == BACKUP_MODE_DIFF_PTRACK))
+			continue;
+
+		mode = file->mode;
+
+		if (file->write_size != BYTES_INVALID)
+		{
+			in[i] = fopen(file->path, PG_BINARY_R);
+			if (in[i] == NULL)
+				elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
+					 strerror(errno));
+		}
+
+		map_entries = in[i] ? read_block_map(file, &map) : NULL;
+		map_pos = 0;
+
+		blknum = 0;
+		while (in[i] != NULL)
+		{
+			off_t		offset;
+
+			if (file->n_blocks != BLOCKNUM_INVALID &&
+				(blknum + 1) > file->n_blocks)
+			{
+				truncate_from = blknum;
+				need_truncate = true;
+				break;
+			}
+
+			if (!next_backup_page_header(in[i], file, &map, map_entries,
+										 &map_pos, &header, &offset))
+				break;
+
+			if (header.block < blknum)
+				elog(ERROR, "Backup is broken at block %u of \"%s\"",
+					 blknum, file->path);
+
+			blknum = header.block;
+
+			if (header.compressed_size == PageIsTruncated)
+			{
+				truncate_from = blknum;
+				need_truncate = true;
+				break;
+			}
+
+			if ((header.compressed_size <= 0 &&
+				 header.compressed_size != PageIsZeroed) ||
+				header.compressed_size > BLCKSZ)
+				elog(ERROR, "Invalid size %d of block %u of \"%s\"",
+					 header.compressed_size, blknum, file->path);
+
+			if (blknum >= allocated)
+			{
+				BlockNumber	new_allocated = Max(Max(allocated * 2, 1024),
+												blknum + 1);
+
+				blocks = pgut_realloc(blocks,
+									  new_allocated * sizeof(DataBlockSource));
+				allocated = new_allocated;
+			}
+			for (; nblocks <= blknum; nblocks++)
+				blocks[nblocks].backup = -1;
+
+			blocks[blknum].backup = i;
+			blocks[blknum].compressed_size = header.compressed_size;
+			blocks[blknum].offset = offset;
+		}
+		pg_free(map_entries);
+
+		/* See comment about DELTA backups in restore_data_file() */
+		if (allow_truncate && file->n_blocks != BLOCKNUM_INVALID &&
+			!need_truncate && nblocks > file->n_blocks)
+		{
+			truncate_from = file->n_blocks;
+			need_truncate = true;
+		}
+
+		if (need_truncate)
+		{
+			BlockNumber	n;
+
+			/* truncation may extend the file with zeroes as well */
+			if (truncate_from > allocated)
+			{
+				blocks = pgut_realloc(blocks,
+									  truncate_from * sizeof(DataBlockSource));
+				allocated = truncate_from;
+			}
+			for (n = nblocks; n < truncate_from; n++)
+				blocks[n].backup = -1;
+			nblocks = truncate_from;
+		}
+	}
+
+	if (incremental && nblocks > 0)
+	{
+		dest_crcs = pgut_newarray(pg_crc32, nblocks);
+		dest_nblocks = fio_get_block_crcs(to_path, 0, nblocks, dest_crcs,
+										  FIO_DB_HOST);
+		if (dest_nblocks < 0)
+		{
+			if (errno != ENOENT)
+				elog(ERROR, "Cannot read restore target file \"%s\": %s",
+					 to_path, strerror(errno));
+			dest_nblocks = 0;
+		}
+	}
+
+	out = fio_fopen(to_path, incremental ? PG_BINARY_R "+" : PG_BINARY_W,
+					FIO_DB_HOST);
+	if (out == NULL)
+		elog(ERROR, "Cannot open restore target file \"%s\": %s",
+			 to_path, strerror(errno));
+
+	for (blknum = 0; blknum < nblocks; blknum++)
+	{
+		DataBlockSource *src = &blocks[blknum];
+		pgFile	   *file;
+		DataPage	compressed_page; /* used as read buffer */
+		DataPage	page;
+		char	   *data = compressed_page.data;
+		bool		zeroed;
+
+		zeroed = src->backup < 0 || src->compressed_size == PageIsZeroed;
+		if (!zeroed)
+		{
+			file = files[src->backup];
+
+			if (fseek(in[src->backup], src->offset, SEEK_SET) != 0 ||
+				fread(compressed_page.data, 1, MAXALIGN(src->compressed_size),
+					  in[src->backup]) != MAXALIGN(src->compressed_size))
+				elog(ERROR, "Cannot read block %u of \"%s\"",
+					 blknum, file->path);
+
+			/* See comment in restore_data_file() */
+			if (src->compressed_size != BLCKSZ
+				|| page_may_be_compressed(compressed_page.data, file->compress_alg,
+										  parse_program_version(backups[src->backup]->program_version)))
+			{
+				const char *errormsg = NULL;
+				int32		uncompressed_size;
+
+				uncompressed_size = do_decompress(page.data, BLCKSZ,
+												  compressed_page.data,
+												  src->compressed_size,
+												  file->compress_alg, &errormsg);
+				if (uncompressed_size < 0 && errormsg != NULL)
+					elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
+						 blknum, file->path, errormsg);
+
+				if (uncompressed_size != BLCKSZ)
+					elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
+						 file->path, uncompressed_size);
+				data = page.data;
+			}
+			zeroed = page_is_zeroed(data);
+		}
+
+		/*
+		 * Zeroed blocks are not written, so the file gets holes instead of
+		 * them. Existing blocks of the file are deallocated.
 		 */
-		if (uncompressed_size == BLCKSZ)
+		if (zeroed)
 		{
-			if (fio_fwrite(out, page.data, BLCKSZ) != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno));
+			if (blknum >= dest_nblocks || dest_crcs[blknum] == zero_page_crc())
+				continue;
+
+			if (hole_end != blknum)
+			{
+				punch_hole(out, to_path, hole_start, hole_end, &write_pos);
+				hole_start = blknum;
+			}
+			hole_end = blknum + 1;
+			nwritten++;
+			continue;
 		}
-		else
+
+		/* skip the block if the destination already has it */
+		if (blknum < dest_nblocks)
 		{
-			if (fio_fwrite(out, compressed_page.data, BLCKSZ) != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno));
+			pg_crc32	crc;
+
+			INIT_FILE_CRC32(true, crc);
+			COMP_FILE_CRC32(true, crc, data, BLCKSZ);
+			FIN_FILE_CRC32(true, crc);
+			if (crc == dest_crcs[blknum])
+				continue;
+		}
+
+		/* blocks are written in order, seek only over holes */
+		if (write_pos != blknum * BLCKSZ)
+		{
+			write_pos = blknum * BLCKSZ;
+			if (fio_fseek(out, write_pos) < 0)
+				elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+					 blknum, to_path, strerror(errno));
 		}
+
+		if (fio_fwrite(out, data, BLCKSZ) != BLCKSZ)
+			elog(ERROR, "Cannot write block %u of \"%s\": %s",
+				 blknum, to_path, strerror(errno));
+		advise_written_pages(out, blknum);
+		throttle_pages(files[0], out, nwritten);
+		write_pos += BLCKSZ;
+		nwritten++;
 	}
+	punch_hole(out, to_path, hole_start, hole_end, &write_pos);
 
-	/*
-	 * DELTA backup have no knowledge about truncated blocks as PAGE or PTRACK do
-	 * But during DELTA backup we read every file in PGDATA and thus DELTA backup
-	 * knows exact size of every file at the time of backup.
-	 * So when restoring file from DELTA backup we, knowning it`s size at
-	 * a time of a backup, can truncate file to this size.
-	 */
-	if (allow_truncate && file->n_blocks != BLOCKNUM_INVALID && !need_truncate)
+	/* zeroed or truncated tail of the file */
+	if ((incremental || write_pos != nblocks * BLCKSZ) &&
+		fio_ftruncate(out, nblocks * BLCKSZ) != 0)
+		elog(ERROR, "Cannot truncate \"%s\": %s", to_path, strerror(errno));
+
+	if (incremental)
+		elog(VERBOSE, "Rewritten %u of %u blocks of \"%s\"",
+			 nwritten, nblocks, to_path);
+
+	/* update file permission */
+	if (fio_chmod(to_path, mode, FIO_DB_HOST) == -1)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
+			 strerror(errno));
+
+	if (fio_fflush(out) != 0)
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+	if (drop_cache)
+		fio_cache_advise(out, 0, 0, FIO_ADVISE_DONTNEED);
+	if (fio_fclose(out))
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+
+	for (i = 0; i < nbackups; i++)
+		if (in[i])
+			fclose(in[i]);
+	pg_free(in);
+	pg_free(blocks);
+	pg_free(dest_crcs);
+}
+
+/*
+ * File systems of local files copied out of the backup catalog by copy_file().
+ * Instead of fsync of every copied file, which is slow for many small files,
+ * each file system is synced once by sync_copied_files() when all files are
+ * copied.
+ */
+#define SYNC_DEVICES_MAX	16
+
+typedef struct SyncDevice
+{
+	dev_t		dev;
+	int			fd;			/* descriptor of a file at the device */
+} SyncDevice;
+
+static SyncDevice sync_devices[SYNC_DEVICES_MAX];
+static int	n_sync_devices = 0;
+static pthread_mutex_t sync_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Leave sync of the local file "fd" to sync_copied_files(). Returns false if
+ * it is not possible and the file must be synced now.
+ */
+static bool
+defer_file_sync(int fd)
+{
+#ifdef __linux__
+	struct stat	st;
+	bool		found = false;
+	int			i;
+
+	if (fstat(fd, &st) != 0)
+		return false;
+
+	pthread_lock(&sync_devices_lock);
+	for (i = 0; i < n_sync_devices && !found; i++)
+		found = sync_devices[i].dev == st.st_dev;
+	if (!found && n_sync_devices < SYNC_DEVICES_MAX)
 	{
-		struct stat st;
-		if (fio_ffstat(out, &st) == 0 && st.st_size > file->n_blocks * BLCKSZ)
+		int			dev_fd = dup(fd);
+
+		if (dev_fd >= 0)
 		{
-			truncate_from = file->n_blocks;
-			need_truncate = true;
+			sync_devices[n_sync_devices].dev = st.st_dev;
+			sync_devices[n_sync_devices].fd = dev_fd;
+			n_sync_devices++;
+			found = true;
 		}
 	}
+	pthread_mutex_unlock(&sync_devices_lock);
 
-	if (need_truncate)
+	return found;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Sync file systems of the files copied by copy_file(). Must be called after
+ * worker threads have exited.
+ */
+void
+sync_copied_files(void)
+{
+#ifdef __linux__
+	int64		fsync_start = progress_clock();
+	int			i;
+
+	for (i = 0; i < n_sync_devices; i++)
 	{
-		off_t		write_pos;
+		if (syncfs(sync_devices[i].fd) != 0)
+			elog(ERROR, "Cannot sync copied files: %s", strerror(errno));
+		close(sync_devices[i].fd);
+	}
+	n_sync_devices = 0;
+	progress_add_time(PROGRESS_FSYNC_TIME, fsync_start);
+#endif
+}
 
-		write_pos = (write_header) ? truncate_from * (BLCKSZ + sizeof(header)) :
-									 truncate_from * BLCKSZ;
+/*
+ * Copy local file without passing its contents through user space: clone it
+ * if the file system can share extents (FICLONE on XFS and btrfs), or else
+ * let the kernel copy it with copy_file_range() or sendfile().
+ * Returns false if none of them is possible, the destination file may be
+ * created already in this case.
+ */
+static bool
+copy_file_in_kernel(const char *from_path, const char *to_path, size_t *size)
+{
+#ifdef __linux__
+	int			in;
+	int			out;
+	struct stat	st;
+	off_t		copied = 0;
+	bool		done = false;
+
+	in = open(from_path, O_RDONLY | PG_BINARY, 0);
+	if (in < 0)
+		return false;
+	if (fstat(in, &st) != 0)
+	{
+		close(in);
+		return false;
+	}
+	out = open(to_path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY, FILE_PERMISSION);
+	if (out < 0)
+	{
+		close(in);
+		return false;
+	}
 
-		/*
-		 * Truncate file to this length.
-		 */
-		if (fio_ftruncate(out, write_pos) != 0)
-			elog(ERROR, "Cannot truncate \"%s\": %s",
-				 file->path, strerror(errno));
-		elog(VERBOSE, "Delta truncate file %s to block %u",
-			 file->path, truncate_from);
+#ifdef FICLONE
+	done = ioctl(out, FICLONE, in) == 0;
+#endif
+
+#ifdef SYS_copy_file_range
+	while (!done)
+	{
+		ssize_t		rc = syscall(SYS_copy_file_range, in, NULL, out, NULL,
+								 st.st_size - copied, 0);
+
+		if (rc <= 0)
+			break;
+		copied += rc;
+		done = copied >= st.st_size;
 	}
+#endif
 
-	/* update file permission */
-	if (fio_chmod(to_path, file->mode, FIO_DB_HOST) == -1)
+	while (!done)
 	{
-		int errno_tmp = errno;
+		ssize_t		rc = sendfile(out, in, NULL, st.st_size - copied);
 
-		if (in)
-			fclose(in);
-		fio_fclose(out);
-		elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
-			 strerror(errno_tmp));
+		if (rc <= 0)
+			break;
+		copied += rc;
+		done = copied >= st.st_size;
 	}
 
-	if (fio_fflush(out) != 0 ||
-		fio_fclose(out))
-		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+	/* empty file needs nothing to copy */
+	if (st.st_size == 0)
+		done = true;
 
-	if (in)
-		fclose(in);
+	/* Synced the same way as files copied through the buffer */
+	if (done && !defer_file_sync(out))
+	{
+		int64		fsync_start = progress_clock();
+
+		if (fsync(out) != 0)
+			done = false;
+		progress_add_time(PROGRESS_FSYNC_TIME, fsync_start);
+	}
+
+	close(in);
+	if (close(out) != 0)
+		done = false;
+
+	*size = st.st_size;
+	return done;
+#else
+	return false;
+#endif
 }
 
 /*
  * Copy file to backup.
  * We do not apply compression to these files, because
  * it is either small control file or already compressed cfs file.
+ *
+ * If both files are local and the source file is in the backup catalog, the
+ * file is copied by the kernel and CRC is taken from the file list instead of
+ * being calculated.
  */
 bool
 copy_file(fio_location from_location, const char *to_root,
@@ -960,6 +3045,28 @@ copy_file(fio_location from_location, const char *to_root,
 	file->read_size = 0;
 	file->write_size = 0;
 
+	join_path_components(to_path, to_root, file->rel_path);
+
+	/* Copy in kernel can't be throttled, so it's not used with --max-rate */
+	if (from_location != FIO_DB_HOST &&
+		!(max_rate && to_location == FIO_DB_HOST) &&
+		!fio_is_remote(from_location) && !fio_is_remote(to_location))
+	{
+		size_t		size;
+
+		if (copy_file_in_kernel(file->path, to_path, &size))
+		{
+			if (chmod(to_path, file->mode) == -1)
+				elog(ERROR, "cannot change mode of \"%s\": %s", to_path,
+					 strerror(errno));
+			file->read_size = size;
+			file->write_size = (int64) size;
+			progress_add(PROGRESS_READ_BYTES, file->read_size);
+			progress_add(PROGRESS_WRITTEN_BYTES, file->write_size);
+			return true;
+		}
+	}
+
 	/* open backup mode file for read */
 	in = fio_fopen(file->path, PG_BINARY_R, from_location);
 	if (in == NULL)
@@ -985,7 +3092,6 @@ copy_file(fio_location from_location, const char *to_root,
 	}
 
 	/* open backup file for write  */
-	join_path_components(to_path, to_root, file->rel_path);
 	out = fio_fopen(to_path, PG_BINARY_W, to_location);
 	if (out == NULL)
 	{
@@ -995,6 +3101,9 @@ copy_file(fio_location from_location, const char *to_root,
 			 to_path, strerror(errno_tmp));
 	}
 
+	if (drop_cache && from_location == FIO_DB_HOST)
+		fio_cache_advise(in, 0, 0, FIO_ADVISE_SEQUENTIAL);
+
 	/* copy content and calc CRC */
 	for (;;)
 	{
@@ -1003,6 +3112,12 @@ copy_file(fio_location from_location, const char *to_root,
 		if ((read_len = fio_fread(in, buf, sizeof(buf))) != sizeof(buf))
 			break;
 
+		if (from_location == FIO_DB_HOST)
+		{
+			advise_read_pages(in, file->read_size / BLCKSZ);
+			throttle_pages(file, in, file->read_size / BLCKSZ);
+		}
+
 		if (fio_fwrite(out, buf, read_len) != read_len)
 		{
 			errno_tmp = errno;
@@ -1016,6 +3131,13 @@ copy_file(fio_location from_location, const char *to_root,
 		COMP_FILE_CRC32(true, crc, buf, read_len);
 
 		file->read_size += read_len;
+
+		/* Range of early writeback ends with the block just written */
+		if (to_location == FIO_DB_HOST)
+		{
+			advise_written_pages(out, file->read_size / BLCKSZ - 1);
+			throttle_pages(file, out, file->read_size / BLCKSZ - 1);
+		}
 	}
 
 	errno_tmp = errno;
@@ -1049,6 +3171,8 @@ copy_file(fio_location from_location, const char *to_root,
 	/* finish CRC calculation and store into pgFile */
 	FIN_FILE_CRC32(true, crc);
 	file->crc = crc;
+	progress_add(PROGRESS_READ_BYTES, file->read_size);
+	progress_add(PROGRESS_WRITTEN_BYTES, file->write_size);
 
 	/* update file permission */
 	if (fio_chmod(to_path, file->mode, to_location) == -1)
@@ -1060,14 +3184,254 @@ copy_file(fio_location from_location, const char *to_root,
 			 strerror(errno_tmp));
 	}
 
-	if (fio_fflush(out) != 0 ||
-		fio_fclose(out))
+	/* Files copied out of the catalog are synced by sync_copied_files() */
+	if (from_location != FIO_DB_HOST && !fio_is_remote(to_location))
+	{
+		if (fflush(out) != 0)
+			elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+		if (!defer_file_sync(fileno(out)) && fio_fflush(out) != 0)
+			elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+	}
+	else if (fio_fflush(out) != 0)
 		elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+	if (drop_cache && to_location == FIO_DB_HOST)
+		fio_cache_advise(out, 0, 0, FIO_ADVISE_DONTNEED);
+	if (fio_fclose(out))
+		elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+	if (drop_cache && from_location == FIO_DB_HOST)
+		fio_cache_advise(in, 0, 0, FIO_ADVISE_DONTNEED);
 	fio_fclose(in);
 
 	return true;
 }
 
+#ifdef HAVE_LIBZ
+/*
+ * Restore WAL segment compressed during streaming. The segment is written
+ * under its rel_path without ".gz" suffix, since server can't read compressed
+ * WAL from its own directory.
+ */
+void
+restore_compressed_wal_file(const char *to_root, fio_location to_location,
+							pgFile *file)
+{
+	char		to_path[MAXPGPATH];
+	char		buf[BLCKSZ];
+	gzFile		gz_in;
+	FILE	   *out;
+	int			read_len;
+	int			errnum;
+
+	join_path_components(to_path, to_root, file->rel_path);
+	/* cut ".gz" suffix */
+	to_path[strlen(to_path) - 3] = '\0';
+
+	gz_in = fio_gzopen(file->path, PG_BINARY_R, Z_DEFAULT_COMPRESSION,
+					   FIO_BACKUP_HOST);
+	if (gz_in == NULL)
+		elog(ERROR, "cannot open compressed WAL segment \"%s\": %s",
+			 file->path, strerror(errno));
+
+	out = fio_fopen(to_path, PG_BINARY_W, to_location);
+	if (out == NULL)
+		elog(ERROR, "cannot open destination file \"%s\": %s",
+			 to_path, strerror(errno));
+
+	file->read_size = 0;
+	file->write_size = 0;
+
+	while ((read_len = fio_gzread(gz_in, buf, sizeof(buf))) > 0)
+	{
+		if (fio_fwrite(out, buf, read_len) != read_len)
+			elog(ERROR, "cannot write to \"%s\": %s", to_path,
+				 strerror(errno));
+		file->write_size += read_len;
+
+		if (to_location == FIO_DB_HOST && file->write_size >= BLCKSZ)
+		{
+			advise_written_pages(out, file->write_size / BLCKSZ - 1);
+			throttle_pages(file, out, file->write_size / BLCKSZ - 1);
+		}
+	}
+	if (read_len < 0)
+		elog(ERROR, "cannot read compressed WAL segment \"%s\": %s",
+			 file->path, fio_gzerror(gz_in, &errnum));
+	fio_gzclose(gz_in);
+
+	if (fio_chmod(to_path, file->mode, to_location) == -1)
+		elog(ERROR, "cannot change mode of \"%s\": %s", to_path,
+			 strerror(errno));
+
+	if (fio_fflush(out) != 0)
+		elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+	if (drop_cache && to_location == FIO_DB_HOST)
+		fio_cache_advise(out, 0, 0, FIO_ADVISE_DONTNEED);
+	if (fio_fclose(out))
+		elog(ERROR, "cannot write \"%s\": %s", to_path, strerror(errno));
+}
+#endif
+
+#define DEDUP_BUFFER_SIZE	(64 * 1024)
+
+/* Compare contents of two local files, false if either can't be read */
+static bool
+files_are_equal(const char *path1, const char *path2)
+{
+	FILE	   *f1;
+	FILE	   *f2;
+	char	   *buf1 = pgut_malloc(DEDUP_BUFFER_SIZE);
+	char	   *buf2 = pgut_malloc(DEDUP_BUFFER_SIZE);
+	bool		equal = false;
+
+	f1 = fopen(path1, PG_BINARY_R);
+	f2 = fopen(path2, PG_BINARY_R);
+
+	while (f1 && f2)
+	{
+		size_t		len1 = fread(buf1, 1, DEDUP_BUFFER_SIZE, f1);
+		size_t		len2 = fread(buf2, 1, DEDUP_BUFFER_SIZE, f2);
+
+		if (len1 != len2 || memcmp(buf1, buf2, len1) != 0 ||
+			ferror(f1) || ferror(f2))
+			break;
+		if (len1 == 0)
+		{
+			equal = true;
+			break;
+		}
+	}
+
+	if (f1)
+		fclose(f1);
+	if (f2)
+		fclose(f2);
+	pg_free(buf1);
+	pg_free(buf2);
+	return equal;
+}
+
+/*
+ * Deduplicate backed up data file "path" against the instance page store.
+ *
+ * Files of the store are named by CRC and size of their contents, a file
+ * with the same name is compared byte by byte. If the same contents are
+ * already stored, the file in backup is replaced by a hard link to it,
+ * otherwise the file itself is linked into the store. So backup files are
+ * never copied into the store, and entries which are not linked by any
+ * backup are removed by delete_backup_files().
+ */
+void
+dedup_backup_file(const char *path, pgFile *file)
+{
+	char		dir[MAXPGPATH];
+	char		bucket[MAXPGPATH];
+	char		store_path[MAXPGPATH];
+	char		tmp_path[MAXPGPATH];
+	int			n;
+
+	if (file->write_size < DEDUP_MIN_SIZE)
+		return;
+
+	join_path_components(dir, backup_instance_path, DEDUP_DIR);
+	snprintf(bucket, MAXPGPATH, "%s/%02X", dir, file->crc >> 24);
+	dir_create_dir(bucket, DIR_PERMISSION);
+
+	for (n = 0;;)
+	{
+		snprintf(store_path, MAXPGPATH, "%s/%08X-" INT64_FORMAT "-%d",
+				 bucket, file->crc, file->write_size, n);
+
+		/* new contents, the backup file is the stored copy now */
+		if (link(path, store_path) == 0)
+			return;
+
+		if (errno != EEXIST)
+		{
+			elog(WARNING, "Cannot link file \"%s\" to \"%s\": %s",
+				 path, store_path, strerror(errno));
+			return;
+		}
+
+		/* different contents with the same CRC, try the next name */
+		if (!files_are_equal(path, store_path))
+		{
+			n++;
+			continue;
+		}
+
+		snprintf(tmp_path, MAXPGPATH, "%s_dedup", path);
+		if (link(store_path, tmp_path) != 0)
+		{
+			/* the entry has been garbage collected meanwhile, retry */
+			if (errno == ENOENT)
+				continue;
+			elog(ERROR, "Cannot link file \"%s\" to \"%s\": %s",
+				 store_path, tmp_path, strerror(errno));
+		}
+		if (rename(tmp_path, path) != 0)
+			elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+				 tmp_path, path, strerror(errno));
+
+		elog(VERBOSE, "File \"%s\" is linked to \"%s\"", path, store_path);
+		return;
+	}
+}
+
+/*
+ * Make a private copy of the backup file, if it is shared with other backups
+ * through the page store. Must be called before the file is modified in place.
+ */
+void
+unshare_backup_file(const char *path)
+{
+	char		tmp_path[MAXPGPATH];
+	char	   *buf;
+	FILE	   *in;
+	FILE	   *out;
+	size_t		len;
+	struct stat	st;
+
+	if (stat(path, &st) != 0)
+	{
+		if (errno == ENOENT)
+			return;
+		elog(ERROR, "Cannot stat file \"%s\": %s", path, strerror(errno));
+	}
+
+	if (st.st_nlink <= 1)
+		return;
+
+	snprintf(tmp_path, MAXPGPATH, "%s_unshare", path);
+
+	in = fopen(path, PG_BINARY_R);
+	if (in == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", path, strerror(errno));
+	out = fopen(tmp_path, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", tmp_path, strerror(errno));
+
+	buf = pgut_malloc(DEDUP_BUFFER_SIZE);
+	while ((len = fread(buf, 1, DEDUP_BUFFER_SIZE, in)) > 0)
+	{
+		if (fwrite(buf, 1, len, out) != len)
+			elog(ERROR, "Cannot write file \"%s\": %s", tmp_path,
+				 strerror(errno));
+	}
+	if (ferror(in))
+		elog(ERROR, "Cannot read file \"%s\": %s", path, strerror(errno));
+	pg_free(buf);
+
+	fclose(in);
+	if (fflush(out) != 0 || fclose(out) != 0)
+		elog(ERROR, "Cannot write file \"%s\": %s", tmp_path, strerror(errno));
+	if (chmod(tmp_path, st.st_mode & ~S_IFMT) != 0)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", tmp_path,
+			 strerror(errno));
+	if (rename(tmp_path, path) != 0)
+		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+			 tmp_path, path, strerror(errno));
+}
+
 /*
  * Validate given page.
  *
@@ -1098,12 +3462,8 @@ validate_one_page(Page page, pgFile *file,
 
 	if (PageIsNew(page))
 	{
-		int			i;
-
 		/* Check if the page is zeroed. */
-		for(i = 0; i < BLCKSZ && page[i] == 0; i++);
-
-		if (i == BLCKSZ)
+		if (page_is_zeroed(page))
 		{
 			elog(LOG, "File: %s blknum %u, page is New, empty zeroed page",
 				 file->path, blknum);
@@ -1223,7 +3583,7 @@ check_data_file(ConnectionArgs *arguments,
 
 	for (blknum = 0; blknum < nblocks; blknum++)
 	{
-		page_state = prepare_page(arguments, file, InvalidXLogRecPtr,
+		page_state = prepare_page(arguments, NULL, file, InvalidXLogRecPtr,
 									blknum, nblocks, in, &n_blocks_skipped,
 									BACKUP_MODE_FULL, curr_page, false, checksum_version);
 
@@ -1338,6 +3698,10 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 			continue;
 		}
 
+		/* zeroed page is stored as header only */
+		if (header.compressed_size == PageIsZeroed)
+			continue;
+
 		Assert(header.compressed_size <= BLCKSZ);
 
 		read_len = fread(compressed_page.data, 1,
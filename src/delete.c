@@ -14,13 +14,67 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "utils/thread.h"
+
+/*
+ * Queue of removal tasks shared by unlink workers.
+ *
+ * Trees are not listed in advance: a worker reads a directory and hands out
+ * its entries to idle workers in batches, subdirectories are found by failed
+ * unlink() and queued to be read in their turn.  The directories themselves
+ * are removed after all workers are finished, deepest first.
+ */
+typedef struct
+{
+	char	   *dir;
+	char	  **names;		/* entries of dir to unlink, NULL to read dir */
+	int			nnames;
+} delete_task;
+
+typedef struct
+{
+	parray	   *tasks;		/* pending tasks */
+	parray	   *dirs;		/* directories read, removed at the end */
+	int			nworkers;
+	int			nbusy;		/* workers doing a task */
+	bool		recursive;	/* remove subdirectories */
+	bool		log_removed; /* report every removed file */
+	bool		stop;		/* failed or interrupted */
+	int64		nremoved;
+	char		error_path[MAXPGPATH];
+	int			error_errno;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} delete_queue;
+
+/* Number of directory entries handed out to a worker at once */
+#define DELETE_BATCH_SIZE	256
+
+/* Some network file systems skip entries of a directory being emptied */
+#define DELETE_MAX_PASSES	3
+
+static void delete_queue_init(delete_queue *q, bool recursive,
+							  bool log_removed);
+static void delete_queue_push(delete_queue *q, char *dir, char **names,
+							  int nnames);
+static bool delete_queue_run(delete_queue *q);
+static void delete_queue_free(delete_queue *q);
+
+static void delete_backup_list(parray *backup_list);
 static void delete_walfiles(XLogRecPtr oldest_lsn, TimeLineID oldest_tli,
 							uint32 xlog_seg_size);
 static void do_retention_internal(parray *backup_list, parray *to_keep_list,
 									parray *to_purge_list);
-static void do_retention_merge(parray *backup_list, parray *to_keep_list,
-									parray *to_purge_list);
-static void do_retention_purge(parray *to_keep_list, parray *to_purge_list);
+static void do_retention_plan_merge(parray *to_keep_list,
+									parray *to_purge_list,
+									parray *merge_chains);
+static void do_retention_plan_purge(parray *to_keep_list,
+									parray *to_purge_list,
+									parray *delete_list);
+static void do_retention_plan_wal(parray *backup_list, parray *merge_chains,
+								  parray *delete_list);
+static void do_retention_merge(parray *backup_list, parray *merge_chains);
+static void do_retention_purge(parray *delete_list);
 static void do_retention_wal(void);
 
 static bool backup_deleted = false;   /* At least one backup was deleted */
@@ -71,19 +125,13 @@ do_delete(time_t backup_id)
 	/* Lock marked for delete backups */
 	catalog_lock_backup_list(delete_list, parray_num(delete_list) - 1, 0);
 
-	/* Delete backups from the end of list */
-	for (i = (int) parray_num(delete_list) - 1; i >= 0; i--)
-	{
-		pgBackup   *backup = (pgBackup *) parray_get(delete_list, (size_t) i);
-
-		if (interrupted)
-			elog(ERROR, "interrupted during delete backup");
-
-		delete_backup_files(backup);
-	}
+	/* Delete backups at once */
+	delete_backup_list(delete_list);
 
 	parray_free(delete_list);
 
+	delete_unreferenced_dedup_files();
+
 	/* Clean WAL segments */
 	if (delete_wal)
 	{
@@ -122,9 +170,12 @@ do_delete(time_t backup_id)
  */
 int do_retention(void)
 {
+	int			i;
 	parray	   *backup_list = NULL;
 	parray	   *to_keep_list = parray_new();
 	parray	   *to_purge_list = parray_new();
+	parray	   *merge_chains = parray_new();
+	parray	   *delete_list = parray_new();
 
 	bool	retention_is_set = false; /* At least one retention policy is set */
 	bool 	backup_list_is_empty = false;
@@ -165,13 +216,33 @@ int do_retention(void)
 	if (retention_is_set && !backup_list_is_empty)
 		do_retention_internal(backup_list, to_keep_list, to_purge_list);
 
+	/*
+	 * Make up the whole plan before taking any action, so that dry run shows
+	 * what is going to be done and expired backups are deleted all at once.
+	 */
+	if (merge_expired && !backup_list_is_empty)
+		do_retention_plan_merge(to_keep_list, to_purge_list, merge_chains);
+
+	if (delete_expired && !backup_list_is_empty)
+		do_retention_plan_purge(to_keep_list, to_purge_list, delete_list);
+
+	if (delete_wal)
+		do_retention_plan_wal(backup_list, merge_chains, delete_list);
+
+	if (delete_expired || merge_expired)
+		elog(INFO, "Retention plan: merge %zu incremental chains, delete %zu backups",
+			 parray_num(merge_chains), parray_num(delete_list));
+
 	if (merge_expired && !dry_run && !backup_list_is_empty)
-		do_retention_merge(backup_list, to_keep_list, to_purge_list);
+		do_retention_merge(backup_list, merge_chains);
 
 	if (delete_expired && !dry_run && !backup_list_is_empty)
-		do_retention_purge(to_keep_list, to_purge_list);
+		do_retention_purge(delete_list);
+
+	/* Store files are released by both merged and purged backups */
+	if ((backup_merged || backup_deleted) && !dry_run)
+		delete_unreferenced_dedup_files();
 
-	/* TODO: some sort of dry run for delete_wal */
 	if (delete_wal && !dry_run)
 		do_retention_wal();
 
@@ -188,6 +259,10 @@ int do_retention(void)
 	parray_free(backup_list);
 	parray_free(to_keep_list);
 	parray_free(to_purge_list);
+	for (i = 0; i < parray_num(merge_chains); i++)
+		parray_free((parray *) parray_get(merge_chains, i));
+	parray_free(merge_chains);
+	parray_free(delete_list);
 
 	return 0;
 
@@ -358,12 +433,16 @@ do_retention_internal(parray *backup_list, parray *to_keep_list, parray *to_purg
 	}
 }
 
-/* Merge partially expired incremental chains */
+/*
+ * Plan merges of partially expired incremental chains.  Every chain is
+ * a list of backups from the final target of merge down to its FULL
+ * ancestor.  Members of the chains are removed from the purge list.
+ */
 static void
-do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_list)
+do_retention_plan_merge(parray *to_keep_list, parray *to_purge_list,
+						parray *merge_chains)
 {
 	int i;
-	int j;
 
 	/* IMPORTANT: we can merge to only those FULL backup, that is NOT
 	 * guarded by retention and final target of such merge must be
@@ -381,7 +460,6 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 	 * FULL  D
 	 */
 
-	/* Merging happens here */
 	for (i = 0; i < parray_num(to_keep_list); i++)
 	{
 		char		*keep_backup_id = NULL;
@@ -390,10 +468,6 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 
 		pgBackup	*keep_backup = (pgBackup *) parray_get(to_keep_list, i);
 
-		/* keep list may shrink during merge */
-		if (!keep_backup)
-			continue;
-
 		elog(INFO, "Consider backup %s for merge", base36enc(keep_backup->start_time));
 
 		/* Got valid incremental backup, find its FULL ancestor */
@@ -428,17 +502,17 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 
 		merge_list = parray_new();
 
-		/* Form up a merge list */
+		/*
+		 * Form up a merge list. Merged backups are not purged, even if merge
+		 * fails they are still needed by the target.
+		 */
 		while(keep_backup->parent_backup_link)
 		{
 			parray_append(merge_list, keep_backup);
+			parray_rm(to_purge_list, keep_backup, pgBackupCompareId);
 			keep_backup = keep_backup->parent_backup_link;
 		}
 
-		/* sanity */
-		if (!merge_list)
-			continue;
-
 		/* sanity */
 		if (parray_num(merge_list) == 0)
 		{
@@ -452,6 +526,24 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 		/* Remove FULL backup from purge list */
 		parray_rm(to_purge_list, full_backup, pgBackupCompareId);
 
+		parray_append(merge_chains, merge_list);
+	}
+}
+
+/* Merge partially expired incremental chains */
+static void
+do_retention_merge(parray *backup_list, parray *merge_chains)
+{
+	int i;
+	int j;
+
+	/* Merging happens here */
+	for (i = 0; i < parray_num(merge_chains); i++)
+	{
+		parray	   *merge_list = (parray *) parray_get(merge_chains, i);
+		pgBackup   *full_backup = (pgBackup *) parray_get(merge_list,
+												parray_num(merge_list) - 1);
+
 		/* Lock merge chain */
 		catalog_lock_backup_list(merge_list, parray_num(merge_list) - 1, 0);
 
@@ -488,23 +580,17 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 
 			merge_backups(full_backup, from_backup);
 			backup_merged = true;
-
-			/* Try to remove merged incremental backup from both keep and purge lists */
-			parray_rm(to_purge_list, from_backup, pgBackupCompareId);
-			parray_set(to_keep_list, i, NULL);
 		}
-
-		/* Cleanup */
-		parray_free(merge_list);
 	}
 
 	elog(INFO, "Retention merging finished");
 
 }
 
-/* Purge expired backups */
+/* Plan purge of expired backups */
 static void
-do_retention_purge(parray *to_keep_list, parray *to_purge_list)
+do_retention_plan_purge(parray *to_keep_list, parray *to_purge_list,
+						parray *delete_list)
 {
 	int i;
 	int j;
@@ -536,10 +622,6 @@ do_retention_purge(parray *to_keep_list, parray *to_purge_list)
 
 			pgBackup   *keep_backup = (pgBackup *) parray_get(to_keep_list, i);
 
-			/* item could have been nullified in merge */
-			if (!keep_backup)
-				continue;
-
 			/* Full backup cannot be a descendant */
 			if (keep_backup->backup_mode == BACKUP_MODE_FULL)
 				continue;
@@ -568,7 +650,71 @@ do_retention_purge(parray *to_keep_list, parray *to_purge_list)
 		if (!purge)
 			continue;
 
-		/* Actual purge */
+		parray_append(delete_list, delete_backup);
+	}
+}
+
+/*
+ * Report WAL segments, which are going to be purged after merges and
+ * deletions of the plan are done.
+ */
+static void
+do_retention_plan_wal(parray *backup_list, parray *merge_chains,
+					  parray *delete_list)
+{
+	pgBackup   *oldest_backup = NULL;
+	int			i;
+	int			j;
+
+	/* Find the oldest backup, which is left after the plan is done */
+	for (i = (int) parray_num(backup_list) - 1; i >= 0 && !oldest_backup; i--)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(backup_list, (size_t) i);
+		bool		merged = false;
+
+		if (parray_bsearch(delete_list, backup, pgBackupCompareIdDesc))
+			continue;
+
+		/* Merge result gets ID and start LSN of the target of merge */
+		for (j = 0; j < parray_num(merge_chains) && !merged; j++)
+		{
+			parray	   *merge_list = (parray *) parray_get(merge_chains, j);
+			int			k;
+
+			for (k = 1; k < parray_num(merge_list) && !merged; k++)
+				merged = (parray_get(merge_list, k) == backup);
+		}
+
+		if (!merged)
+			oldest_backup = backup;
+	}
+
+	if (oldest_backup)
+	{
+		XLogSegNo	segno;
+		char		segment[MAXFNAMELEN];
+
+		GetXLogSegNo(oldest_backup->start_lsn, segno,
+					 instance_config.xlog_seg_size);
+		GetXLogFileName(segment, oldest_backup->tli, segno,
+						instance_config.xlog_seg_size);
+		elog(INFO, "Retention plan: remove WAL segments older than %s", segment);
+	}
+	else
+		elog(INFO, "Retention plan: remove all WAL segments");
+}
+
+/* Purge expired backups */
+static void
+do_retention_purge(parray *delete_list)
+{
+	parray	   *locked_list = parray_new();
+	int			i;
+
+	for (i = 0; i < parray_num(delete_list); i++)
+	{
+		pgBackup   *delete_backup = (pgBackup *) parray_get(delete_list, i);
+
 		if (!lock_backup(delete_backup))
 		{
 			/* If the backup still is used, do not interrupt and go to the next */
@@ -577,11 +723,17 @@ do_retention_purge(parray *to_keep_list, parray *to_purge_list)
 			continue;
 		}
 
-		/* Delete backup and update status to DELETED */
-		delete_backup_files(delete_backup);
-		backup_deleted = true;
+		parray_append(locked_list, delete_backup);
+	}
 
+	/* Delete backups and update their status to DELETED */
+	if (parray_num(locked_list) > 0)
+	{
+		delete_backup_list(locked_list);
+		backup_deleted = true;
 	}
+
+	parray_free(locked_list);
 }
 
 /* Purge WAL */
@@ -630,60 +782,486 @@ do_retention_wal(void)
 void
 delete_backup_files(pgBackup *backup)
 {
-	size_t		i;
-	char		path[MAXPGPATH];
-	char		timestamp[100];
-	parray	   *files;
-	size_t		num_files;
+	parray	   *backup_list = parray_new();
 
-	/*
-	 * If the backup was deleted already, there is nothing to do.
-	 */
-	if (backup->status == BACKUP_STATUS_DELETED)
+	parray_append(backup_list, backup);
+	delete_backup_list(backup_list);
+	parray_free(backup_list);
+}
+
+/*
+ * Delete backup files of the backups in the list and update their status
+ * to BACKUP_STATUS_DELETED.
+ *
+ * The backup catalog is local and backup directories contain only files
+ * made by pg_probackup, so a whole tree is removed without reading its
+ * file list.  Symbolic links are removed but not followed.
+ */
+static void
+delete_backup_list(parray *backup_list)
+{
+	delete_queue q;
+	int			i;
+
+	delete_queue_init(&q, true, false);
+
+	for (i = 0; i < parray_num(backup_list); i++)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(backup_list, i);
+		char		path[MAXPGPATH];
+		char		timestamp[100];
+
+		/*
+		 * If the backup was deleted already, there is nothing to do.
+		 */
+		if (backup->status == BACKUP_STATUS_DELETED)
+		{
+			elog(WARNING, "Backup %s already deleted",
+				 base36enc(backup->start_time));
+			continue;
+		}
+
+		time2iso(timestamp, lengthof(timestamp), backup->recovery_time);
+
+		elog(INFO, "Delete: %s %s",
+			 base36enc(backup->start_time), timestamp);
+
+		/*
+		 * Update STATUS to BACKUP_STATUS_DELETING in preparation for the case which
+		 * the error occurs before deleting all backup files.
+		 */
+		write_backup_status(backup, BACKUP_STATUS_DELETING);
+
+		pgBackupGetPath(backup, path, lengthof(path), NULL);
+		delete_queue_push(&q, pgut_strdup(path), NULL, 0);
+	}
+
+	if (!delete_queue_run(&q))
+	{
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "interrupted during delete backup");
+		elog(ERROR, "cannot remove \"%s\": %s", q.error_path,
+			 strerror(q.error_errno));
+	}
+
+	elog(VERBOSE, INT64_FORMAT " files are removed", q.nremoved);
+	delete_queue_free(&q);
+
+	for (i = 0; i < parray_num(backup_list); i++)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(backup_list, i);
+
+		backup->status = BACKUP_STATUS_DELETED;
+	}
+}
+
+/*
+ * Initialize empty queue.  If "recursive" is false, directories are not
+ * removed, only files.
+ */
+static void
+delete_queue_init(delete_queue *q, bool recursive, bool log_removed)
+{
+	int			rc;
+
+	MemSet(q, 0, sizeof(delete_queue));
+	q->tasks = parray_new();
+	q->dirs = parray_new();
+	q->recursive = recursive;
+	q->log_removed = log_removed;
+
+	rc = pthread_mutex_init(&q->lock, NULL);
+	if (rc == 0)
+		rc = pthread_cond_init(&q->cond, NULL);
+	if (rc != 0)
+		elog(ERROR, "Cannot initialize mutex: %s", strerror(rc));
+}
+
+static void
+delete_queue_free(delete_queue *q)
+{
+	parray_walk(q->dirs, pfree);
+	parray_free(q->dirs);
+	parray_free(q->tasks);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+}
+
+/*
+ * Add a task to the queue.  The queue takes ownership of "dir" and "names".
+ * If "names" is NULL, the directory is to be read and removed.
+ */
+static void
+delete_queue_push(delete_queue *q, char *dir, char **names, int nnames)
+{
+	delete_task *task = pgut_new(delete_task);
+
+	task->dir = dir;
+	task->names = names;
+	task->nnames = nnames;
+
+	pthread_lock(&q->lock);
+	parray_append(q->tasks, task);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Hand out a batch of entries to an idle worker.  Returns false if all workers
+ * are busy, so the caller had better remove the entries itself.
+ */
+static bool
+delete_queue_offer(delete_queue *q, const char *dir, char **names, int nnames)
+{
+	bool		idle;
+
+	pthread_lock(&q->lock);
+	idle = q->nbusy + (int) parray_num(q->tasks) < q->nworkers;
+	pthread_mutex_unlock(&q->lock);
+
+	if (idle)
+		delete_queue_push(q, pgut_strdup(dir), names, nnames);
+	return idle;
+}
+
+/* Stop all workers on error or interrupt */
+static void
+delete_queue_stop(delete_queue *q, const char *path, int error_errno)
+{
+	pthread_lock(&q->lock);
+	if (!q->stop && path)
+	{
+		strlcpy(q->error_path, path, sizeof(q->error_path));
+		q->error_errno = error_errno;
+	}
+	q->stop = true;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* Unlink entries of the task, queue subdirectories found among them */
+static void
+delete_unlink_names(delete_queue *q, const char *dir, char **names, int nnames)
+{
+	int64		nremoved = 0;
+	int			i;
+
+	for (i = 0; i < nnames; i++)
 	{
-		elog(WARNING, "Backup %s already deleted",
-			 base36enc(backup->start_time));
+		char		path[MAXPGPATH];
+		struct stat	st;
+
+		if (interrupted || thread_interrupted)
+		{
+			delete_queue_stop(q, NULL, 0);
+			break;
+		}
+
+		join_path_components(path, dir, names[i]);
+		if (unlink(path) == 0)
+		{
+			if (q->log_removed)
+				elog(LOG, "removed file \"%s\"", path);
+			nremoved++;
+		}
+		else if (errno == ENOENT)
+			continue;
+		/* unlink() of a directory fails with EISDIR or EPERM */
+		else if (q->recursive && lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+			delete_queue_push(q, pgut_strdup(path), NULL, 0);
+		else
+		{
+			delete_queue_stop(q, path, errno);
+			break;
+		}
+	}
+
+	pthread_lock(&q->lock);
+	q->nremoved += nremoved;
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* Read the directory and remove its entries in batches */
+static void
+delete_read_dir(delete_queue *q, char *dir)
+{
+	DIR		   *d;
+	struct dirent *ent;
+	char	  **names = NULL;
+	int			nnames = 0;
+
+	d = opendir(dir);
+	if (d == NULL)
+	{
+		if (errno != ENOENT)
+			delete_queue_stop(q, dir, errno);
+		pfree(dir);
 		return;
 	}
 
-	time2iso(timestamp, lengthof(timestamp), backup->recovery_time);
+	/* the directory itself is removed after all its entries */
+	pthread_lock(&q->lock);
+	parray_append(q->dirs, dir);
+	pthread_mutex_unlock(&q->lock);
+
+	while (errno = 0, (ent = readdir(d)) != NULL)
+	{
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
 
-	elog(INFO, "Delete: %s %s",
-		 base36enc(backup->start_time), timestamp);
+		if (names == NULL)
+			names = pgut_newarray(char *, DELETE_BATCH_SIZE);
+		names[nnames++] = pgut_strdup(ent->d_name);
 
-	/*
-	 * Update STATUS to BACKUP_STATUS_DELETING in preparation for the case which
-	 * the error occurs before deleting all backup files.
-	 */
-	write_backup_status(backup, BACKUP_STATUS_DELETING);
+		if (nnames == DELETE_BATCH_SIZE)
+		{
+			if (!delete_queue_offer(q, dir, names, nnames))
+			{
+				delete_unlink_names(q, dir, names, nnames);
+				while (nnames > 0)
+					pfree(names[--nnames]);
+				pfree(names);
+			}
+			names = NULL;
+			nnames = 0;
+
+			if (q->stop)
+				break;
+		}
+	}
+	if (errno && !q->stop)
+		delete_queue_stop(q, dir, errno);
+	closedir(d);
+
+	if (nnames > 0)
+		delete_unlink_names(q, dir, names, nnames);
+	while (nnames > 0)
+		pfree(names[--nnames]);
+	pg_free(names);
+
+	if (progress)
+	{
+		int64		nremoved;
+
+		pthread_lock(&q->lock);
+		nremoved = q->nremoved;
+		pthread_mutex_unlock(&q->lock);
+
+		elog(INFO, "Progress: " INT64_FORMAT " files are removed, directory \"%s\" is read",
+			 nremoved, dir);
+	}
+}
+
+/* Unlink worker */
+static void *
+delete_worker(void *arg)
+{
+	delete_queue *q = (delete_queue *) arg;
+
+	for (;;)
+	{
+		delete_task *task = NULL;
+
+		pthread_lock(&q->lock);
+		while (parray_num(q->tasks) == 0 && q->nbusy > 0 && !q->stop)
+			pthread_cond_wait(&q->cond, &q->lock);
+		if (parray_num(q->tasks) > 0 && !q->stop)
+		{
+			/* depth first, so that the queue stays short */
+			task = (delete_task *) parray_remove(q->tasks,
+												 parray_num(q->tasks) - 1);
+			q->nbusy++;
+		}
+		else
+			pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+
+		if (task == NULL)
+			break;
+
+		if (task->names)
+		{
+			int			i;
+
+			delete_unlink_names(q, task->dir, task->names, task->nnames);
+			for (i = 0; i < task->nnames; i++)
+				pfree(task->names[i]);
+			pfree(task->names);
+			pfree(task->dir);
+		}
+		else
+			delete_read_dir(q, task->dir);
+		pfree(task);
+
+		pthread_lock(&q->lock);
+		q->nbusy--;
+		if (q->nbusy == 0 && parray_num(q->tasks) == 0)
+			pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	return NULL;
+}
+
+/* Deeper directories go first */
+static int
+delete_dir_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) b, *(char * const *) a);
+}
+
+/*
+ * Run queued tasks by num_threads workers and remove the directories which
+ * were read.  Returns false on error or interrupt.
+ */
+static bool
+delete_queue_run(delete_queue *q)
+{
+	int			pass;
+	int			i;
+
+	for (pass = 1; parray_num(q->tasks) > 0; pass++)
+	{
+		q->nworkers = Max(num_threads, 1);
+
+		if (q->nworkers > 1)
+		{
+			pthread_t  *threads = pgut_newarray(pthread_t, q->nworkers);
+
+			thread_interrupted = false;
+			for (i = 0; i < q->nworkers; i++)
+				pthread_create(&threads[i], NULL, delete_worker, q);
+			for (i = 0; i < q->nworkers; i++)
+				pthread_join(threads[i], NULL);
+			pfree(threads);
+		}
+		else
+			delete_worker(q);
+
+		if (q->stop || interrupted || thread_interrupted)
+			break;
+
+		parray_qsort(q->dirs, delete_dir_compare);
+		for (i = 0; i < parray_num(q->dirs); i++)
+		{
+			char	   *dir = (char *) parray_get(q->dirs, i);
+
+			if (!q->stop && rmdir(dir) != 0 && errno != ENOENT)
+			{
+				/* read the directory once more */
+				if ((errno == ENOTEMPTY || errno == EEXIST) &&
+					pass < DELETE_MAX_PASSES)
+				{
+					delete_queue_push(q, dir, NULL, 0);
+					continue;
+				}
+				delete_queue_stop(q, dir, errno);
+			}
+			pfree(dir);
+		}
+		parray_free(q->dirs);
+		q->dirs = parray_new();
 
-	/* list files to be deleted */
-	files = parray_new();
-	pgBackupGetPath(backup, path, lengthof(path), NULL);
-	dir_list_file(files, path, false, true, true, 0, FIO_BACKUP_HOST);
+		if (q->stop)
+			break;
+	}
 
-	/* delete leaf node first */
-	parray_qsort(files, pgFileComparePathDesc);
-	num_files = parray_num(files);
-	for (i = 0; i < num_files; i++)
+	while (parray_num(q->tasks) > 0)
 	{
-		pgFile	   *file = (pgFile *) parray_get(files, i);
+		delete_task *task = (delete_task *) parray_remove(q->tasks, 0);
+
+		if (task->names)
+		{
+			for (i = 0; i < task->nnames; i++)
+				pfree(task->names[i]);
+			pfree(task->names);
+		}
+		pfree(task->dir);
+		pfree(task);
+	}
+
+	return !(q->stop || interrupted || thread_interrupted);
+}
 
-		if (progress)
-			elog(INFO, "Progress: (%zd/%zd). Process file \"%s\"",
-				 i + 1, num_files, file->path);
+/*
+ * Garbage collect the page store of the instance. Every backup file which
+ * refers to a stored file is a hard link to it, so the file which has no
+ * other links is not used by any backup and is removed. Empty directories
+ * of the store are removed as well.
+ *
+ * The whole store is scanned, so a command calls it once after all its
+ * backups are deleted rather than after each of them.
+ */
+void
+delete_unreferenced_dedup_files(void)
+{
+	char		dedup_path[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *ent;
+	int			nremoved = 0;
+
+	join_path_components(dedup_path, backup_instance_path, DEDUP_DIR);
+
+	dir = opendir(dedup_path);
+	if (dir == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open directory \"%s\": %s", dedup_path,
+				 strerror(errno));
+		return;
+	}
+
+	while ((ent = readdir(dir)) != NULL)
+	{
+		char		bucket_path[MAXPGPATH];
+		DIR		   *bucket;
+		struct dirent *file_ent;
+
+		if (ent->d_name[0] == '.')
+			continue;
 
 		if (interrupted)
 			elog(ERROR, "interrupted during delete backup");
 
-		pgFileDelete(file);
+		join_path_components(bucket_path, dedup_path, ent->d_name);
+		bucket = opendir(bucket_path);
+		if (bucket == NULL)
+		{
+			elog(WARNING, "Cannot open directory \"%s\": %s", bucket_path,
+				 strerror(errno));
+			continue;
+		}
+
+		while ((file_ent = readdir(bucket)) != NULL)
+		{
+			char		path[MAXPGPATH];
+			struct stat	st;
+
+			if (file_ent->d_name[0] == '.')
+				continue;
+
+			join_path_components(path, bucket_path, file_ent->d_name);
+			if (stat(path, &st) != 0 || st.st_nlink > 1)
+				continue;
+
+			if (unlink(path) != 0)
+				elog(WARNING, "Cannot remove file \"%s\": %s", path,
+					 strerror(errno));
+			else
+				nremoved++;
+		}
+		closedir(bucket);
+
+		/* fails if the bucket is not empty */
+		rmdir(bucket_path);
 	}
+	closedir(dir);
 
-	parray_walk(files, pgFileFree);
-	parray_free(files);
-	backup->status = BACKUP_STATUS_DELETED;
+	rmdir(dedup_path);
 
-	return;
+	if (nremoved > 0)
+		elog(VERBOSE, "%d unreferenced files are removed from \"%s\"",
+			 nremoved, dedup_path);
 }
 
 /*
@@ -703,10 +1281,11 @@ delete_walfiles(XLogRecPtr oldest_lsn, TimeLineID oldest_tli,
 	char		oldestSegmentNeeded[MAXFNAMELEN];
 	DIR		   *arcdir;
 	struct dirent *arcde;
-	char		wal_file[MAXPGPATH];
 	char		max_wal_file[MAXPGPATH];
 	char		min_wal_file[MAXPGPATH];
-	int			rc;
+	delete_queue q;
+	char	  **names = NULL;
+	int			nnames = 0;
 
 	max_wal_file[0] = '\0';
 	min_wal_file[0] = '\0';
@@ -724,78 +1303,92 @@ delete_walfiles(XLogRecPtr oldest_lsn, TimeLineID oldest_tli,
 
 	/*
 	 * Now it is time to do the actual work and to remove all the segments
-	 * not needed anymore.
+	 * not needed anymore.  Segments are collected first and then removed in
+	 * batches by num_threads workers.
 	 */
-	if ((arcdir = opendir(arclog_path)) != NULL)
+	if ((arcdir = opendir(arclog_path)) == NULL)
+	{
+		elog(WARNING, "could not open archive location \"%s\": %s",
+			 arclog_path, strerror(errno));
+		return;
+	}
+
+	delete_queue_init(&q, false, true);
+
+	while (errno = 0, (arcde = readdir(arcdir)) != NULL)
 	{
-		while (errno = 0, (arcde = readdir(arcdir)) != NULL)
+		/*
+		 * We ignore the timeline part of the WAL segment identifiers in
+		 * deciding whether a segment is still needed.  This ensures that
+		 * we won't prematurely remove a segment from a parent timeline.
+		 * We could probably be a little more proactive about removing
+		 * segments of non-parent timelines, but that would be a whole lot
+		 * more complicated.
+		 *
+		 * We use the alphanumeric sorting property of the filenames to
+		 * decide which ones are earlier than the exclusiveCleanupFileName
+		 * file. Note that this means files are not removed in the order
+		 * they were originally written, in case this worries you.
+		 *
+		 * We also should not forget that WAL segment can be compressed.
+		 */
+		if (!IsXLogFileName(arcde->d_name) &&
+			!IsPartialXLogFileName(arcde->d_name) &&
+			!IsBackupHistoryFileName(arcde->d_name) &&
+			!IsCompressedXLogFileName(arcde->d_name) &&
+			!IsXLogSummaryFileName(arcde->d_name))
+			continue;
+
+		if (!XLogRecPtrIsInvalid(oldest_lsn) &&
+			strncmp(arcde->d_name + 8, oldestSegmentNeeded + 8, 16) >= 0)
+			continue;
+
+		if (names == NULL)
+			names = pgut_newarray(char *, DELETE_BATCH_SIZE);
+		names[nnames++] = pgut_strdup(arcde->d_name);
+		if (nnames == DELETE_BATCH_SIZE)
 		{
-			/*
-			 * We ignore the timeline part of the WAL segment identifiers in
-			 * deciding whether a segment is still needed.  This ensures that
-			 * we won't prematurely remove a segment from a parent timeline.
-			 * We could probably be a little more proactive about removing
-			 * segments of non-parent timelines, but that would be a whole lot
-			 * more complicated.
-			 *
-			 * We use the alphanumeric sorting property of the filenames to
-			 * decide which ones are earlier than the exclusiveCleanupFileName
-			 * file. Note that this means files are not removed in the order
-			 * they were originally written, in case this worries you.
-			 *
-			 * We also should not forget that WAL segment can be compressed.
-			 */
-			if (IsXLogFileName(arcde->d_name) ||
-				IsPartialXLogFileName(arcde->d_name) ||
-				IsBackupHistoryFileName(arcde->d_name) ||
-				IsCompressedXLogFileName(arcde->d_name))
-			{
-				if (XLogRecPtrIsInvalid(oldest_lsn) ||
-					strncmp(arcde->d_name + 8, oldestSegmentNeeded + 8, 16) < 0)
-				{
-					/*
-					 * Use the original file name again now, including any
-					 * extension that might have been chopped off before testing
-					 * the sequence.
-					 */
-					snprintf(wal_file, MAXPGPATH, "%s/%s",
-							 arclog_path, arcde->d_name);
-
-					rc = unlink(wal_file);
-					if (rc != 0)
-					{
-						elog(WARNING, "could not remove file \"%s\": %s",
-							 wal_file, strerror(errno));
-						break;
-					}
-					elog(LOG, "removed WAL segment \"%s\"", wal_file);
-
-					if (max_wal_file[0] == '\0' ||
-						strcmp(max_wal_file + 8, arcde->d_name + 8) < 0)
-						strcpy(max_wal_file, arcde->d_name);
-
-					if (min_wal_file[0] == '\0' ||
-						strcmp(min_wal_file + 8, arcde->d_name + 8) > 0)
-						strcpy(min_wal_file, arcde->d_name);
-				}
-			}
+			delete_queue_push(&q, pgut_strdup(arclog_path), names, nnames);
+			names = NULL;
+			nnames = 0;
 		}
 
+		if (IsXLogSummaryFileName(arcde->d_name))
+			continue;
+
+		if (max_wal_file[0] == '\0' ||
+			strcmp(max_wal_file + 8, arcde->d_name + 8) < 0)
+			strcpy(max_wal_file, arcde->d_name);
+
+		if (min_wal_file[0] == '\0' ||
+			strcmp(min_wal_file + 8, arcde->d_name + 8) > 0)
+			strcpy(min_wal_file, arcde->d_name);
+	}
+
+	if (errno)
+		elog(WARNING, "could not read archive location \"%s\": %s",
+			 arclog_path, strerror(errno));
+	if (closedir(arcdir))
+		elog(WARNING, "could not close archive location \"%s\": %s",
+			 arclog_path, strerror(errno));
+
+	if (nnames > 0)
+		delete_queue_push(&q, pgut_strdup(arclog_path), names, nnames);
+
+	if (delete_queue_run(&q))
+	{
 		if (min_wal_file[0] != '\0')
 			elog(INFO, "removed min WAL segment \"%s\"", min_wal_file);
 		if (max_wal_file[0] != '\0')
 			elog(INFO, "removed max WAL segment \"%s\"", max_wal_file);
-
-		if (errno)
-			elog(WARNING, "could not read archive location \"%s\": %s",
-				 arclog_path, strerror(errno));
-		if (closedir(arcdir))
-			elog(WARNING, "could not close archive location \"%s\": %s",
-				 arclog_path, strerror(errno));
 	}
+	else if (interrupted || thread_interrupted)
+		elog(ERROR, "interrupted during WAL purge");
 	else
-		elog(WARNING, "could not open archive location \"%s\": %s",
-			 arclog_path, strerror(errno));
+		elog(WARNING, "could not remove file \"%s\": %s",
+			 q.error_path, strerror(q.error_errno));
+
+	delete_queue_free(&q);
 }
 
 
@@ -804,7 +1397,6 @@ int
 do_delete_instance(void)
 {
 	parray	   *backup_list;
-	int i;
 	char		instance_config_path[MAXPGPATH];
 
 	/* Delete all backups. */
@@ -812,19 +1404,24 @@ do_delete_instance(void)
 
 	catalog_lock_backup_list(backup_list, 0, parray_num(backup_list) - 1);
 
-	for (i = 0; i < parray_num(backup_list); i++)
-	{
-		pgBackup   *backup = (pgBackup *) parray_get(backup_list, i);
-		delete_backup_files(backup);
-	}
+	delete_backup_list(backup_list);
 
 	/* Cleanup */
 	parray_walk(backup_list, pgBackupFree);
 	parray_free(backup_list);
 
+	/* Store files of all deleted backups, or of backups deleted by hand */
+	delete_unreferenced_dedup_files();
+
 	/* Delete all wal files. */
 	delete_walfiles(InvalidXLogRecPtr, 0, instance_config.xlog_seg_size);
 
+	/* Delete catalog summary, it is recreated after write_backup() */
+	join_path_components(instance_config_path, backup_instance_path, BACKUP_CATALOG_SUMMARY);
+	if (remove(instance_config_path) && errno != ENOENT)
+		elog(ERROR, "can't remove \"%s\": %s", instance_config_path,
+			strerror(errno));
+
 	/* Delete backup instance config file */
 	join_path_components(instance_config_path, backup_instance_path, BACKUP_CATALOG_CONF_FILE);
 	if (remove(instance_config_path))
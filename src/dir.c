@@ -19,9 +19,13 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include <dirent.h>
 
 #include "utils/configuration.h"
+#include "utils/thread.h"
 
 /*
  * The contents of these directories are removed or recreated during server
@@ -121,11 +125,16 @@ typedef struct TablespaceCreatedList
 static int BlackListCompare(const void *str1, const void *str2);
 
 static char dir_check_file(pgFile *file);
+static bool dir_list_file_entry(parray *files, pgFile *file, bool exclude,
+								parray *black_list);
+static void dir_list_file_callback(void *arg, const char *rel_path,
+								   const struct stat *st);
 static void dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
 								   bool omit_symlink, parray *black_list,
 								   int external_dir_num, fio_location location);
 static void opt_path_map(ConfigOption *opt, const char *arg,
 						 TablespaceList *list, const char *type);
+static void file_arena_release(pgFileArena *arena);
 
 /* Tablespace mapping */
 static TablespaceList tablespace_dirs = {NULL, NULL};
@@ -178,6 +187,7 @@ pgFileNew(const char *path, const char *rel_path, bool omit_symlink,
 	file = pgFileInit(path, rel_path);
 	file->size = st.st_size;
 	file->mode = st.st_mode;
+	file->mtime = st.st_mtime;
 	file->external_dir_num = external_dir_num;
 
 	return file;
@@ -192,9 +202,6 @@ pgFileInit(const char *path, const char *rel_path)
 	file = (pgFile *) pgut_malloc(sizeof(pgFile));
 	MemSet(file, 0, sizeof(pgFile));
 
-	file->forkName = pgut_malloc(MAXPGPATH);
-	file->forkName[0] = '\0';
-
 	file->path = pgut_strdup(path);
 	canonicalize_path(file->path);
 
@@ -253,54 +260,26 @@ pg_crc32
 pgFileGetCRC(const char *file_path, bool use_crc32c, bool raise_on_deleted,
 			 size_t *bytes_read, fio_location location)
 {
-	FILE	   *fp;
 	pg_crc32	crc = 0;
-	char		buf[1024];
-	size_t		len = 0;
-	size_t		total = 0;
-	int			errno_tmp;
-
-	INIT_FILE_CRC32(use_crc32c, crc);
 
-	/* open file in binary read mode */
-	fp = fio_fopen(file_path, PG_BINARY_R, location);
-	if (fp == NULL)
+	/* calc CRC of file on the host where it is located */
+	if (fio_get_crc32(file_path, use_crc32c, false, &crc, bytes_read,
+					  location) < 0)
 	{
+		if (interrupted)
+			elog(ERROR, "interrupted during CRC calculation");
+
 		if (!raise_on_deleted && errno == ENOENT)
 		{
+			INIT_FILE_CRC32(use_crc32c, crc);
 			FIN_FILE_CRC32(use_crc32c, crc);
 			return crc;
 		}
 		else
-			elog(ERROR, "cannot open file \"%s\": %s",
+			elog(ERROR, "cannot calculate CRC of file \"%s\": %s",
 				file_path, strerror(errno));
 	}
 
-	/* calc CRC of file */
-	for (;;)
-	{
-		if (interrupted)
-			elog(ERROR, "interrupted during CRC calculation");
-
-		len = fio_fread(fp, buf, sizeof(buf));
-		if(len == 0)
-			break;
-		/* update CRC */
-		COMP_FILE_CRC32(use_crc32c, crc, buf, len);
-		total += len;
-	}
-
-	if (bytes_read)
-		*bytes_read = total;
-
-	errno_tmp = errno;
-	if (len < 0)
-		elog(WARNING, "cannot read \"%s\": %s", file_path,
-			strerror(errno_tmp));
-
-	FIN_FILE_CRC32(use_crc32c, crc);
-	fio_fclose(fp);
-
 	return crc;
 }
 
@@ -314,12 +293,17 @@ pgFileFree(void *file)
 
 	file_ptr = (pgFile *) file;
 
+	/* strings of the file are allocated in the arena too */
+	if (file_ptr->arena)
+	{
+		file_ptr->arena->nfiles--;
+		file_arena_release(file_ptr->arena);
+		return;
+	}
+
 	if (file_ptr->linked)
 		free(file_ptr->linked);
 
-	if (file_ptr->forkName)
-		free(file_ptr->forkName);
-
 	pfree(file_ptr->path);
 	pfree(file_ptr->rel_path);
 	pfree(file);
@@ -435,12 +419,76 @@ pgFileCompareSize(const void *f1, const void *f2)
 		return 0;
 }
 
+/*
+ * Create queue of parallel tasks to process 'files'.
+ *
+ * Files placed in the backup catalog are weighted by their written size.
+ * Otherwise files are weighted by their size and grouped by tablespace,
+ * every external directory makes a group of its own.
+ */
+ThreadTasks *
+pgFileTasksCreate(parray *files, bool in_backup)
+{
+	int			nfiles = parray_num(files);
+	int64	   *sizes = pgut_newarray(int64, nfiles + 1);
+	uint32	   *groups = NULL;
+	ThreadTasks *tasks;
+	int			i;
+
+	if (!in_backup)
+		groups = pgut_newarray(uint32, nfiles + 1);
+
+	for (i = 0; i < nfiles; i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (!S_ISREG(file->mode))
+			sizes[i] = 0;
+		else if (in_backup)
+			sizes[i] = (file->write_size > 0) ? file->write_size : 0;
+		else
+			sizes[i] = file->size;
+
+		if (groups == NULL)
+			continue;
+
+		if (file->external_dir_num)
+			groups[i] = 0x80000000 | file->external_dir_num;
+		else if (path_is_prefix_of_path(PG_TBLSPC_DIR, file->rel_path) &&
+				 strlen(file->rel_path) > strlen(PG_TBLSPC_DIR))
+			groups[i] = atooid(file->rel_path + strlen(PG_TBLSPC_DIR) + 1);
+		else
+			groups[i] = 0;
+	}
+
+	tasks = thread_tasks_create(nfiles, sizes, groups);
+
+	pg_free(sizes);
+	pg_free(groups);
+
+	return tasks;
+}
+
 static int
 BlackListCompare(const void *str1, const void *str2)
 {
 	return strcmp(*(char **) str1, *(char **) str2);
 }
 
+/* State of listing of the directory tree received from remote agent */
+typedef struct
+{
+	parray	   *files;
+	pgFile	   *root;
+	bool		exclude;
+	parray	   *black_list;
+	int			external_dir_num;
+
+	/* Entries inside of this directory (relative to root) are skipped */
+	char		skip_dir[MAXPGPATH];
+	size_t		skip_len;
+} dir_list_state;
+
 /*
  * List files, symbolic links and directories in the directory "root" and add
  * pgFile objects to "files".  We add "root" to "files" if add_root is true.
@@ -455,6 +503,7 @@ dir_list_file(parray *files, const char *root, bool exclude, bool omit_symlink,
 	pgFile	   *file;
 	parray	   *black_list = NULL;
 	char		path[MAXPGPATH];
+	dir_list_state state;
 
 	join_path_components(path, backup_instance_path, PG_BLACK_LIST);
 	/* List files with black list */
@@ -512,8 +561,18 @@ dir_list_file(parray *files, const char *root, bool exclude, bool omit_symlink,
 	if (add_root)
 		parray_append(files, file);
 
-	dir_list_file_internal(files, file, exclude, omit_symlink, black_list,
-						   external_dir_num, location);
+	/* Remote agent can send the whole tree at once */
+	state.files = files;
+	state.root = file;
+	state.exclude = exclude;
+	state.black_list = black_list;
+	state.external_dir_num = external_dir_num;
+	state.skip_len = 0;
+
+	if (!fio_list_dir(file->path, omit_symlink, dir_list_file_callback, &state,
+					  location))
+		dir_list_file_internal(files, file, exclude, omit_symlink, black_list,
+							   external_dir_num, location);
 
 	if (!add_root)
 		pgFileFree(file);
@@ -689,8 +748,8 @@ dir_check_file(pgFile *file)
 			fork_name = strstr(file->name, "_");
 			if (fork_name)
 			{
-				/* Auxiliary fork of the relfile */
-				sscanf(file->name, "%u_%s", &(file->relOid), file->forkName);
+				/* Auxiliary fork of the relfile, see FORK_NAME_SIZE */
+				sscanf(file->name, "%u_%15s", &(file->relOid), file->forkName);
 
 				/* Do not backup ptrack files */
 				if (strcmp(file->forkName, "ptrack") == 0)
@@ -724,6 +783,100 @@ dir_check_file(pgFile *file)
 	return CHECK_TRUE;
 }
 
+/*
+ * Add file found in the directory into "files" unless it is excluded.
+ * If "exclude" is true skip files from pgdata_exclude_files and do not list
+ * content of directories from pgdata_exclude_dir. Takes ownership of "file".
+ *
+ * Returns true if the file is a directory which content should be listed.
+ */
+static bool
+dir_list_file_entry(parray *files, pgFile *file, bool exclude,
+					parray *black_list)
+{
+	char		check_res;
+
+	/*
+	 * Add only files, directories and links. Skip sockets and other
+	 * unexpected file formats.
+	 */
+	if (!S_ISDIR(file->mode) && !S_ISREG(file->mode))
+	{
+		elog(WARNING, "Skip \"%s\": unexpected file format", file->path);
+		pgFileFree(file);
+		return false;
+	}
+
+	/* Skip if the directory is in black_list defined by user */
+	if (black_list && parray_bsearch(black_list, file->path,
+									 BlackListCompare))
+	{
+		elog(LOG, "Skip \"%s\": it is in the user's black list", file->path);
+		pgFileFree(file);
+		return false;
+	}
+
+	if (exclude)
+	{
+		check_res = dir_check_file(file);
+		if (check_res == CHECK_FALSE)
+		{
+			/* Skip */
+			pgFileFree(file);
+			return false;
+		}
+		else if (check_res == CHECK_EXCLUDE_FALSE)
+		{
+			/* We add the directory itself which content was excluded */
+			parray_append(files, file);
+			return false;
+		}
+	}
+
+	parray_append(files, file);
+
+	return S_ISDIR(file->mode);
+}
+
+/*
+ * Handle entry of the directory tree listed by fio_list_dir(). Entries come
+ * in depth-first order, so content of a directory which should not be listed
+ * immediately follows the directory and is skipped by prefix.
+ */
+static void
+dir_list_file_callback(void *arg, const char *rel_path, const struct stat *st)
+{
+	dir_list_state *state = (dir_list_state *) arg;
+	pgFile	   *file;
+	char		child[MAXPGPATH];
+	char		rel_child[MAXPGPATH];
+
+	if (state->skip_len > 0)
+	{
+		if (strncmp(rel_path, state->skip_dir, state->skip_len) == 0 &&
+			rel_path[state->skip_len] == '/')
+			return;
+		state->skip_len = 0;
+	}
+
+	join_path_components(child, state->root->path, rel_path);
+	join_path_components(rel_child, state->root->rel_path, rel_path);
+
+	file = pgFileInit(child, rel_child);
+	file->size = st->st_size;
+	file->mode = st->st_mode;
+	file->mtime = st->st_mtime;
+	file->external_dir_num = state->external_dir_num;
+
+	if (!dir_list_file_entry(state->files, file, state->exclude,
+							 state->black_list) &&
+		S_ISDIR(st->st_mode))
+	{
+		strlcpy(state->skip_dir, rel_path, MAXPGPATH);
+		state->skip_len = strlen(state->skip_dir);
+	}
+}
+
 /*
  * List files in parent->path directory.  If "exclude" is true do not add into
  * "files" files from pgdata_exclude_files and directories from
@@ -759,7 +912,6 @@ dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
 		pgFile	   *file;
 		char		child[MAXPGPATH];
 		char		rel_child[MAXPGPATH];
-		char		check_res;
 
 		join_path_components(child, parent->path, dent->d_name);
 		join_path_components(rel_child, parent->rel_path, dent->d_name);
@@ -777,50 +929,11 @@ dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
 			continue;
 		}
 
-		/*
-		 * Add only files, directories and links. Skip sockets and other
-		 * unexpected file formats.
-		 */
-		if (!S_ISDIR(file->mode) && !S_ISREG(file->mode))
-		{
-			elog(WARNING, "Skip \"%s\": unexpected file format", file->path);
-			pgFileFree(file);
-			continue;
-		}
-
-		/* Skip if the directory is in black_list defined by user */
-		if (black_list && parray_bsearch(black_list, file->path,
-										 BlackListCompare))
-		{
-			elog(LOG, "Skip \"%s\": it is in the user's black list", file->path);
-			pgFileFree(file);
-			continue;
-		}
-
-		if (exclude)
-		{
-			check_res = dir_check_file(file);
-			if (check_res == CHECK_FALSE)
-			{
-				/* Skip */
-				pgFileFree(file);
-				continue;
-			}
-			else if (check_res == CHECK_EXCLUDE_FALSE)
-			{
-				/* We add the directory itself which content was excluded */
-				parray_append(files, file);
-				continue;
-			}
-		}
-
-		parray_append(files, file);
-
 		/*
 		 * If the entry is a directory call dir_list_file_internal()
 		 * recursively.
 		 */
-		if (S_ISDIR(file->mode))
+		if (dir_list_file_entry(files, file, exclude, black_list))
 			dir_list_file_internal(files, file, exclude, omit_symlink,
 								   black_list, external_dir_num, location);
 	}
@@ -841,7 +954,7 @@ dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
  *
  * Copy of function get_tablespace_mapping() from pg_basebackup.c.
  */
-static const char *
+const char *
 get_tablespace_mapping(const char *dir)
 {
 	TablespaceListCell *cell;
@@ -1131,13 +1244,14 @@ read_tablespace_map(parray *files, const char *backup_dir)
 
 /*
  * Check that all tablespace mapping entries have correct linked directory
- * paths. Linked directories must be empty or do not exist.
+ * paths. Linked directories must be empty or do not exist, unless the
+ * restore is incremental.
  *
  * If tablespace-mapping option is supplied, all OLDDIR entries must have
  * entries in tablespace_map file.
  */
 void
-check_tablespace_mapping(pgBackup *backup)
+check_tablespace_mapping(pgBackup *backup, bool incremental)
 {
 	char		this_backup_path[MAXPGPATH];
 	parray	   *links;
@@ -1184,7 +1298,8 @@ check_tablespace_mapping(pgBackup *backup)
 			elog(ERROR, "tablespace directory is not an absolute path: %s\n",
 				 linked_path);
 
-		if (!dir_is_empty(linked_path, FIO_DB_HOST))
+		/* stale files are removed by incremental restore */
+		if (!incremental && !dir_is_empty(linked_path, FIO_DB_HOST))
 			elog(ERROR, "restore tablespace destination is not empty: \"%s\"",
 				 linked_path);
 	}
@@ -1194,8 +1309,13 @@ check_tablespace_mapping(pgBackup *backup)
 	parray_free(links);
 }
 
+/*
+ * Check that external directory mapping entries match external directories
+ * of the backup. The directories must be empty or do not exist, unless the
+ * restore is incremental.
+ */
 void
-check_external_dir_mapping(pgBackup *backup)
+check_external_dir_mapping(pgBackup *backup, bool incremental)
 {
 	TablespaceListCell *cell;
 	parray *external_dirs_to_restore;
@@ -1243,7 +1363,7 @@ check_external_dir_mapping(pgBackup *backup)
 	}
 
 	/* 2 - all linked directories must be empty */
-	for (i = 0; i < parray_num(external_dirs_to_restore); i++)
+	for (i = 0; i < parray_num(external_dirs_to_restore) && !incremental; i++)
 	{
 		char	    *external_dir = (char *) parray_get(external_dirs_to_restore,
 														i);
@@ -1271,234 +1391,682 @@ get_external_remap(char *current_dir)
 	return current_dir;
 }
 
-/* Parsing states for get_control_value() */
-#define CONTROL_WAIT_NAME			1
-#define CONTROL_INNAME				2
-#define CONTROL_WAIT_COLON			3
-#define CONTROL_WAIT_VALUE			4
-#define CONTROL_INVALUE				5
-#define CONTROL_WAIT_NEXT_NAME		6
+/*
+ * Memory arena for pgFile structs read from one file list and their
+ * strings. The arena is released when the last of its files is freed by
+ * pgFileFree(), so parray_walk(files, pgFileFree) turns into a single
+ * release. Files of one list must be freed by one thread.
+ */
+#define FILE_ARENA_BLOCK_SIZE	(1024 * 1024)
+
+typedef struct pgFileArenaBlock
+{
+	struct pgFileArenaBlock *next;
+	size_t		used;
+	size_t		size;
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} pgFileArenaBlock;
+
+struct pgFileArena
+{
+	pgFileArenaBlock *blocks;
+	pgFileArenaBlock *free_blocks;	/* blocks left by file_arena_reset() */
+	size_t		nfiles;			/* number of files not freed yet */
+};
+
+static pgFileArena *
+file_arena_create(void)
+{
+	pgFileArena *arena = pgut_new(pgFileArena);
+
+	arena->blocks = NULL;
+	arena->free_blocks = NULL;
+	arena->nfiles = 0;
+	return arena;
+}
+
+static void *
+file_arena_alloc(pgFileArena *arena, size_t size)
+{
+	pgFileArenaBlock *block = arena->blocks;
+	void	   *ptr;
+
+	size = MAXALIGN(size);
+	if (block == NULL || block->used + size > block->size)
+	{
+		size_t		block_size = Max(size, FILE_ARENA_BLOCK_SIZE);
+
+		/* reuse memory of the previous files if possible */
+		if (arena->free_blocks && arena->free_blocks->size >= size)
+		{
+			block = arena->free_blocks;
+			arena->free_blocks = block->next;
+		}
+		else
+		{
+			block = pgut_malloc(offsetof(pgFileArenaBlock, data) + block_size);
+			block->size = block_size;
+		}
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+static char *
+file_arena_strdup(pgFileArena *arena, const char *str)
+{
+	size_t		len = strlen(str) + 1;
+	char	   *res = file_arena_alloc(arena, len);
+
+	memcpy(res, str, len);
+	return res;
+}
+
+/* Free the arena if it has no files left */
+static void
+file_arena_release(pgFileArena *arena)
+{
+	pgFileArenaBlock *block;
+
+	if (arena->nfiles > 0)
+		return;
+
+	block = arena->blocks;
+	while (block)
+	{
+		pgFileArenaBlock *next = block->next;
+
+		pfree(block);
+		block = next;
+	}
+	block = arena->free_blocks;
+	while (block)
+	{
+		pgFileArenaBlock *next = block->next;
+
+		pfree(block);
+		block = next;
+	}
+	pfree(arena);
+}
+
+/*
+ * Forget all files of the arena and keep its memory for the next files.
+ * Files allocated in the arena must not be used anymore.
+ */
+static void
+file_arena_reset(pgFileArena *arena)
+{
+	while (arena->blocks)
+	{
+		pgFileArenaBlock *block = arena->blocks;
+
+		arena->blocks = block->next;
+		block->next = arena->free_blocks;
+		arena->free_blocks = block;
+	}
+	arena->nfiles = 0;
+}
+
+/*
+ * Create pgFile for the entry "path" of the backup content list.
+ */
+static pgFile *
+file_list_init_file(pgFileArena *arena, const char *root,
+					const char *external_prefix, const char *path,
+					int external_dir_num)
+{
+	char		filepath[MAXPGPATH];
+	pgFile	   *file;
+	char	   *file_name;
+
+	if (external_dir_num && external_prefix)
+	{
+		char temp[MAXPGPATH];
+
+		makeExternalDirPathByNum(temp, external_prefix, external_dir_num);
+		join_path_components(filepath, temp, path);
+	}
+	else if (root)
+		join_path_components(filepath, root, path);
+	else
+		strcpy(filepath, path);
+
+	file = (pgFile *) file_arena_alloc(arena, sizeof(pgFile));
+	MemSet(file, 0, sizeof(pgFile));
+	file->arena = arena;
+	arena->nfiles++;
+
+	file->path = file_arena_strdup(arena, filepath);
+	canonicalize_path(file->path);
+
+	file->rel_path = file_arena_strdup(arena, path);
+	canonicalize_path(file->rel_path);
+
+	file_name = last_dir_separator(file->path);
+	if (file_name == NULL)
+		file->name = file->path;
+	else
+		file->name = file_name + 1;
+
+	file->n_blocks = BLOCKNUM_INVALID;
+
+	return file;
+}
+
+/* Fields of the backup_content.control line */
+#define FILE_LIST_PATH				(1 << 0)
+#define FILE_LIST_SIZE				(1 << 1)
+#define FILE_LIST_MODE				(1 << 2)
+#define FILE_LIST_IS_DATAFILE		(1 << 3)
+#define FILE_LIST_CRC				(1 << 4)
+#define FILE_LIST_SEGNO				(1 << 5)
+#define FILE_LIST_N_BLOCKS			(1 << 6)
+#define FILE_LIST_MANDATORY			(FILE_LIST_PATH | FILE_LIST_SIZE | \
+									 FILE_LIST_MODE | FILE_LIST_IS_DATAFILE | \
+									 FILE_LIST_CRC)
+
+/* Values of one line of backup_content.control */
+typedef struct FileListLine
+{
+	int			found;			/* FILE_LIST_* flags of found fields */
+	char	   *path;
+	char	   *linked;
+	char	   *compress_alg;
+	int64		write_size;
+	int64		mode;		/* bit length of mode_t depends on platforms */
+	int64		is_datafile;
+	int64		is_cfs;
+	int64		external_dir_num;
+	int64		crc;
+	int64		segno;
+	int64		n_blocks;
+} FileListLine;
+
+static bool
+parse_file_list_int64(const char *value, int64 *result)
+{
+	/* Length of the value should not be greater than 31 */
+	if (strlen(value) >= 32)
+		return false;
+
+	if (!parse_int64(value, result, 0))
+	{
+		/* We assume that too big value is -1 */
+		if (errno == ERANGE)
+			*result = BYTES_INVALID;
+		else
+			return false;
+	}
+	return true;
+}
 
 /*
- * Get value from json-like line "str" of backup_content.control file.
+ * Parse json-like line "str" of backup_content.control file in one pass.
  *
  * The line has the following format:
  *   {"name1":"value1", "name2":"value2"}
  *
- * The value will be returned to "value_str" as string if it is not NULL. If it
- * is NULL the value will be returned to "value_int64" as int64.
- *
- * Returns true if the value was found in the line.
+ * The line is modified in place and string values of "res" point into it.
+ * Unknown fields are skipped.
  */
-static bool
-get_control_value(const char *str, const char *name,
-				  char *value_str, int64 *value_int64, bool is_mandatory)
+static void
+parse_file_list_line(char *str, int line_num, const char *file_txt,
+					 FileListLine *res)
 {
-	int			state = CONTROL_WAIT_NAME;
-	char	   *name_ptr = (char *) name;
-	char	   *buf = (char *) str;
-	char		buf_int64[32],	/* Buffer for "value_int64" */
-			   *buf_int64_ptr = buf_int64;
-
-	/* Set default values */
-	if (value_str)
-		*value_str = '\0';
-	else if (value_int64)
-		*value_int64 = 0;
+	char	   *buf = str;
+
+	MemSet(res, 0, sizeof(FileListLine));
+	res->compress_alg = "";
 
 	while (*buf)
 	{
-		switch (state)
+		char	   *name;
+		char	   *value;
+		int64	   *value_int64 = NULL;
+		int			flag = 0;
+
+		/* Wait for the name */
+		while (*buf && *buf != '"')
 		{
-			case CONTROL_WAIT_NAME:
-				if (*buf == '"')
-					state = CONTROL_INNAME;
-				else if (IsAlpha(*buf))
-					goto bad_format;
-				break;
-			case CONTROL_INNAME:
-				/* Found target field. Parse value. */
-				if (*buf == '"')
-					state = CONTROL_WAIT_COLON;
-				/* Check next field */
-				else if (*buf != *name_ptr)
-				{
-					name_ptr = (char *) name;
-					state = CONTROL_WAIT_NEXT_NAME;
-				}
-				else
-					name_ptr++;
-				break;
-			case CONTROL_WAIT_COLON:
-				if (*buf == ':')
-					state = CONTROL_WAIT_VALUE;
-				else if (!IsSpace(*buf))
-					goto bad_format;
-				break;
-			case CONTROL_WAIT_VALUE:
-				if (*buf == '"')
-				{
-					state = CONTROL_INVALUE;
-					buf_int64_ptr = buf_int64;
-				}
-				else if (IsAlpha(*buf))
-					goto bad_format;
-				break;
-			case CONTROL_INVALUE:
-				/* Value was parsed, exit */
-				if (*buf == '"')
-				{
-					if (value_str)
-					{
-						*value_str = '\0';
-					}
-					else if (value_int64)
-					{
-						/* Length of buf_uint64 should not be greater than 31 */
-						if (buf_int64_ptr - buf_int64 >= 32)
-							elog(ERROR, "field \"%s\" is out of range in the line %s of the file %s",
-								 name, str, DATABASE_FILE_LIST);
-
-						*buf_int64_ptr = '\0';
-						if (!parse_int64(buf_int64, value_int64, 0))
-						{
-							/* We assume that too big value is -1 */
-							if (errno == ERANGE)
-								*value_int64 = BYTES_INVALID;
-							else
-								goto bad_format;
-						}
-					}
-
-					return true;
-				}
-				else
-				{
-					if (value_str)
-					{
-						*value_str = *buf;
-						value_str++;
-					}
-					else
-					{
-						*buf_int64_ptr = *buf;
-						buf_int64_ptr++;
-					}
-				}
-				break;
-			case CONTROL_WAIT_NEXT_NAME:
-				if (*buf == ',')
-					state = CONTROL_WAIT_NAME;
-				break;
-			default:
-				/* Should not happen */
-				break;
+			if (IsAlpha(*buf))
+				goto bad_format;
+			buf++;
 		}
+		if (*buf == '\0')
+			break;
 
+		name = ++buf;
+		while (*buf && *buf != '"')
+			buf++;
+		if (*buf == '\0')
+			goto bad_format;
+		*buf++ = '\0';
+
+		/* Wait for the colon */
+		while (IsSpace(*buf))
+			buf++;
+		if (*buf != ':')
+			goto bad_format;
 		buf++;
-	}
 
-	/* There is no close quotes */
-	if (state == CONTROL_INNAME || state == CONTROL_INVALUE)
-		goto bad_format;
+		/* Wait for the value */
+		while (*buf && *buf != '"')
+		{
+			if (IsAlpha(*buf))
+				goto bad_format;
+			buf++;
+		}
+		if (*buf == '\0')
+			goto bad_format;
 
-	/* Did not find target field */
-	if (is_mandatory)
-		elog(ERROR, "field \"%s\" is not found in the line %s of the file %s",
-			 name, str, DATABASE_FILE_LIST);
-	return false;
+		value = ++buf;
+		while (*buf && *buf != '"')
+			buf++;
+		if (*buf == '\0')
+			goto bad_format;
+		*buf++ = '\0';
+
+		if (strcmp(name, "path") == 0)
+		{
+			res->path = value;
+			flag = FILE_LIST_PATH;
+		}
+		else if (strcmp(name, "size") == 0)
+		{
+			value_int64 = &res->write_size;
+			flag = FILE_LIST_SIZE;
+		}
+		else if (strcmp(name, "mode") == 0)
+		{
+			value_int64 = &res->mode;
+			flag = FILE_LIST_MODE;
+		}
+		else if (strcmp(name, "is_datafile") == 0)
+		{
+			value_int64 = &res->is_datafile;
+			flag = FILE_LIST_IS_DATAFILE;
+		}
+		else if (strcmp(name, "is_cfs") == 0)
+			value_int64 = &res->is_cfs;
+		else if (strcmp(name, "crc") == 0)
+		{
+			value_int64 = &res->crc;
+			flag = FILE_LIST_CRC;
+		}
+		else if (strcmp(name, "compress_alg") == 0)
+			res->compress_alg = value;
+		else if (strcmp(name, "external_dir_num") == 0)
+			value_int64 = &res->external_dir_num;
+		else if (strcmp(name, "segno") == 0)
+		{
+			value_int64 = &res->segno;
+			flag = FILE_LIST_SEGNO;
+		}
+		else if (strcmp(name, "linked") == 0)
+			res->linked = value;
+		else if (strcmp(name, "n_blocks") == 0)
+		{
+			value_int64 = &res->n_blocks;
+			flag = FILE_LIST_N_BLOCKS;
+		}
+
+		if (value_int64 && !parse_file_list_int64(value, value_int64))
+			elog(ERROR, "field \"%s\" has invalid value \"%s\" in the line %d of the file %s",
+				 name, value, line_num, file_txt);
+
+		res->found |= flag;
+
+		/* Wait for the next name */
+		while (*buf && *buf != ',')
+			buf++;
+	}
+
+	if ((res->found & FILE_LIST_MANDATORY) != FILE_LIST_MANDATORY)
+		elog(ERROR, "mandatory field is not found in the line %d of the file %s",
+			 line_num, file_txt);
+	return;
 
 bad_format:
-	elog(ERROR, "%s file has invalid format in line %s",
-		 DATABASE_FILE_LIST, str);
-	return false;	/* Make compiler happy */
+	elog(ERROR, "%s file has invalid format in line %d",
+		 file_txt, line_num);
 }
 
 /*
- * Construct parray of pgFile from the backup content list.
- * If root is not NULL, path will be absolute path.
+ * Read DATABASE_FILE_LIST_BIN written next to the text list "file_txt".
+ * Returns NULL if there is no binary list or it doesn't match the text one,
+ * in that case the caller should parse the text list.
+ *
+ * Local list is mapped into memory and its records are used in place,
+ * list of remote host is read at once.
  */
-parray *
-dir_read_file_list(const char *root, const char *external_prefix,
-				   const char *file_txt, fio_location location)
+static parray *
+dir_read_file_list_bin(const char *root, const char *external_prefix,
+					   const char *file_txt, fio_location location)
 {
-	FILE   *fp;
-	parray *files;
-	char	buf[MAXPGPATH * 2];
+	char		bin_path[MAXPGPATH];
+	char	   *fname;
+	int			fd;
+	struct stat	st;
+	struct stat	text_st;
+	char	   *buf;
+	bool		mapped = false;
+	size_t		done = 0;
+	FileListBinHeader *header;
+	FileListBinRecord *records;
+	char	   *strings;
+	pg_crc32	crc;
+	parray	   *files = NULL;
+	pgFileArena *arena;
+	uint32		i;
+
+	/* binary list is always located in the same directory */
+	fname = last_dir_separator(file_txt);
+	if (strcmp(fname ? fname + 1 : file_txt, DATABASE_FILE_LIST) != 0)
+		return NULL;
+	strncpy(bin_path, file_txt, MAXPGPATH);
+	bin_path[fname ? fname - file_txt + 1 : 0] = '\0';
+	strncat(bin_path, DATABASE_FILE_LIST_BIN, MAXPGPATH - strlen(bin_path) - 1);
+
+	fd = fio_open(bin_path, O_RDONLY | PG_BINARY, location);
+	if (fd < 0)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open \"%s\": %s", bin_path, strerror(errno));
+		return NULL;
+	}
 
-	fp = fio_open_stream(file_txt, location);
-	if (fp == NULL)
-		elog(ERROR, "cannot open \"%s\": %s", file_txt, strerror(errno));
+	if (fio_fstat(fd, &st) < 0 || st.st_size < sizeof(FileListBinHeader) ||
+		fio_stat(file_txt, &text_st, true, location) < 0)
+	{
+		fio_close(fd);
+		return NULL;
+	}
 
-	files = parray_new();
+#ifndef WIN32
+	if (!fio_is_remote(location))
+	{
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED)
+		{
+			mapped = true;
+			done = st.st_size;
+		}
+	}
+#endif
+	if (!mapped)
+	{
+		/* read the whole file at once, it is used in place */
+		buf = pgut_malloc(st.st_size);
+		while (done < st.st_size)
+		{
+			ssize_t		rc = fio_read(fd, buf + done, st.st_size - done);
 
-	while (fgets(buf, lengthof(buf), fp))
+			if (rc <= 0)
+				break;
+			done += rc;
+		}
+	}
+	fio_close(fd);
+
+	header = (FileListBinHeader *) buf;
+	records = (FileListBinRecord *) (buf + sizeof(FileListBinHeader));
+	strings = (char *) (records + header->nfiles);
+
+	if (done == st.st_size && header->magic == FILE_LIST_BIN_MAGIC &&
+		header->version != FILE_LIST_BIN_VERSION)
 	{
-		char		path[MAXPGPATH];
-		char		filepath[MAXPGPATH];
-		char		linked[MAXPGPATH];
-		char		compress_alg_string[MAXPGPATH];
-		int64		write_size,
-					mode,		/* bit length of mode_t depends on platforms */
-					is_datafile,
-					is_cfs,
-					external_dir_num,
-					crc,
-					segno,
-					n_blocks;
-		pgFile	   *file;
+		elog(LOG, "File list \"%s\" has version %u, using \"%s\"",
+			 bin_path, header->version, file_txt);
+		goto cleanup;
+	}
 
-		get_control_value(buf, "path", path, NULL, true);
-		get_control_value(buf, "size", NULL, &write_size, true);
-		get_control_value(buf, "mode", NULL, &mode, true);
-		get_control_value(buf, "is_datafile", NULL, &is_datafile, true);
-		get_control_value(buf, "is_cfs", NULL, &is_cfs, false);
-		get_control_value(buf, "crc", NULL, &crc, true);
-		get_control_value(buf, "compress_alg", compress_alg_string, NULL, false);
-		get_control_value(buf, "external_dir_num", NULL, &external_dir_num, false);
+	if (done != st.st_size ||
+		header->magic != FILE_LIST_BIN_MAGIC ||
+		header->strings_size == 0 ||
+		st.st_size != sizeof(FileListBinHeader) +
+			(uint64) header->nfiles * sizeof(FileListBinRecord) +
+			header->strings_size ||
+		strings[header->strings_size - 1] != '\0')
+	{
+		elog(WARNING, "File list \"%s\" has invalid format, using \"%s\"",
+			 bin_path, file_txt);
+		goto cleanup;
+	}
 
-		if (external_dir_num && external_prefix)
-		{
-			char temp[MAXPGPATH];
+	/*
+	 * Text list may be rewritten by someone who doesn't know about binary
+	 * one. Size is compared first, CRC of the text list is calculated on its
+	 * host only if the size matches.
+	 */
+	if (header->text_size != (int64) text_st.st_size ||
+		fio_get_crc32(file_txt, true, false, &crc, NULL, location) < 0 ||
+		crc != header->text_crc)
+	{
+		elog(LOG, "File list \"%s\" is outdated, using \"%s\"",
+			 bin_path, file_txt);
+		goto cleanup;
+	}
 
-			makeExternalDirPathByNum(temp, external_prefix, external_dir_num);
-			join_path_components(filepath, temp, path);
-		}
-		else if (root)
-			join_path_components(filepath, root, path);
-		else
-			strcpy(filepath, path);
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, records,
+					header->nfiles * sizeof(FileListBinRecord) + header->strings_size);
+	FIN_FILE_CRC32(true, crc);
+	if (crc != header->crc)
+	{
+		elog(WARNING, "File list \"%s\" is corrupted, using \"%s\"",
+			 bin_path, file_txt);
+		goto cleanup;
+	}
+
+	files = parray_new();
+	arena = file_arena_create();
+
+	for (i = 0; i < header->nfiles; i++)
+	{
+		FileListBinRecord *rec = &records[i];
+		pgFile	   *file;
 
-		file = pgFileInit(filepath, path);
+		if (rec->path >= header->strings_size ||
+			rec->linked >= header->strings_size)
+			elog(ERROR, "File list \"%s\" has invalid format", bin_path);
 
-		file->write_size = (int64) write_size;
-		file->mode = (mode_t) mode;
-		file->is_datafile = is_datafile ? true : false;
-		file->is_cfs = is_cfs ? true : false;
-		file->crc = (pg_crc32) crc;
-		file->compress_alg = parse_compress_alg(compress_alg_string);
-		file->external_dir_num = external_dir_num;
+		file = file_list_init_file(arena, root, external_prefix,
+								   strings + rec->path, rec->external_dir_num);
 
-		/*
-		 * Optional fields
-		 */
+		file->write_size = rec->write_size;
+		file->mode = (mode_t) rec->mode;
+		file->is_datafile = rec->is_datafile ? true : false;
+		file->is_cfs = rec->is_cfs ? true : false;
+		file->crc = rec->crc;
+		file->compress_alg = (CompressAlg) rec->compress_alg;
+		file->external_dir_num = rec->external_dir_num;
+		file->segno = rec->segno;
+		file->n_blocks = rec->n_blocks;
 
-		if (get_control_value(buf, "linked", linked, NULL, false) && linked[0])
+		if (rec->linked != 0 && strings[rec->linked] != '\0')
 		{
-			file->linked = pgut_strdup(linked);
+			file->linked = file_arena_strdup(arena, strings + rec->linked);
 			canonicalize_path(file->linked);
 		}
 
-		if (get_control_value(buf, "segno", NULL, &segno, false))
-			file->segno = (int) segno;
+		parray_append(files, file);
+	}
 
-		if (get_control_value(buf, "n_blocks", NULL, &n_blocks, false))
-			file->n_blocks = (int) n_blocks;
+	/* release the arena if the list is empty */
+	file_arena_release(arena);
 
-		parray_append(files, file);
+cleanup:
+#ifndef WIN32
+	if (mapped)
+		munmap(buf, st.st_size);
+	else
+#endif
+		pg_free(buf);
+	return files;
+}
+
+/*
+ * Reader of the text backup content list, which gives out files as they
+ * are parsed, so the whole list need not be kept in memory.
+ */
+struct pgFileListReader
+{
+	char	   *root;
+	char	   *external_prefix;
+	char	   *file_txt;
+	FILE	   *fp;
+	int			line_num;
+	char		buf[MAXPGPATH * 2];
+	/* memory of the last batch, reused by the next one */
+	pgFileArena *arena;
+	parray	   *batch;
+};
+
+/*
+ * Open the backup content list "file_txt" for reading by
+ * file_list_read_batch(). If root is not NULL, paths of the files will be
+ * absolute paths.
+ */
+pgFileListReader *
+file_list_open(const char *root, const char *external_prefix,
+			   const char *file_txt, fio_location location)
+{
+	pgFileListReader *reader = pgut_new(pgFileListReader);
+
+	reader->fp = fio_open_stream(file_txt, location);
+	if (reader->fp == NULL)
+		elog(ERROR, "cannot open \"%s\": %s", file_txt, strerror(errno));
+
+	reader->root = root ? pgut_strdup(root) : NULL;
+	reader->external_prefix = external_prefix ? pgut_strdup(external_prefix) : NULL;
+	reader->file_txt = pgut_strdup(file_txt);
+	reader->line_num = 0;
+	reader->arena = NULL;
+	reader->batch = NULL;
+	return reader;
+}
+
+/* Parse the next line of the list, returns NULL at the end of the list */
+static pgFile *
+file_list_next(pgFileListReader *reader, pgFileArena *arena)
+{
+	FileListLine line;
+	pgFile	   *file;
+
+	if (!fgets(reader->buf, lengthof(reader->buf), reader->fp))
+		return NULL;
+
+	parse_file_list_line(reader->buf, ++reader->line_num, reader->file_txt,
+						 &line);
+
+	file = file_list_init_file(arena, reader->root, reader->external_prefix,
+							   line.path, (int) line.external_dir_num);
+
+	file->write_size = (int64) line.write_size;
+	file->mode = (mode_t) line.mode;
+	file->is_datafile = line.is_datafile ? true : false;
+	file->is_cfs = line.is_cfs ? true : false;
+	file->crc = (pg_crc32) line.crc;
+	file->compress_alg = parse_compress_alg(line.compress_alg);
+	file->external_dir_num = line.external_dir_num;
+
+	/*
+	 * Optional fields
+	 */
+
+	if (line.linked && line.linked[0])
+	{
+		file->linked = file_arena_strdup(arena, line.linked);
+		canonicalize_path(file->linked);
 	}
 
-	fio_close_stream(fp);
+	if (line.found & FILE_LIST_SEGNO)
+		file->segno = (int) line.segno;
+
+	if (line.found & FILE_LIST_N_BLOCKS)
+		file->n_blocks = (int) line.n_blocks;
+
+	return file;
+}
+
+/*
+ * Read up to "max_files" next files of the list. Returns NULL at the end of
+ * the list. The files belong to the reader and must not be freed, they are
+ * valid until the next call, which reuses their memory.
+ */
+parray *
+file_list_read_batch(pgFileListReader *reader, int max_files)
+{
+	pgFile	   *file;
+
+	if (reader->arena == NULL)
+		reader->arena = file_arena_create();
+	else
+		file_arena_reset(reader->arena);
+
+	if (reader->batch)
+		parray_free(reader->batch);
+	reader->batch = parray_new();
+
+	while (parray_num(reader->batch) < max_files &&
+		   (file = file_list_next(reader, reader->arena)) != NULL)
+		parray_append(reader->batch, file);
+
+	return parray_num(reader->batch) > 0 ? reader->batch : NULL;
+}
+
+void
+file_list_close(pgFileListReader *reader)
+{
+	if (reader->arena)
+	{
+		file_arena_reset(reader->arena);
+		file_arena_release(reader->arena);
+	}
+	if (reader->batch)
+		parray_free(reader->batch);
+
+	fio_close_stream(reader->fp);
+	pg_free(reader->root);
+	pg_free(reader->external_prefix);
+	pg_free(reader->file_txt);
+	pg_free(reader);
+}
+
+/*
+ * Construct parray of pgFile from the backup content list.
+ * If root is not NULL, path will be absolute path.
+ */
+parray *
+dir_read_file_list(const char *root, const char *external_prefix,
+				   const char *file_txt, fio_location location)
+{
+	pgFileListReader *reader;
+	parray *files;
+	pgFileArena *arena;
+	pgFile *file;
+
+	files = dir_read_file_list_bin(root, external_prefix, file_txt, location);
+	if (files != NULL)
+		return files;
+
+	reader = file_list_open(root, external_prefix, file_txt, location);
+
+	files = parray_new();
+	arena = file_arena_create();
+
+	while ((file = file_list_next(reader, arena)) != NULL)
+		parray_append(files, file);
+
+	/* release the arena if the list is empty */
+	file_arena_release(arena);
+	file_list_close(reader);
 	return files;
 }
 
@@ -106,8 +106,12 @@ help_pg_probackup(void)
 	printf(_("\n  %s backup -B backup-path -b backup-mode --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [-C]\n"));
 	printf(_("                 [--stream [-S slot-name]] [--temp-slot]\n"));
+	printf(_("                 [--wal-summary]\n"));
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
+	printf(_("                 [--dedup] [--omit-zero-pages]\n"));
+	printf(_("                 [--drop-cache] [--max-rate=rate]\n"));
 	printf(_("                 [--external-dirs=external-directories-paths]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
@@ -141,8 +145,10 @@ help_pg_probackup(void)
 	printf(_("                 [--restore-as-replica]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [-T OLDDIR=NEWDIR] [--progress]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--external-mapping=OLDDIR=NEWDIR]\n"));
-	printf(_("                 [--skip-external-dirs]\n"));
+	printf(_("                 [--skip-external-dirs] [--incremental]\n"));
+	printf(_("                 [--drop-cache] [--max-rate=rate]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n"));
@@ -150,6 +156,7 @@ help_pg_probackup(void)
 
 	printf(_("\n  %s validate -B backup-path [--instance=instance_name]\n"), PROGRAM_NAME);
 	printf(_("                 [-i backup-id] [--progress] [-j num-threads]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--recovery-target-time=time|--recovery-target-xid=xid\n"));
 	printf(_("                  |--recovery-target-lsn=lsn [--recovery-target-inclusive=boolean]]\n"));
 	printf(_("                 [--recovery-target-timeline=timeline]\n"));
@@ -175,6 +182,7 @@ help_pg_probackup(void)
 
 	printf(_("\n  %s merge -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 -i backup-id [--progress] [-j num-threads]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--help]\n"));
 
 	printf(_("\n  %s add-instance -B backup-path -D pgdata-path\n"), PROGRAM_NAME);
@@ -192,7 +200,8 @@ help_pg_probackup(void)
 	printf(_("\n  %s archive-push -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
-	printf(_("                 [--overwrite]\n"));
+	printf(_("                 [--overwrite] [-j num-threads]\n"));
+	printf(_("                 [--batch-size=batch_size] [--wal-summary]\n"));
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -204,6 +213,7 @@ help_pg_probackup(void)
 	printf(_("\n  %s archive-get -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n"));
@@ -233,8 +243,12 @@ help_backup(void)
 	printf(_("\n%s backup -B backup-path -b backup-mode --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [-C]\n"));
 	printf(_("                 [--stream [-S slot-name] [--temp-slot]\n"));
+	printf(_("                 [--wal-summary]\n"));
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
+	printf(_("                 [--dedup] [--omit-zero-pages]\n"));
+	printf(_("                 [--drop-cache] [--max-rate=rate]\n"));
 	printf(_("                 [-E external-directories-paths]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
@@ -264,11 +278,18 @@ help_backup(void)
 	printf(_("      --stream                     stream the transaction log and include it in the backup\n"));
 	printf(_("  -S, --slot=SLOTNAME              replication slot to use\n"));
 	printf(_("      --temp-slot                  use temporary replication slot\n"));
+	printf(_("      --wal-summary                write summaries of streamed WAL segments\n"));
 	printf(_("      --backup-pg-log              backup of '%s' directory\n"), PG_LOG_DIR);
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --progress-file=path         periodically write statistics in JSON format to file\n"));
 	printf(_("      --no-validate                disable validation after backup\n"));
 	printf(_("      --skip-block-validation      set to validate only file-level checksum\n"));
+	printf(_("      --dedup                      share identical data files with other backups\n"));
+	printf(_("      --omit-zero-pages            store zeroed pages of data files without page data\n"));
+	printf(_("      --drop-cache                 do not keep read data files in OS page cache\n"));
+	printf(_("      --max-rate=rate              limit read rate of every device of data directory\n"));
+	printf(_("                                   (default unit: kB per second)\n"));
 	printf(_("  -E  --external-dirs=external-directories-paths\n"));
 	printf(_("                                   backup some directories not from pgdata \n"));
 	printf(_("                                   (example: --external-dirs=/tmp/dir1:/tmp/dir2)\n"));
@@ -309,7 +330,7 @@ help_backup(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib', 'pglz', 'none' (default: none)\n"));
+	printf(_("                                   available options: 'zlib', 'pglz', 'zstd', 'lz4', 'none' (default: none)\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -357,8 +378,10 @@ help_restore(void)
 	printf(_("                 [--restore-as-replica]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [-T OLDDIR=NEWDIR] [--progress]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--external-mapping=OLDDIR=NEWDIR]\n"));
-	printf(_("                 [--skip-external-dirs]\n"));
+	printf(_("                 [--skip-external-dirs] [--incremental]\n"));
+	printf(_("                 [--drop-cache] [--max-rate=rate]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n\n"));
@@ -371,6 +394,7 @@ help_restore(void)
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --progress-file=path         periodically write statistics in JSON format to file\n"));
 	printf(_("      --recovery-target-time=time  time stamp up to which recovery will proceed\n"));
 	printf(_("      --recovery-target-xid=xid    transaction ID up to which recovery will proceed\n"));
 	printf(_("      --recovery-target-lsn=lsn    LSN of the write-ahead log location up to which recovery will proceed\n"));
@@ -396,6 +420,11 @@ help_restore(void)
 	printf(_("      --external-mapping=OLDDIR=NEWDIR\n"));
 	printf(_("                                   relocate the external directory from OLDDIR to NEWDIR\n"));
 	printf(_("      --skip-external-dirs         do not restore all external directories\n"));
+	printf(_("      --incremental                restore into non-empty data directory rewriting\n"));
+	printf(_("                                   only changed blocks of data files\n"));
+	printf(_("      --drop-cache                 do not keep restored files in OS page cache\n"));
+	printf(_("      --max-rate=rate              limit write rate of every device of data directory\n"));
+	printf(_("                                   (default unit: kB per second)\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -435,6 +464,7 @@ help_validate(void)
 {
 	printf(_("\n%s validate -B backup-path [--instance=instance_name]\n"), PROGRAM_NAME);
 	printf(_("                 [-i backup-id] [--progress] [-j num-threads]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--recovery-target-time=time|--recovery-target-xid=xid\n"));
 	printf(_("                  |--recovery-target-lsn=lsn [--recovery-target-inclusive=boolean]]\n"));
 	printf(_("                 [--recovery-target-timeline=timeline]\n"));
@@ -446,6 +476,7 @@ help_validate(void)
 	printf(_("  -i, --backup-id=backup-id        backup to validate\n"));
 
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --progress-file=path         periodically write statistics in JSON format to file\n"));
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --recovery-target-time=time  time stamp up to which recovery will proceed\n"));
 	printf(_("      --recovery-target-xid=xid    transaction ID up to which recovery will proceed\n"));
@@ -590,6 +621,7 @@ help_merge(void)
 {
 	printf(_("\n%s merge -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 -i backup-id [-j num-threads] [--progress]\n"));
+	printf(_("                 [--progress-file=path]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-filename=log-filename]\n"));
@@ -604,6 +636,7 @@ help_merge(void)
 
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --progress-file=path         periodically write statistics in JSON format to file\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -687,7 +720,7 @@ help_set_config(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','pglz','zstd','lz4','none' (default: 'none')\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -774,7 +807,8 @@ help_archive_push(void)
 	printf(_("\n%s archive-push -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
-	printf(_("                 [--overwrite]\n"));
+	printf(_("                 [--overwrite] [-j num-threads]\n"));
+	printf(_("                 [--batch-size=batch_size] [--wal-summary]\n"));
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -789,11 +823,16 @@ help_archive_push(void)
 	printf(_("      --wal-file-name=wal-file-name\n"));
 	printf(_("                                   name of the WAL file to retrieve from the server\n"));
 	printf(_("      --overwrite                  overwrite archived WAL file\n"));
+	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --batch-size=NUM             number of WAL segments ready in archive_status\n"));
+	printf(_("                                   to push in one call (default: 1)\n"));
+	printf(_("      --wal-summary                write summaries of pushed WAL segments\n"));
+	printf(_("                                   to speed up validation to recovery target\n"));
 
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','pglz','zstd','lz4','none' (default: 'none')\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -815,6 +854,7 @@ help_archive_get(void)
 	printf(_("\n%s archive-get -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n\n"));
@@ -825,6 +865,10 @@ help_archive_get(void)
 	printf(_("                                   relative destination path name of the WAL file on the server\n"));
 	printf(_("      --wal-file-name=wal-file-name\n"));
 	printf(_("                                   name of the WAL file to retrieve from the archive\n"));
+	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --batch-size=NUM             number of WAL segments to fetch in one call,\n"));
+	printf(_("                                   the following ones are prefetched before the call\n"));
+	printf(_("                                   returns (default: 1)\n"));
 
 	printf(_("\n  Remote options:\n"));
 	printf(_("      --remote-proto=protocol      remote protocol to use\n"));
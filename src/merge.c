@@ -19,6 +19,7 @@ typedef struct
 	parray	   *to_files;
 	parray	   *files;
 	parray	   *from_external;
+	ThreadTasks *tasks;			/* queue of files entries */
 
 	pgBackup   *to_backup;
 	pgBackup   *from_backup;
@@ -40,6 +41,10 @@ reorder_external_dirs(pgBackup *to_backup, parray *to_external,
 					  parray *from_external);
 static int
 get_external_index(const char *key, const parray *list);
+static bool merge_pages_as_is(pgBackup *to_backup, pgBackup *from_backup,
+							  pgFile *to_file, pgFile *from_file);
+static void recalc_copied_file_crc(pgBackup *from_backup, const char *to_root,
+								   pgFile *file);
 
 /*
  * Implementation of MERGE command.
@@ -146,6 +151,8 @@ do_merge(time_t backup_id)
 		merge_backups(full_backup, from_backup);
 	}
 
+	delete_unreferenced_dedup_files();
+
 	pgBackupValidate(full_backup);
 	if (full_backup->status == BACKUP_STATUS_CORRUPT)
 		elog(ERROR, "Merging of backup %s failed", base36enc(backup_id));
@@ -181,6 +188,7 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 	parray	   *to_external = NULL,
 			   *from_external = NULL;
 	pthread_t  *threads = NULL;
+	ThreadTasks *tasks;
 	merge_files_arg *threads_args = NULL;
 	int			i;
 	time_t		merge_time;
@@ -242,8 +250,6 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 	pgBackupGetPath(from_backup, control_file, lengthof(control_file),
 					DATABASE_FILE_LIST);
 	files = dir_read_file_list(NULL, NULL, control_file, FIO_BACKUP_HOST);
-	/* sort by size for load balancing */
-	parray_qsort(files, pgFileCompareSize);
 
 	/*
 	 * Previous merging was interrupted during deleting source backup. It is
@@ -291,10 +297,11 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 			join_path_components(dirpath, new_container, file->path);
 			dir_create_dir(dirpath, DIR_PERMISSION);
 		}
-		pg_atomic_init_flag(&file->lock);
 	}
+	tasks = pgFileTasksCreate(files, true);
 
 	thread_interrupted = false;
+	progress_start("merge", files, false);
 	for (i = 0; i < num_threads; i++)
 	{
 		merge_files_arg *arg = &(threads_args[i]);
@@ -308,6 +315,7 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 		arg->from_external = from_external;
 		arg->to_external_prefix = to_external_prefix;
 		arg->from_external_prefix = from_external_prefix;
+		arg->tasks = tasks;
 		/* By default there are some error */
 		arg->ret = 1;
 
@@ -323,6 +331,10 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 		if (threads_args[i].ret == 1)
 			merge_isok = false;
 	}
+	thread_tasks_free(tasks);
+	if (merge_isok)
+		sync_copied_files();
+	progress_stop();
 	if (!merge_isok)
 		elog(ERROR, "Data files merging failed");
 
@@ -368,7 +380,7 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 	else
 		to_backup->wal_bytes = BYTES_INVALID;
 
-	write_backup_filelist(to_backup, files, from_database_path, NULL);
+	write_backup_filelist(to_backup, files, from_database_path, NULL, true);
 	write_backup(to_backup);
 
 delete_source_backup:
@@ -407,6 +419,18 @@ delete_source_backup:
 			pgFileDelete(file);
 			elog(VERBOSE, "Deleted \"%s\"", file->path);
 
+			/* Block map of the data file, if any */
+			if (file->is_datafile && !file->is_cfs)
+			{
+				char		map_path[MAXPGPATH];
+
+				snprintf(map_path, MAXPGPATH, "%s%s", to_file_path,
+						 BLOCK_MAP_SUFFIX);
+				if (unlink(map_path) != 0 && errno != ENOENT)
+					elog(WARNING, "Cannot remove file \"%s\": %s", map_path,
+						 strerror(errno));
+			}
+
 			file->path = prev_path;
 		}
 	}
@@ -456,10 +480,12 @@ merge_files(void *arg)
 	merge_files_arg *argument = (merge_files_arg *) arg;
 	pgBackup   *to_backup = argument->to_backup;
 	pgBackup   *from_backup = argument->from_backup;
-	int			i,
+	int			i = -1,
 				num_files = parray_num(argument->files);
 
-	for (i = 0; i < num_files; i++)
+	progress_thread_init();
+
+	while ((i = thread_tasks_next(argument->tasks, i)) >= 0)
 	{
 		pgFile	   *file = (pgFile *) parray_get(argument->files, i);
 		pgFile	   *to_file;
@@ -468,6 +494,8 @@ merge_files(void *arg)
 		char		from_file_path[MAXPGPATH];
 		char	   *prev_file_path;
 
+		progress_file_start(file);
+
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during merging backups");
@@ -476,9 +504,6 @@ merge_files(void *arg)
 		if (S_ISDIR(file->mode))
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
 				 i + 1, num_files, file->path);
@@ -557,8 +582,22 @@ merge_files(void *arg)
 			 * We need more complicate algorithm if target file should be
 			 * compressed.
 			 */
-			if (to_backup->compress_alg == PGLZ_COMPRESS ||
-				to_backup->compress_alg == ZLIB_COMPRESS)
+			if (is_compressed_alg(to_backup->compress_alg) &&
+				merge_pages_as_is(to_backup, from_backup, to_file, file))
+			{
+				/*
+				 * Both files are compressed by the same algorithm, so we can
+				 * just replace changed page records of the target file.
+				 */
+				elog(VERBOSE, "Merge pages of source file into \"%s\"",
+					 to_file_path);
+
+				merge_data_file(to_file ? to_file_path : NULL, to_file_path,
+								file,
+								from_backup->backup_mode == BACKUP_MODE_DIFF_DELTA);
+				write_block_map(to_file_path, file);
+			}
+			else if (is_compressed_alg(to_backup->compress_alg))
 			{
 				char		tmp_file_path[MAXPGPATH];
 				char	   *prev_path;
@@ -607,6 +646,11 @@ merge_files(void *arg)
 				elog(VERBOSE, "Compress file and save it into the directory \"%s\"",
 					 argument->to_root);
 
+				/* The file may be shared with other backups, don't overwrite it */
+				if (unlink(to_file_path) != 0 && errno != ENOENT)
+					elog(ERROR, "Could not remove file \"%s\": %s",
+						 to_file_path, strerror(errno));
+
 				/* Again we need to change path */
 				prev_path = file->path;
 				file->path = tmp_file_path;
@@ -634,6 +678,7 @@ merge_files(void *arg)
 			else
 			{
 				/* We can merge in-place here */
+				unshare_backup_file(to_file_path);
 				restore_data_file(to_file_path, file,
 								  from_backup->backup_mode == BACKUP_MODE_DIFF_DELTA,
 								  true,
@@ -645,6 +690,7 @@ merge_files(void *arg)
 				 */
 				file->write_size = pgFileSize(to_file_path);
 				file->crc = pgFileGetCRC(to_file_path, true, true, NULL, FIO_LOCAL_HOST);
+				write_dense_block_map(to_file_path, file);
 			}
 		}
 		else if (file->external_dir_num)
@@ -660,11 +706,15 @@ merge_files(void *arg)
 			makeExternalDirPathByNum(to_root, argument->to_external_prefix,
 									 new_dir_num);
 			copy_file(FIO_LOCAL_HOST, to_root, FIO_LOCAL_HOST, file, false);
+			recalc_copied_file_crc(from_backup, to_root, file);
 		}
 		else if (strcmp(file->name, "pg_control") == 0)
 			copy_pgcontrol_file(argument->from_root, FIO_LOCAL_HOST, argument->to_root, FIO_LOCAL_HOST, file);
 		else
+		{
 			copy_file(FIO_LOCAL_HOST, argument->to_root, FIO_LOCAL_HOST, file, false);
+			recalc_copied_file_crc(from_backup, argument->to_root, file);
+		}
 
 		/*
 		 * We need to save compression algorithm type of the target backup to be
@@ -689,6 +739,46 @@ merge_files(void *arg)
 	return NULL;
 }
 
+/*
+ * copy_file() may take CRC of the copied file from the file list. Backups
+ * prior to 2.0.25 have CRC calculated differently, so calculate it again.
+ */
+static void
+recalc_copied_file_crc(pgBackup *from_backup, const char *to_root,
+					   pgFile *file)
+{
+	char		to_path[MAXPGPATH];
+
+	if (parse_program_version(from_backup->program_version) >= 20025)
+		return;
+
+	join_path_components(to_path, to_root, file->rel_path);
+	file->crc = pgFileGetCRC(to_path, true, true, NULL, FIO_LOCAL_HOST);
+}
+
+/*
+ * Check if compressed page records of "from_file" can be copied into the
+ * target file without recompression. Records are copied as they are, so it
+ * works for any algorithm used by both files. Page headers of versions before
+ * 2.0.23 don't tell reliably whether the page is compressed, so such backups
+ * are merged by restoring the file.
+ */
+static bool
+merge_pages_as_is(pgBackup *to_backup, pgBackup *from_backup,
+				  pgFile *to_file, pgFile *from_file)
+{
+	if (parse_program_version(to_backup->program_version) < 20023 ||
+		parse_program_version(from_backup->program_version) < 20023)
+		return false;
+
+	if (to_file && to_file->compress_alg != to_backup->compress_alg)
+		return false;
+
+	/* Unchanged file of DELTA backup is only truncated */
+	return from_file->write_size == BYTES_INVALID ||
+		from_file->compress_alg == to_backup->compress_alg;
+}
+
 /* Recursively delete a directory and its contents */
 static void
 remove_dir_with_files(const char *path)
@@ -0,0 +1,330 @@
+/*-------------------------------------------------------------------------
+ *
+ * pagemap.c: sets of changed blocks of data files.
+ *
+ * PAGE and PTRACK backups copy only blocks changed since the previous
+ * backup. Changes of a huge table are usually either sparse or long runs
+ * of blocks written by bulk load, so the set is kept as a sorted array of
+ * runs. It costs a few bytes for a sparse map and lets backup read a run
+ * of blocks at once. If the set becomes so fragmented that a bitmap is
+ * smaller, it is converted to a bitmap of the same format as pg_rewind
+ * datapagemap and ptrack use.
+ *
+ * Copyright (c) 2019, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+/* Fragmented sets of less runs than that are not converted to bitmap */
+#define PAGEMAP_MIN_RUNS	16
+
+#define BITMAP_BYTES(nblocks)	(((nblocks) + 7) / 8)
+
+static bool
+bitmap_test(const unsigned char *bitmap, BlockNumber blkno)
+{
+	return (bitmap[blkno / 8] & (1 << (blkno % 8))) != 0;
+}
+
+/* Make room for blocks below "end" in bitmap */
+static void
+bitmap_enlarge(PageMap *map, BlockNumber end)
+{
+	uint32		size = BITMAP_BYTES(end);
+
+	if (size <= map->bitmapsize)
+		return;
+
+	/* grow by doubling, but not beyond the size of a segment */
+	size = Max(size, Min(map->bitmapsize * 2, BITMAP_BYTES(RELSEG_SIZE)));
+	map->bitmap = pgut_realloc(map->bitmap, size);
+	MemSet(map->bitmap + map->bitmapsize, 0, size - map->bitmapsize);
+	map->bitmapsize = size;
+}
+
+static void
+bitmap_add_range(PageMap *map, BlockNumber start, BlockNumber end)
+{
+	bitmap_enlarge(map, end);
+
+	for (; start < end && start % 8 != 0; start++)
+		map->bitmap[start / 8] |= 1 << (start % 8);
+	if (end - start >= 8)
+	{
+		memset(map->bitmap + start / 8, 0xFF, (end - start) / 8);
+		start += (end - start) / 8 * 8;
+	}
+	for (; start < end; start++)
+		map->bitmap[start / 8] |= 1 << (start % 8);
+}
+
+/*
+ * Find next run of set bits of bitmap starting from bit "*pos".
+ */
+static bool
+bitmap_next_run(const unsigned char *bitmap, uint32 size, uint32 *pos,
+				BlockNumber *start, BlockNumber *end)
+{
+	uint32		nbits = size * 8;
+	uint32		bit = *pos;
+
+	while (bit < nbits && !bitmap_test(bitmap, bit))
+	{
+		/* skip empty bytes at once */
+		if (bit % 8 == 0 && bitmap[bit / 8] == 0)
+			bit += 8;
+		else
+			bit++;
+	}
+	if (bit >= nbits)
+	{
+		*pos = nbits;
+		return false;
+	}
+
+	*start = bit;
+	while (bit < nbits && bitmap_test(bitmap, bit))
+	{
+		if (bit % 8 == 0 && bitmap[bit / 8] == 0xFF)
+			bit += 8;
+		else
+			bit++;
+	}
+	*end = bit;
+	*pos = bit;
+	return true;
+}
+
+/* Convert runs of the map into bitmap */
+static void
+pagemap_make_bitmap(PageMap *map)
+{
+	uint32		i;
+
+	Assert(map->bitmap == NULL);
+
+	bitmap_enlarge(map, map->runs[map->nruns - 1].end);
+	for (i = 0; i < map->nruns; i++)
+		bitmap_add_range(map, map->runs[i].start, map->runs[i].end);
+
+	pg_free(map->runs);
+	map->runs = NULL;
+	map->nruns = 0;
+	map->maxruns = 0;
+}
+
+/*
+ * Add blocks [start, end) to the map.
+ */
+void
+pagemap_add_range(PageMap *map, BlockNumber start, BlockNumber end)
+{
+	uint32		lo,
+				hi,
+				i;
+
+	if (start >= end)
+		return;
+
+	if (map->bitmap)
+	{
+		bitmap_add_range(map, start, end);
+		return;
+	}
+
+	/* Blocks are often added in ascending order, try to extend last run */
+	if (map->nruns > 0 && map->runs[map->nruns - 1].end >= start &&
+		map->runs[map->nruns - 1].start <= start)
+	{
+		PageMapRun *last = &map->runs[map->nruns - 1];
+
+		last->end = Max(last->end, end);
+		return;
+	}
+
+	/* Find the first run which may be merged with the new one */
+	lo = 0;
+	hi = map->nruns;
+	while (lo < hi)
+	{
+		uint32		mid = lo + (hi - lo) / 2;
+
+		if (map->runs[mid].end < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* and the runs covered by the new one */
+	for (hi = lo; hi < map->nruns && map->runs[hi].start <= end; hi++)
+		;
+
+	if (hi > lo)
+	{
+		/* merge runs [lo, hi) with the new one */
+		map->runs[lo].start = Min(map->runs[lo].start, start);
+		map->runs[lo].end = Max(map->runs[hi - 1].end, end);
+		if (hi - lo > 1)
+		{
+			memmove(&map->runs[lo + 1], &map->runs[hi],
+					(map->nruns - hi) * sizeof(PageMapRun));
+			map->nruns -= hi - lo - 1;
+		}
+		return;
+	}
+
+	if (map->nruns == map->maxruns)
+	{
+		map->maxruns = map->maxruns ? map->maxruns * 2 : 4;
+		map->runs = pgut_realloc(map->runs, map->maxruns * sizeof(PageMapRun));
+	}
+	for (i = map->nruns; i > lo; i--)
+		map->runs[i] = map->runs[i - 1];
+	map->runs[lo].start = start;
+	map->runs[lo].end = end;
+	map->nruns++;
+
+	if (map->nruns >= PAGEMAP_MIN_RUNS &&
+		map->nruns * sizeof(PageMapRun) >
+		BITMAP_BYTES(map->runs[map->nruns - 1].end))
+		pagemap_make_bitmap(map);
+}
+
+void
+pagemap_add(PageMap *map, BlockNumber blkno)
+{
+	pagemap_add_range(map, blkno, blkno + 1);
+}
+
+/*
+ * Fill empty map from bitmap of "size" bytes, e.g. from ptrack map.
+ */
+void
+pagemap_set_bitmap(PageMap *map, const char *bitmap, uint32 size)
+{
+	const unsigned char *bits = (const unsigned char *) bitmap;
+	BlockNumber	start,
+				end;
+	uint32		pos = 0;
+	uint32		nruns = 0;
+
+	Assert(pagemap_is_empty(map));
+
+	if (size == 0)
+		return;
+
+	while (bitmap_next_run(bits, size, &pos, &start, &end))
+		nruns++;
+
+	/*
+	 * Bitmap without changed blocks is kept as is, so the file is not
+	 * mistaken for one without pagemap.
+	 */
+	if (nruns == 0 || nruns * sizeof(PageMapRun) > size)
+	{
+		map->bitmap = pgut_malloc(size);
+		memcpy(map->bitmap, bitmap, size);
+		map->bitmapsize = size;
+		return;
+	}
+
+	map->runs = pgut_newarray(PageMapRun, nruns);
+	map->maxruns = nruns;
+	pos = 0;
+	while (bitmap_next_run(bits, size, &pos, &start, &end))
+	{
+		map->runs[map->nruns].start = start;
+		map->runs[map->nruns].end = end;
+		map->nruns++;
+	}
+}
+
+/*
+ * Returns true if nothing was added to the map yet.
+ */
+bool
+pagemap_is_empty(const PageMap *map)
+{
+	return map->nruns == 0 && map->bitmap == NULL;
+}
+
+/* Number of blocks in the map */
+BlockNumber
+pagemap_count(const PageMap *map)
+{
+	PageMapIterator iter;
+	BlockNumber	start,
+				end;
+	BlockNumber	count = 0;
+
+	pagemap_iterate(&iter, map);
+	while (pagemap_next_run(&iter, &start, &end))
+		count += end - start;
+
+	return count;
+}
+
+void
+pagemap_free(PageMap *map)
+{
+	pg_free(map->runs);
+	pg_free(map->bitmap);
+	MemSet(map, 0, sizeof(PageMap));
+}
+
+/*
+ * Start iteration over the map. Either pagemap_next_run() or pagemap_next()
+ * may be used with the iterator, but not both.
+ */
+void
+pagemap_iterate(PageMapIterator *iter, const PageMap *map)
+{
+	iter->map = map;
+	iter->pos = 0;
+	iter->next = 0;
+	iter->end = 0;
+}
+
+/*
+ * Get next run of blocks [start, end) in ascending order.
+ */
+bool
+pagemap_next_run(PageMapIterator *iter, BlockNumber *start, BlockNumber *end)
+{
+	const PageMap *map = iter->map;
+
+	if (map->bitmap)
+		return bitmap_next_run(map->bitmap, map->bitmapsize, &iter->pos,
+							   start, end);
+
+	if (iter->pos >= map->nruns)
+		return false;
+
+	*start = map->runs[iter->pos].start;
+	*end = map->runs[iter->pos].end;
+	iter->pos++;
+	return true;
+}
+
+/*
+ * Get next block in ascending order.
+ */
+bool
+pagemap_next(PageMapIterator *iter, BlockNumber *blkno)
+{
+	if (iter->next >= iter->end)
+	{
+		BlockNumber	start,
+					end;
+
+		if (!pagemap_next_run(iter, &start, &end))
+			return false;
+		iter->next = start;
+		iter->end = end;
+	}
+
+	*blkno = iter->next++;
+	return true;
+}
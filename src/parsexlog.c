@@ -99,6 +99,23 @@ typedef struct XLogReaderData
 	int			thread_num;
 	TimeLineID	tli;
 
+	/*
+	 * Parameters of reading are kept per reader, so that readers can be used
+	 * by several threads concurrently.
+	 */
+	const char *archivedir;
+	uint32		seg_size;
+	/*
+	 * If true a wal reader thread switches to the next segment using
+	 * segno_next.
+	 */
+	bool		manual_switch;
+	/*
+	 * If true a wal reader thread waits for other threads if the thread met
+	 * absent wal segment.
+	 */
+	bool		consistent_read;
+
 	XLogRecTarget cur_rec;
 	XLogSegNo	xlogsegno;
 	bool		xlogexists;
@@ -177,6 +194,46 @@ static void validateXLogRecord(XLogReaderState *record,
 							   XLogReaderData *reader_data, bool *stop_reading);
 static bool getRecordTimestamp(XLogReaderState *record, TimestampTz *recordXtime);
 
+/*
+ * Summary of an archived WAL segment. It is written by archive-push next to
+ * the segment and allows to skip decoding of segments during validation.
+ * Records are decoded starting from "start_lsn", which is the end of the last
+ * record of the previous segment summary if it was available. So summaries of
+ * consecutive segments are continuous if start_lsn of the next one is equal
+ * to next_lsn of the previous one.
+ */
+typedef struct WalSegmentSummary
+{
+	uint32		magic;
+	TimeLineID	tli;
+	XLogSegNo	segno;
+	XLogRecPtr	start_lsn;		/* LSN decoding was started from */
+	XLogRecPtr	first_lsn;		/* start of the first read record */
+	XLogRecPtr	last_lsn;		/* start of the last read record */
+	XLogRecPtr	next_lsn;		/* end+1 of the last read record */
+	/* Timestamps of commit, abort and restore point records, 0 if none */
+	TimestampTz	min_time;
+	TimestampTz	max_time;
+	TimestampTz	last_time;
+	/* Transaction ids of read records, InvalidTransactionId if none */
+	TransactionId min_xid;
+	TransactionId max_xid;
+	TransactionId last_xid;
+	pg_crc32	seg_crc;		/* CRC32C of the uncompressed segment */
+	pg_crc32	crc;			/* CRC32C of the fields above */
+} WalSegmentSummary;
+
+#define WAL_SUMMARY_MAGIC	0x50425701
+
+static bool read_wal_segment_summary(const char *archivedir, TimeLineID tli,
+									 XLogSegNo segno, uint32 wal_seg_size,
+									 WalSegmentSummary *summary);
+static XLogRecPtr skip_summarized_wal(const char *archivedir, TimeLineID tli,
+									  uint32 wal_seg_size, XLogRecPtr startpoint,
+									  time_t target_time, TransactionId target_xid,
+									  XLogRecPtr target_lsn,
+									  XLogRecTarget *last_rec);
+
 static XLogSegNo segno_start = 0;
 /* Segment number where target record is located */
 static XLogSegNo segno_target = 0;
@@ -204,19 +261,6 @@ timestamptz_to_time_t(TimestampTz t)
 	return result;
 }
 
-static const char	   *wal_archivedir = NULL;
-static uint32			wal_seg_size = 0;
-/*
- * If true a wal reader thread switches to the next segment using
- * segno_next.
- */
-static bool				wal_manual_switch = false;
-/*
- * If true a wal reader thread waits for other threads if the thread met absent
- * wal segment.
- */
-static bool				wal_consistent_read = false;
-
 /*
  * Variables used within validate_wal() and validateXLogRecord() to stop workers
  */
@@ -268,10 +312,21 @@ validate_backup_wal_from_start_to_stop(pgBackup *backup,
 									   uint32 xlog_seg_size)
 {
 	bool		got_endpoint;
+	XLogRecTarget skipped_rec;
+	XLogRecPtr	startpoint;
+
+	/*
+	 * Segments before the one containing stop LSN need not be decoded, if
+	 * they match their summaries.
+	 */
+	MemSet(&skipped_rec, 0, sizeof(skipped_rec));
+	startpoint = skip_summarized_wal(archivedir, tli, xlog_seg_size,
+									 backup->start_lsn, 0, InvalidTransactionId,
+									 backup->stop_lsn, &skipped_rec);
 
 	got_endpoint = RunXLogThreads(archivedir, 0, InvalidTransactionId,
 								  InvalidXLogRecPtr, tli, xlog_seg_size,
-								  backup->start_lsn, backup->stop_lsn,
+								  startpoint, backup->stop_lsn,
 								  false, NULL, NULL);
 
 	if (!got_endpoint)
@@ -380,10 +435,26 @@ validate_wal(pgBackup *backup, const char *archivedir,
 		|| (XRecOffIsValid(target_lsn) && last_rec.rec_lsn >= target_lsn))
 		all_wal = true;
 
-	all_wal = all_wal ||
-		RunXLogThreads(archivedir, target_time, target_xid, target_lsn,
-					   tli, wal_seg_size, backup->stop_lsn,
-					   InvalidXLogRecPtr, true, validateXLogRecord, &last_rec);
+	if (!all_wal)
+	{
+		XLogRecTarget skipped_rec = last_rec;
+		XLogRecPtr	startpoint;
+
+		/* Do not decode segments, which certainly don't contain the target */
+		startpoint = skip_summarized_wal(archivedir, tli, wal_seg_size,
+										 backup->stop_lsn, target_time,
+										 target_xid, target_lsn, &skipped_rec);
+		last_rec = skipped_rec;
+
+		all_wal = RunXLogThreads(archivedir, target_time, target_xid, target_lsn,
+								 tli, wal_seg_size, startpoint,
+								 InvalidXLogRecPtr, true, validateXLogRecord,
+								 &last_rec);
+
+		/* Records read by threads may have no timestamp */
+		if (last_rec.rec_time == 0)
+			last_rec.rec_time = skipped_rec.rec_time;
+	}
 	if (last_rec.rec_time > 0)
 		time2iso(last_timestamp, lengthof(last_timestamp),
 				 timestamptz_to_time_t(last_rec.rec_time));
@@ -630,6 +701,330 @@ get_last_wal_lsn(const char *archivedir, XLogRecPtr start_lsn,
 	return res;
 }
 
+/*
+ * Find archived WAL segment "segno" in "archivedir". Returns false if neither
+ * plain nor compressed segment exists.
+ */
+static bool
+get_archived_wal_path(const char *archivedir, TimeLineID tli, XLogSegNo segno,
+					  uint32 wal_seg_size, char *path, bool *is_compressed)
+{
+	char		xlogfname[MAXFNAMELEN];
+
+	GetXLogFileName(xlogfname, tli, segno, wal_seg_size);
+	snprintf(path, MAXPGPATH, "%s/%s", archivedir, xlogfname);
+	*is_compressed = false;
+
+	if (fio_access(path, F_OK, FIO_BACKUP_HOST) == 0)
+		return true;
+
+#ifdef HAVE_LIBZ
+	snprintf(path, MAXPGPATH, "%s/%s.gz", archivedir, xlogfname);
+	*is_compressed = true;
+
+	if (fio_access(path, F_OK, FIO_BACKUP_HOST) == 0)
+		return true;
+#endif
+
+	return false;
+}
+
+/*
+ * Read summary of WAL segment "segno". Returns false if the summary is absent
+ * or invalid.
+ */
+static bool
+read_wal_segment_summary(const char *archivedir, TimeLineID tli,
+						 XLogSegNo segno, uint32 wal_seg_size,
+						 WalSegmentSummary *summary)
+{
+	char		xlogfname[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+	pg_crc32	crc;
+	int			fd;
+	ssize_t		rc;
+
+	GetXLogFileName(xlogfname, tli, segno, wal_seg_size);
+	snprintf(path, MAXPGPATH, "%s/%s%s", archivedir, xlogfname,
+			 WAL_SUMMARY_SUFFIX);
+
+	fd = fio_open(path, O_RDONLY | PG_BINARY, FIO_BACKUP_HOST);
+	if (fd < 0)
+		return false;
+
+	rc = fio_read(fd, summary, sizeof(WalSegmentSummary));
+	fio_close(fd);
+
+	if (rc != sizeof(WalSegmentSummary))
+	{
+		elog(WARNING, "Invalid size of WAL segment summary \"%s\"", path);
+		return false;
+	}
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, summary, offsetof(WalSegmentSummary, crc));
+	FIN_FILE_CRC32(true, crc);
+
+	if (summary->magic != WAL_SUMMARY_MAGIC || crc != summary->crc ||
+		summary->tli != tli || summary->segno != segno)
+	{
+		elog(WARNING, "Invalid WAL segment summary \"%s\"", path);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Decode archived WAL segment "wal_file_name" and write its summary into
+ * "archivedir". The summary is only an accelerator for validation, so errors
+ * are reported as warnings and archiving continues.
+ */
+void
+write_wal_segment_summary(const char *archivedir, const char *wal_file_name,
+						  uint32 wal_seg_size)
+{
+	WalSegmentSummary summary;
+	WalSegmentSummary prev;
+	XLogReaderState *xlogreader;
+	XLogReaderData reader_data;
+	XLogRecPtr	startpoint;
+	XLogRecPtr	found = InvalidXLogRecPtr;
+	XLogSegNo	segno;
+	TimeLineID	tli;
+	bool		complete = false;
+	char		seg_path[MAXPGPATH];
+	char		path[MAXPGPATH];
+	char		path_temp[MAXPGPATH];
+	bool		is_compressed;
+	size_t		seg_size;
+	int			fd;
+
+	GetXLogFromFileName(wal_file_name, &tli, &segno, wal_seg_size);
+
+	if (!get_archived_wal_path(archivedir, tli, segno, wal_seg_size,
+							   seg_path, &is_compressed))
+	{
+		elog(WARNING, "Cannot find archived WAL segment \"%s\"", wal_file_name);
+		return;
+	}
+
+	MemSet(&summary, 0, sizeof(summary));
+	summary.magic = WAL_SUMMARY_MAGIC;
+	summary.tli = tli;
+	summary.segno = segno;
+
+	xlogreader = InitXLogPageRead(&reader_data, archivedir, tli, wal_seg_size,
+								  false, false, true);
+
+	/*
+	 * Start from the end of the previous segment to decode the record which
+	 * crosses the segment boundary.
+	 */
+	if (segno > 0 &&
+		read_wal_segment_summary(archivedir, tli, segno - 1, wal_seg_size, &prev))
+	{
+		summary.start_lsn = prev.next_lsn;
+		found = XLogFindNextRecord(xlogreader, summary.start_lsn);
+	}
+
+	if (XLogRecPtrIsInvalid(found))
+	{
+		GetXLogRecPtr(segno, 0, wal_seg_size, summary.start_lsn);
+		found = XLogFindNextRecord(xlogreader, summary.start_lsn);
+	}
+
+	startpoint = found;
+	summary.first_lsn = found;
+
+	/* Read records up to the end of the segment */
+	while (!XLogRecPtrIsInvalid(found))
+	{
+		XLogRecord *record;
+		XLogSegNo	rec_segno;
+		TimestampTz	rec_time;
+		TransactionId rec_xid;
+		char	   *errormsg;
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during WAL reading");
+
+		record = XLogReadRecord(xlogreader, startpoint, &errormsg);
+		if (record == NULL)
+		{
+			/* The next segment is not archived yet */
+			complete = reader_data.xlogsegno > segno;
+			break;
+		}
+		startpoint = InvalidXLogRecPtr;
+
+		GetXLogSegNo(xlogreader->ReadRecPtr, rec_segno, wal_seg_size);
+		if (rec_segno > segno)
+		{
+			complete = true;
+			break;
+		}
+
+		summary.last_lsn = xlogreader->ReadRecPtr;
+		summary.next_lsn = xlogreader->EndRecPtr;
+
+		if (getRecordTimestamp(xlogreader, &rec_time))
+		{
+			if (summary.min_time == 0 || rec_time < summary.min_time)
+				summary.min_time = rec_time;
+			if (rec_time > summary.max_time)
+				summary.max_time = rec_time;
+			summary.last_time = rec_time;
+		}
+
+		rec_xid = XLogRecGetXid(xlogreader);
+		if (TransactionIdIsValid(rec_xid))
+		{
+			if (!TransactionIdIsValid(summary.min_xid) ||
+				TransactionIdPrecedes(rec_xid, summary.min_xid))
+				summary.min_xid = rec_xid;
+			if (!TransactionIdIsValid(summary.max_xid) ||
+				TransactionIdPrecedes(summary.max_xid, rec_xid))
+				summary.max_xid = rec_xid;
+			summary.last_xid = rec_xid;
+		}
+	}
+
+	CleanupXLogPageRead(xlogreader);
+	XLogReaderFree(xlogreader);
+
+	if (!complete || XLogRecPtrIsInvalid(summary.last_lsn))
+	{
+		elog(WARNING, "Cannot decode WAL segment \"%s\", its summary is not written",
+			 wal_file_name);
+		return;
+	}
+
+	if (fio_get_crc32(seg_path, true, is_compressed, &summary.seg_crc,
+					  &seg_size, FIO_BACKUP_HOST) != 0)
+	{
+		elog(WARNING, "Cannot calculate CRC of WAL segment \"%s\": %s",
+			 seg_path, strerror(errno));
+		return;
+	}
+
+	INIT_FILE_CRC32(true, summary.crc);
+	COMP_FILE_CRC32(true, summary.crc, &summary, offsetof(WalSegmentSummary, crc));
+	FIN_FILE_CRC32(true, summary.crc);
+
+	snprintf(path, MAXPGPATH, "%s/%s%s", archivedir, wal_file_name,
+			 WAL_SUMMARY_SUFFIX);
+	snprintf(path_temp, MAXPGPATH, "%s.tmp", path);
+
+	fd = fio_open(path_temp, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+				  FIO_BACKUP_HOST);
+	if (fd < 0)
+	{
+		elog(WARNING, "Cannot open WAL segment summary \"%s\": %s",
+			 path_temp, strerror(errno));
+		return;
+	}
+
+	if (fio_write(fd, &summary, sizeof(summary)) != sizeof(summary) ||
+		fio_flush(fd) != 0 || fio_close(fd) != 0 ||
+		fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
+	{
+		elog(WARNING, "Cannot write WAL segment summary \"%s\": %s",
+			 path, strerror(errno));
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		return;
+	}
+
+	elog(LOG, "WAL segment summary is written to \"%s\"", path);
+}
+
+/*
+ * Skip archived WAL segments starting from "startpoint", which does not
+ * contain the recovery target according to their summaries. A segment is
+ * skipped only if its summary continues the previous one and the segment
+ * content matches the CRC stored in the summary, so the skipped WAL is as
+ * valid as it was when it was archived. "last_rec" is set to the last record
+ * of skipped segments.
+ *
+ * Returns LSN to continue decoding from.
+ */
+static XLogRecPtr
+skip_summarized_wal(const char *archivedir, TimeLineID tli,
+					uint32 wal_seg_size, XLogRecPtr startpoint,
+					time_t target_time, TransactionId target_xid,
+					XLogRecPtr target_lsn, XLogRecTarget *last_rec)
+{
+	WalSegmentSummary summary;
+	XLogRecPtr	next_lsn = InvalidXLogRecPtr;
+	XLogSegNo	segno;
+	XLogSegNo	start_segno;
+	uint32		nskipped = 0;
+
+	GetXLogSegNo(startpoint, segno, wal_seg_size);
+	start_segno = segno;
+
+	while (read_wal_segment_summary(archivedir, tli, segno, wal_seg_size, &summary))
+	{
+		char		seg_path[MAXPGPATH];
+		bool		is_compressed;
+		pg_crc32	crc;
+		size_t		size;
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during WAL validation");
+
+		/* Check that summaries are continuous */
+		if (segno == start_segno ? summary.first_lsn > startpoint :
+			summary.start_lsn != next_lsn)
+			break;
+
+		/* The segment may contain the target, it must be decoded */
+		if ((TransactionIdIsValid(target_xid) &&
+			 TransactionIdIsValid(summary.min_xid) &&
+			 !TransactionIdPrecedes(target_xid, summary.min_xid) &&
+			 !TransactionIdPrecedes(summary.max_xid, target_xid)) ||
+			(target_time != 0 && summary.max_time != 0 &&
+			 timestamptz_to_time_t(summary.max_time) >= target_time) ||
+			(XRecOffIsValid(target_lsn) && summary.last_lsn >= target_lsn))
+			break;
+
+		if (!get_archived_wal_path(archivedir, tli, segno, wal_seg_size,
+								   seg_path, &is_compressed) ||
+			fio_get_crc32(seg_path, true, is_compressed, &crc, &size,
+						  FIO_BACKUP_HOST) != 0 ||
+			crc != summary.seg_crc)
+		{
+			elog(LOG, "WAL segment \"%s\" doesn't match its summary", seg_path);
+			break;
+		}
+
+		if (summary.last_lsn > last_rec->rec_lsn)
+		{
+			last_rec->rec_lsn = summary.last_lsn;
+			if (TransactionIdIsValid(summary.last_xid))
+				last_rec->rec_xid = summary.last_xid;
+		}
+		if (summary.last_time > last_rec->rec_time)
+			last_rec->rec_time = summary.last_time;
+
+		next_lsn = summary.next_lsn;
+		nskipped++;
+		segno++;
+	}
+
+	if (nskipped == 0)
+		return startpoint;
+
+	elog(LOG, "Skipped %u WAL segments using their summaries", nskipped);
+
+	/* The next record starts after page header, if the last one ends the page */
+	if (!XRecOffIsValid(next_lsn))
+		next_lsn += next_lsn % wal_seg_size == 0 ?
+			SizeOfXLogLongPHD : SizeOfXLogShortPHD;
+
+	return next_lsn;
+}
+
 #ifdef HAVE_LIBZ
 /*
  * Show error during work with compressed file
@@ -658,7 +1053,7 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 	uint32		targetPageOff;
 
 	reader_data = (XLogReaderData *) xlogreader->private_data;
-	targetPageOff = targetPagePtr % wal_seg_size;
+	targetPageOff = targetPagePtr % reader_data->seg_size;
 
 	if (interrupted || thread_interrupted)
 		elog(ERROR, "Thread [%d]: Interrupted during WAL reading",
@@ -668,7 +1063,7 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 	 * See if we need to switch to a new segment because the requested record
 	 * is not in the currently open one.
 	 */
-	if (!IsInXLogSeg(targetPagePtr, reader_data->xlogsegno, wal_seg_size))
+	if (!IsInXLogSeg(targetPagePtr, reader_data->xlogsegno, reader_data->seg_size))
 	{
 		elog(VERBOSE, "Thread [%d]: Need to switch to the next WAL segment, page LSN %X/%X, record being read LSN %X/%X",
 			 reader_data->thread_num,
@@ -688,7 +1083,7 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 			/*
 			 * Switch to the next WAL segment after reading contrecord.
 			 */
-			if (wal_manual_switch)
+			if (reader_data->manual_switch)
 				reader_data->need_switch = true;
 		}
 		else
@@ -698,7 +1093,7 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 			 * Do not switch to next WAL segment in this function. It is
 			 * manually switched by a thread routine.
 			 */
-			if (wal_manual_switch)
+			if (reader_data->manual_switch)
 			{
 				reader_data->need_switch = true;
 				return -1;
@@ -706,7 +1101,7 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 		}
 	}
 
-	GetXLogSegNo(targetPagePtr, reader_data->xlogsegno, wal_seg_size);
+	GetXLogSegNo(targetPagePtr, reader_data->xlogsegno, reader_data->seg_size);
 
 	/* Try to switch to the next WAL segment */
 	if (!reader_data->xlogexists)
@@ -714,8 +1109,8 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 		char		xlogfname[MAXFNAMELEN];
 
 		GetXLogFileName(xlogfname, reader_data->tli, reader_data->xlogsegno,
-						wal_seg_size);
-		snprintf(reader_data->xlogpath, MAXPGPATH, "%s/%s", wal_archivedir,
+						reader_data->seg_size);
+		snprintf(reader_data->xlogpath, MAXPGPATH, "%s/%s", reader_data->archivedir,
 				 xlogfname);
 
 		if (fileExists(reader_data->xlogpath, FIO_BACKUP_HOST))
@@ -835,19 +1230,18 @@ InitXLogPageRead(XLogReaderData *reader_data, const char *archivedir,
 {
 	XLogReaderState *xlogreader = NULL;
 
-	wal_archivedir = archivedir;
-	wal_seg_size = segment_size;
-	wal_manual_switch = manual_switch;
-	wal_consistent_read = consistent_read;
-
 	MemSet(reader_data, 0, sizeof(XLogReaderData));
+	reader_data->archivedir = archivedir;
+	reader_data->seg_size = segment_size;
+	reader_data->manual_switch = manual_switch;
+	reader_data->consistent_read = consistent_read;
 	reader_data->tli = tli;
 	reader_data->xlogfile = -1;
 
 	if (allocate_reader)
 	{
 #if PG_VERSION_NUM >= 110000
-		xlogreader = XLogReaderAllocate(wal_seg_size, &SimpleXLogPageRead,
+		xlogreader = XLogReaderAllocate(reader_data->seg_size, &SimpleXLogPageRead,
 										reader_data);
 #else
 		xlogreader = XLogReaderAllocate(&SimpleXLogPageRead, reader_data);
@@ -1037,7 +1431,7 @@ XLogThreadWorker(void *arg)
 	bool		need_read = true;
 
 #if PG_VERSION_NUM >= 110000
-	xlogreader = XLogReaderAllocate(wal_seg_size, &SimpleXLogPageRead,
+	xlogreader = XLogReaderAllocate(reader_data->seg_size, &SimpleXLogPageRead,
 									reader_data);
 #else
 	xlogreader = XLogReaderAllocate(&SimpleXLogPageRead, reader_data);
@@ -1054,7 +1448,7 @@ XLogThreadWorker(void *arg)
 	 */
 	if (XLogRecPtrIsInvalid(found))
 	{
-		if (wal_consistent_read && XLogWaitForConsistency(xlogreader))
+		if (reader_data->consistent_read && XLogWaitForConsistency(xlogreader))
 			need_read = false;
 		else
 		{
@@ -1121,9 +1515,9 @@ XLogThreadWorker(void *arg)
 			 * XLogWaitForConsistency() is normally used only with threads.
 			 * Call it here for just in case.
 			 */
-			if (wal_consistent_read && XLogWaitForConsistency(xlogreader))
+			if (reader_data->consistent_read && XLogWaitForConsistency(xlogreader))
 				break;
-			else if (wal_consistent_read)
+			else if (reader_data->consistent_read)
 			{
 				XLogSegNo	segno_report;
 
@@ -1183,7 +1577,7 @@ XLogThreadWorker(void *arg)
 		 * Check if other thread got the target segment. Check it not very
 		 * often, only every WAL page.
 		 */
-		if (wal_consistent_read && prev_page_off != 0 &&
+		if (reader_data->consistent_read && prev_page_off != 0 &&
 			prev_page_off != reader_data->prev_page_off)
 		{
 			XLogSegNo	segno;
@@ -1200,7 +1594,7 @@ XLogThreadWorker(void *arg)
 		/* continue reading at next record */
 		thread_arg->startpoint = InvalidXLogRecPtr;
 
-		GetXLogSegNo(xlogreader->EndRecPtr, nextSegNo, wal_seg_size);
+		GetXLogSegNo(xlogreader->EndRecPtr, nextSegNo, reader_data->seg_size);
 
 		if (thread_arg->endSegNo != 0 &&
 			!XLogRecPtrIsInvalid(thread_arg->endpoint) &&
@@ -1248,7 +1642,7 @@ SwitchThreadToNextWal(XLogReaderState *xlogreader, xlog_thread_arg *arg)
 		return false;
 
 	/* Adjust next record position */
-	GetXLogRecPtr(reader_data->xlogsegno, 0, wal_seg_size, arg->startpoint);
+	GetXLogRecPtr(reader_data->xlogsegno, 0, reader_data->seg_size, arg->startpoint);
 	/* We need to close previously opened file if it wasn't closed earlier */
 	CleanupXLogPageRead(xlogreader);
 	/* Skip over the page header and contrecord if any */
@@ -1264,9 +1658,9 @@ SwitchThreadToNextWal(XLogReaderState *xlogreader, xlog_thread_arg *arg)
 		 * Check if we need to stop reading. We stop if other thread found a
 		 * target segment.
 		 */
-		if (wal_consistent_read && XLogWaitForConsistency(xlogreader))
+		if (reader_data->consistent_read && XLogWaitForConsistency(xlogreader))
 			return false;
-		else if (wal_consistent_read)
+		else if (reader_data->consistent_read)
 		{
 			XLogSegNo	segno_report;
 
@@ -1320,7 +1714,7 @@ XLogWaitForConsistency(XLogReaderState *xlogreader)
 			char		xlogfname[MAXFNAMELEN];
 
 			GetXLogFileName(xlogfname, reader_data->tli, reader_data->xlogsegno,
-							wal_seg_size);
+							reader_data->seg_size);
 
 			elog(VERBOSE, "Thread [%d]: Possible WAL corruption in %s. Wait for other threads to decide is this a failure",
 				 reader_data->thread_num, xlogfname);
@@ -1542,3 +1936,19 @@ getRecordTimestamp(XLogReaderState *record, TimestampTz *recordXtime)
 	return false;
 }
 
+/*
+ * Copy of the backend function, which is not available in frontend.
+ * Transaction ids are compared modulo 2^32, as they wrap around.
+ */
+bool
+TransactionIdPrecedes(TransactionId id1, TransactionId id2)
+{
+	int32		diff;
+
+	if (!TransactionIdIsNormal(id1) || !TransactionIdIsNormal(id2))
+		return (id1 < id2);
+
+	diff = (int32) (id1 - id2);
+	return (diff < 0);
+}
+
@@ -67,14 +67,22 @@ static char *backup_id_string = NULL;
 int			num_threads = 1;
 bool		stream_wal = false;
 bool		progress = false;
+/* file to which statistics are periodically dumped */
+char	   *progress_file = NULL;
 #if PG_VERSION_NUM >= 100000
 char	   *replication_slot = NULL;
 #endif
 bool		temp_slot = false;
+bool		drop_cache = false;
+/* I/O rate limit of every device in kB/s, 0 if unlimited */
+uint32		max_rate = 0;
 
 /* backup options */
 bool		backup_logs = false;
 bool		smooth_checkpoint;
+bool		dedup = false;
+/* store zeroed pages of data files as page headers only */
+bool		omit_zero_pages = false;
 char       *remote_agent;
 
 /* restore options */
@@ -95,6 +103,7 @@ bool no_validate = false;
 
 bool skip_block_validation = false;
 bool skip_external_dirs = false;
+bool incremental_restore = false;
 
 /* checkdb options */
 bool need_amcheck = false;
@@ -118,6 +127,8 @@ char	   *instance_name;
 static char *wal_file_path;
 static char *wal_file_name;
 static bool	file_overwrite = false;
+static uint32 batch_size = 1;
+static bool	wal_summary = false;
 
 /* show options */
 ShowFormat show_format = SHOW_PLAIN;
@@ -145,6 +156,9 @@ static ConfigOption cmd_options[] =
 	{ 'u', 'j', "threads",			&num_threads,		SOURCE_CMD_STRICT },
 	{ 'b', 131, "stream",			&stream_wal,		SOURCE_CMD_STRICT },
 	{ 'b', 132, "progress",			&progress,			SOURCE_CMD_STRICT },
+	{ 's', 240, "progress-file",	&progress_file,		SOURCE_CMD_STRICT },
+	{ 'b', 238, "drop-cache",		&drop_cache,		SOURCE_CMD_STRICT },
+	{ 'u', 239, "max-rate",			&max_rate,			SOURCE_CMD_STRICT, SOURCE_DEFAULT, NULL, OPTION_UNIT_KB },
 	{ 's', 'i', "backup-id",		&backup_id_string,	SOURCE_CMD_STRICT },
 	/* backup options */
 	{ 'b', 133, "backup-pg-log",	&backup_logs,		SOURCE_CMD_STRICT },
@@ -156,6 +170,8 @@ static ConfigOption cmd_options[] =
 	{ 'b', 135, "delete-expired",	&delete_expired,	SOURCE_CMD_STRICT },
 	{ 'b', 235, "merge-expired",	&merge_expired,		SOURCE_CMD_STRICT },
 	{ 'b', 237, "dry-run",			&dry_run,			SOURCE_CMD_STRICT },
+	{ 'b', 236, "dedup",			&dedup,				SOURCE_CMD_STRICT },
+	{ 'b', 241, "omit-zero-pages",	&omit_zero_pages,	SOURCE_CMD_STRICT },
 	/* restore options */
 	{ 's', 136, "recovery-target-time",	&target_time,	SOURCE_CMD_STRICT },
 	{ 's', 137, "recovery-target-xid",	&target_xid,	SOURCE_CMD_STRICT },
@@ -171,6 +187,7 @@ static ConfigOption cmd_options[] =
 	{ 'b', 143, "no-validate",		&no_validate,		SOURCE_CMD_STRICT },
 	{ 'b', 154, "skip-block-validation", &skip_block_validation,	SOURCE_CMD_STRICT },
 	{ 'b', 156, "skip-external-dirs", &skip_external_dirs,	SOURCE_CMD_STRICT },
+	{ 'b', 158, "incremental",		&incremental_restore,	SOURCE_CMD_STRICT },
 	/* checkdb options */
 	{ 'b', 195, "amcheck",			&need_amcheck,		SOURCE_CMD_STRICT },
 	{ 'b', 196, "heapallindexed",	&heapallindexed,	SOURCE_CMD_STRICT },
@@ -191,6 +208,8 @@ static ConfigOption cmd_options[] =
 	{ 's', 150, "wal-file-path",	&wal_file_path,		SOURCE_CMD_STRICT },
 	{ 's', 151, "wal-file-name",	&wal_file_name,		SOURCE_CMD_STRICT },
 	{ 'b', 152, "overwrite",		&file_overwrite,	SOURCE_CMD_STRICT },
+	{ 'u', 159, "batch-size",		&batch_size,		SOURCE_CMD_STRICT },
+	{ 'b', 160, "wal-summary",		&wal_summary,		SOURCE_CMD_STRICT },
 	/* show options */
 	{ 'f', 153, "format",			opt_show_format,	SOURCE_CMD_STRICT },
 
@@ -306,6 +325,8 @@ main(int argc, char *argv[])
 					 "Agent version %s doesn't match master pg_probackup version %s",
 					 remote_agent, PROGRAM_VERSION);
 			}
+			if (parse_program_version(remote_agent) >= AGENT_HANDSHAKE_VERSION)
+				fio_agent_greet(STDOUT_FILENO);
 			fio_communicate(STDIN_FILENO, STDOUT_FILENO);
 			return 0;
 		}
@@ -601,9 +622,10 @@ main(int argc, char *argv[])
 	switch (backup_subcmd)
 	{
 		case ARCHIVE_PUSH_CMD:
-			return do_archive_push(wal_file_path, wal_file_name, file_overwrite);
+			return do_archive_push(wal_file_path, wal_file_name, file_overwrite,
+								   batch_size, wal_summary);
 		case ARCHIVE_GET_CMD:
-			return do_archive_get(wal_file_path, wal_file_name);
+			return do_archive_get(wal_file_path, wal_file_name, batch_size);
 		case ADD_INSTANCE_CMD:
 			return do_add_instance();
 		case DELETE_INSTANCE_CMD:
@@ -627,8 +649,12 @@ main(int argc, char *argv[])
 				if (current.backup_mode == BACKUP_MODE_INVALID)
 					elog(ERROR, "required parameter not specified: BACKUP_MODE "
 						 "(-b, --backup-mode)");
+#ifdef WIN32
+				if (dedup)
+					elog(ERROR, "--dedup is not supported on Windows");
+#endif
 
-				return do_backup(start_time, no_validate);
+				return do_backup(start_time, no_validate, wal_summary);
 			}
 		case RESTORE_CMD:
 			return do_restore_or_validate(current.backup_id,
@@ -736,6 +762,16 @@ compress_init(void)
 		if (instance_config.compress_alg == ZLIB_COMPRESS)
 			elog(ERROR, "This build does not support zlib compression");
 		else
+#endif
+#ifndef HAVE_LIBZSTD
+		if (instance_config.compress_alg == ZSTD_COMPRESS)
+			elog(ERROR, "This build does not support zstd compression");
+		else
+#endif
+#ifndef HAVE_LIBLZ4
+		if (instance_config.compress_alg == LZ4_COMPRESS)
+			elog(ERROR, "This build does not support lz4 compression");
+		else
 #endif
 		if (instance_config.compress_alg == PGLZ_COMPRESS && num_threads > 1)
 			elog(ERROR, "Multithread backup does not support pglz compression");
@@ -56,7 +56,11 @@ extern const char  *PROGRAM_EMAIL;
 #define BACKUP_CONTROL_FILE		"backup.control"
 #define BACKUP_CATALOG_CONF_FILE	"pg_probackup.conf"
 #define BACKUP_CATALOG_PID		"backup.pid"
+#define BACKUP_CATALOG_SUMMARY	"backups.summary"
 #define DATABASE_FILE_LIST		"backup_content.control"
+#define DATABASE_FILE_LIST_BIN	"backup_content.bin"
+/* Instance page store, see dedup_backup_file() */
+#define DEDUP_DIR				".dedup"
 #define PG_BACKUP_LABEL_FILE	"backup_label"
 #define PG_BLACK_LIST			"black_list"
 #define PG_TABLESPACE_MAP_FILE "tablespace_map"
@@ -90,6 +94,8 @@ typedef enum CompressAlg
 	NONE_COMPRESS,
 	PGLZ_COMPRESS,
 	ZLIB_COMPRESS,
+	ZSTD_COMPRESS,
+	LZ4_COMPRESS,
 } CompressAlg;
 
 #define INIT_FILE_CRC32(use_crc32c, crc) \
@@ -115,11 +121,54 @@ do { \
 } while (0)
 
 
-/* Information about single file (or dir) in backup */
+typedef struct pgFileArena pgFileArena;
+typedef struct pgFileListReader pgFileListReader;
+typedef struct BlockMapBuilder BlockMapBuilder;
+
+/*
+ * Set of changed blocks of a data file segment, see pagemap.c.
+ * Blocks are kept as sorted runs [start, end) unless the set is so
+ * fragmented that a bitmap is smaller. Zeroed PageMap is an empty set.
+ */
+typedef struct PageMapRun
+{
+	BlockNumber	start;
+	BlockNumber	end;
+} PageMapRun;
+
+typedef struct PageMap
+{
+	PageMapRun *runs;
+	uint32		nruns;
+	uint32		maxruns;
+	unsigned char *bitmap;	/* used instead of runs if not NULL */
+	uint32		bitmapsize;	/* size of bitmap in bytes */
+} PageMap;
+
+typedef struct PageMapIterator
+{
+	const PageMap *map;
+	uint32		pos;		/* next run or next bit of bitmap */
+	BlockNumber	next;		/* next block of the current run */
+	BlockNumber	end;		/* end of the current run */
+} PageMapIterator;
+
+/* Size of pgFile.forkName, enough for fork name with segment number */
+#define FORK_NAME_SIZE	16
+
+/*
+ * Information about single file (or dir) in backup.
+ * Fields are grouped by size to avoid padding. Keys used by sorting and
+ * searching of file lists go first.
+ */
 typedef struct pgFile
 {
-	char	*name;			/* file or directory name */
+	char	   *path;		/* absolute path of the file */
+	char	   *rel_path;	/* relative path of the file */
+	char	*name;			/* file or directory name, points into path */
+	int		external_dir_num; /* Number of external directory. 0 if not external */
 	mode_t	mode;			/* protection (file type and permission) */
+	time_t	mtime;			/* time of last modification at listing */
 	size_t	size;			/* size of the file */
 	size_t	read_size;		/* size of the portion read (if only some pages are
 							   backed up, it's different from size) */
@@ -127,30 +176,66 @@ typedef struct pgFile
 							   that the file existed but was not backed up
 							   because not modified since last backup. */
 							/* we need int64 here to store '-1' value */
-	pg_crc32 crc;			/* CRC value of the file, regular file only */
 	char	*linked;		/* path of the linked file */
-	bool	is_datafile;	/* true if the file is PostgreSQL data file */
-	char	   *path;		/* absolute path of the file */
-	char	   *rel_path;	/* relative path of the file */
+	pgFileArena *arena;		/* arena holding the file and its strings, NULL if
+							   allocated by pgFileInit() */
+	BlockMapBuilder *block_map; /* block map collected while the file is
+								   written to backup, see write_block_map() */
+	dev_t	dev;			/* device of the file at database host for
+							   --max-rate, 0 if not looked up yet */
+	PageMap	pagemap;		/* pages updated since previous backup */
+	pg_crc32 crc;			/* CRC value of the file, regular file only */
 	Oid		tblspcOid;		/* tblspcOid extracted from path, if applicable */
 	Oid		dbOid;			/* dbOid extracted from path, if applicable */
 	Oid		relOid;			/* relOid extracted from path, if applicable */
-	char	*forkName;		/* forkName extracted from path, if applicable */
 	int		segno;			/* Segment number for ptrack */
 	int		n_blocks;		/* size of the file in blocks, readed during DELTA backup */
+	CompressAlg compress_alg; /* compression algorithm applied to the file */
+	bool	is_datafile;	/* true if the file is PostgreSQL data file */
 	bool	is_cfs;			/* Flag to distinguish files compressed by CFS*/
 	bool	is_database;
-	int		external_dir_num; /* Number of external directory. 0 if not external */
 	bool	exists_in_prev;	/* Mark files, both data and regular, that exists in previous backup */
-	CompressAlg compress_alg; /* compression algorithm applied to the file */
-	volatile pg_atomic_flag lock;	/* lock for synchronization of parallel threads  */
-	datapagemap_t pagemap;	/* bitmap of pages updated since previous backup */
 	bool	pagemap_isabsent; /* Used to mark files with unknown state of pagemap,
 							   * i.e. datafiles without _ptrack */
+	char	forkName[FORK_NAME_SIZE]; /* forkName extracted from path, if applicable */
 } pgFile;
 
-/* Special values of datapagemap_t bitmapsize */
-#define PageBitmapIsEmpty 0		/* Used to mark unchanged datafiles */
+/*
+ * Binary copy of DATABASE_FILE_LIST, written next to it. It consists of
+ * the header, the array of fixed-size records sorted by (path,
+ * external_dir_num) and the string table. Offset 0 in the string table
+ * is an empty string. The text file remains the primary one: the binary
+ * file is used only if text_size and text_crc match the text file.
+ */
+#define FILE_LIST_BIN_MAGIC		0x464C4250	/* "PBLF" */
+#define FILE_LIST_BIN_VERSION	2
+
+typedef struct FileListBinHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		nfiles;			/* number of records */
+	uint32		strings_size;	/* size of the string table */
+	int64		text_size;		/* size of DATABASE_FILE_LIST */
+	pg_crc32	text_crc;		/* CRC32C of DATABASE_FILE_LIST */
+	pg_crc32	crc;			/* CRC of the records and the string table */
+} FileListBinHeader;
+
+typedef struct FileListBinRecord
+{
+	int64		write_size;
+	uint32		mode;
+	pg_crc32	crc;
+	uint32		path;			/* offset in the string table */
+	uint32		linked;			/* offset in the string table, 0 if none */
+	int32		segno;
+	int32		n_blocks;
+	int32		external_dir_num;
+	uint8		is_datafile;
+	uint8		is_cfs;
+	uint8		compress_alg;
+	uint8		padding;
+} FileListBinRecord;
 
 /* Current state of backup */
 typedef enum BackupStatus
@@ -182,14 +267,47 @@ typedef enum ShowFormat
 	SHOW_JSON
 } ShowFormat;
 
+/* Statistics collected by worker threads, see progress.c */
+typedef enum ProgressStat
+{
+	PROGRESS_FILES,				/* number of processed files */
+	PROGRESS_PROCESSED_BYTES,	/* size of processed files */
+	PROGRESS_READ_BYTES,
+	PROGRESS_WRITTEN_BYTES,
+	PROGRESS_SKIPPED_PAGES,		/* pages skipped as not changed */
+	PROGRESS_SCANNED_PAGES,		/* pages of data files read or skipped */
+	PROGRESS_COMPRESS_TIME,		/* times are in microseconds */
+	PROGRESS_NETWORK_WAIT,
+	PROGRESS_FSYNC_TIME,
+	PROGRESS_NSTATS
+} ProgressStat;
+
 
 /* special values of pgBackup fields */
 #define INVALID_BACKUP_ID	0    /* backup ID is not provided by user */
 #define BYTES_INVALID		(-1) /* file didn`t changed since previous backup, DELTA backup do not rely on it */
 #define FILE_NOT_FOUND		(-2) /* file disappeared during backup */
 #define BLOCKNUM_INVALID	(-1)
-#define PROGRAM_VERSION	"2.1.3"
+#define PROGRAM_VERSION	"2.1.4"
 #define AGENT_PROTOCOL_VERSION 20103
+/* Master of this version or newer accepts pages in FIO_PAGE_BATCH messages */
+#define AGENT_PAGE_BATCH_VERSION 20104
+/* Master of this version or newer expects greeting of agent, see fio_agent_handshake() */
+#define AGENT_HANDSHAKE_VERSION 20104
+/* Agent of this version or newer can send range of blocks of data file */
+#define AGENT_SEND_PAGES_RANGE_VERSION 20104
+/* Agent of this version or newer can calculate CRC of every block of file */
+#define AGENT_BLOCK_CRCS_VERSION 20104
+/* Agent of this version or newer can calculate CRC of the whole file */
+#define AGENT_GET_CRC32_VERSION 20104
+/* Agent of this version or newer accepts page cache hints */
+#define AGENT_CACHE_ADVISE_VERSION 20104
+/* Agent of this version or newer can multiplex connection, see FIO_MUX */
+#define AGENT_MUX_VERSION 20104
+/* Agent of this version or newer lists directory tree at once, see FIO_LIST_DIR */
+#define AGENT_LIST_DIR_VERSION 20104
+/* Agent of this version or newer deallocates ranges of files, see FIO_PUNCH_HOLE */
+#define AGENT_PUNCH_HOLE_VERSION 20104
 
 
 typedef struct ConnectionOptions
@@ -206,6 +324,24 @@ typedef struct ConnectionArgs
 	PGcancel   *cancel_conn;
 } ConnectionArgs;
 
+/* Maximal number of blocks fetched by one pg_ptrack_get_blocks() call */
+#define PTRACK_BLOCKS_BATCH	64
+
+/* Number of blocks of data file read from disk at once */
+#define DATA_FILE_READ_BLOCKS	128
+
+/*
+ * Blocks of relation segment fetched from shared buffers in one query.
+ * found[i] is false if block blknums[i] is not read, e.g. it was truncated.
+ */
+typedef struct PtrackBlocks
+{
+	int			nblocks;
+	BlockNumber	blknums[PTRACK_BLOCKS_BATCH];	/* absolute block numbers */
+	bool		found[PTRACK_BLOCKS_BATCH];
+	char	   *pages;			/* PTRACK_BLOCKS_BATCH * BLCKSZ bytes */
+} PtrackBlocks;
+
 /*
  * An instance configuration. It can be stored in a configuration file or passed
  * from command line.
@@ -308,6 +444,17 @@ struct pgBackup
 										* in the format suitable for recovery.conf */
 	char			*external_dir_str;	/* List of external directories,
 										 * separated by ':' */
+
+	/*
+	 * Statistics of copying of backup files, collected by progress.c.
+	 * Times are in milliseconds. BYTES_INVALID means unknown.
+	 */
+	int64			read_bytes;
+	int64			skipped_pages;
+	int64			scanned_pages;
+	int64			compress_time;
+	int64			network_wait;
+	int64			fsync_time;
 };
 
 /* Recovery target for restore and validate subcommands */
@@ -341,6 +488,7 @@ typedef struct
 	parray	   *prev_filelist;
 	parray	   *external_dirs;
 	XLogRecPtr	prev_start_lsn;
+	struct ThreadTasks *tasks;	/* queue of files_list entries */
 
 	ConnectionArgs conn_arg;
 	int			thread_num;
@@ -367,6 +515,41 @@ typedef struct BackupPageHeader
 #define PageIsTruncated -2
 #define SkipCurrentPage -3
 #define PageIsCorrupted -4 /* used by checkdb */
+#define PageIsZeroed -5 /* zeroed page stored without data, see --omit-zero-pages */
+
+/*
+ * Optional block map of a data file in backup, stored next to it in the file
+ * with BLOCK_MAP_SUFFIX. It maps block numbers to offsets of page data, so
+ * readers don't have to parse every page header before the needed block.
+ * The map is used only if file_crc and file_size match the data file.
+ */
+#define BLOCK_MAP_SUFFIX		".bmap"
+#define BLOCK_MAP_MAGIC			0x50424D31	/* "PBM1" */
+/* Smaller files are scanned fast enough without the map */
+#define BLOCK_MAP_MIN_BLOCKS	128
+
+typedef struct BlockMapHeader
+{
+	uint32		magic;
+	uint32		nentries;		/* number of page records */
+	BlockNumber	truncated;		/* block of truncation record or
+								 * InvalidBlockNumber */
+	pg_crc32	file_crc;		/* CRC of the data file */
+	int64		file_size;		/* size of the data file */
+	pg_crc32	crc;			/* CRC of the header up to this field and
+								 * of the entries */
+	uint32		padding;
+} BlockMapHeader;
+
+typedef struct BlockMapEntry
+{
+	BlockNumber	block;
+	int32		compressed_size;
+	int64		offset;			/* offset of the page data */
+} BlockMapEntry;
+
+/* Smaller data files are not deduplicated by --dedup */
+#define DEDUP_MIN_SIZE			(128 * 1024)
 
 
 /*
@@ -390,6 +573,14 @@ typedef struct BackupPageHeader
 	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&		\
 	 strcmp((fname) + XLOG_FNAME_LEN, ".gz") == 0)
 
+/* Summary of archived WAL segment, see write_wal_segment_summary() */
+#define WAL_SUMMARY_SUFFIX		".summary"
+
+#define IsXLogSummaryFileName(fname) \
+	(strlen(fname) == XLOG_FNAME_LEN + strlen(WAL_SUMMARY_SUFFIX) &&	\
+	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&			\
+	 strcmp((fname) + XLOG_FNAME_LEN, WAL_SUMMARY_SUFFIX) == 0)
+
 #if PG_VERSION_NUM >= 110000
 #define GetXLogSegNo(xlrp, logSegNo, wal_segsz_bytes) \
 	XLByteToSeg(xlrp, logSegNo, wal_segsz_bytes)
@@ -399,6 +590,8 @@ typedef struct BackupPageHeader
 	XLogFileName(fname, tli, logSegNo, wal_segsz_bytes)
 #define IsInXLogSeg(xlrp, logSegNo, wal_segsz_bytes) \
 	XLByteInSeg(xlrp, logSegNo, wal_segsz_bytes)
+#define GetXLogFromFileName(fname, tli, logSegNo, wal_segsz_bytes) \
+	XLogFromFileName(fname, tli, logSegNo, wal_segsz_bytes)
 #else
 #define GetXLogSegNo(xlrp, logSegNo, wal_segsz_bytes) \
 	XLByteToSeg(xlrp, logSegNo)
@@ -408,6 +601,8 @@ typedef struct BackupPageHeader
 	XLogFileName(fname, tli, logSegNo)
 #define IsInXLogSeg(xlrp, logSegNo, wal_segsz_bytes) \
 	XLByteInSeg(xlrp, logSegNo)
+#define GetXLogFromFileName(fname, tli, logSegNo, wal_segsz_bytes) \
+	XLogFromFileName(fname, tli, logSegNo)
 #endif
 
 #define IsSshProtocol() (instance_config.remote.host && strcmp(instance_config.remote.proto, "ssh") == 0)
@@ -421,14 +616,19 @@ extern char		arclog_path[MAXPGPATH];
 extern int		num_threads;
 extern bool		stream_wal;
 extern bool		progress;
+extern char	   *progress_file;
 #if PG_VERSION_NUM >= 100000
 /* In pre-10 'replication_slot' is defined in receivelog.h */
 extern char	   *replication_slot;
 #endif
 extern bool 	temp_slot;
+extern bool		drop_cache;
+extern uint32	max_rate;
 
 /* backup options */
 extern bool		smooth_checkpoint;
+extern bool		dedup;
+extern bool		omit_zero_pages;
 
 /* remote probackup options */
 extern char* remote_agent;
@@ -440,6 +640,7 @@ extern bool exclusive_backup;
 extern bool restore_as_replica;
 extern bool skip_block_validation;
 extern bool skip_external_dirs;
+extern bool incremental_restore;
 
 /* delete options */
 extern bool		delete_wal;
@@ -471,7 +672,7 @@ extern char** commands_args;
 extern const char *pgdata_exclude_dir[];
 
 /* in backup.c */
-extern int do_backup(time_t start_time, bool no_validate);
+extern int do_backup(time_t start_time, bool no_validate, bool wal_summary);
 extern void do_checkdb(bool need_amcheck, ConnectionOptions conn_opt,
 				  char *pgdata);
 extern BackupMode parse_backup_mode(const char *value);
@@ -483,6 +684,10 @@ extern char *pg_ptrack_get_block(ConnectionArgs *arguments,
 								 Oid dbOid, Oid tblsOid, Oid relOid,
 								 BlockNumber blknum,
 								 size_t *result_size);
+extern void pg_ptrack_get_blocks(ConnectionArgs *arguments,
+								 Oid dbOid, Oid tblsOid, Oid relOid,
+								 BlockNumber *blknums, int nblocks,
+								 PtrackBlocks *blocks);
 /* in restore.c */
 extern int do_restore_or_validate(time_t target_backup_id,
 					  pgRecoveryTarget *rt,
@@ -506,8 +711,10 @@ extern int do_add_instance(void);
 
 /* in archive.c */
 extern int do_archive_push(char *wal_file_path, char *wal_file_name,
-						   bool overwrite);
-extern int do_archive_get(char *wal_file_path, char *wal_file_name);
+						   bool overwrite, uint32 batch_size,
+						   bool wal_summary);
+extern int do_archive_get(char *wal_file_path, char *wal_file_name,
+						  uint32 batch_size);
 
 
 /* in configure.c */
@@ -521,6 +728,7 @@ extern int do_show(time_t requested_backup_id);
 /* in delete.c */
 extern void do_delete(time_t backup_id);
 extern void delete_backup_files(pgBackup *backup);
+extern void delete_unreferenced_dedup_files(void);
 extern int do_retention(void);
 extern int do_delete_instance(void);
 
@@ -556,7 +764,8 @@ extern pgBackup *catalog_get_last_data_backup(parray *backup_list,
 											  TimeLineID tli);
 extern void pgBackupWriteControl(FILE *out, pgBackup *backup);
 extern void write_backup_filelist(pgBackup *backup, parray *files,
-								  const char *root, parray *external_list);
+								  const char *root, parray *external_list,
+								  bool write_bin);
 
 extern void pgBackupGetPath(const pgBackup *backup, char *path, size_t len,
 							const char *subdir);
@@ -576,6 +785,7 @@ extern bool is_prolific(parray *backup_list, pgBackup *target_backup);
 extern bool in_backup_list(parray *backup_list, pgBackup *target_backup);
 extern int get_backup_index_number(parray *backup_list, pgBackup *backup);
 extern bool launch_agent(void);
+extern void fio_mux_agent(int in, int out);
 extern void launch_ssh(char* argv[]);
 
 #define COMPRESS_ALG_DEFAULT NOT_DEFINED_COMPRESS
@@ -583,6 +793,7 @@ extern void launch_ssh(char* argv[]);
 
 extern CompressAlg parse_compress_alg(const char *arg);
 extern const char* deparse_compress_alg(int alg);
+extern bool is_compressed_alg(CompressAlg alg);
 
 /* in dir.c */
 extern void dir_list_file(parray *files, const char *root, bool exclude,
@@ -595,16 +806,23 @@ extern void create_data_directories(parray *dest_files,
 										fio_location location);
 
 extern void read_tablespace_map(parray *files, const char *backup_dir);
+extern const char *get_tablespace_mapping(const char *dir);
 extern void opt_tablespace_map(ConfigOption *opt, const char *arg);
 extern void opt_externaldir_map(ConfigOption *opt, const char *arg);
-extern void check_tablespace_mapping(pgBackup *backup);
-extern void check_external_dir_mapping(pgBackup *backup);
+extern void check_tablespace_mapping(pgBackup *backup, bool incremental);
+extern void check_external_dir_mapping(pgBackup *backup, bool incremental);
 extern char *get_external_remap(char *current_dir);
 
 extern void print_file_list(FILE *out, const parray *files, const char *root,
 							const char *external_prefix, parray *external_list);
 extern parray *dir_read_file_list(const char *root, const char *external_prefix,
 								  const char *file_txt, fio_location location);
+extern pgFileListReader *file_list_open(const char *root,
+										const char *external_prefix,
+										const char *file_txt,
+										fio_location location);
+extern parray *file_list_read_batch(pgFileListReader *reader, int max_files);
+extern void file_list_close(pgFileListReader *reader);
 extern parray *make_external_directory_list(const char *colon_separated_dirs,
 											bool remap);
 extern void free_dir_list(parray *list);
@@ -634,6 +852,8 @@ extern int pgFileComparePathDesc(const void *f1, const void *f2);
 extern int pgFileComparePathWithExternalDesc(const void *f1, const void *f2);
 extern int pgFileCompareLinked(const void *f1, const void *f2);
 extern int pgFileCompareSize(const void *f1, const void *f2);
+struct ThreadTasks;
+extern struct ThreadTasks *pgFileTasksCreate(parray *files, bool in_backup);
 
 /* in data.c */
 extern bool check_data_file(ConnectionArgs* arguments, pgFile* file, uint32 checksum_version);
@@ -643,12 +863,31 @@ extern bool backup_data_file(backup_files_arg* arguments,
 							 BackupMode backup_mode,
 							 CompressAlg calg, int clevel,
 							 bool missing_ok);
+extern void help_backup_data_files(backup_files_arg *arguments);
+extern int delta_prescan_pages(const char *pages, int n, XLogRecPtr horizon_lsn,
+							   bool *skip);
 extern void restore_data_file(const char *to_path,
 							  pgFile *file, bool allow_truncate,
 							  bool write_header,
 							  uint32 backup_version);
+extern void merge_data_file(const char *to_path, const char *result_path,
+							pgFile *from_file, bool allow_truncate);
+extern void block_map_add(pgFile *file, const char *data, size_t size);
+extern void write_block_map(const char *path, pgFile *file);
+extern void write_dense_block_map(const char *path, pgFile *file);
+extern void restore_data_file_chain(const char *to_path, pgFile **files,
+									pgBackup **backups, int nbackups,
+									bool incremental);
+extern void sync_copied_files(void);
 extern bool copy_file(fio_location from_location, const char *to_root,
 					  fio_location to_location, pgFile *file, bool missing_ok);
+#ifdef HAVE_LIBZ
+extern void restore_compressed_wal_file(const char *to_root,
+										fio_location to_location, pgFile *file);
+#endif
+
+extern void dedup_backup_file(const char *path, pgFile *file);
+extern void unshare_backup_file(const char *path);
 
 extern bool check_file_pages(pgFile *file, XLogRecPtr stop_lsn,
 							 uint32 checksum_version, uint32 backup_version);
@@ -670,6 +909,33 @@ extern bool wal_contains_lsn(const char *archivedir, XLogRecPtr target_lsn,
 extern XLogRecPtr get_last_wal_lsn(const char *archivedir, XLogRecPtr start_lsn,
 								   XLogRecPtr stop_lsn, TimeLineID tli,
 								   bool seek_prev_segment, uint32 seg_size);
+extern void write_wal_segment_summary(const char *archivedir,
+									  const char *wal_file_name,
+									  uint32 seg_size);
+
+/* in pagemap.c */
+extern void pagemap_add(PageMap *map, BlockNumber blkno);
+extern void pagemap_add_range(PageMap *map, BlockNumber start, BlockNumber end);
+extern void pagemap_set_bitmap(PageMap *map, const char *bitmap, uint32 size);
+extern bool pagemap_is_empty(const PageMap *map);
+extern BlockNumber pagemap_count(const PageMap *map);
+extern void pagemap_free(PageMap *map);
+extern void pagemap_iterate(PageMapIterator *iter, const PageMap *map);
+extern bool pagemap_next_run(PageMapIterator *iter, BlockNumber *start,
+							 BlockNumber *end);
+extern bool pagemap_next(PageMapIterator *iter, BlockNumber *blkno);
+
+/* in progress.c */
+extern void progress_start(const char *command, parray *files,
+						   bool backup_size);
+extern void progress_add_files(parray *files);
+extern void progress_thread_init(void);
+extern void progress_file_start(pgFile *file);
+extern void progress_add(ProgressStat stat, int64 value);
+extern int64 progress_clock(void);
+extern void progress_add_time(ProgressStat stat, int64 start);
+extern void progress_stop(void);
+extern void progress_summary(pgBackup *backup);
 
 /* in util.c */
 extern TimeLineID get_current_timeline(bool safe);
@@ -692,6 +958,7 @@ extern long unsigned int base36dec(const char *text);
 extern uint32 parse_server_version(const char *server_version_str);
 extern uint32 parse_program_version(const char *program_version);
 extern bool   parse_page(Page page, XLogRecPtr *lsn);
+extern bool   page_is_zeroed(const char *page);
 int32  do_compress(void* dst, size_t dst_size, void const* src, size_t src_size,
 				   CompressAlg alg, int level, const char **errormsg);
 
@@ -0,0 +1,524 @@
+/*-------------------------------------------------------------------------
+ *
+ * progress.c: statistics of parallel commands.
+ *
+ * Worker threads of backup, restore, merge and validate count read and
+ * written bytes and time spent on compression, network and fsync.  Every
+ * thread has its own counters, so counting costs one uncontended atomic
+ * addition.  With --progress-file the counters are periodically dumped to
+ * the file as a JSON document.  Time spent on compression, network and fsync
+ * costs two clock readings per page, so it is measured only if it is going
+ * to be reported.
+ *
+ * Copyright (c) 2019, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "utils/json.h"
+#include "utils/thread.h"
+
+/* How often the progress file is rewritten, in milliseconds */
+#define PROGRESS_REPORT_INTERVAL	1000
+/* Level of the final statistics message, see progress_stop() */
+#define STATISTICS_LEVEL	(progress ? INFO : LOG)
+
+/* Counters of one thread */
+typedef struct ProgressThread
+{
+	pg_atomic_uint64 values[PROGRESS_NSTATS];
+	/* Size of the file being processed, used by the owner thread only */
+	int64		pending_bytes;
+	bool		pending;
+	/* Keep counters of different threads in different cache lines */
+	char		pad[PG_CACHE_LINE_SIZE];
+} ProgressThread;
+
+static const char *stat_names[PROGRESS_NSTATS] =
+{
+	"files",
+	"processed-bytes",
+	"read-bytes",
+	"written-bytes",
+	"skipped-pages",
+	"scanned-pages",
+	"compress-time",
+	"network-wait",
+	"fsync-time"
+};
+
+/* Statistics being collected, progress_threads[0] is shared by other threads */
+static const char *progress_command = NULL;
+static ProgressThread *progress_threads = NULL;
+static int	progress_nthreads = 0;
+static pg_atomic_uint32 progress_next_thread;
+static int64 progress_start_time;
+static int64 progress_total_files;
+static int64 progress_total_bytes;
+static bool progress_backup_size;
+/* Incremented by progress_start(), so threads notice new counters */
+static uint32 progress_generation = 0;
+static bool progress_active = false;
+/* Compress time, network wait and fsync time are measured */
+static bool progress_timing = false;
+
+static __thread ProgressThread *my_progress = NULL;
+static __thread uint32 my_progress_generation = 0;
+
+/* Progress file reporter */
+static pthread_t progress_reporter;
+static bool progress_reporter_started = false;
+static bool progress_reporter_stop = false;
+static pthread_mutex_t progress_reporter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_reporter_cond = PTHREAD_COND_INITIALIZER;
+
+static void *progress_report(void *arg);
+static void write_progress_file(void);
+
+/* Current time in microseconds */
+static int64
+progress_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Current time in microseconds, or 0 if times are not measured.
+ */
+int64
+progress_clock(void)
+{
+	if (!progress_active || !progress_timing)
+		return 0;
+
+	return progress_now();
+}
+
+/* Size of the file used to estimate remaining time */
+static int64
+progress_file_size(pgFile *file)
+{
+	int64		size = progress_backup_size ? file->write_size : file->size;
+
+	return S_ISREG(file->mode) && size > 0 ? size : 0;
+}
+
+static ProgressThread *
+get_progress_thread(void)
+{
+	if (!progress_active)
+		return NULL;
+	if (my_progress != NULL && my_progress_generation == progress_generation)
+		return my_progress;
+	return progress_threads;
+}
+
+/*
+ * Start collecting statistics of the command processing files.  Sizes of
+ * the files are used to estimate remaining time, if backup_size is true
+ * their sizes in backup are used instead of original sizes.  "files" may be
+ * NULL if the files are processed by parts, see progress_add_files().
+ */
+void
+progress_start(const char *command, parray *files, bool backup_size)
+{
+	int			i,
+				j;
+
+	progress_backup_size = backup_size;
+	progress_total_files = 0;
+	progress_total_bytes = 0;
+	if (files)
+	{
+		progress_total_files = parray_num(files);
+		for (i = 0; i < parray_num(files); i++)
+			progress_total_bytes += progress_file_size(parray_get(files, i));
+	}
+
+	pg_free(progress_threads);
+
+	progress_command = command;
+	progress_nthreads = num_threads;
+	progress_threads = (ProgressThread *)
+		pgut_malloc(sizeof(ProgressThread) * (progress_nthreads + 1));
+	for (i = 0; i <= progress_nthreads; i++)
+	{
+		for (j = 0; j < PROGRESS_NSTATS; j++)
+			pg_atomic_init_u64(&progress_threads[i].values[j], 0);
+		progress_threads[i].pending_bytes = 0;
+		progress_threads[i].pending = false;
+	}
+	pg_atomic_init_u32(&progress_next_thread, 1);
+	progress_generation++;
+	progress_active = true;
+
+	/* Times are reported to the progress file or by progress_stop() */
+	progress_timing = progress_file != NULL ||
+		STATISTICS_LEVEL >= logger_config.log_level_console ||
+		STATISTICS_LEVEL >= logger_config.log_level_file;
+
+	progress_start_time = progress_now();
+
+	if (progress_file)
+	{
+		int			rc;
+
+		progress_reporter_stop = false;
+		rc = pthread_create(&progress_reporter, NULL, progress_report, NULL);
+		if (rc != 0)
+			elog(ERROR, "Cannot start progress reporter: %s", strerror(rc));
+		progress_reporter_started = true;
+	}
+}
+
+/*
+ * Account the next part of files, which is processed by a new set of worker
+ * threads.  Threads of the previous part must be finished, the new ones
+ * take over their counters.
+ */
+void
+progress_add_files(parray *files)
+{
+	int			i;
+
+	if (!progress_active)
+		return;
+
+	progress_total_files += parray_num(files);
+	for (i = 0; i < parray_num(files); i++)
+		progress_total_bytes += progress_file_size(parray_get(files, i));
+
+	pg_atomic_write_u32(&progress_next_thread, 1);
+}
+
+/*
+ * Give own counters to the current worker thread.  Threads which are not
+ * registered share the counters of the main thread.
+ */
+void
+progress_thread_init(void)
+{
+	uint32		n;
+
+	if (!progress_active)
+		return;
+
+	n = pg_atomic_fetch_add_u32(&progress_next_thread, 1);
+	if (n > progress_nthreads)
+		return;
+
+	my_progress = &progress_threads[n];
+	my_progress_generation = progress_generation;
+}
+
+void
+progress_add(ProgressStat stat, int64 value)
+{
+	ProgressThread *thread = get_progress_thread();
+
+	if (thread != NULL)
+		pg_atomic_fetch_add_u64(&thread->values[stat], value);
+}
+
+/*
+ * Account time passed since start, which was got from progress_clock().
+ */
+void
+progress_add_time(ProgressStat stat, int64 start)
+{
+	if (start != 0)
+		progress_add(stat, progress_clock() - start);
+}
+
+/*
+ * Count the file as taken by the current thread.  The file is counted as
+ * processed when the thread takes the next one, or when statistics are
+ * stopped.
+ */
+void
+progress_file_start(pgFile *file)
+{
+	ProgressThread *thread = get_progress_thread();
+
+	if (thread == NULL || thread == progress_threads)
+		return;
+
+	if (thread->pending)
+	{
+		pg_atomic_fetch_add_u64(&thread->values[PROGRESS_FILES], 1);
+		pg_atomic_fetch_add_u64(&thread->values[PROGRESS_PROCESSED_BYTES],
+								thread->pending_bytes);
+	}
+	thread->pending_bytes = progress_file_size(file);
+	thread->pending = true;
+}
+
+/*
+ * Sum of the statistic over all threads.
+ */
+static int64
+progress_total(ProgressStat stat)
+{
+	int64		total = 0;
+	int			i;
+
+	for (i = 0; i <= progress_nthreads; i++)
+		total += pg_atomic_read_u64(&progress_threads[i].values[stat]);
+	return total;
+}
+
+/*
+ * Stop collecting statistics.  Must be called after worker threads have
+ * exited.  The counters stay available for progress_summary().
+ */
+void
+progress_stop(void)
+{
+	int			i;
+	int64		elapsed;
+	int64		read_bytes;
+	int64		written_bytes;
+
+	if (!progress_active)
+		return;
+
+	/* Files being processed by exited threads are done */
+	for (i = 1; i <= progress_nthreads; i++)
+	{
+		ProgressThread *thread = &progress_threads[i];
+
+		if (!thread->pending)
+			continue;
+		pg_atomic_fetch_add_u64(&thread->values[PROGRESS_FILES], 1);
+		pg_atomic_fetch_add_u64(&thread->values[PROGRESS_PROCESSED_BYTES],
+								thread->pending_bytes);
+		thread->pending = false;
+	}
+
+	if (progress_reporter_started)
+	{
+		pthread_lock(&progress_reporter_mutex);
+		progress_reporter_stop = true;
+		pthread_cond_signal(&progress_reporter_cond);
+		pthread_mutex_unlock(&progress_reporter_mutex);
+
+		pthread_join(progress_reporter, NULL);
+		progress_reporter_started = false;
+
+		/* Leave the final statistics in the file */
+		write_progress_file();
+	}
+
+	elapsed = progress_now() - progress_start_time;
+	progress_active = false;
+
+	read_bytes = progress_total(PROGRESS_READ_BYTES);
+	written_bytes = progress_total(PROGRESS_WRITTEN_BYTES);
+
+	elog(STATISTICS_LEVEL,
+		 "Statistics of %s: " INT64_FORMAT " files, read " INT64_FORMAT
+		 " bytes, written " INT64_FORMAT " bytes in %.3f s (%.1f MB/s), "
+		 "skipped " INT64_FORMAT " of " INT64_FORMAT " data pages. "
+		 "Compress time %.3f s, network wait %.3f s, fsync time %.3f s",
+		 progress_command, progress_total(PROGRESS_FILES),
+		 read_bytes, written_bytes, elapsed / 1000000.0,
+		 elapsed > 0 ? (double) read_bytes / elapsed : 0.0,
+		 progress_total(PROGRESS_SKIPPED_PAGES),
+		 progress_total(PROGRESS_SCANNED_PAGES),
+		 progress_total(PROGRESS_COMPRESS_TIME) / 1000000.0,
+		 progress_total(PROGRESS_NETWORK_WAIT) / 1000000.0,
+		 progress_total(PROGRESS_FSYNC_TIME) / 1000000.0);
+}
+
+/*
+ * Store the final statistics of backup copying into its control file.
+ */
+void
+progress_summary(pgBackup *backup)
+{
+	if (progress_threads == NULL)
+		return;
+
+	backup->read_bytes = progress_total(PROGRESS_READ_BYTES);
+	backup->skipped_pages = progress_total(PROGRESS_SKIPPED_PAGES);
+	backup->scanned_pages = progress_total(PROGRESS_SCANNED_PAGES);
+	/* Times are stored in milliseconds, if they were measured */
+	if (!progress_timing)
+		return;
+	backup->compress_time = progress_total(PROGRESS_COMPRESS_TIME) / 1000;
+	backup->network_wait = progress_total(PROGRESS_NETWORK_WAIT) / 1000;
+	backup->fsync_time = progress_total(PROGRESS_FSYNC_TIME) / 1000;
+}
+
+/*
+ * Main routine of the progress reporter thread.
+ */
+static void *
+progress_report(void *arg)
+{
+	pthread_lock(&progress_reporter_mutex);
+
+	while (!progress_reporter_stop)
+	{
+		struct timeval now;
+		struct timespec timeout;
+
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + PROGRESS_REPORT_INTERVAL / 1000;
+		timeout.tv_nsec = now.tv_usec * 1000L +
+			(PROGRESS_REPORT_INTERVAL % 1000) * 1000000L;
+		timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+		timeout.tv_nsec %= 1000000000L;
+
+		pthread_cond_timedwait(&progress_reporter_cond,
+							   &progress_reporter_mutex, &timeout);
+		if (progress_reporter_stop)
+			break;
+
+		pthread_mutex_unlock(&progress_reporter_mutex);
+		write_progress_file();
+		pthread_lock(&progress_reporter_mutex);
+	}
+
+	pthread_mutex_unlock(&progress_reporter_mutex);
+
+	return NULL;
+}
+
+static void
+json_add_seconds(PQExpBuffer buf, const char *name, int64 usec, int32 level)
+{
+	json_add_key(buf, name, level);
+	appendPQExpBuffer(buf, "%.3f", usec / 1000000.0);
+}
+
+static void
+json_add_stats(PQExpBuffer buf, const int64 *values, int32 level)
+{
+	int			i;
+
+	for (i = 0; i < PROGRESS_NSTATS; i++)
+	{
+		if (i == PROGRESS_COMPRESS_TIME || i == PROGRESS_NETWORK_WAIT ||
+			i == PROGRESS_FSYNC_TIME)
+			json_add_seconds(buf, stat_names[i], values[i], level);
+		else
+		{
+			json_add_key(buf, stat_names[i], level);
+			appendPQExpBuffer(buf, INT64_FORMAT, values[i]);
+		}
+	}
+}
+
+/*
+ * Dump current statistics into the progress file.  The file is written
+ * under a temporary name and renamed, so readers never see partial data.
+ */
+static void
+write_progress_file(void)
+{
+	PQExpBufferData buf;
+	int32		json_level = 0;
+	int64		totals[PROGRESS_NSTATS];
+	int64		elapsed;
+	char		tmp_path[MAXPGPATH];
+	FILE	   *out;
+	int			i,
+				j;
+
+	elapsed = progress_now() - progress_start_time;
+	for (j = 0; j < PROGRESS_NSTATS; j++)
+		totals[j] = progress_total(j);
+
+	initPQExpBuffer(&buf);
+	json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+
+	json_add_value(&buf, "command", progress_command, json_level, true);
+	json_add_seconds(&buf, "elapsed", elapsed, json_level);
+
+	json_add_key(&buf, "total-files", json_level);
+	appendPQExpBuffer(&buf, INT64_FORMAT, progress_total_files);
+	json_add_key(&buf, "total-bytes", json_level);
+	appendPQExpBuffer(&buf, INT64_FORMAT, progress_total_bytes);
+
+	json_add_stats(&buf, totals, json_level);
+
+	json_add_key(&buf, "read-rate", json_level);
+	appendPQExpBuffer(&buf, INT64_FORMAT, elapsed > 0 ?
+					  (int64) (totals[PROGRESS_READ_BYTES] * 1000000.0 / elapsed) : 0);
+	json_add_key(&buf, "write-rate", json_level);
+	appendPQExpBuffer(&buf, INT64_FORMAT, elapsed > 0 ?
+					  (int64) (totals[PROGRESS_WRITTEN_BYTES] * 1000000.0 / elapsed) : 0);
+
+	json_add_key(&buf, "compress-ratio", json_level);
+	appendPQExpBuffer(&buf, "%.2f", totals[PROGRESS_WRITTEN_BYTES] > 0 ?
+					  (double) totals[PROGRESS_READ_BYTES] / totals[PROGRESS_WRITTEN_BYTES] : 1.0);
+
+	/* Share of data file pages not copied by incremental backup */
+	json_add_key(&buf, "skip-rate", json_level);
+	appendPQExpBuffer(&buf, "%.3f", totals[PROGRESS_SCANNED_PAGES] > 0 ?
+					  (double) totals[PROGRESS_SKIPPED_PAGES] / totals[PROGRESS_SCANNED_PAGES] : 0.0);
+
+	/* Estimate remaining time by the size of processed files */
+	json_add_key(&buf, "eta", json_level);
+	if (totals[PROGRESS_PROCESSED_BYTES] > 0)
+		appendPQExpBuffer(&buf, "%.0f",
+						  Max(progress_total_bytes - totals[PROGRESS_PROCESSED_BYTES], 0) *
+						  (elapsed / 1000000.0) / totals[PROGRESS_PROCESSED_BYTES]);
+	else
+		appendPQExpBufferStr(&buf, "null");
+
+	json_add_key(&buf, "threads", json_level);
+	json_add(&buf, JT_BEGIN_ARRAY, &json_level);
+	for (i = 0; i <= progress_nthreads; i++)
+	{
+		int64		values[PROGRESS_NSTATS];
+
+		for (j = 0; j < PROGRESS_NSTATS; j++)
+			values[j] = pg_atomic_read_u64(&progress_threads[i].values[j]);
+
+		if (i != 0)
+			appendPQExpBufferChar(&buf, ',');
+		json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+		json_add_key(&buf, "thread", json_level);
+		appendPQExpBuffer(&buf, "%d", i);
+		json_add_stats(&buf, values, json_level);
+		json_add(&buf, JT_END_OBJECT, &json_level);
+	}
+	json_add(&buf, JT_END_ARRAY, &json_level);
+
+	json_add(&buf, JT_END_OBJECT, &json_level);
+
+	snprintf(tmp_path, MAXPGPATH, "%s.tmp", progress_file);
+	out = fopen(tmp_path, PG_BINARY_W);
+	if (out == NULL)
+	{
+		elog(WARNING, "Cannot open progress file \"%s\": %s",
+			 tmp_path, strerror(errno));
+		termPQExpBuffer(&buf);
+		return;
+	}
+
+	if (fwrite(buf.data, 1, buf.len, out) != buf.len)
+	{
+		elog(WARNING, "Cannot write progress file \"%s\": %s",
+			 tmp_path, strerror(errno));
+		fclose(out);
+	}
+	else if (fclose(out) != 0)
+		elog(WARNING, "Cannot write progress file \"%s\": %s",
+			 tmp_path, strerror(errno));
+	else if (rename(tmp_path, progress_file) != 0)
+		elog(WARNING, "Cannot rename progress file \"%s\" to \"%s\": %s",
+			 tmp_path, progress_file, strerror(errno));
+
+	termPQExpBuffer(&buf);
+}
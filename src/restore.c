@@ -17,14 +17,22 @@
 
 #include "utils/thread.h"
 
+/* Backup of the chain being restored */
 typedef struct
 {
-	parray	   *files;
 	pgBackup   *backup;
+	parray	   *files;			/* sorted by pgFileCompareRelPathWithExternal */
 	parray	   *external_dirs;
-	char	   *external_prefix;
+	char		database_path[MAXPGPATH];
+} restore_chain_backup;
+
+typedef struct
+{
+	restore_chain_backup *chain;	/* from FULL backup to the destination one */
+	int			chain_len;
 	parray	   *dest_external_dirs;
 	parray	   *dest_files;
+	ThreadTasks *tasks;			/* queue of dest_files entries */
 
 	/*
 	 * Return value from the thread.
@@ -33,8 +41,14 @@ typedef struct
 	int			ret;
 } restore_files_arg;
 
-static void restore_backup(pgBackup *backup, parray *dest_external_dirs,
-						   parray *dest_files);
+static void restore_chain(parray *parent_chain, parray *dest_external_dirs,
+						  parray *dest_files);
+static void prepare_incremental_restore(pgBackup *dest_backup,
+										parray *dest_files,
+										parray *dest_external_dirs);
+static void remove_stale_files(parray *dest_files, const char *root,
+							   int external_dir_num);
+static void prepare_tablespace_links(pgBackup *dest_backup);
 static void create_recovery_conf(time_t backup_id,
 								 pgRecoveryTarget *rt,
 								 pgBackup *backup);
@@ -65,7 +79,8 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 			elog(ERROR,
 				"required parameter not specified: PGDATA (-D, --pgdata)");
 		/* Check if restore destination empty */
-		if (!dir_is_empty(instance_config.pgdata, FIO_DB_HOST))
+		if (!incremental_restore &&
+			!dir_is_empty(instance_config.pgdata, FIO_DB_HOST))
 			elog(ERROR, "restore destination is not empty: \"%s\"",
 				 instance_config.pgdata);
 	}
@@ -288,11 +303,11 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 	 */
 	if (is_restore)
 	{
-		check_tablespace_mapping(dest_backup);
+		check_tablespace_mapping(dest_backup, incremental_restore);
 
 		/* no point in checking external directories if their restore is not resquested */
 		if (!skip_external_dirs)
-			check_external_dir_mapping(dest_backup);
+			check_external_dir_mapping(dest_backup, incremental_restore);
 	}
 
 	/* At this point we are sure that parent chain is whole
@@ -437,6 +452,15 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 										FIO_BACKUP_HOST);
 		parray_qsort(dest_files, pgFileCompareRelPathWithExternal);
 
+		if (dest_backup->external_dir_str && !skip_external_dirs)
+			dest_external_dirs = make_external_directory_list(
+												dest_backup->external_dir_str,
+												true);
+
+		if (incremental_restore)
+			prepare_incremental_restore(dest_backup, dest_files,
+										dest_external_dirs);
+
 		/*
 		 * Restore dest_backup internal directories.
 		 */
@@ -448,11 +472,8 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 		/*
 		 * Restore dest_backup external directories.
 		 */
-		if (dest_backup->external_dir_str && !skip_external_dirs)
+		if (dest_external_dirs)
 		{
-			dest_external_dirs = make_external_directory_list(
-												dest_backup->external_dir_str,
-												true);
 			if (parray_num(dest_external_dirs) > 0)
 				elog(LOG, "Restore external directories");
 
@@ -462,7 +483,7 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 		}
 
 		/*
-		 * At least restore backups files starting from the parent backup.
+		 * Restore files of the whole chain starting from the parent backup.
 		 */
 		for (i = parray_num(parent_chain) - 1; i >= 0; i--)
 		{
@@ -480,10 +501,10 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 			 */
 			if (rt->no_validate && !lock_backup(backup))
 				elog(ERROR, "Cannot lock backup directory");
-
-			restore_backup(backup, dest_external_dirs, dest_files);
 		}
 
+		restore_chain(parent_chain, dest_external_dirs, dest_files);
+
 		if (dest_external_dirs != NULL)
 			free_dir_list(dest_external_dirs);
 
@@ -505,121 +526,141 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 }
 
 /*
- * Restore one backup.
+ * Restore the chain of backups "parent_chain" (from the destination backup
+ * to FULL backup) in one pass. Every destination file is restored once:
+ * regular files are copied from the newest backup which contains them and
+ * blocks of data files are merged across the chain by
+ * restore_data_file_chain().
  */
-void
-restore_backup(pgBackup *backup, parray *dest_external_dirs, parray *dest_files)
+static void
+restore_chain(parray *parent_chain, parray *dest_external_dirs,
+			  parray *dest_files)
 {
-	char		timestamp[100];
-	char		database_path[MAXPGPATH];
-	char		external_prefix[MAXPGPATH];
-	char		list_path[MAXPGPATH];
-	parray	   *files;
-	parray	   *external_dirs = NULL;
+	restore_chain_backup *chain;
+	int			chain_len = parray_num(parent_chain);
 	int			i;
+	int			j;
 	/* arrays with meta info for multi threaded backup */
 	pthread_t  *threads;
 	restore_files_arg *threads_args;
+	ThreadTasks *tasks;
 	bool		restore_isok = true;
 
-	if (backup->status != BACKUP_STATUS_OK &&
-		backup->status != BACKUP_STATUS_DONE)
-		elog(ERROR, "Backup %s cannot be restored because it is not valid",
-			 base36enc(backup->start_time));
-
-	/* confirm block size compatibility */
-	if (backup->block_size != BLCKSZ)
-		elog(ERROR,
-			"BLCKSZ(%d) is not compatible(%d expected)",
-			backup->block_size, BLCKSZ);
-	if (backup->wal_block_size != XLOG_BLCKSZ)
-		elog(ERROR,
-			"XLOG_BLCKSZ(%d) is not compatible(%d expected)",
-			backup->wal_block_size, XLOG_BLCKSZ);
+	chain = pgut_newarray(restore_chain_backup, chain_len);
 
-	time2iso(timestamp, lengthof(timestamp), backup->start_time);
-	elog(LOG, "Restoring database from backup %s", timestamp);
+	for (j = 0; j < chain_len; j++)
+	{
+		restore_chain_backup *item = &chain[j];
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain,
+													 chain_len - 1 - j);
+		char		timestamp[100];
+		char		external_prefix[MAXPGPATH];
+		char		list_path[MAXPGPATH];
+
+		if (backup->status != BACKUP_STATUS_OK &&
+			backup->status != BACKUP_STATUS_DONE)
+			elog(ERROR, "Backup %s cannot be restored because it is not valid",
+				 base36enc(backup->start_time));
+
+		/* confirm block size compatibility */
+		if (backup->block_size != BLCKSZ)
+			elog(ERROR,
+				"BLCKSZ(%d) is not compatible(%d expected)",
+				backup->block_size, BLCKSZ);
+		if (backup->wal_block_size != XLOG_BLCKSZ)
+			elog(ERROR,
+				"XLOG_BLCKSZ(%d) is not compatible(%d expected)",
+				backup->wal_block_size, XLOG_BLCKSZ);
 
-	if (backup->external_dir_str)
-		external_dirs = make_external_directory_list(backup->external_dir_str,
-													 true);
+		time2iso(timestamp, lengthof(timestamp), backup->start_time);
+		elog(LOG, "Reading file list of backup %s", timestamp);
 
-	/*
-	 * Get list of files which need to be restored.
-	 */
-	pgBackupGetPath(backup, database_path, lengthof(database_path), DATABASE_DIR);
-	pgBackupGetPath(backup, external_prefix, lengthof(external_prefix),
-					EXTERNAL_DIR);
-	pgBackupGetPath(backup, list_path, lengthof(list_path), DATABASE_FILE_LIST);
-	files = dir_read_file_list(database_path, external_prefix, list_path,
-							   FIO_BACKUP_HOST);
+		item->backup = backup;
+		item->external_dirs = NULL;
+		if (backup->external_dir_str)
+			item->external_dirs = make_external_directory_list(backup->external_dir_str,
+															   true);
 
-	/* Restore directories in do_backup_instance way */
-	parray_qsort(files, pgFileComparePath);
+		/*
+		 * Get list of files which need to be restored.
+		 */
+		pgBackupGetPath(backup, item->database_path,
+						lengthof(item->database_path), DATABASE_DIR);
+		pgBackupGetPath(backup, external_prefix, lengthof(external_prefix),
+						EXTERNAL_DIR);
+		pgBackupGetPath(backup, list_path, lengthof(list_path), DATABASE_FILE_LIST);
+		item->files = dir_read_file_list(item->database_path, external_prefix,
+										 list_path, FIO_BACKUP_HOST);
 
-	/*
-	 * Make external directories before restore
-	 * and setup threads at the same time
-	 */
-	for (i = 0; i < parray_num(files); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files, i);
+		/* Restore directories in do_backup_instance way */
+		parray_qsort(item->files, pgFileComparePath);
 
 		/*
-		 * If the entry was an external directory, create it in the backup.
+		 * Make external directories before restore
 		 */
-		if (!skip_external_dirs &&
-			file->external_dir_num && S_ISDIR(file->mode) &&
-			/* Do not create unnecessary external directories */
-			parray_bsearch(dest_files, file, pgFileCompareRelPathWithExternal))
+		for (i = 0; i < parray_num(item->files); i++)
 		{
-			char	   *external_path;
-
-			if (!external_dirs ||
-				parray_num(external_dirs) < file->external_dir_num - 1)
-				elog(ERROR, "Inconsistent external directory backup metadata");
+			pgFile	   *file = (pgFile *) parray_get(item->files, i);
 
-			external_path = parray_get(external_dirs,
-									   file->external_dir_num - 1);
-			if (backup_contains_external(external_path, dest_external_dirs))
+			/*
+			 * If the entry was an external directory, create it in the backup.
+			 */
+			if (!skip_external_dirs &&
+				file->external_dir_num && S_ISDIR(file->mode) &&
+				/* Do not create unnecessary external directories */
+				parray_bsearch(dest_files, file, pgFileCompareRelPathWithExternal))
 			{
-				char		container_dir[MAXPGPATH];
-				char		dirpath[MAXPGPATH];
-				char	   *dir_name;
-
-				makeExternalDirPathByNum(container_dir, external_prefix,
-										file->external_dir_num);
-				dir_name = GetRelativePath(file->path, container_dir);
-				elog(VERBOSE, "Create directory \"%s\"", dir_name);
-				join_path_components(dirpath, external_path, dir_name);
-				fio_mkdir(dirpath, DIR_PERMISSION, FIO_DB_HOST);
+				char	   *external_path;
+
+				if (!item->external_dirs ||
+					parray_num(item->external_dirs) < file->external_dir_num - 1)
+					elog(ERROR, "Inconsistent external directory backup metadata");
+
+				external_path = parray_get(item->external_dirs,
+										   file->external_dir_num - 1);
+				if (backup_contains_external(external_path, dest_external_dirs))
+				{
+					char		container_dir[MAXPGPATH];
+					char		dirpath[MAXPGPATH];
+					char	   *dir_name;
+
+					makeExternalDirPathByNum(container_dir, external_prefix,
+											file->external_dir_num);
+					dir_name = GetRelativePath(file->path, container_dir);
+					elog(VERBOSE, "Create directory \"%s\"", dir_name);
+					join_path_components(dirpath, external_path, dir_name);
+					fio_mkdir(dirpath, DIR_PERMISSION, FIO_DB_HOST);
+				}
 			}
 		}
 
-		/* setup threads */
-		pg_atomic_clear_flag(&file->lock);
+		/* Files are looked up by destination files */
+		parray_qsort(item->files, pgFileCompareRelPathWithExternal);
 	}
+
+	/* setup threads */
+	tasks = pgFileTasksCreate(dest_files, false);
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (restore_files_arg *) palloc(sizeof(restore_files_arg) *
 												num_threads);
 
 	/* Restore files into target directory */
 	thread_interrupted = false;
+	progress_start("restore", dest_files, false);
 	for (i = 0; i < num_threads; i++)
 	{
 		restore_files_arg *arg = &(threads_args[i]);
 
-		arg->files = files;
-		arg->backup = backup;
-		arg->external_dirs = external_dirs;
-		arg->external_prefix = external_prefix;
+		arg->chain = chain;
+		arg->chain_len = chain_len;
 		arg->dest_external_dirs = dest_external_dirs;
 		arg->dest_files = dest_files;
+		arg->tasks = tasks;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
 
 		/* Useless message TODO: rewrite */
-		elog(LOG, "Start thread for num:%zu", parray_num(files));
+		elog(LOG, "Start thread for num:%zu", parray_num(dest_files));
 
 		pthread_create(&threads[i], NULL, restore_files, arg);
 	}
@@ -631,6 +672,10 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs, parray *dest_files)
 		if (threads_args[i].ret == 1)
 			restore_isok = false;
 	}
+	thread_tasks_free(tasks);
+	if (restore_isok)
+		sync_copied_files();
+	progress_stop();
 	if (!restore_isok)
 		elog(ERROR, "Data files restoring failed");
 
@@ -638,13 +683,218 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs, parray *dest_files)
 	pfree(threads_args);
 
 	/* cleanup */
+	for (j = 0; j < chain_len; j++)
+	{
+		parray_walk(chain[j].files, pgFileFree);
+		parray_free(chain[j].files);
+
+		if (chain[j].external_dirs != NULL)
+			free_dir_list(chain[j].external_dirs);
+
+		elog(LOG, "Restore %s backup completed",
+			 base36enc(chain[j].backup->start_time));
+	}
+	pg_free(chain);
+}
+
+/*
+ * Prepare non-empty PGDATA for incremental restore. Remove files and
+ * directories which are not present in the destination backup, so that
+ * the result is the same as if the backup was restored into an empty
+ * directory. The same is done for the directories of tablespaces and
+ * external directories the backup is restored into. Symbolic links to
+ * tablespaces are removed as well, they are created again by
+ * create_data_directories().
+ */
+static void
+prepare_incremental_restore(pgBackup *dest_backup, parray *dest_files,
+							parray *dest_external_dirs)
+{
+	char		path[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *dir_ent;
+	int			i;
+
+	join_path_components(path, instance_config.pgdata, "postmaster.pid");
+	if (fio_access(path, F_OK, FIO_DB_HOST) == 0)
+		elog(ERROR, "Cannot do incremental restore into \"%s\": postmaster.pid exists, "
+			 "the server must be stopped", instance_config.pgdata);
+
+	elog(INFO, "Incremental restore into \"%s\"", instance_config.pgdata);
+
+	/* Tablespaces are cleaned through the links in pg_tblspc */
+	prepare_tablespace_links(dest_backup);
+
+	remove_stale_files(dest_files, instance_config.pgdata, 0);
+
+	if (dest_external_dirs)
+	{
+		for (i = 0; i < parray_num(dest_external_dirs); i++)
+		{
+			char	   *external_path = parray_get(dest_external_dirs, i);
+
+			if (fio_access(external_path, F_OK, FIO_DB_HOST) == 0)
+				remove_stale_files(dest_files, external_path, i + 1);
+		}
+	}
+
+	/* remove symbolic links to tablespaces */
+	join_path_components(path, instance_config.pgdata, PG_TBLSPC_DIR);
+	dir = fio_opendir(path, FIO_DB_HOST);
+	if (dir == NULL)
+	{
+		if (errno == ENOENT)
+			return;
+		elog(ERROR, "Cannot open directory \"%s\": %s", path, strerror(errno));
+	}
+
+	while ((dir_ent = fio_readdir(dir)))
+	{
+		char		link_path[MAXPGPATH];
+		struct stat	st;
+
+		if (strcmp(dir_ent->d_name, ".") == 0 ||
+			strcmp(dir_ent->d_name, "..") == 0)
+			continue;
+
+		join_path_components(link_path, path, dir_ent->d_name);
+		if (fio_stat(link_path, &st, false, FIO_DB_HOST) == 0 &&
+			S_ISLNK(st.st_mode) &&
+			fio_unlink(link_path, FIO_DB_HOST) < 0)
+			elog(ERROR, "Cannot remove symbolic link \"%s\": %s",
+				 link_path, strerror(errno));
+	}
+	fio_closedir(dir);
+}
+
+/*
+ * Remove entries of directory "root" which are not present in the
+ * destination backup. "external_dir_num" is the number of external
+ * directory the root is restored from, 0 for PGDATA.
+ */
+static void
+remove_stale_files(parray *dest_files, const char *root, int external_dir_num)
+{
+	parray	   *files = parray_new();
+	int			i;
+
+	dir_list_file(files, root, false, true, false, external_dir_num,
+				  FIO_DB_HOST);
+
+	/* remove files before their directories */
+	parray_qsort(files, pgFileComparePathDesc);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		pgFile	  **dest_file;
+
+		dest_file = (pgFile **) parray_bsearch(dest_files, file,
+											   pgFileCompareRelPathWithExternal);
+
+		/* tablespace_map is not restored */
+		if (dest_file &&
+			S_ISDIR(file->mode) == S_ISDIR((*dest_file)->mode) &&
+			!(external_dir_num == 0 &&
+			  path_is_prefix_of_path(PG_TABLESPACE_MAP_FILE, file->rel_path)))
+			continue;
+
+		elog(VERBOSE, "Remove \"%s\", it is not present in the backup",
+			 file->path);
+		if (fio_unlink(file->path, FIO_DB_HOST) < 0)
+			elog(ERROR, "Cannot remove \"%s\": %s", file->path, strerror(errno));
+	}
+
 	parray_walk(files, pgFileFree);
 	parray_free(files);
+}
+
+/*
+ * Make every link in pg_tblspc point to the directory the tablespace of the
+ * destination backup is restored into, so that the contents of the
+ * directory is listed and cleaned along with PGDATA. Links to other
+ * directories are removed without touching their contents.
+ */
+static void
+prepare_tablespace_links(pgBackup *dest_backup)
+{
+	char		backup_path[MAXPGPATH];
+	char		tblspc_path[MAXPGPATH];
+	parray	   *links = parray_new();
+	DIR		   *dir;
+	struct dirent *dir_ent;
+	int			i;
+
+	pgBackupGetPath(dest_backup, backup_path, lengthof(backup_path), NULL);
+	read_tablespace_map(links, backup_path);
+	parray_qsort(links, pgFileCompareName);
+
+	join_path_components(tblspc_path, instance_config.pgdata, PG_TBLSPC_DIR);
+
+	dir = fio_opendir(tblspc_path, FIO_DB_HOST);
+	if (dir == NULL && errno != ENOENT)
+		elog(ERROR, "Cannot open directory \"%s\": %s", tblspc_path,
+			 strerror(errno));
+
+	while (dir && (dir_ent = fio_readdir(dir)))
+	{
+		char		link_path[MAXPGPATH];
+		struct stat	st;
+		struct stat	link_st;
+		struct stat	target_st;
+		pgFile		key;
+		pgFile	   *keyp = &key;
+		pgFile	  **link;
+
+		if (strcmp(dir_ent->d_name, ".") == 0 ||
+			strcmp(dir_ent->d_name, "..") == 0)
+			continue;
+
+		join_path_components(link_path, tblspc_path, dir_ent->d_name);
+		if (fio_stat(link_path, &st, false, FIO_DB_HOST) < 0 ||
+			!S_ISLNK(st.st_mode))
+			continue;
 
-	if (external_dirs != NULL)
-		free_dir_list(external_dirs);
+		/* keep the link if it leads to the directory we restore into */
+		MemSet(&key, 0, sizeof(key));
+		key.name = dir_ent->d_name;
+		link = (pgFile **) parray_bsearch(links, keyp, pgFileCompareName);
+		if (link &&
+			fio_stat(link_path, &link_st, true, FIO_DB_HOST) == 0 &&
+			fio_stat(get_tablespace_mapping((*link)->linked), &target_st,
+					 true, FIO_DB_HOST) == 0 &&
+			link_st.st_dev == target_st.st_dev &&
+			link_st.st_ino == target_st.st_ino)
+			continue;
+
+		elog(VERBOSE, "Remove symbolic link \"%s\"", link_path);
+		if (fio_unlink(link_path, FIO_DB_HOST) < 0)
+			elog(ERROR, "Cannot remove symbolic link \"%s\": %s",
+				 link_path, strerror(errno));
+	}
+	if (dir)
+		fio_closedir(dir);
+
+	/* link the directories which were not linked yet */
+	for (i = 0; i < parray_num(links); i++)
+	{
+		pgFile	   *link = (pgFile *) parray_get(links, i);
+		const char *linked_path = get_tablespace_mapping(link->linked);
+		char		link_path[MAXPGPATH];
+
+		join_path_components(link_path, tblspc_path, link->name);
+		if (fio_access(link_path, F_OK, FIO_DB_HOST) == 0 ||
+			fio_access(linked_path, F_OK, FIO_DB_HOST) < 0)
+			continue;
+
+		fio_mkdir(tblspc_path, DIR_PERMISSION, FIO_DB_HOST);
+		if (fio_symlink(linked_path, link_path, FIO_DB_HOST) < 0)
+			elog(ERROR, "Could not create symbolic link \"%s\": %s",
+				 link_path, strerror(errno));
+	}
 
-	elog(LOG, "Restore %s backup completed", base36enc(backup->start_time));
+	parray_walk(links, pgFileFree);
+	parray_free(links);
 }
 
 /*
@@ -653,19 +903,24 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs, parray *dest_files)
 static void *
 restore_files(void *arg)
 {
-	int			i;
+	int			i = -1;
 	restore_files_arg *arguments = (restore_files_arg *)arg;
+	pgFile	  **files;
+	pgBackup  **backups;
 
-	for (i = 0; i < parray_num(arguments->files); i++)
-	{
-		char		from_root[MAXPGPATH];
-		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
+	files = pgut_newarray(pgFile *, arguments->chain_len);
+	backups = pgut_newarray(pgBackup *, arguments->chain_len);
+	progress_thread_init();
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
+	while ((i = thread_tasks_next(arguments->tasks, i)) >= 0)
+	{
+		pgFile	   *dest_file = (pgFile *) parray_get(arguments->dest_files, i);
+		restore_chain_backup *item = NULL;
+		pgFile	   *file = NULL;
+		int			nfiles = 0;
+		int			j;
 
-		pgBackupGetPath(arguments->backup, from_root,
-						lengthof(from_root), DATABASE_DIR);
+		progress_file_start(dest_file);
 
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
@@ -673,47 +928,44 @@ restore_files(void *arg)
 
 		if (progress)
 			elog(INFO, "Progress: (%d/%lu). Process file %s ",
-				 i + 1, (unsigned long) parray_num(arguments->files),
-				 file->rel_path);
-
-		/*
-		 * For PAGE and PTRACK backups skip datafiles which haven't changed
-		 * since previous backup and thus were not backed up.
-		 * We cannot do the same when restoring DELTA backup because we need information
-		 * about every datafile to correctly truncate them.
-		 */
-		if (file->write_size == BYTES_INVALID)
-		{
-			/* data file, only PAGE and PTRACK can skip */
-			if (((file->is_datafile && !file->is_cfs) &&
-				(arguments->backup->backup_mode == BACKUP_MODE_DIFF_PAGE ||
-				 arguments->backup->backup_mode == BACKUP_MODE_DIFF_PTRACK)) ||
-				/* non-data file can be skipped regardless of backup type */
-				!(file->is_datafile && !file->is_cfs))
-			{
-				elog(VERBOSE, "The file didn`t change. Skip restore: \"%s\"", file->path);
-				continue;
-			}
-		}
+				 i + 1, (unsigned long) parray_num(arguments->dest_files),
+				 dest_file->rel_path);
 
 		/* Directories were created before */
-		if (S_ISDIR(file->mode))
+		if (S_ISDIR(dest_file->mode))
 			continue;
 
 		/* Do not restore tablespace_map file */
-		if (path_is_prefix_of_path(PG_TABLESPACE_MAP_FILE, file->rel_path))
+		if (path_is_prefix_of_path(PG_TABLESPACE_MAP_FILE, dest_file->rel_path))
 		{
 			elog(VERBOSE, "Skip tablespace_map");
 			continue;
 		}
 
 		/* Do no restore external directory file if a user doesn't want */
-		if (skip_external_dirs && file->external_dir_num > 0)
+		if (skip_external_dirs && dest_file->external_dir_num > 0)
 			continue;
 
-		/* Skip unnecessary file */
-		if (parray_bsearch(arguments->dest_files, file,
-						   pgFileCompareRelPathWithExternal) == NULL)
+		/* Summaries of streamed WAL segments are used only for validation */
+		if (path_is_prefix_of_path(PG_XLOG_DIR, dest_file->rel_path) &&
+			IsXLogSummaryFileName(dest_file->name))
+			continue;
+
+		/* Find the file in every backup of the chain */
+		for (j = 0; j < arguments->chain_len; j++)
+		{
+			pgFile	  **file_item;
+
+			file_item = (pgFile **) parray_bsearch(arguments->chain[j].files,
+												   dest_file,
+												   pgFileCompareRelPathWithExternal);
+			files[j] = file_item ? *file_item : NULL;
+			backups[j] = arguments->chain[j].backup;
+			if (files[j])
+				nfiles++;
+		}
+
+		if (nfiles == 0)
 			continue;
 
 		/*
@@ -722,22 +974,47 @@ restore_files(void *arg)
 		 * block and have BackupPageHeader meta information, so we cannot just
 		 * copy the file from backup.
 		 */
-		elog(VERBOSE, "Restoring file %s, is_datafile %i, is_cfs %i",
-			 file->path, file->is_datafile?1:0, file->is_cfs?1:0);
-		if (file->is_datafile && !file->is_cfs)
+		if (dest_file->is_datafile && !dest_file->is_cfs)
 		{
 			char		to_path[MAXPGPATH];
 
+			elog(VERBOSE, "Restoring data file %s from %d backups",
+				 dest_file->rel_path, nfiles);
+
 			join_path_components(to_path, instance_config.pgdata,
-								 file->rel_path);
-			restore_data_file(to_path, file,
-							  arguments->backup->backup_mode == BACKUP_MODE_DIFF_DELTA,
-							  false,
-							  parse_program_version(arguments->backup->program_version));
+								 dest_file->rel_path);
+			restore_data_file_chain(to_path, files, backups,
+									arguments->chain_len, incremental_restore);
+			continue;
+		}
+
+		/*
+		 * Other files are copied as a whole, so only the newest copy of
+		 * the file matters. Unchanged files were not backed up.
+		 */
+		for (j = arguments->chain_len - 1; j >= 0; j--)
+		{
+			if (files[j] && files[j]->write_size != BYTES_INVALID)
+			{
+				item = &arguments->chain[j];
+				file = files[j];
+				break;
+			}
 		}
-		else if (file->external_dir_num)
+
+		if (file == NULL)
 		{
-			char	   *external_path = parray_get(arguments->external_dirs,
+			elog(VERBOSE, "The file didn`t change. Skip restore: \"%s\"",
+				 dest_file->rel_path);
+			continue;
+		}
+
+		elog(VERBOSE, "Restoring file %s, is_datafile %i, is_cfs %i",
+			 file->path, file->is_datafile?1:0, file->is_cfs?1:0);
+
+		if (file->external_dir_num)
+		{
+			char	   *external_path = parray_get(item->external_dirs,
 												   file->external_dir_num - 1);
 			if (backup_contains_external(external_path,
 										 arguments->dest_external_dirs))
@@ -745,20 +1022,28 @@ restore_files(void *arg)
 						  external_path, FIO_DB_HOST, file, false);
 		}
 		else if (strcmp(file->name, "pg_control") == 0)
-			copy_pgcontrol_file(from_root, FIO_BACKUP_HOST,
+			copy_pgcontrol_file(item->database_path, FIO_BACKUP_HOST,
 								instance_config.pgdata, FIO_DB_HOST,
 								file);
+#ifdef HAVE_LIBZ
+		else if (path_is_prefix_of_path(PG_XLOG_DIR, file->rel_path) &&
+				 IsCompressedXLogFileName(file->name))
+			restore_compressed_wal_file(instance_config.pgdata, FIO_DB_HOST,
+										file);
+#endif
 		else
 			copy_file(FIO_BACKUP_HOST,
 					  instance_config.pgdata, FIO_DB_HOST,
 					  file, false);
 
 		/* print size of restored file */
-		if (file->write_size != BYTES_INVALID)
-			elog(VERBOSE, "Restored file %s : " INT64_FORMAT " bytes",
-				 file->path, file->write_size);
+		elog(VERBOSE, "Restored file %s : " INT64_FORMAT " bytes",
+			 file->path, file->write_size);
 	}
 
+	pg_free(files);
+	pg_free(backups);
+
 	/* Data files restoring is successful */
 	arguments->ret = 0;
 
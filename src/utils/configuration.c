@@ -471,6 +471,48 @@ config_get_opt(int argc, char **argv, ConfigOption cmd_options[],
 	return optind;
 }
 
+/*
+ * Assign the option specified by the single line of configuration file.
+ * Return number of parsed options, i.e. 0 or 1.
+ */
+static int
+config_parse_line(char *buf, const char *path, ConfigOption options[],
+				  int elevel, bool strict)
+{
+	char		key[1024];
+	char		value[1024];
+	size_t		i;
+
+	for (i = strlen(buf); i > 0 && IsSpace(buf[i - 1]); i--)
+		buf[i - 1] = '\0';
+
+	if (!parse_pair(buf, key, value))
+		return 0;
+
+	for (i = 0; options[i].type; i++)
+	{
+		ConfigOption *opt = &options[i];
+
+		if (key_equals(key, opt->lname))
+		{
+			if (opt->allowed < SOURCE_FILE &&
+				opt->allowed != SOURCE_FILE_STRICT)
+				elog(elevel, "Option %s cannot be specified in file",
+					 opt->lname);
+			else if (opt->source <= SOURCE_FILE)
+			{
+				assign_option(opt, value, SOURCE_FILE);
+				return 1;
+			}
+			return 0;
+		}
+	}
+	if (strict)
+		elog(elevel, "Invalid option \"%s\" in file \"%s\"", key, path);
+
+	return 0;
+}
+
 /*
  * Get configuration from configuration file.
  * Return number of parsed options.
@@ -481,8 +523,6 @@ config_read_opt(const char *path, ConfigOption options[], int elevel,
 {
 	FILE   *fp;
 	char	buf[1024];
-	char	key[1024];
-	char	value[1024];
 	int		parsed_options = 0;
 
 	if (!options)
@@ -492,38 +532,44 @@ config_read_opt(const char *path, ConfigOption options[], int elevel,
 		return parsed_options;
 
 	while (fgets(buf, lengthof(buf), fp))
-	{
-		size_t		i;
+		parsed_options += config_parse_line(buf, path, options, elevel, strict);
 
-		for (i = strlen(buf); i > 0 && IsSpace(buf[i - 1]); i--)
-			buf[i - 1] = '\0';
+	fio_close_stream(fp);
 
-		if (parse_pair(buf, key, value))
-		{
-			for (i = 0; options[i].type; i++)
-			{
-				ConfigOption *opt = &options[i];
+	return parsed_options;
+}
 
-				if (key_equals(key, opt->lname))
-				{
-					if (opt->allowed < SOURCE_FILE &&
-						opt->allowed != SOURCE_FILE_STRICT)
-						elog(elevel, "Option %s cannot be specified in file",
-							 opt->lname);
-					else if (opt->source <= SOURCE_FILE)
-					{
-						assign_option(opt, value, SOURCE_FILE);
-						parsed_options++;
-					}
-					break;
-				}
-			}
-			if (strict && !options[i].type)
-				elog(elevel, "Invalid option \"%s\" in file \"%s\"", key, path);
+/*
+ * Get configuration from the contents of configuration file already loaded
+ * into memory. "path" is used only in messages. Lines are split in the same
+ * way as fgets() does it in config_read_opt().
+ * Return number of parsed options.
+ */
+int
+config_parse_opt_buf(const char *data, size_t len, const char *path,
+					 ConfigOption options[], int elevel, bool strict)
+{
+	char		buf[1024];
+	size_t		pos = 0;
+	int			parsed_options = 0;
+
+	if (!options)
+		return parsed_options;
+
+	while (pos < len)
+	{
+		size_t		n = 0;
+
+		while (pos < len && n < lengthof(buf) - 1)
+		{
+			buf[n++] = data[pos++];
+			if (buf[n - 1] == '\n')
+				break;
 		}
-	}
+		buf[n] = '\0';
 
-	fio_close_stream(fp);
+		parsed_options += config_parse_line(buf, path, options, elevel, strict);
+	}
 
 	return parsed_options;
 }
@@ -8,8 +8,16 @@
 #include <pthread.h>
 #endif
 
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/falloc.h>
+#endif
+
 #include "pg_probackup.h"
 #include "file.h"
+#include "thread.h"
 #include "storage/checksum.h"
 
 #define PRINTF_BUF_SIZE  1024
@@ -20,6 +28,11 @@ static __thread unsigned long fio_fdset = 0;
 static __thread void* fio_stdin_buffer;
 static __thread int fio_stdout = 0;
 static __thread int fio_stdin = 0;
+/*
+ * Version of remote agent learned by fio_agent_handshake(), 0 if agent is not
+ * started. All agents of the process are started from the same binary.
+ */
+static uint32 fio_agent_version = 0;
 
 fio_location MyLocation;
 
@@ -31,8 +44,14 @@ typedef struct
 	uint32      checksumVersion;
 	int         calg;
 	int         clevel;
+	BlockNumber startBlock; /* not sent by masters older than 2.1.4 */
+	uint32      flags;      /* FIO_SEND_* flags, not sent by older masters */
 } fio_send_request;
 
+/* Check if the field of the FIO_SEND_PAGES request was sent by master */
+#define fio_send_request_has(size, field) \
+	((size) >= offsetof(fio_send_request, field) + sizeof(((fio_send_request*)0)->field))
+
 
 /* Convert FIO pseudo handle to index in file descriptor array */
 #define fio_fileno(f) (((size_t)f - 1) | FIO_PIPE_MARKER)
@@ -107,7 +126,7 @@ static int remove_file_or_dir(char const* path)
 #endif
 
 /* Check if specified location is local for current node */
-static bool fio_is_remote(fio_location location)
+bool fio_is_remote(fio_location location)
 {
 	bool is_remote = MyLocation != FIO_LOCAL_HOST
 		&& location != FIO_LOCAL_HOST
@@ -121,6 +140,7 @@ static bool fio_is_remote(fio_location location)
 static ssize_t fio_read_all(int fd, void* buf, size_t size)
 {
 	size_t offs = 0;
+	int64 start = progress_clock();
 	while (offs < size)
 	{
 		ssize_t rc = read(fd, (char*)buf + offs, size - offs);
@@ -128,12 +148,14 @@ static ssize_t fio_read_all(int fd, void* buf, size_t size)
 			if (errno == EINTR) {
 				continue;
 			}
+			progress_add_time(PROGRESS_NETWORK_WAIT, start);
 			return rc;
 		} else if (rc == 0) {
 			break;
 		}
 		offs += rc;
 	}
+	progress_add_time(PROGRESS_NETWORK_WAIT, start);
 	return offs;
 }
 
@@ -293,6 +315,81 @@ int fio_closedir(DIR *dir)
 	}
 }
 
+/* Entry of FIO_LIST_DIR reply, followed by relative path with trailing zero */
+typedef struct
+{
+	uint32 mode;
+	uint32 path_len;
+	int64  size;
+	int64  mtime;
+} fio_list_dir_entry;
+
+/*
+ * List the whole directory tree at remote host by a single request instead
+ * of opendir/readdir/stat round trip per entry. Returns false if location is
+ * local or agent is too old, so that caller has to traverse the tree itself.
+ */
+bool fio_list_dir(char const* path, bool follow_symlinks,
+				  fio_list_dir_callback callback, void* arg, fio_location location)
+{
+	fio_header hdr;
+	size_t path_len = strlen(path) + 1;
+	char* buf;
+
+	if (!fio_is_remote(location) ||
+		fio_get_agent_version() < AGENT_LIST_DIR_VERSION)
+		return false;
+
+	hdr.cop = FIO_LIST_DIR;
+	hdr.handle = -1;
+	hdr.arg = follow_symlinks;
+	hdr.size = path_len;
+
+	IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+
+	buf = pgut_malloc(FIO_LIST_DIR_BATCH_SIZE);
+	while (true)
+	{
+		size_t pos = 0;
+
+		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		Assert(hdr.size <= FIO_LIST_DIR_BATCH_SIZE);
+		if (hdr.size > 0)
+			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
+
+		/* Whole tree is sent */
+		if (hdr.cop == FIO_LIST_DIR)
+			break;
+
+		Assert(hdr.cop == FIO_SEND);
+		while (pos < hdr.size)
+		{
+			fio_list_dir_entry entry;
+			struct stat st;
+
+			memcpy(&entry, buf + pos, sizeof(entry));
+			pos += sizeof(entry);
+
+			memset(&st, 0, sizeof(st));
+			st.st_mode = entry.mode;
+			st.st_size = entry.size;
+			st.st_mtime = entry.mtime;
+			callback(arg, buf + pos, &st);
+
+			pos += entry.path_len;
+		}
+	}
+
+	/* Agent failed to read the tree, payload contains the failed path */
+	if (hdr.arg != 0)
+		elog(ERROR, "Cannot read directory \"%s\": %s",
+			 hdr.size ? buf : path, strerror(hdr.arg));
+
+	pg_free(buf);
+	return true;
+}
+
 /* Open file */
 int fio_open(char const* path, int mode, fio_location location)
 {
@@ -396,7 +493,9 @@ int fio_fflush(FILE* f)
 	{
 		rc = fflush(f);
 		if (rc == 0) {
+			int64 start = progress_clock();
 			rc = fsync(fileno(f));
+			progress_add_time(PROGRESS_FSYNC_TIME, start);
 		}
 	}
 	return rc;
@@ -405,7 +504,14 @@ int fio_fflush(FILE* f)
 /* Sync file to the disk (does nothing for remote file) */
 int fio_flush(int fd)
 {
-	return fio_is_remote_fd(fd) ? 0 : fsync(fd);
+	int rc = 0;
+	if (!fio_is_remote_fd(fd))
+	{
+		int64 start = progress_clock();
+		rc = fsync(fd);
+		progress_add_time(PROGRESS_FSYNC_TIME, start);
+	}
+	return rc;
 }
 
 /* Close output stream */
@@ -469,6 +575,210 @@ int fio_truncate(int fd, off_t size)
 }
 
 
+/*
+ * Apply page cache hint to the file descriptor. Errors are ignored: hints
+ * don't affect correctness, and not every platform supports them.
+ */
+static void fio_cache_advise_impl(int fd, off_t offset, off_t len, int advice)
+{
+	switch (advice)
+	{
+		case FIO_ADVISE_SEQUENTIAL:
+#ifdef HAVE_POSIX_FADVISE
+			(void) posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+#endif
+			break;
+		case FIO_ADVISE_DONTNEED:
+#ifdef HAVE_POSIX_FADVISE
+			(void) posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+			break;
+		case FIO_ADVISE_WRITEBACK:
+#ifdef HAVE_SYNC_FILE_RANGE
+			(void) sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+#endif
+			break;
+	}
+}
+
+/*
+ * Give page cache hint about the range of the file, len 0 means up to the
+ * end of file. Hints are not sent to agents which don't support them.
+ */
+void fio_cache_advise(FILE* f, off_t offset, off_t len, fio_cache_advice advice)
+{
+	if (fio_is_remote_file(f))
+	{
+		struct {
+			fio_header hdr;
+			int64      range[2];
+		} req;
+
+		if (fio_get_agent_version() < AGENT_CACHE_ADVISE_VERSION)
+			return;
+
+		req.hdr.cop = FIO_CACHE_ADVISE;
+		req.hdr.handle = fio_fileno(f) & ~FIO_PIPE_MARKER;
+		req.hdr.size = sizeof(req.range);
+		req.hdr.arg = advice;
+		req.range[0] = offset;
+		req.range[1] = len;
+
+		IO_CHECK(fio_write_all(fio_stdout, &req, sizeof(req)), sizeof(req));
+	}
+	else
+	{
+		/* data written to the stream must reach the file first */
+		if (advice == FIO_ADVISE_WRITEBACK && fflush(f) != 0)
+			return;
+		fio_cache_advise_impl(fileno(f), offset, len, advice);
+	}
+}
+
+/*
+ * Deallocate the range of the file, so that it reads as zeroes. Zeroes are
+ * written if the file system can't punch holes. The file position is not
+ * changed.
+ */
+static int fio_punch_hole_impl(int fd, off_t offset, off_t len)
+{
+	static const char zeroes[BLCKSZ];
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+		return 0;
+#endif
+	while (len > 0)
+	{
+		ssize_t rc = pwrite(fd, zeroes, Min(len, (off_t) sizeof(zeroes)), offset);
+
+		if (rc <= 0)
+		{
+			if (rc == 0)
+				errno = ENOSPC;
+			return -1;
+		}
+		offset += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/*
+ * Deallocate the range of the file written through the stream "f".
+ * Returns -1 with errno ENOTSUP if the agent is too old, then the caller
+ * has to write zeroes itself. Errors of remote agent are fatal for it.
+ */
+int fio_punch_hole(FILE* f, off_t offset, off_t len)
+{
+	if (fio_is_remote_file(f))
+	{
+		struct {
+			fio_header hdr;
+			int64      range[2];
+		} req;
+
+		if (fio_get_agent_version() < AGENT_PUNCH_HOLE_VERSION)
+		{
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		req.hdr.cop = FIO_PUNCH_HOLE;
+		req.hdr.handle = fio_fileno(f) & ~FIO_PIPE_MARKER;
+		req.hdr.size = sizeof(req.range);
+		req.hdr.arg = 0;
+		req.range[0] = offset;
+		req.range[1] = len;
+
+		IO_CHECK(fio_write_all(fio_stdout, &req, sizeof(req)), sizeof(req));
+		return 0;
+	}
+	else
+	{
+		/* data written to the stream must reach the file first */
+		if (fflush(f) != 0)
+			return -1;
+		return fio_punch_hole_impl(fileno(f), offset, len);
+	}
+}
+
+/*
+ * Token buckets limiting I/O rate on every device, see fio_throttle().
+ * The table is shared by all threads of the process. Pages of remote files
+ * are accounted here when they are received, so the limit holds however
+ * many agents the threads use.
+ */
+#define FIO_RATE_BUCKETS 32
+
+typedef struct
+{
+	dev_t          dev;
+	double         tokens;    /* bytes which may be transferred right now */
+	struct timeval last;      /* time of the last refill */
+} fio_rate_bucket;
+
+static fio_rate_bucket fio_rate_buckets[FIO_RATE_BUCKETS];
+static int fio_n_rate_buckets = 0;
+static pthread_mutex_t fio_rate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Account 'size' bytes transferred from or to device 'dev' of database host
+ * and sleep if the device exceeds --max-rate. Bursts up to one second of
+ * traffic are allowed.
+ */
+void fio_throttle(dev_t dev, size_t size)
+{
+	fio_rate_bucket* bucket = NULL;
+	double rate = (double) max_rate * 1024;
+	struct timeval now;
+	double delay = 0;
+	int i;
+
+	if (max_rate == 0)
+		return;
+
+	gettimeofday(&now, NULL);
+	pthread_lock(&fio_rate_lock);
+
+	for (i = 0; i < fio_n_rate_buckets; i++)
+	{
+		if (fio_rate_buckets[i].dev == dev)
+		{
+			bucket = &fio_rate_buckets[i];
+			break;
+		}
+	}
+	if (bucket == NULL)
+	{
+		/* Too many devices: the rest share the last bucket */
+		if (fio_n_rate_buckets == FIO_RATE_BUCKETS)
+			bucket = &fio_rate_buckets[FIO_RATE_BUCKETS - 1];
+		else
+		{
+			bucket = &fio_rate_buckets[fio_n_rate_buckets++];
+			bucket->dev = dev;
+			bucket->tokens = rate;
+			bucket->last = now;
+		}
+	}
+
+	bucket->tokens += rate * ((now.tv_sec - bucket->last.tv_sec) +
+							  (now.tv_usec - bucket->last.tv_usec) / 1000000.0);
+	if (bucket->tokens > rate)
+		bucket->tokens = rate;
+	bucket->last = now;
+
+	bucket->tokens -= size;
+	if (bucket->tokens < 0)
+		delay = -bucket->tokens / rate;
+
+	pthread_mutex_unlock(&fio_rate_lock);
+
+	if (delay > 0)
+		pg_usleep((long) (delay * 1000000));
+}
+
 /*
  * Read file from specified location.
  */
@@ -1114,8 +1424,486 @@ static void fio_send_file(int out, char const* path)
 	}
 }
 
+/*
+ * Learn version of the agent started for current thread. An agent of 2.1.4
+ * or newer greets the master of such version with FIO_AGENT_VERSION header,
+ * see fio_agent_greet(). Older agents send nothing until they are asked, so
+ * the greeting is followed by FIO_ACCESS command, which is answered by agent
+ * of any version, and the first header received tells which one it is.
+ */
+void fio_agent_handshake(void)
+{
+	fio_header hdr;
+	char const* path = ".";
+
+	hdr.cop = FIO_ACCESS;
+	hdr.handle = 0;
+	hdr.size = strlen(path) + 1;
+	hdr.arg = F_OK;
+	IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(fio_stdout, path, hdr.size), hdr.size);
+
+	IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+	if (hdr.cop == FIO_AGENT_VERSION)
+	{
+		fio_agent_version = hdr.arg;
+		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+	}
+	else /* old agent, assume the oldest compatible protocol */
+		fio_agent_version = AGENT_PROTOCOL_VERSION;
+
+	if (hdr.cop != FIO_ACCESS)
+		elog(ERROR, "Unexpected reply of agent: %d", hdr.cop);
+}
+
+/* Greeting of the agent sent before any command is served, agent side */
+void fio_agent_greet(int out)
+{
+	fio_header hdr;
+
+	hdr.cop = FIO_AGENT_VERSION;
+	hdr.handle = 0;
+	hdr.size = 0;
+	hdr.arg = parse_program_version(PROGRAM_VERSION);
+	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+}
+
+/* Get version of remote agent, 0 if agent is not used */
+uint32 fio_get_agent_version(void)
+{
+	return fio_is_remote(FIO_DB_HOST) ? fio_agent_version : 0;
+}
+
+/*
+ * Switch connection of the current thread to multiplexed mode, see
+ * fio_mux_agent(). Descriptors of the connection are returned in "in" and "out"
+ * and the thread must open a channel of multiplexed connection to continue.
+ * Returns false if the agent can't multiplex connection.
+ */
+bool fio_mux_start(int* in, int* out)
+{
+	fio_header hdr;
+
+	if (fio_get_agent_version() < AGENT_MUX_VERSION)
+		return false;
+
+	hdr.cop = FIO_MUX;
+	hdr.handle = 0;
+	hdr.size = 0;
+	hdr.arg = 0;
+	IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+	Assert(hdr.cop == FIO_MUX);
+	if (hdr.arg != 0)
+		return false;
+
+	*in = fio_stdin;
+	*out = fio_stdout;
+	fio_stdin = fio_stdout = 0;
+	return true;
+}
+
+/*
+ * Calculate CRC of every block of local file "path" starting from
+ * "startBlock", at most "nblocks" blocks. Partial last block is taken as is.
+ * Returns number of calculated CRCs or -1 in case of error.
+ */
+static int fio_get_block_crcs_impl(char const* path, BlockNumber startBlock,
+								   BlockNumber nblocks, pg_crc32* crcs)
+{
+	#define CRC_READ_BLOCKS 64
+	char*  buf;
+	int    fd;
+	int    n = 0;
+	int    errno_tmp;
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		return -1;
+
+	if (lseek(fd, (off_t)startBlock * BLCKSZ, SEEK_SET) < 0)
+		goto error;
+
+	buf = malloc(CRC_READ_BLOCKS * BLCKSZ);
+	while (n < nblocks)
+	{
+		ssize_t rc = read(fd, buf, Min(nblocks - n, CRC_READ_BLOCKS) * BLCKSZ);
+		ssize_t offs;
+
+		if (rc < 0)
+		{
+			free(buf);
+			goto error;
+		}
+		if (rc == 0)
+			break;
+
+		for (offs = 0; offs < rc && n < nblocks; offs += BLCKSZ)
+		{
+			INIT_FILE_CRC32(true, crcs[n]);
+			COMP_FILE_CRC32(true, crcs[n], buf + offs, Min(BLCKSZ, rc - offs));
+			FIN_FILE_CRC32(true, crcs[n]);
+			n += 1;
+		}
+		if (rc % BLCKSZ != 0)
+			break;
+	}
+	free(buf);
+	close(fd);
+	return n;
+
+  error:
+	errno_tmp = errno;
+	close(fd);
+	errno = errno_tmp;
+	return -1;
+}
+
+/*
+ * Calculate CRC of every block of the file on the specified host, so that
+ * destination file can be compared with the backup without transferring it.
+ * Returns number of blocks for which CRC is calculated, it is less than
+ * "nblocks" if the file is shorter, or -1 in case of error.
+ */
+int fio_get_block_crcs(char const* path, BlockNumber startBlock,
+					   BlockNumber nblocks, pg_crc32* crcs, fio_location location)
+{
+	if (fio_is_remote(location))
+	{
+		size_t path_len = strlen(path) + 1;
+		int    n = 0;
+
+		if (fio_get_agent_version() < AGENT_BLOCK_CRCS_VERSION)
+			elog(ERROR, "Remote agent of version %u cannot calculate CRC of file blocks",
+				 fio_get_agent_version());
+
+		while (n < nblocks)
+		{
+			fio_header hdr;
+			BlockNumber start = startBlock + n;
+			BlockNumber requested = Min(nblocks - n, FIO_BLOCK_CRCS_MAX);
+			BlockNumber received;
+
+			hdr.cop = FIO_GET_BLOCK_CRCS;
+			hdr.handle = -1;
+			hdr.size = sizeof(start) + path_len;
+			hdr.arg = requested;
+
+			IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+			IO_CHECK(fio_write_all(fio_stdout, &start, sizeof(start)), sizeof(start));
+			IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+
+			IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+			Assert(hdr.cop == FIO_GET_BLOCK_CRCS);
+
+			if (hdr.arg != 0)
+			{
+				errno = hdr.arg;
+				return -1;
+			}
+			IO_CHECK(fio_read_all(fio_stdin, crcs + n, hdr.size), hdr.size);
+			received = hdr.size / sizeof(pg_crc32);
+			n += received;
+
+			/* end of file */
+			if (received < requested)
+				break;
+		}
+		return n;
+	}
+	else
+	{
+		return fio_get_block_crcs_impl(path, startBlock, nblocks, crcs);
+	}
+}
+
+/* Flags of FIO_GET_CRC32 request passed in fio_header.arg */
+#define FIO_CRC32_USE_CRC32C 1
+#define FIO_CRC32_DECOMPRESS 2
+
+/* Size of read buffer used to calculate CRC of the file */
+#define FIO_CRC32_BUF_SIZE (64*1024)
+
+typedef struct
+{
+	uint64   size;
+	pg_crc32 crc;
+} fio_crc32_result;
+
+/*
+ * Calculate CRC of the whole local file "path". If "decompress" is true,
+ * CRC of the uncompressed contents of gzip file is calculated.
+ * Returns 0 on success or -1 in case of error.
+ */
+static int fio_get_crc32_impl(char const* path, bool use_crc32c, bool decompress,
+							  pg_crc32* crc, size_t* size)
+{
+	char*  buf;
+	size_t total = 0;
+	int    errno_tmp;
+
+	INIT_FILE_CRC32(use_crc32c, *crc);
+
+	if (decompress)
+	{
+#ifdef HAVE_LIBZ
+		gzFile gz = gzopen(path, PG_BINARY_R);
+		if (gz == NULL)
+		{
+			if (errno == 0)
+				errno = ENOMEM;
+			return -1;
+		}
+
+		buf = malloc(FIO_CRC32_BUF_SIZE);
+		for (;;)
+		{
+			int rc;
+
+			if (interrupted)
+			{
+				rc = -1;
+				errno = EINTR;
+			}
+			else
+				rc = gzread(gz, buf, FIO_CRC32_BUF_SIZE);
+
+			if (rc < 0)
+			{
+				if (errno == 0)
+					errno = EIO;
+				errno_tmp = errno;
+				free(buf);
+				gzclose(gz);
+				errno = errno_tmp;
+				return -1;
+			}
+			if (rc == 0)
+				break;
+			COMP_FILE_CRC32(use_crc32c, *crc, buf, rc);
+			total += rc;
+		}
+		free(buf);
+		gzclose(gz);
+#else
+		errno = EINVAL;
+		return -1;
+#endif
+	}
+	else
+	{
+		int fd = open(path, O_RDONLY | PG_BINARY, 0);
+		if (fd < 0)
+			return -1;
+
+		buf = malloc(FIO_CRC32_BUF_SIZE);
+		for (;;)
+		{
+			ssize_t rc;
+
+			if (interrupted)
+			{
+				rc = -1;
+				errno = EINTR;
+			}
+			else
+				rc = read(fd, buf, FIO_CRC32_BUF_SIZE);
+
+			if (rc < 0)
+			{
+				errno_tmp = errno;
+				free(buf);
+				close(fd);
+				errno = errno_tmp;
+				return -1;
+			}
+			if (rc == 0)
+				break;
+			COMP_FILE_CRC32(use_crc32c, *crc, buf, rc);
+			total += rc;
+		}
+		free(buf);
+		close(fd);
+	}
+
+	FIN_FILE_CRC32(use_crc32c, *crc);
+	if (size)
+		*size = total;
+	return 0;
+}
+
+/*
+ * Calculate CRC of the file streaming it from the remote agent.
+ * It is used for agents which do not support FIO_GET_CRC32.
+ */
+static int fio_get_crc32_stream(char const* path, bool use_crc32c, bool decompress,
+								pg_crc32* crc, size_t* size, fio_location location)
+{
+	char*  buf = pgut_malloc(FIO_CRC32_BUF_SIZE);
+	size_t total = 0;
+	int    errno_tmp;
+
+	INIT_FILE_CRC32(use_crc32c, *crc);
+
+	if (decompress)
+	{
+#ifdef HAVE_LIBZ
+		gzFile gz = fio_gzopen(path, PG_BINARY_R, Z_DEFAULT_COMPRESSION, location);
+		if (gz == NULL)
+		{
+			pg_free(buf);
+			return -1;
+		}
+
+		for (;;)
+		{
+			int rc = fio_gzread(gz, buf, FIO_CRC32_BUF_SIZE);
+			if (rc < 0 || (rc == 0 && !fio_gzeof(gz)))
+			{
+				pg_free(buf);
+				fio_gzclose(gz);
+				errno = EIO;
+				return -1;
+			}
+			if (rc == 0)
+				break;
+			COMP_FILE_CRC32(use_crc32c, *crc, buf, rc);
+			total += rc;
+		}
+		fio_gzclose(gz);
+#else
+		pg_free(buf);
+		errno = EINVAL;
+		return -1;
+#endif
+	}
+	else
+	{
+		FILE* f = fio_fopen(path, PG_BINARY_R, location);
+		if (f == NULL)
+		{
+			pg_free(buf);
+			return -1;
+		}
+
+		for (;;)
+		{
+			ssize_t rc = fio_fread(f, buf, FIO_CRC32_BUF_SIZE);
+			if (rc < 0)
+			{
+				errno_tmp = errno;
+				pg_free(buf);
+				fio_fclose(f);
+				errno = errno_tmp;
+				return -1;
+			}
+			if (rc == 0)
+				break;
+			COMP_FILE_CRC32(use_crc32c, *crc, buf, rc);
+			total += rc;
+		}
+		fio_fclose(f);
+	}
+	pg_free(buf);
+
+	FIN_FILE_CRC32(use_crc32c, *crc);
+	if (size)
+		*size = total;
+	return 0;
+}
+
+/*
+ * Calculate CRC of the file on the host where it is located, so that only
+ * CRC is transferred instead of the whole file. If "size" is not NULL, it
+ * is set to the number of bytes used to calculate CRC.
+ * Returns 0 on success or -1 in case of error.
+ */
+int fio_get_crc32(char const* path, bool use_crc32c, bool decompress,
+				  pg_crc32* crc, size_t* size, fio_location location)
+{
+	if (fio_is_remote(location))
+	{
+		fio_header hdr;
+		fio_crc32_result res;
+		size_t path_len = strlen(path) + 1;
+
+		if (fio_get_agent_version() < AGENT_GET_CRC32_VERSION)
+			return fio_get_crc32_stream(path, use_crc32c, decompress, crc, size, location);
+
+		hdr.cop = FIO_GET_CRC32;
+		hdr.handle = -1;
+		hdr.size = path_len;
+		hdr.arg = (use_crc32c ? FIO_CRC32_USE_CRC32C : 0)
+			| (decompress ? FIO_CRC32_DECOMPRESS : 0);
+
+		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+
+		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		Assert(hdr.cop == FIO_GET_CRC32);
+
+		if (hdr.arg != 0)
+		{
+			errno = hdr.arg;
+			return -1;
+		}
+		Assert(hdr.size == sizeof(res));
+		IO_CHECK(fio_read_all(fio_stdin, &res, sizeof(res)), sizeof(res));
+
+		*crc = res.crc;
+		if (size)
+			*size = res.size;
+		return 0;
+	}
+	else
+	{
+		return fio_get_crc32_impl(path, use_crc32c, decompress, crc, size);
+	}
+}
+
 int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 				   XLogRecPtr horizonLsn, BlockNumber* nBlocksSkipped, int calg, int clevel)
+{
+	return fio_send_pages_range(in, out, file, 0, file->size/BLCKSZ,
+								horizonLsn, nBlocksSkipped, NULL, NULL,
+								calg, clevel);
+}
+
+/* Number of the last page in FIO_PAGE_BATCH message */
+static BlockNumber fio_page_batch_last_block(char const* batch, size_t size)
+{
+	BlockNumber last = InvalidBlockNumber;
+	size_t pos = 0;
+
+	while (pos < size)
+	{
+		BackupPageHeader* bph = (BackupPageHeader*)(batch + pos);
+
+		last = bph->block;
+		pos += sizeof(BackupPageHeader);
+		if (bph->compressed_size > 0)
+			pos += MAXALIGN(bph->compressed_size);
+	}
+	return last;
+}
+
+/*
+ * Send blocks [startBlock, endBlock) of remote data file to the out file.
+ * Nonzero startBlock is supported only by agents of
+ * AGENT_SEND_PAGES_RANGE_VERSION and newer.
+ * Returns number of the block following the last processed block or
+ * negative value on error. If truncated is not NULL, it is set when the end
+ * of file is reached before endBlock.
+ * If the agent fails to verify a page, PAGE_CHECKSUM_MISMATCH is returned,
+ * pages preceding it are already written to the out file and badBlock (if
+ * not NULL) is set to the number of the failed block. Agents which do not
+ * report the failed block let us know only the first block not sent yet.
+ */
+int fio_send_pages_range(FILE* in, FILE* out, pgFile *file,
+						 BlockNumber startBlock, BlockNumber endBlock,
+						 XLogRecPtr horizonLsn, BlockNumber* nBlocksSkipped,
+						 bool* truncated, BlockNumber* badBlock,
+						 int calg, int clevel)
 {
 	struct {
 		fio_header hdr;
@@ -1123,6 +1911,8 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 	} req;
 	BlockNumber	n_blocks_read = 0;
 	BlockNumber blknum = 0;
+	BlockNumber next_block = startBlock; /* following the last received page */
+	char* batch = NULL;
 
 	Assert(fio_is_remote_file(in));
 
@@ -1130,14 +1920,24 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 	req.hdr.size = sizeof(fio_send_request);
 	req.hdr.handle = fio_fileno(in) & ~FIO_PIPE_MARKER;
 
-	req.arg.nblocks = file->size/BLCKSZ;
+	req.arg.nblocks = endBlock;
 	req.arg.segBlockNum = file->segno * RELSEG_SIZE;
 	req.arg.horizonLsn = horizonLsn;
 	req.arg.checksumVersion = current.checksum_version;
 	req.arg.calg = calg;
 	req.arg.clevel = clevel;
+	req.arg.startBlock = startBlock;
+	req.arg.flags = (drop_cache ? FIO_SEND_DROP_CACHE : 0) |
+		(omit_zero_pages ? FIO_SEND_OMIT_ZERO_PAGES : 0) |
+		FIO_SEND_REPORT_BAD_BLOCK;
+
+	if (startBlock != 0 && fio_get_agent_version() < AGENT_SEND_PAGES_RANGE_VERSION)
+		elog(ERROR, "Agent version %u cannot send range of blocks",
+			 fio_get_agent_version());
 
 	file->compress_alg = calg;
+	if (truncated)
+		*truncated = false;
 
 	IO_CHECK(fio_write_all(fio_stdout, &req, sizeof(req)), sizeof(req));
 
@@ -1146,12 +1946,64 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 		fio_header hdr;
 		char buf[BLCKSZ + sizeof(BackupPageHeader)];
 		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+
+		if (hdr.cop == FIO_PAGE_BATCH)
+		{
+			/*
+			 * Agent has packed several pages in one message: they are already
+			 * in backup file format, so write them at once.
+			 */
+			if (batch == NULL)
+				batch = pgut_malloc(FIO_PAGE_BATCH_SIZE);
+
+			Assert(hdr.size <= FIO_PAGE_BATCH_SIZE);
+			IO_CHECK(fio_read_all(fio_stdin, batch, hdr.size), hdr.size);
+
+			COMP_FILE_CRC32(true, file->crc, batch, hdr.size);
+
+			if (fio_fwrite(out, batch, hdr.size) != hdr.size)
+			{
+				int	errno_tmp = errno;
+				fio_fclose(out);
+				elog(ERROR, "File: %s, cannot write backup at block %u: %s",
+					 file->path, ((BackupPageHeader*)batch)->block,
+					 strerror(errno_tmp));
+			}
+			block_map_add(file, batch, hdr.size);
+			file->write_size += hdr.size;
+			file->read_size += (int64) hdr.arg * BLCKSZ;
+			progress_add(PROGRESS_WRITTEN_BYTES, hdr.size);
+			progress_add(PROGRESS_READ_BYTES, (int64) hdr.arg * BLCKSZ);
+			n_blocks_read += hdr.arg;
+			next_block = fio_page_batch_last_block(batch, hdr.size) + 1;
+			fio_throttle(file->dev, (size_t) hdr.arg * BLCKSZ);
+			continue;
+		}
+
 		Assert(hdr.cop == FIO_PAGE);
 
 		if ((int)hdr.arg < 0) /* read error */
 		{
-			errno = -(int)hdr.arg;
-			return -1;
+			free(batch);
+			if ((int)hdr.arg == PAGE_CHECKSUM_MISMATCH)
+			{
+				BlockNumber bad_block = next_block;
+
+				if (hdr.size == sizeof(BackupPageHeader))
+				{
+					BackupPageHeader bph;
+
+					IO_CHECK(fio_read_all(fio_stdin, &bph, sizeof(bph)), sizeof(bph));
+					bad_block = bph.block;
+				}
+				Assert(hdr.size == 0 || hdr.size == sizeof(BackupPageHeader));
+				if (badBlock)
+					*badBlock = bad_block;
+				*nBlocksSkipped = bad_block - startBlock - n_blocks_read;
+			}
+			else
+				errno = -(int)hdr.arg;
+			return (int)hdr.arg;
 		}
 
 		blknum = hdr.arg;
@@ -1170,45 +2022,241 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 			elog(ERROR, "File: %s, cannot write backup at block %u: %s",
 				 file->path, blknum, strerror(errno_tmp));
 		}
+		block_map_add(file, buf, hdr.size);
 		file->write_size += hdr.size;
+		progress_add(PROGRESS_WRITTEN_BYTES, hdr.size);
 		n_blocks_read++;
+		next_block = blknum + 1;
+		fio_throttle(file->dev, BLCKSZ);
 
 		if (((BackupPageHeader*)buf)->compressed_size == PageIsTruncated)
 		{
+			if (truncated)
+				*truncated = true;
 			blknum += 1;
 			break;
 		}
 		file->read_size += BLCKSZ;
+		progress_add(PROGRESS_READ_BYTES, BLCKSZ);
 	}
-	*nBlocksSkipped = blknum - n_blocks_read;
+	free(batch);
+	*nBlocksSkipped = blknum - startBlock - n_blocks_read;
 	return blknum;
 }
 
-static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
+/*
+ * FIO_PAGE_BATCH message: header is followed by pages in backup file format.
+ * hdr.arg is number of pages in the message.
+ */
+typedef struct
+{
+	fio_header hdr;
+	char       data[FIO_PAGE_BATCH_SIZE];
+} fio_page_batch;
+
+/*
+ * Agent accumulates pages in one of two batches. Filled batch is passed to
+ * the sender thread, so reading and compression of the next pages overlap
+ * with transfer of the previous ones.
+ */
+typedef struct
+{
+	int             out;
+	fio_page_batch  batch[2];
+	fio_page_batch* fill;     /* batch which is filled now */
+#ifndef WIN32
+	fio_page_batch* pending;  /* batch to be sent, NULL if sender is idle */
+	bool            finished;
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+#endif
+} fio_page_sender;
+
+#ifndef WIN32
+static void* fio_page_sender_thread(void* arg)
+{
+	fio_page_sender* ps = (fio_page_sender*)arg;
+
+	pthread_mutex_lock(&ps->lock);
+	while (true)
+	{
+		fio_page_batch* batch;
+
+		while (ps->pending == NULL && !ps->finished)
+			pthread_cond_wait(&ps->cond, &ps->lock);
+
+		batch = ps->pending;
+		if (batch == NULL)
+			break;
+
+		pthread_mutex_unlock(&ps->lock);
+		IO_CHECK(fio_write_all(ps->out, batch, sizeof(fio_header) + batch->hdr.size),
+				 sizeof(fio_header) + batch->hdr.size);
+		pthread_mutex_lock(&ps->lock);
+
+		ps->pending = NULL;
+		pthread_cond_signal(&ps->cond);
+	}
+	pthread_mutex_unlock(&ps->lock);
+	return NULL;
+}
+#endif
+
+static fio_page_sender* fio_page_sender_start(int out)
+{
+	fio_page_sender* ps = (fio_page_sender*)pgut_malloc(sizeof(fio_page_sender));
+
+	ps->out = out;
+	ps->batch[0].hdr.cop = ps->batch[1].hdr.cop = FIO_PAGE_BATCH;
+	ps->batch[0].hdr.size = ps->batch[0].hdr.arg = 0;
+	ps->fill = &ps->batch[0];
+#ifndef WIN32
+	ps->pending = NULL;
+	ps->finished = false;
+	pthread_mutex_init(&ps->lock, NULL);
+	pthread_cond_init(&ps->cond, NULL);
+	if (pthread_create(&ps->thread, NULL, fio_page_sender_thread, ps) != 0)
+	{
+		fprintf(stderr, "%s:%d: cannot create sender thread\n", __FILE__, __LINE__);
+		exit(EXIT_FAILURE);
+	}
+#endif
+	return ps;
+}
+
+/* Pass filled batch for sending and switch to another one */
+static void fio_page_sender_flush(fio_page_sender* ps)
+{
+	fio_page_batch* batch = ps->fill;
+
+	if (batch->hdr.arg == 0)
+		return;
+#ifdef WIN32
+	IO_CHECK(fio_write_all(ps->out, batch, sizeof(fio_header) + batch->hdr.size),
+			 sizeof(fio_header) + batch->hdr.size);
+#else
+	pthread_mutex_lock(&ps->lock);
+	while (ps->pending != NULL)
+		pthread_cond_wait(&ps->cond, &ps->lock);
+	ps->pending = batch;
+	pthread_cond_signal(&ps->cond);
+	pthread_mutex_unlock(&ps->lock);
+#endif
+	ps->fill = batch == &ps->batch[0] ? &ps->batch[1] : &ps->batch[0];
+	ps->fill->hdr.size = ps->fill->hdr.arg = 0;
+}
+
+/* Get space for one more page. Compressed page can be larger than BLCKSZ */
+static char* fio_page_sender_reserve(fio_page_sender* ps)
+{
+	if (ps->fill->hdr.size + sizeof(BackupPageHeader) + BLCKSZ*2 > FIO_PAGE_BATCH_SIZE)
+		fio_page_sender_flush(ps);
+	return ps->fill->data + ps->fill->hdr.size;
+}
+
+static void fio_page_sender_commit(fio_page_sender* ps, size_t size)
+{
+	ps->fill->hdr.size += size;
+	ps->fill->hdr.arg += 1;
+}
+
+/* Send all accumulated pages and wait until sender thread is finished */
+static void fio_page_sender_stop(fio_page_sender* ps)
+{
+	fio_page_sender_flush(ps);
+#ifndef WIN32
+	pthread_mutex_lock(&ps->lock);
+	ps->finished = true;
+	pthread_cond_signal(&ps->cond);
+	pthread_mutex_unlock(&ps->lock);
+	pthread_join(ps->thread, NULL);
+	pthread_cond_destroy(&ps->cond);
+	pthread_mutex_destroy(&ps->lock);
+#endif
+	free(ps);
+}
+
+/*
+ * Read data file and send its pages to master.
+ * If use_batch is true, pages are sent in FIO_PAGE_BATCH messages,
+ * otherwise each page is sent in separate FIO_PAGE message.
+ * End of segment and errors are always reported by FIO_PAGE message.
+ */
+static void fio_send_pages_impl(int fd, int out, fio_send_request* req, bool use_batch)
 {
 	BlockNumber blknum;
 	char read_buffer[BLCKSZ+1];
 	fio_header hdr;
+	fio_page_sender* sender = use_batch ? fio_page_sender_start(out) : NULL;
+	/* Blocks are read ahead by chunks, see delta_prescan_pages() */
+	char* chunk = pgut_malloc((size_t) DATA_FILE_READ_BLOCKS * BLCKSZ);
+	bool chunk_skip[DATA_FILE_READ_BLOCKS];
+	BlockNumber chunk_start = req->startBlock;
+	BlockNumber chunk_size = 0;
 
 	hdr.cop = FIO_PAGE;
 	read_buffer[BLCKSZ] = 1; /* barrier */
 
-	for (blknum = 0; blknum < req->nblocks; blknum++)
+	if (req->flags & FIO_SEND_DROP_CACHE)
+		fio_cache_advise_impl(fd, 0, 0, FIO_ADVISE_SEQUENTIAL);
+
+	for (blknum = req->startBlock; blknum < req->nblocks; blknum++)
 	{
 		int retry_attempts = PAGE_READ_ATTEMPTS;
 		XLogRecPtr page_lsn = InvalidXLogRecPtr;
+		bool in_chunk;
+
+		/* Drop pages read so far, they are not needed anymore */
+		if ((req->flags & FIO_SEND_DROP_CACHE) && blknum > req->startBlock &&
+			(blknum - req->startBlock) % FIO_CACHE_ADVISE_BLOCKS == 0)
+			fio_cache_advise_impl(fd, (off_t) (blknum - FIO_CACHE_ADVISE_BLOCKS) * BLCKSZ,
+								  (off_t) FIO_CACHE_ADVISE_BLOCKS * BLCKSZ,
+								  FIO_ADVISE_DONTNEED);
+
+		if (blknum >= chunk_start + chunk_size)
+		{
+			ssize_t rc = pread(fd, chunk,
+							   (size_t) Min(req->nblocks - blknum, DATA_FILE_READ_BLOCKS) * BLCKSZ,
+							   (off_t) blknum * BLCKSZ);
+
+			chunk_start = blknum;
+			chunk_size = rc > 0 ? rc / BLCKSZ : 0;
+			/* Unchanged pages of DELTA backup are not even verified */
+			if (chunk_size > 0 && req->horizonLsn != InvalidXLogRecPtr)
+				delta_prescan_pages(chunk, chunk_size, req->horizonLsn, chunk_skip);
+			else
+				memset(chunk_skip, 0, sizeof(chunk_skip));
+		}
+
+		in_chunk = blknum < chunk_start + chunk_size;
+		if (in_chunk && chunk_skip[blknum - chunk_start])
+			continue;
 
 		while (true)
 		{
-			ssize_t rc = pread(fd, read_buffer, BLCKSZ, blknum*BLCKSZ);
+			ssize_t rc;
+
+			/* Retry rereads the page */
+			if (in_chunk)
+			{
+				memcpy(read_buffer, chunk + (size_t) (blknum - chunk_start) * BLCKSZ, BLCKSZ);
+				rc = BLCKSZ;
+				in_chunk = false;
+			}
+			else
+				rc = pread(fd, read_buffer, BLCKSZ, blknum*BLCKSZ);
 
 			if (rc <= 0)
 			{
+				pg_free(chunk);
 				if (rc < 0)
 				{
 					hdr.arg = -errno;
 					hdr.size = 0;
 					Assert((int)hdr.arg < 0);
+					if (sender)
+						fio_page_sender_stop(sender);
 					IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
 				}
 				else
@@ -1218,6 +2266,8 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 					bph.compressed_size = PageIsTruncated;
 					hdr.arg = blknum;
 					hdr.size = sizeof(bph);
+					if (sender)
+						fio_page_sender_stop(sender);
 					IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
 					IO_CHECK(fio_write_all(out, &bph, sizeof(bph)), sizeof(bph));
 				}
@@ -1227,11 +2277,8 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 			{
 				if (!parse_page((Page)read_buffer, &page_lsn))
 				{
-					int i;
-					for (i = 0; read_buffer[i] == 0; i++);
-
 					/* Page is zeroed. No need to check header and checksum. */
-					if (i == BLCKSZ)
+					if (page_is_zeroed(read_buffer))
 						break;
 				}
 				else if (!req->checksumVersion
@@ -1243,43 +2290,211 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 
 			if (--retry_attempts == 0)
 			{
-				hdr.size = 0;
+				BackupPageHeader bph;
+
+				pg_free(chunk);
+				bph.block = blknum;
+				bph.compressed_size = PageIsCorrupted;
+				hdr.size = (req->flags & FIO_SEND_REPORT_BAD_BLOCK) ? sizeof(bph) : 0;
 				hdr.arg = PAGE_CHECKSUM_MISMATCH;
+				if (sender)
+					fio_page_sender_stop(sender);
 				IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+				if (hdr.size != 0)
+					IO_CHECK(fio_write_all(out, &bph, sizeof(bph)), sizeof(bph));
 				return;
 			}
 		}
 		/* horizonLsn is not 0 for delta backup. As far as unsigned number are always greater or equal than zero, there is no sense to add more checks */
 		if (page_lsn >= req->horizonLsn || page_lsn == InvalidXLogRecPtr)
 		{
-			char write_buffer[BLCKSZ*2];
+			char local_buffer[BLCKSZ*2];
+			char* write_buffer = sender ? fio_page_sender_reserve(sender) : local_buffer;
 			BackupPageHeader* bph = (BackupPageHeader*)write_buffer;
 			const char *errormsg = NULL;
 
 			hdr.arg = bph->block = blknum;
 			hdr.size = sizeof(BackupPageHeader);
 
-			bph->compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader), sizeof(write_buffer) - sizeof(BackupPageHeader),
-											   read_buffer, BLCKSZ, req->calg, req->clevel,
-											   &errormsg);
-			if (bph->compressed_size <= 0 || bph->compressed_size >= BLCKSZ)
+			if ((req->flags & FIO_SEND_OMIT_ZERO_PAGES) && page_is_zeroed(read_buffer))
+				bph->compressed_size = PageIsZeroed;
+			else
 			{
-				/* Do not compress page */
-				memcpy(write_buffer + sizeof(BackupPageHeader), read_buffer, BLCKSZ);
-				bph->compressed_size = BLCKSZ;
+				bph->compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader), sizeof(local_buffer) - sizeof(BackupPageHeader),
+												   read_buffer, BLCKSZ, req->calg, req->clevel,
+												   &errormsg);
+				if (bph->compressed_size <= 0 || bph->compressed_size >= BLCKSZ)
+				{
+					/* Do not compress page */
+					memcpy(write_buffer + sizeof(BackupPageHeader), read_buffer, BLCKSZ);
+					bph->compressed_size = BLCKSZ;
+				}
+				hdr.size += MAXALIGN(bph->compressed_size);
 			}
-			hdr.size += MAXALIGN(bph->compressed_size);
 
-			IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
-			IO_CHECK(fio_write_all(out, write_buffer, hdr.size), hdr.size);
+			if (sender)
+				fio_page_sender_commit(sender, hdr.size);
+			else
+			{
+				IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+				IO_CHECK(fio_write_all(out, write_buffer, hdr.size), hdr.size);
+			}
 		}
 	}
+	pg_free(chunk);
+	if (sender)
+		fio_page_sender_stop(sender);
 	hdr.size = 0;
 	hdr.arg = blknum;
 	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
 }
 
 /* Execute commands at remote host */
+typedef struct
+{
+	int    out;
+	bool   follow_symlinks;
+	size_t root_len;
+	size_t batch_size;
+	char   path[MAXPGPATH];
+	char   batch[FIO_LIST_DIR_BATCH_SIZE];
+} fio_list_dir_state;
+
+static void fio_list_dir_flush(fio_list_dir_state* state)
+{
+	fio_header hdr;
+
+	hdr.cop = FIO_SEND;
+	hdr.handle = -1;
+	hdr.arg = 0;
+	hdr.size = state->batch_size;
+	IO_CHECK(fio_write_all(state->out, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(state->out, state->batch, hdr.size), hdr.size);
+	state->batch_size = 0;
+}
+
+/*
+ * Send entries of directory state->path and, recursively, of its
+ * subdirectories. On failure -1 is returned with errno set and state->path
+ * pointing to the entry which can not be read. Entries removed concurrently
+ * are silently skipped.
+ */
+static int fio_list_dir_walk(fio_list_dir_state* state)
+{
+	char*  path = state->path;
+	size_t len = strlen(path);
+	DIR*   dir;
+	struct dirent* dent;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return errno == ENOENT ? 0 : -1;
+
+	errno = 0;
+	while ((dent = readdir(dir)) != NULL)
+	{
+		fio_list_dir_entry entry;
+		struct stat st;
+		size_t name_len = strlen(dent->d_name);
+		int    rc;
+
+		if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		if (len + name_len + 2 > MAXPGPATH)
+		{
+			closedir(dir);
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		path[len] = '/';
+		memcpy(&path[len + 1], dent->d_name, name_len + 1);
+
+		rc = state->follow_symlinks ? stat(path, &st) : lstat(path, &st);
+		if (rc < 0)
+		{
+			int errno_tmp = errno;
+
+			if (errno_tmp == ENOENT)
+			{
+				path[len] = '\0';
+				errno = 0;
+				continue;
+			}
+			closedir(dir);
+			errno = errno_tmp;
+			return -1;
+		}
+
+		entry.mode = st.st_mode;
+		entry.size = st.st_size;
+		entry.mtime = st.st_mtime;
+		entry.path_len = len + name_len + 1 - state->root_len;
+
+		if (state->batch_size + sizeof(entry) + entry.path_len > FIO_LIST_DIR_BATCH_SIZE)
+			fio_list_dir_flush(state);
+		memcpy(&state->batch[state->batch_size], &entry, sizeof(entry));
+		state->batch_size += sizeof(entry);
+		memcpy(&state->batch[state->batch_size], &path[state->root_len + 1], entry.path_len);
+		state->batch_size += entry.path_len;
+
+		if (S_ISDIR(st.st_mode) && fio_list_dir_walk(state) < 0)
+		{
+			int errno_tmp = errno;
+
+			closedir(dir);
+			errno = errno_tmp;
+			return -1;
+		}
+		path[len] = '\0';
+		errno = 0;
+	}
+	if (errno != 0 && errno != ENOENT)
+	{
+		int errno_tmp = errno;
+
+		closedir(dir);
+		errno = errno_tmp;
+		return -1;
+	}
+	closedir(dir);
+	return 0;
+}
+
+/* Send the whole directory tree in batches of entries, see fio_list_dir() */
+static void fio_list_dir_impl(int out, char const* root, bool follow_symlinks)
+{
+	fio_list_dir_state* state = malloc(sizeof(fio_list_dir_state));
+	fio_header hdr;
+
+	state->out = out;
+	state->follow_symlinks = follow_symlinks;
+	state->batch_size = 0;
+	strncpy(state->path, root, MAXPGPATH - 1);
+	state->path[MAXPGPATH - 1] = '\0';
+	state->root_len = strlen(state->path);
+
+	hdr.cop = FIO_LIST_DIR;
+	hdr.handle = -1;
+	if (fio_list_dir_walk(state) < 0)
+	{
+		hdr.arg = errno;
+		hdr.size = strlen(state->path) + 1;
+	}
+	else
+	{
+		hdr.arg = 0;
+		hdr.size = 0;
+	}
+
+	if (state->batch_size > 0)
+		fio_list_dir_flush(state);
+
+	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(out, state->path, hdr.size), hdr.size);
+	free(state);
+}
+
 void fio_communicate(int in, int out)
 {
 	/*
@@ -1295,6 +2510,8 @@ void fio_communicate(int in, int out)
 	fio_header hdr;
 	struct stat st;
 	int rc;
+	/* Masters of old versions do not understand FIO_PAGE_BATCH messages */
+	bool page_batch = parse_program_version(remote_agent) >= AGENT_PAGE_BATCH_VERSION;
 
 #ifdef WIN32
     SYS_CHECK(setmode(in, _O_BINARY));
@@ -1414,9 +2631,66 @@ void fio_communicate(int in, int out)
 			SYS_CHECK(ftruncate(fd[hdr.handle], hdr.arg));
 			break;
 		  case FIO_SEND_PAGES:
-			Assert(hdr.size == sizeof(fio_send_request));
-			fio_send_pages_impl(fd[hdr.handle], out, (fio_send_request*)buf);
+			/* request of old master */
+			if (!fio_send_request_has(hdr.size, startBlock))
+				((fio_send_request*)buf)->startBlock = 0;
+			if (!fio_send_request_has(hdr.size, flags))
+				((fio_send_request*)buf)->flags = 0;
+			Assert(hdr.size <= sizeof(fio_send_request));
+			fio_send_pages_impl(fd[hdr.handle], out, (fio_send_request*)buf, page_batch);
+			break;
+		  case FIO_GET_BLOCK_CRCS: /* Calculate CRC of file blocks */
+			{
+				pg_crc32* crcs = malloc(Min(hdr.arg, FIO_BLOCK_CRCS_MAX) * sizeof(pg_crc32));
+				rc = fio_get_block_crcs_impl(buf + sizeof(BlockNumber),
+											 *(BlockNumber*)buf,
+											 Min(hdr.arg, FIO_BLOCK_CRCS_MAX), crcs);
+				hdr.size = rc < 0 ? 0 : rc * sizeof(pg_crc32);
+				hdr.arg = rc < 0 ? errno : 0;
+				IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+				IO_CHECK(fio_write_all(out, crcs, hdr.size), hdr.size);
+				free(crcs);
+			}
+			break;
+		  case FIO_CACHE_ADVISE: /* Page cache hint, no reply */
+			Assert(hdr.size == 2*sizeof(int64));
+			fio_cache_advise_impl(fd[hdr.handle], ((int64*)buf)[0],
+								  ((int64*)buf)[1], hdr.arg);
+			break;
+		  case FIO_PUNCH_HOLE: /* Deallocate range of file, no reply */
+			Assert(hdr.size == 2*sizeof(int64));
+			SYS_CHECK(fio_punch_hole_impl(fd[hdr.handle], ((int64*)buf)[0],
+										  ((int64*)buf)[1]));
+			break;
+		  case FIO_GET_CRC32: /* Calculate CRC of file */
+			{
+				fio_crc32_result res;
+				size_t size = 0;
+				rc = fio_get_crc32_impl(buf, (hdr.arg & FIO_CRC32_USE_CRC32C) != 0,
+										(hdr.arg & FIO_CRC32_DECOMPRESS) != 0,
+										&res.crc, &size);
+				res.size = size;
+				hdr.size = rc < 0 ? 0 : sizeof(res);
+				hdr.arg = rc < 0 ? errno : 0;
+				IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+				IO_CHECK(fio_write_all(out, &res, hdr.size), hdr.size);
+			}
+			break;
+		  case FIO_LIST_DIR: /* Send the whole directory tree */
+			fio_list_dir_impl(out, buf, hdr.arg != 0);
 			break;
+		  case FIO_MUX: /* Serve connection shared by several master threads */
+#ifdef WIN32
+			hdr.arg = EINVAL;
+			IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+			break;
+#else
+			hdr.arg = 0;
+			IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+			fio_mux_agent(in, out);
+			free(buf);
+			return;
+#endif
 		  default:
 			Assert(false);
 		}
@@ -1424,7 +2698,7 @@ void fio_communicate(int in, int out)
 	free(buf);
 	if (rc != 0) { /* Not end of stream: normal pipe close */
 		perror("read");
-		exit(EXIT_FAILURE);
+		fio_error_exit();
 	}
 }
 
@@ -33,9 +33,25 @@ typedef enum
 	FIO_READDIR,
 	FIO_CLOSEDIR,
 	FIO_SEND_PAGES,
-	FIO_PAGE
+	FIO_PAGE,
+	FIO_PAGE_BATCH,
+	FIO_AGENT_VERSION,
+	FIO_GET_BLOCK_CRCS,
+	FIO_GET_CRC32,
+	FIO_CACHE_ADVISE,
+	FIO_MUX,
+	FIO_LIST_DIR,
+	FIO_PUNCH_HOLE
 } fio_operations;
 
+/* Hints about use of file data by page cache, see fio_cache_advise() */
+typedef enum
+{
+	FIO_ADVISE_SEQUENTIAL,	/* file will be read sequentially */
+	FIO_ADVISE_DONTNEED,	/* drop cached pages of the range */
+	FIO_ADVISE_WRITEBACK	/* start writeback of dirty pages of the range */
+} fio_cache_advice;
+
 typedef enum
 {
 	FIO_LOCAL_HOST,  /* data is locate at local host */
@@ -47,9 +63,18 @@ typedef enum
 #define FIO_FDMAX 64
 #define FIO_PIPE_MARKER 0x40000000
 #define PAGE_CHECKSUM_MISMATCH (-256)
-
-#define SYS_CHECK(cmd) do if ((cmd) < 0) { fprintf(stderr, "%s:%d: (%s) %s\n", __FILE__, __LINE__, #cmd, strerror(errno)); exit(EXIT_FAILURE); } while (0)
-#define IO_CHECK(cmd, size) do { int _rc = (cmd); if (_rc != (size)) { if (remote_agent) { fprintf(stderr, "%s:%d: proceeds %d bytes instead of %d: %s\n", __FILE__, __LINE__, _rc, (int)(size), _rc >= 0 ? "end of data" :  strerror(errno)); exit(EXIT_FAILURE); } else elog(ERROR, "Communication error: %s", _rc >= 0 ? "end of data" :  strerror(errno)); } } while (0)
+/*
+ * Maximal payload of FIO_PAGE_BATCH message. It should fit in
+ * 20 bits of fio_header.size and leave room for one more page.
+ */
+#define FIO_PAGE_BATCH_SIZE (1024*1024 - 2*BLCKSZ)
+/* Maximal number of block CRCs in one FIO_GET_BLOCK_CRCS reply */
+#define FIO_BLOCK_CRCS_MAX (256*1024 - 1)
+/* Maximal payload of one batch of FIO_LIST_DIR entries */
+#define FIO_LIST_DIR_BATCH_SIZE (64*1024)
+
+#define SYS_CHECK(cmd) do if ((cmd) < 0) { fprintf(stderr, "%s:%d: (%s) %s\n", __FILE__, __LINE__, #cmd, strerror(errno)); fio_error_exit(); } while (0)
+#define IO_CHECK(cmd, size) do { int _rc = (cmd); if (_rc != (size)) { if (remote_agent) { fprintf(stderr, "%s:%d: proceeds %d bytes instead of %d: %s\n", __FILE__, __LINE__, _rc, (int)(size), _rc >= 0 ? "end of data" :  strerror(errno)); fio_error_exit(); } else elog(ERROR, "Communication error: %s", _rc >= 0 ? "end of data" :  strerror(errno)); } } while (0)
 
 typedef struct
 {
@@ -61,11 +86,15 @@ typedef struct
 
 extern fio_location MyLocation;
 
+extern void    fio_error_exit(void) pg_attribute_noreturn();
+
 /* Check if FILE handle is local or remote (created by FIO) */
 #define fio_is_remote_file(file) ((size_t)(file) <= FIO_FDMAX)
 
+extern bool    fio_is_remote(fio_location location);
 extern void    fio_redirect(int in, int out);
 extern void    fio_communicate(int in, int out);
+extern bool    fio_mux_start(int* in, int* out);
 
 extern FILE*   fio_fopen(char const* name, char const* mode, fio_location location);
 extern size_t  fio_fwrite(FILE* f, void const* buf, size_t size);
@@ -77,10 +106,30 @@ extern int     fio_fseek(FILE* f, off_t offs);
 extern int     fio_ftruncate(FILE* f, off_t size);
 extern int     fio_fclose(FILE* f);
 extern int     fio_ffstat(FILE* f, struct stat* st);
+extern void    fio_cache_advise(FILE* f, off_t offset, off_t len, fio_cache_advice advice);
+extern int     fio_punch_hole(FILE* f, off_t offset, off_t len);
+extern void    fio_throttle(dev_t dev, size_t size);
 
 struct pgFile;
 extern  int    fio_send_pages(FILE* in, FILE* out, struct pgFile *file, XLogRecPtr horizonLsn, 
 							  BlockNumber* nBlocksSkipped, int calg, int clevel);
+/* Flags of FIO_SEND_PAGES request */
+#define FIO_SEND_DROP_CACHE	0x1	/* drop read pages from page cache */
+#define FIO_SEND_OMIT_ZERO_PAGES 0x2	/* send zeroed pages as header only */
+#define FIO_SEND_REPORT_BAD_BLOCK 0x4	/* report block failed verification */
+/* Number of blocks after which page cache hints are given */
+#define FIO_CACHE_ADVISE_BLOCKS	256
+
+extern  int    fio_send_pages_range(FILE* in, FILE* out, struct pgFile *file,
+									BlockNumber startBlock, BlockNumber endBlock,
+									XLogRecPtr horizonLsn, BlockNumber* nBlocksSkipped,
+									bool* truncated, BlockNumber* badBlock,
+									int calg, int clevel);
+extern void    fio_agent_handshake(void);
+extern void    fio_agent_greet(int out);
+extern uint32  fio_get_agent_version(void);
+extern int     fio_get_block_crcs(char const* path, BlockNumber startBlock,
+								  BlockNumber nblocks, pg_crc32* crcs, fio_location location);
 
 extern int     fio_open(char const* name, int mode, fio_location location);
 extern ssize_t fio_write(int fd, void const* buf, size_t size);
@@ -101,6 +150,14 @@ extern int     fio_stat(char const* path, struct stat* st, bool follow_symlinks,
 extern DIR*    fio_opendir(char const* path, fio_location location);
 extern struct dirent * fio_readdir(DIR *dirp);
 extern int     fio_closedir(DIR *dirp);
+
+/*
+ * Called by fio_list_dir() for every entry of the directory tree in
+ * depth-first pre-order. rel_path is relative to the listed directory.
+ */
+typedef void (*fio_list_dir_callback)(void* arg, char const* rel_path, struct stat const* st);
+extern bool    fio_list_dir(char const* path, bool follow_symlinks,
+							fio_list_dir_callback callback, void* arg, fio_location location);
 extern FILE*   fio_open_stream(char const* name, fio_location location);
 extern int     fio_close_stream(FILE* f);
 
@@ -9,6 +9,14 @@
 
 #include "postgres_fe.h"
 
+#ifdef FRONTEND
+#undef FRONTEND
+#include <port/atomics.h>
+#define FRONTEND
+#else
+#include <port/atomics.h>
+#endif
+
 #include <sys/stat.h>
 
 #include "pg_probackup.h"
@@ -42,6 +50,8 @@ typedef enum
 void pg_log(eLogType type, const char *fmt,...) pg_attribute_printf(2, 3);
 
 static void elog_internal(int elevel, bool file_only, const char *message);
+static void write_log_message(int elevel, bool file_only, time_t log_time,
+							  const char *message);
 static void elog_stderr(int elevel, const char *fmt, ...)
 						pg_attribute_printf(2, 3);
 static char *get_log_message(const char *fmt, va_list args) pg_attribute_printf(1, 0);
@@ -63,6 +73,63 @@ static bool loggin_in_progress = false;
 
 static pthread_mutex_t log_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+#ifndef WIN32
+/*
+ * Worker threads do not write messages below ERROR themselves.  Every thread
+ * puts them into its own ring buffer without taking any lock, and the log
+ * writer thread drains the rings into the log files and stderr.
+ *
+ * Messages of the main thread and errors are written synchronously after
+ * all the rings are drained, so the log of a failed command is complete.
+ * The rings are also drained at exit.
+ */
+#define LOG_RING_SIZE			(64 * 1024)	/* must be a power of 2 */
+/* Longer messages are written synchronously */
+#define LOG_RING_MAX_MESSAGE	(LOG_RING_SIZE / 4)
+/* How long the log writer waits for new messages, in milliseconds */
+#define LOG_WRITER_NAPTIME		100
+
+typedef struct LogRingEntry
+{
+	int			elevel;
+	bool		file_only;
+	time_t		log_time;
+	uint32		len;			/* length of the message including '\0' */
+	/* the message follows */
+} LogRingEntry;
+
+typedef struct LogRing
+{
+	struct LogRing *next;
+	pg_atomic_flag owned;		/* the ring is used by a running thread */
+	/* Positions grow monotonically and wrap around at 2^32 */
+	pg_atomic_uint32 head;		/* advanced by the owner thread only */
+	pg_atomic_uint32 tail;		/* advanced under log_file_mutex only */
+	char		data[LOG_RING_SIZE];
+} LogRing;
+
+/* Rings are never freed, a ring of an exited thread is reused */
+static LogRing *log_rings = NULL;
+static pthread_mutex_t log_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread LogRing *my_log_ring = NULL;
+static pthread_key_t log_ring_key;
+
+static pthread_once_t log_writer_once = PTHREAD_ONCE_INIT;
+static bool log_writer_started = false;
+/* Set under log_file_mutex when the logger is shut down at exit */
+static bool log_writer_stopped = false;
+static pthread_mutex_t log_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_writer_cond = PTHREAD_COND_INITIALIZER;
+
+/* Message being written out of a ring, protected by log_file_mutex */
+static char log_ring_message[LOG_RING_MAX_MESSAGE];
+
+static bool log_ring_put(int elevel, bool file_only, time_t log_time,
+						 const char *message);
+static bool flush_log_rings(void);
+static void stop_log_writer(void);
+#endif
+
 /*
  * Initialize logger.
  *
@@ -155,17 +222,16 @@ exit_if_necessary(int elevel)
 }
 
 /*
- * Logs to stderr or to log file and exit if ERROR.
- *
- * Actual implementation for elog() and pg_log().
+ * Writes message to log file, error log file and stderr according to its
+ * level.  Caller must hold log_file_mutex.
  */
 static void
-elog_internal(int elevel, bool file_only, const char *message)
+write_log_message(int elevel, bool file_only, time_t log_time,
+				  const char *message)
 {
 	bool		write_to_file,
 				write_to_error_log,
 				write_to_stderr;
-	time_t		log_time = (time_t) time(NULL);
 	char		strfbuf[128];
 
 	write_to_file = elevel >= logger_config.log_level_file
@@ -180,8 +246,6 @@ elog_internal(int elevel, bool file_only, const char *message)
 		write_to_stderr |= write_to_error_log | write_to_file;
 		write_to_error_log = write_to_file = false;
 	}
-	pthread_lock(&log_file_mutex);
-	loggin_in_progress = true;
 
 	if (write_to_file || write_to_error_log)
 		strftime(strfbuf, sizeof(strfbuf), "%Y-%m-%d %H:%M:%S %Z",
@@ -237,6 +301,33 @@ elog_internal(int elevel, bool file_only, const char *message)
 		fprintf(stderr, "%s\n", message);
 		fflush(stderr);
 	}
+}
+
+/*
+ * Logs to stderr or to log file and exit if ERROR.
+ *
+ * Actual implementation for elog() and pg_log().
+ */
+static void
+elog_internal(int elevel, bool file_only, const char *message)
+{
+	time_t		log_time = (time_t) time(NULL);
+
+#ifndef WIN32
+	/* Leave messages of worker threads to the log writer */
+	if (elevel < ERROR && !remote_agent && main_tid != pthread_self() &&
+		log_ring_put(elevel, file_only, log_time, message))
+		return;
+#endif
+
+	pthread_lock(&log_file_mutex);
+	loggin_in_progress = true;
+
+#ifndef WIN32
+	/* Write out earlier messages of worker threads first */
+	flush_log_rings();
+#endif
+	write_log_message(elevel, file_only, log_time, message);
 
 	exit_if_necessary(elevel);
 
@@ -244,6 +335,257 @@ elog_internal(int elevel, bool file_only, const char *message)
 	pthread_mutex_unlock(&log_file_mutex);
 }
 
+#ifndef WIN32
+/*
+ * Copy len bytes to the ring starting at position pos.
+ */
+static void
+log_ring_write(LogRing *ring, uint32 pos, const void *src, size_t len)
+{
+	uint32		offset = pos % LOG_RING_SIZE;
+	size_t		first = Min(len, LOG_RING_SIZE - offset);
+
+	memcpy(ring->data + offset, src, first);
+	memcpy(ring->data, (const char *) src + first, len - first);
+}
+
+/*
+ * Copy len bytes from the ring starting at position pos.
+ */
+static void
+log_ring_read(LogRing *ring, uint32 pos, void *dst, size_t len)
+{
+	uint32		offset = pos % LOG_RING_SIZE;
+	size_t		first = Min(len, LOG_RING_SIZE - offset);
+
+	memcpy(dst, ring->data + offset, first);
+	memcpy((char *) dst + first, ring->data, len - first);
+}
+
+/*
+ * Main routine of the log writer thread.
+ */
+static void *
+log_writer(void *arg)
+{
+	for (;;)
+	{
+		bool		found;
+		struct timespec timeout;
+
+		pthread_lock(&log_file_mutex);
+		if (log_writer_stopped)
+		{
+			pthread_mutex_unlock(&log_file_mutex);
+			break;
+		}
+		loggin_in_progress = true;
+		found = flush_log_rings();
+		loggin_in_progress = false;
+		pthread_mutex_unlock(&log_file_mutex);
+
+		if (found)
+			continue;
+
+		/*
+		 * Threads wake us up without taking log_writer_mutex, so a wakeup
+		 * may be lost.  Hence wait with a timeout.
+		 */
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += LOG_WRITER_NAPTIME * 1000000L;
+		timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+		timeout.tv_nsec %= 1000000000L;
+
+		pthread_lock(&log_writer_mutex);
+		pthread_cond_timedwait(&log_writer_cond, &log_writer_mutex, &timeout);
+		pthread_mutex_unlock(&log_writer_mutex);
+	}
+
+	return NULL;
+}
+
+/* Called at exit of a thread which had a ring */
+static void
+release_log_ring(void *arg)
+{
+	pg_atomic_clear_flag(&((LogRing *) arg)->owned);
+}
+
+static void
+start_log_writer(void)
+{
+	pthread_t	writer;
+
+	if (pthread_key_create(&log_ring_key, release_log_ring) != 0)
+		return;
+	if (pthread_create(&writer, NULL, log_writer, NULL) != 0)
+		return;
+	pthread_detach(writer);
+
+	atexit(stop_log_writer);
+	log_writer_started = true;
+}
+
+/*
+ * Returns ring of the current thread, starts the log writer if necessary.
+ * Returns NULL if messages should be written synchronously.
+ */
+static LogRing *
+get_log_ring(void)
+{
+	LogRing    *ring;
+
+	if (my_log_ring != NULL)
+		return my_log_ring;
+
+	if (pthread_once(&log_writer_once, start_log_writer) != 0 ||
+		!log_writer_started)
+		return NULL;
+
+	pthread_lock(&log_rings_mutex);
+
+	for (ring = log_rings; ring != NULL; ring = ring->next)
+	{
+		if (pg_atomic_test_set_flag(&ring->owned))
+			break;
+	}
+
+	if (ring == NULL)
+	{
+		/* Do not use pgut_malloc(), it would log an error */
+		ring = (LogRing *) malloc(sizeof(LogRing));
+		if (ring == NULL)
+		{
+			pthread_mutex_unlock(&log_rings_mutex);
+			return NULL;
+		}
+		pg_atomic_init_flag(&ring->owned);
+		pg_atomic_test_set_flag(&ring->owned);
+		pg_atomic_init_u32(&ring->head, 0);
+		pg_atomic_init_u32(&ring->tail, 0);
+		ring->next = log_rings;
+		log_rings = ring;
+	}
+
+	pthread_mutex_unlock(&log_rings_mutex);
+
+	pthread_setspecific(log_ring_key, ring);
+	my_log_ring = ring;
+
+	return ring;
+}
+
+/*
+ * Put message into the ring of the current thread.
+ * Returns false if the message should be written synchronously, i.e. if the
+ * ring is full or the message is too long.
+ */
+static bool
+log_ring_put(int elevel, bool file_only, time_t log_time, const char *message)
+{
+	LogRing    *ring;
+	LogRingEntry entry;
+	size_t		len = strlen(message) + 1;
+	uint32		size;
+	uint32		head,
+				tail;
+
+	if (len > LOG_RING_MAX_MESSAGE || log_writer_stopped ||
+		(ring = get_log_ring()) == NULL)
+		return false;
+
+	size = MAXALIGN(sizeof(LogRingEntry) + len);
+	head = pg_atomic_read_u32(&ring->head);
+	tail = pg_atomic_read_u32(&ring->tail);
+	if (head - tail + size > LOG_RING_SIZE)
+		return false;
+
+	/* Do not overwrite the space until it is released by the reader */
+	pg_memory_barrier();
+
+	entry.elevel = elevel;
+	entry.file_only = file_only;
+	entry.log_time = log_time;
+	entry.len = (uint32) len;
+	log_ring_write(ring, head, &entry, sizeof(entry));
+	log_ring_write(ring, head + sizeof(entry), message, len);
+
+	/* Publish the message */
+	pg_write_barrier();
+	pg_atomic_write_u32(&ring->head, head + size);
+
+	if (head == tail)
+		pthread_cond_signal(&log_writer_cond);
+
+	return true;
+}
+
+/*
+ * Write out messages of all rings.  Caller must hold log_file_mutex.
+ * Returns true if any message was written.
+ */
+static bool
+flush_log_rings(void)
+{
+	LogRing    *ring;
+	bool		found = false;
+
+	/* New rings are added to the head of the list only */
+	pthread_lock(&log_rings_mutex);
+	ring = log_rings;
+	pthread_mutex_unlock(&log_rings_mutex);
+
+	for (; ring != NULL; ring = ring->next)
+	{
+		uint32		tail = pg_atomic_read_u32(&ring->tail);
+		uint32		head = pg_atomic_read_u32(&ring->head);
+
+		/* Do not read messages before they are published */
+		pg_read_barrier();
+
+		while (tail != head)
+		{
+			LogRingEntry entry;
+
+			log_ring_read(ring, tail, &entry, sizeof(entry));
+			log_ring_read(ring, tail + sizeof(entry), log_ring_message,
+						  entry.len);
+
+			/* Release the space before the message is written */
+			pg_memory_barrier();
+			tail += MAXALIGN(sizeof(LogRingEntry) + entry.len);
+			pg_atomic_write_u32(&ring->tail, tail);
+
+			write_log_message(entry.elevel, entry.file_only, entry.log_time,
+							  log_ring_message);
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Write out the remaining messages and stop the log writer at exit.
+ */
+static void
+stop_log_writer(void)
+{
+	if (!log_writer_started)
+		return;
+
+	pthread_lock(&log_file_mutex);
+	if (!log_writer_stopped)
+	{
+		loggin_in_progress = true;
+		flush_log_rings();
+		loggin_in_progress = false;
+		log_writer_stopped = true;
+	}
+	pthread_mutex_unlock(&log_file_mutex);
+}
+#endif
+
 /*
  * Log only to stderr. It is called only within elog_internal() when another
  * logging already was started.
@@ -668,6 +1010,10 @@ logfile_open:
 static void
 release_logfile(void)
 {
+#ifndef WIN32
+	stop_log_writer();
+#endif
+
 	if (log_file)
 	{
 		fclose(log_file);
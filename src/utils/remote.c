@@ -5,8 +5,15 @@
 #include <sys/wait.h>
 #include <signal.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
 #include "pg_probackup.h"
 #include "file.h"
+#include "thread.h"
 
 #define MAX_CMDLINE_LENGTH  4096
 #define MAX_CMDLINE_OPTIONS 256
@@ -81,7 +88,7 @@ static bool needs_quotes(char const* path)
 	return strchr(path, ' ') != NULL;
 }
 
-bool launch_agent(void)
+static bool spawn_agent(void)
 {
 	char cmd[MAX_CMDLINE_LENGTH];
 	char* ssh_argv[MAX_CMDLINE_OPTIONS];
@@ -200,6 +207,578 @@ bool launch_agent(void)
 		/*atexit(kill_child);*/
 
 		fio_redirect(infd[0], outfd[1]); /* write to stdout */
+		fio_agent_handshake();
+	}
+	return true;
+}
+
+#ifndef WIN32
+
+/*
+ * Multiplexed connection with the agent.
+ *
+ * If there are several threads, all of them share one SSH connection
+ * instead of starting their own. Each thread speaks the usual FIO protocol
+ * over its own socket pair, the other end of which is served by the
+ * multiplexer thread. It sends the data of every channel to the agent in
+ * frames tagged with the channel number. At the agent side every channel
+ * is served by a thread of its own running fio_communicate(). Error in
+ * such thread closes its channel only, see fio_error_exit(). The channel
+ * of a master thread is closed when the thread exits.
+ *
+ * Each side may send at most FIO_MUX_WINDOW bytes of a channel which are
+ * not written to the channel socket by the peer yet. Thus one slow channel
+ * doesn't stall the others and buffered data is limited.
+ */
+#define FIO_MUX_CHANNELS	128
+#define FIO_MUX_WINDOW		(256*1024)
+#define FIO_MUX_FRAME_SIZE	(64*1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef enum
+{
+	FIO_MUX_DATA,			/* data of the channel */
+	FIO_MUX_OPEN,			/* master opened the channel */
+	FIO_MUX_CLOSE,			/* sender won't use the channel anymore */
+	FIO_MUX_CREDIT			/* receiver consumed 'size' bytes of the channel */
+} fio_mux_frame_type;
+
+typedef struct
+{
+	uint16		channel;
+	uint16		type;
+	uint32		size;
+} fio_mux_header;
+
+typedef struct
+{
+	char	   *data;
+	size_t		start;
+	size_t		end;
+	size_t		size;
+} fio_mux_buffer;
+
+typedef struct
+{
+	int			fd;			/* our end of the socket pair, -1 if the slot is free */
+	bool		opened;		/* OPEN frame is sent or received */
+	bool		eof;		/* CLOSE frame is sent */
+	bool		closed;		/* CLOSE frame is received */
+	uint32		credit;		/* number of bytes which may be sent to the peer */
+	uint32		consumed;	/* bytes written to fd and not acknowledged yet */
+	fio_mux_buffer out;		/* data received from the peer to write to fd */
+} fio_mux_channel;
+
+static fio_mux_channel mux_channels[FIO_MUX_CHANNELS];
+/* Protects mux_channels, mux_active and mux_unsupported */
+static pthread_mutex_t mux_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes launch of the agent by master threads */
+static pthread_mutex_t mux_launch_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool mux_active = false;
+static bool mux_unsupported = false;
+static int mux_link[2];
+/* Master threads wake up multiplexer to open their channels */
+static int mux_wakeup[2] = {-1, -1};
+/* Channel socket of master thread is closed by destructor of this key */
+static pthread_key_t mux_thread_key;
+static pthread_once_t mux_thread_key_once = PTHREAD_ONCE_INIT;
+/* Agent thread serving a channel, see fio_error_exit() */
+static __thread bool mux_channel_thread = false;
+
+static char* mux_buffer_reserve(fio_mux_buffer* buf, size_t size)
+{
+	if (buf->start == buf->end)
+		buf->start = buf->end = 0;
+	if (buf->end + size > buf->size && buf->start > 0)
+	{
+		memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+		buf->end -= buf->start;
+		buf->start = 0;
+	}
+	if (buf->end + size > buf->size)
+	{
+		buf->size = Max(buf->size * 2, buf->end + size);
+		buf->data = pgut_realloc(buf->data, buf->size);
+	}
+	return buf->data + buf->end;
+}
+
+static void mux_send(fio_mux_buffer* link, int channel, fio_mux_frame_type type, uint32 size)
+{
+	fio_mux_header hdr;
+
+	hdr.channel = channel;
+	hdr.type = type;
+	hdr.size = size;
+	memcpy(mux_buffer_reserve(link, sizeof(hdr)), &hdr, sizeof(hdr));
+	link->end += sizeof(hdr);
+}
+
+static void mux_init_channel(fio_mux_channel* ch, int fd, bool opened)
+{
+	SYS_CHECK(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK));
+	ch->fd = fd;
+	ch->opened = opened;
+	ch->eof = false;
+	ch->closed = false;
+	ch->credit = FIO_MUX_WINDOW;
+	ch->consumed = 0;
+	ch->out.start = ch->out.end = 0;
+}
+
+static void mux_free_channel(fio_mux_channel* ch)
+{
+	close(ch->fd);
+	ch->fd = -1;
+	pg_free(ch->out.data);
+	memset(&ch->out, 0, sizeof(ch->out));
+}
+
+static void mux_close_agent_channel(void* arg)
+{
+	close((int) (intptr_t) arg);
+}
+
+static void* mux_agent_channel(void* arg)
+{
+	mux_channel_thread = true;
+	/* Peer gets end of data if the thread fails, see fio_error_exit() */
+	pthread_cleanup_push(mux_close_agent_channel, arg);
+	fio_communicate((int) (intptr_t) arg, (int) (intptr_t) arg);
+	pthread_cleanup_pop(true);
+	return NULL;
+}
+
+/* Open channel requested by master, agent side */
+static bool mux_open_agent_channel(int channel)
+{
+	pthread_t thread;
+	int sp[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0)
+		return false;
+	mux_init_channel(&mux_channels[channel], sp[0], true);
+	if (pthread_create(&thread, NULL, mux_agent_channel, (void*) (intptr_t) sp[1]) != 0)
+		return false;
+	pthread_detach(thread);
+	return true;
+}
+
+/* Process frames received from the peer. Returns false on protocol error. */
+static bool mux_receive(fio_mux_buffer* in, fio_mux_buffer* link_out, bool is_agent)
+{
+	while (in->end - in->start >= sizeof(fio_mux_header))
+	{
+		fio_mux_header hdr;
+		fio_mux_channel* ch;
+
+		memcpy(&hdr, in->data + in->start, sizeof(hdr));
+		if (hdr.channel >= FIO_MUX_CHANNELS)
+			return false;
+		ch = &mux_channels[hdr.channel];
+
+		switch (hdr.type)
+		{
+		  case FIO_MUX_DATA:
+			if (hdr.size > FIO_MUX_FRAME_SIZE)
+				return false;
+			if (in->end - in->start < sizeof(hdr) + hdr.size)
+				return true; /* wait for the rest of the frame */
+			if (ch->fd >= 0)
+			{
+				memcpy(mux_buffer_reserve(&ch->out, hdr.size),
+					   in->data + in->start + sizeof(hdr), hdr.size);
+				ch->out.end += hdr.size;
+			}
+			in->start += hdr.size;
+			break;
+		  case FIO_MUX_OPEN:
+			if (!is_agent || ch->fd >= 0 || !mux_open_agent_channel(hdr.channel))
+				return false;
+			break;
+		  case FIO_MUX_CLOSE:
+			ch->closed = true;
+			break;
+		  case FIO_MUX_CREDIT:
+			ch->credit += hdr.size;
+			break;
+		  default:
+			return false;
+		}
+		in->start += sizeof(hdr);
+	}
+	return true;
+}
+
+/* Move data between the channel socket and the link */
+static void mux_serve_channel(fio_mux_channel* ch, int channel, short revents,
+							  fio_mux_buffer* link_out)
+{
+	if (ch->out.end > ch->out.start)
+	{
+		ssize_t rc = send(ch->fd, ch->out.data + ch->out.start,
+						  ch->out.end - ch->out.start, MSG_NOSIGNAL);
+		if (rc > 0)
+		{
+			ch->out.start += rc;
+			ch->consumed += rc;
+			if (ch->consumed >= FIO_MUX_WINDOW / 4)
+			{
+				mux_send(link_out, channel, FIO_MUX_CREDIT, ch->consumed);
+				ch->consumed = 0;
+			}
+		}
+		else if (errno != EAGAIN && errno != EINTR)
+		{
+			/* Nobody reads the channel anymore */
+			ch->out.start = ch->out.end;
+			if (!ch->eof)
+			{
+				ch->eof = true;
+				mux_send(link_out, channel, FIO_MUX_CLOSE, 0);
+			}
+		}
+	}
+
+	if ((revents & (POLLIN | POLLHUP | POLLERR)) && !ch->eof && ch->credit > 0)
+	{
+		size_t size = Min(ch->credit, FIO_MUX_FRAME_SIZE);
+		char* frame = mux_buffer_reserve(link_out, sizeof(fio_mux_header) + size);
+		ssize_t rc = recv(ch->fd, frame + sizeof(fio_mux_header), size, 0);
+
+		if (rc > 0)
+		{
+			fio_mux_header hdr;
+
+			hdr.channel = channel;
+			hdr.type = FIO_MUX_DATA;
+			hdr.size = rc;
+			memcpy(frame, &hdr, sizeof(hdr));
+			link_out->end += sizeof(hdr) + rc;
+			ch->credit -= rc;
+		}
+		else if (rc == 0 || (errno != EAGAIN && errno != EINTR))
+		{
+			ch->eof = true;
+			mux_send(link_out, channel, FIO_MUX_CLOSE, 0);
+		}
+	}
+
+	/* Both sides are done with the channel */
+	if (ch->closed && ch->out.end == ch->out.start)
+	{
+		if (!ch->eof)
+			mux_send(link_out, channel, FIO_MUX_CLOSE, 0);
+		mux_free_channel(ch);
+	}
+}
+
+/*
+ * Main loop of multiplexer. Returns when the link is closed by the peer,
+ * false is returned in case of error.
+ */
+static bool mux_loop(int in, int out, bool is_agent)
+{
+	fio_mux_buffer link_in = {0};
+	fio_mux_buffer link_out = {0};
+	struct pollfd pfd[FIO_MUX_CHANNELS + 3];
+	int pfd_channel[FIO_MUX_CHANNELS + 3];
+	bool result = false;
+
+	SYS_CHECK(fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK));
+	SYS_CHECK(fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK));
+
+	while (true)
+	{
+		ssize_t rc;
+		int n = 0;
+		int i;
+
+		pfd[n].fd = in;
+		pfd[n++].events = POLLIN;
+		pfd[n].fd = link_out.end > link_out.start ? out : -1;
+		pfd[n++].events = POLLOUT;
+		pfd[n].fd = is_agent ? -1 : mux_wakeup[0];
+		pfd[n++].events = POLLIN;
+
+		pthread_lock(&mux_lock);
+		for (i = 0; i < FIO_MUX_CHANNELS; i++)
+		{
+			fio_mux_channel* ch = &mux_channels[i];
+			short events = 0;
+
+			if (ch->fd < 0 || !ch->opened)
+				continue;
+			if (!ch->eof && ch->credit > 0)
+				events |= POLLIN;
+			if (ch->out.end > ch->out.start)
+				events |= POLLOUT;
+			if (events == 0)
+				continue;
+			pfd[n].fd = ch->fd;
+			pfd[n].events = events;
+			pfd_channel[n++] = i;
+		}
+		pthread_mutex_unlock(&mux_lock);
+
+		if (poll(pfd, n, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		pthread_lock(&mux_lock);
+
+		/* Open channels of new master threads */
+		if (pfd[2].revents & POLLIN)
+		{
+			char c;
+
+			while (read(mux_wakeup[0], &c, 1) > 0);
+			for (i = 0; i < FIO_MUX_CHANNELS; i++)
+			{
+				if (mux_channels[i].fd >= 0 && !mux_channels[i].opened)
+				{
+					mux_channels[i].opened = true;
+					mux_send(&link_out, i, FIO_MUX_OPEN, 0);
+				}
+			}
+		}
+
+		if (pfd[0].revents)
+		{
+			rc = read(in, mux_buffer_reserve(&link_in, FIO_MUX_FRAME_SIZE), FIO_MUX_FRAME_SIZE);
+			if (rc == 0)
+			{
+				result = true;
+				pthread_mutex_unlock(&mux_lock);
+				break;
+			}
+			if (rc < 0 && errno != EAGAIN && errno != EINTR)
+			{
+				pthread_mutex_unlock(&mux_lock);
+				break;
+			}
+			if (rc > 0)
+			{
+				link_in.end += rc;
+				if (!mux_receive(&link_in, &link_out, is_agent))
+				{
+					errno = EPROTO;
+					pthread_mutex_unlock(&mux_lock);
+					break;
+				}
+			}
+		}
+
+		for (i = 3; i < n; i++)
+		{
+			fio_mux_channel* ch = &mux_channels[pfd_channel[i]];
+
+			if (ch->fd == pfd[i].fd)
+				mux_serve_channel(ch, pfd_channel[i], pfd[i].revents, &link_out);
+		}
+
+		/* Deliver data of the channels closed by the peer */
+		for (i = 0; i < FIO_MUX_CHANNELS; i++)
+		{
+			if (mux_channels[i].fd >= 0 && mux_channels[i].closed)
+				mux_serve_channel(&mux_channels[i], i, 0, &link_out);
+		}
+
+		pthread_mutex_unlock(&mux_lock);
+
+		if (link_out.end > link_out.start)
+		{
+			rc = write(out, link_out.data + link_out.start, link_out.end - link_out.start);
+			if (rc > 0)
+				link_out.start += rc;
+			else if (rc < 0 && errno != EAGAIN && errno != EINTR)
+				break;
+		}
+	}
+
+	pg_free(link_in.data);
+	pg_free(link_out.data);
+	return result;
+}
+
+/* Serve multiplexed connection at the agent side */
+void fio_mux_agent(int in, int out)
+{
+	int i;
+
+	for (i = 0; i < FIO_MUX_CHANNELS; i++)
+		mux_channels[i].fd = -1;
+
+	if (!mux_loop(in, out, true))
+	{
+		fprintf(stderr, "Multiplexed connection failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void* mux_master_thread(void* arg)
+{
+	/* New connection may be started when this thread is finishing */
+	int in = mux_link[0];
+	int out = mux_link[1];
+	int i;
+
+	if (!mux_loop(in, out, false))
+		elog(WARNING, "Connection with agent failed: %s", strerror(errno));
+
+	/* Threads waiting for reply get end of data */
+	pthread_lock(&mux_lock);
+	mux_active = false;
+	for (i = 0; i < FIO_MUX_CHANNELS; i++)
+	{
+		if (mux_channels[i].fd >= 0)
+			mux_free_channel(&mux_channels[i]);
+	}
+	pthread_mutex_unlock(&mux_lock);
+
+	close(in);
+	close(out);
+	return NULL;
+}
+
+/*
+ * Close channel socket when master thread exits, so multiplexer sends
+ * CLOSE frame and the slot of the channel is freed.
+ */
+static void mux_close_thread_channel(void* arg)
+{
+	close((int) (intptr_t) arg - 1);
+}
+
+static void mux_create_thread_key(void)
+{
+	int rc = pthread_key_create(&mux_thread_key, mux_close_thread_channel);
+
+	if (rc != 0)
+		elog(ERROR, "Cannot create multiplexer thread key: %s", strerror(rc));
+}
+
+/* Switch connection of the current thread to multiplexed mode */
+static bool mux_start(void)
+{
+	pthread_t thread;
+	int i;
+
+	if (!fio_mux_start(&mux_link[0], &mux_link[1]))
+	{
+		pthread_lock(&mux_lock);
+		mux_unsupported = true;
+		pthread_mutex_unlock(&mux_lock);
+		return false;
 	}
+
+	if (mux_wakeup[0] < 0)
+	{
+		SYS_CHECK(pipe(mux_wakeup));
+		SYS_CHECK(fcntl(mux_wakeup[0], F_SETFL, fcntl(mux_wakeup[0], F_GETFL) | O_NONBLOCK));
+	}
+	pthread_once(&mux_thread_key_once, mux_create_thread_key);
+
+	pthread_lock(&mux_lock);
+	for (i = 0; i < FIO_MUX_CHANNELS; i++)
+		mux_channels[i].fd = -1;
+	mux_active = true;
+	pthread_mutex_unlock(&mux_lock);
+
+	if (pthread_create(&thread, NULL, mux_master_thread, NULL) != 0)
+		elog(ERROR, "Cannot create multiplexer thread: %s", strerror(errno));
+	pthread_detach(thread);
+
+	elog(LOG, "Connection with agent is multiplexed");
 	return true;
 }
+
+/* Open new channel of the multiplexed connection for the current thread */
+static bool mux_open_channel(void)
+{
+	int sp[2];
+	int i;
+
+	pthread_lock(&mux_lock);
+	for (i = 0; i < FIO_MUX_CHANNELS; i++)
+	{
+		if (mux_channels[i].fd < 0)
+			break;
+	}
+	if (!mux_active || i == FIO_MUX_CHANNELS)
+	{
+		/* Too many threads, use separate connection */
+		pthread_mutex_unlock(&mux_lock);
+		return spawn_agent();
+	}
+
+	SYS_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sp));
+	mux_init_channel(&mux_channels[i], sp[0], false);
+	pthread_mutex_unlock(&mux_lock);
+
+	IO_CHECK(write(mux_wakeup[1], "", 1), 1);
+	fio_redirect(sp[1], sp[1]);
+	/* Zero value is not passed to destructor, so descriptor is shifted */
+	if (pthread_setspecific(mux_thread_key, (void*) (intptr_t) (sp[1] + 1)) != 0)
+		elog(ERROR, "Cannot set multiplexer thread key");
+	return true;
+}
+
+#endif   /* WIN32 */
+
+/*
+ * Exit on system or communication error. Agent thread serving a channel
+ * of multiplexed connection finishes alone, other channels keep working.
+ */
+void fio_error_exit(void)
+{
+#ifndef WIN32
+	if (mux_channel_thread)
+		pthread_exit(NULL);
+#endif
+	exit(EXIT_FAILURE);
+}
+
+bool launch_agent(void)
+{
+#ifndef WIN32
+	bool		unsupported;
+
+	pthread_lock(&mux_lock);
+	unsupported = mux_unsupported;
+	pthread_mutex_unlock(&mux_lock);
+
+	/* Threads share one connection with the agent */
+	if (num_threads > 1 && !unsupported)
+	{
+		bool		result = true;
+		bool		active;
+
+		pthread_lock(&mux_launch_lock);
+		pthread_lock(&mux_lock);
+		active = mux_active;
+		pthread_mutex_unlock(&mux_lock);
+		if (!active)
+		{
+			result = spawn_agent();
+			if (result && !mux_start())
+			{
+				/* Use the connection of this thread as is */
+				pthread_mutex_unlock(&mux_launch_lock);
+				return true;
+			}
+		}
+		if (result)
+			result = mux_open_channel();
+		pthread_mutex_unlock(&mux_launch_lock);
+		return result;
+	}
+#endif
+	return spawn_agent();
+}
@@ -9,8 +9,47 @@
 
 #include "postgres_fe.h"
 
+#ifdef FRONTEND
+#undef FRONTEND
+#include <port/atomics.h>
+#define FRONTEND
+#else
+#include <port/atomics.h>
+#endif
+
+#include "logger.h"
 #include "thread.h"
 
+/* Tasks of one group, see ThreadTasks */
+typedef struct ThreadTaskGroup
+{
+	int		   *tasks;			/* points into ThreadTasks.order */
+	int			ntasks;
+	int			head;			/* next task to hand out */
+	int			running;		/* number of threads processing the group */
+} ThreadTaskGroup;
+
+struct ThreadTasks
+{
+	int			ntasks;
+	int		   *order;			/* tasks ordered by group and descending size */
+	int		   *task_group;		/* group of every task */
+	int			ngroups;
+	ThreadTaskGroup *groups;
+
+	/* Ticket counter used if there is only one group */
+	pg_atomic_uint32 next;
+	/* Protects groups if there are several of them */
+	pthread_mutex_t lock;
+};
+
+typedef struct ThreadTaskSortItem
+{
+	int64		size;
+	uint32		group;
+	int			task;
+} ThreadTaskSortItem;
+
 bool thread_interrupted = false;
 
 #ifdef WIN32
@@ -107,3 +146,139 @@ pthread_lock(pthread_mutex_t *mp)
 #endif
 	return pthread_mutex_lock(mp);
 }
+
+static int
+thread_task_compare(const void *a, const void *b)
+{
+	const ThreadTaskSortItem *t1 = (const ThreadTaskSortItem *) a;
+	const ThreadTaskSortItem *t2 = (const ThreadTaskSortItem *) b;
+
+	if (t1->group != t2->group)
+		return (t1->group > t2->group) ? 1 : -1;
+	if (t1->size != t2->size)
+		return (t1->size < t2->size) ? 1 : -1;
+	return t1->task - t2->task;
+}
+
+/*
+ * Create queue of 'ntasks' tasks with the given sizes.  If 'groups' is not
+ * NULL, it contains an arbitrary group key of every task.
+ */
+ThreadTasks *
+thread_tasks_create(int ntasks, const int64 *sizes, const uint32 *groups)
+{
+	ThreadTasks *tasks;
+	ThreadTaskSortItem *items;
+	int			i;
+
+	tasks = (ThreadTasks *) pg_malloc0(sizeof(ThreadTasks));
+	tasks->ntasks = ntasks;
+	tasks->order = (int *) pg_malloc(sizeof(int) * (ntasks + 1));
+	tasks->task_group = (int *) pg_malloc(sizeof(int) * (ntasks + 1));
+	tasks->groups = (ThreadTaskGroup *) pg_malloc0(sizeof(ThreadTaskGroup) *
+												   (ntasks + 1));
+	pg_atomic_init_u32(&tasks->next, 0);
+
+	items = (ThreadTaskSortItem *) pg_malloc(sizeof(ThreadTaskSortItem) *
+											 (ntasks + 1));
+	for (i = 0; i < ntasks; i++)
+	{
+		items[i].size = sizes ? sizes[i] : 0;
+		items[i].group = groups ? groups[i] : 0;
+		items[i].task = i;
+	}
+	qsort(items, ntasks, sizeof(ThreadTaskSortItem), thread_task_compare);
+
+	for (i = 0; i < ntasks; i++)
+	{
+		ThreadTaskGroup *group;
+
+		if (i == 0 || items[i].group != items[i - 1].group)
+		{
+			group = &tasks->groups[tasks->ngroups++];
+			group->tasks = &tasks->order[i];
+		}
+		else
+			group = &tasks->groups[tasks->ngroups - 1];
+
+		tasks->order[i] = items[i].task;
+		tasks->task_group[items[i].task] = tasks->ngroups - 1;
+		group->ntasks++;
+	}
+	pg_free(items);
+
+	if (tasks->ngroups > 1)
+	{
+		int			rc = pthread_mutex_init(&tasks->lock, NULL);
+
+		if (rc != 0)
+			elog(ERROR, "Cannot initialize mutex: %s", strerror(rc));
+	}
+
+	return tasks;
+}
+
+/*
+ * Get next task for the calling thread.  'prev' is the task finished by the
+ * thread or -1 on the first call.  Returns -1 if there are no tasks left.
+ */
+int
+thread_tasks_next(ThreadTasks *tasks, int prev)
+{
+	ThreadTaskGroup *best = NULL;
+	int			task = -1;
+	int			i;
+
+	if (tasks->ngroups <= 1)
+	{
+		uint32		ticket = pg_atomic_fetch_add_u32(&tasks->next, 1);
+
+		return (ticket < (uint32) tasks->ntasks) ? tasks->order[ticket] : -1;
+	}
+
+	pthread_lock(&tasks->lock);
+
+	if (prev >= 0)
+		tasks->groups[tasks->task_group[prev]].running--;
+
+	/*
+	 * Take the group with the fewest running threads, prefer the group with
+	 * more pending tasks among equal ones.
+	 */
+	for (i = 0; i < tasks->ngroups; i++)
+	{
+		ThreadTaskGroup *group = &tasks->groups[i];
+
+		if (group->head >= group->ntasks)
+			continue;
+
+		if (best == NULL || group->running < best->running ||
+			(group->running == best->running &&
+			 group->ntasks - group->head > best->ntasks - best->head))
+			best = group;
+	}
+
+	if (best)
+	{
+		task = best->tasks[best->head++];
+		best->running++;
+	}
+
+	pthread_mutex_unlock(&tasks->lock);
+
+	return task;
+}
+
+void
+thread_tasks_free(ThreadTasks *tasks)
+{
+	if (tasks == NULL)
+		return;
+
+	if (tasks->ngroups > 1)
+		pthread_mutex_destroy(&tasks->lock);
+	pg_free(tasks->order);
+	pg_free(tasks->task_group);
+	pg_free(tasks->groups);
+	pg_free(tasks);
+}
@@ -38,4 +38,20 @@ extern bool			thread_interrupted;
 
 extern int pthread_lock(pthread_mutex_t *mp);
 
+/*
+ * Queue of tasks shared by worker threads of a parallel command.
+ *
+ * Tasks are identified by their index in the caller's array and are handed
+ * out largest first.  Tasks may be split into groups (e.g. tablespaces), in
+ * this case a thread takes the next task from the group being processed by
+ * the fewest threads, so that threads spread over all groups instead of
+ * piling up on a single slow volume.
+ */
+typedef struct ThreadTasks ThreadTasks;
+
+extern ThreadTasks *thread_tasks_create(int ntasks, const int64 *sizes,
+										const uint32 *groups);
+extern int thread_tasks_next(ThreadTasks *tasks, int prev);
+extern void thread_tasks_free(ThreadTasks *tasks);
+
 #endif   /* PROBACKUP_THREAD_H */
@@ -21,10 +21,18 @@ static void do_validate_instance(void);
 static bool corrupted_backup_found = false;
 static bool skipped_due_to_lock = false;
 
+/*
+ * The content list is read and validated by parts of that many files, so
+ * memory used by validation doesn't depend on the number of files.
+ */
+#define VALIDATE_BATCH_FILES	10000
+
 typedef struct
 {
 	const char *base_path;
 	parray		*files;
+	ThreadTasks *tasks;			/* queue of files entries */
+	int			first_file;		/* number of files in previous parts */
 	bool		corrupted;
 	XLogRecPtr 	stop_lsn;
 	uint32		checksum_version;
@@ -47,12 +55,15 @@ pgBackupValidate(pgBackup *backup)
 	char		base_path[MAXPGPATH];
 	char		external_prefix[MAXPGPATH];
 	char		path[MAXPGPATH];
+	pgFileListReader *reader;
 	parray	   *files;
+	int			first_file = 0;
 	bool		corrupted = false;
 	bool		validation_isok = true;
 	/* arrays with meta info for multi threaded validate */
 	pthread_t  *threads;
 	validate_files_arg *threads_args;
+	ThreadTasks *tasks;
 	int			i;
 
 	/* Check backup version */
@@ -103,50 +114,57 @@ pgBackupValidate(pgBackup *backup)
 	pgBackupGetPath(backup, base_path, lengthof(base_path), DATABASE_DIR);
 	pgBackupGetPath(backup, external_prefix, lengthof(external_prefix), EXTERNAL_DIR);
 	pgBackupGetPath(backup, path, lengthof(path), DATABASE_FILE_LIST);
-	files = dir_read_file_list(base_path, external_prefix, path, FIO_BACKUP_HOST);
-
-	/* setup threads */
-	for (i = 0; i < parray_num(files); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files, i);
-		pg_atomic_clear_flag(&file->lock);
-	}
+	reader = file_list_open(base_path, external_prefix, path, FIO_BACKUP_HOST);
 
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (validate_files_arg *)
 		palloc(sizeof(validate_files_arg) * num_threads);
 
-	/* Validate files */
+	/* Validate files of every part of the list in parallel */
 	thread_interrupted = false;
-	for (i = 0; i < num_threads; i++)
+	progress_start("validate", NULL, true);
+	while (validation_isok &&
+		   (files = file_list_read_batch(reader, VALIDATE_BATCH_FILES)) != NULL)
 	{
-		validate_files_arg *arg = &(threads_args[i]);
-
-		arg->base_path = base_path;
-		arg->files = files;
-		arg->corrupted = false;
-		arg->backup_mode = backup->backup_mode;
-		arg->stop_lsn = backup->stop_lsn;
-		arg->checksum_version = backup->checksum_version;
-		arg->backup_version = parse_program_version(backup->program_version);
-		/* By default there are some error */
-		threads_args[i].ret = 1;
-
-		pthread_create(&threads[i], NULL, pgBackupValidateFiles, arg);
-	}
+		/* setup threads */
+		tasks = pgFileTasksCreate(files, true);
+		progress_add_files(files);
 
-	/* Wait theads */
-	for (i = 0; i < num_threads; i++)
-	{
-		validate_files_arg *arg = &(threads_args[i]);
+		for (i = 0; i < num_threads; i++)
+		{
+			validate_files_arg *arg = &(threads_args[i]);
+
+			arg->base_path = base_path;
+			arg->files = files;
+			arg->tasks = tasks;
+			arg->first_file = first_file;
+			arg->corrupted = false;
+			arg->backup_mode = backup->backup_mode;
+			arg->stop_lsn = backup->stop_lsn;
+			arg->checksum_version = backup->checksum_version;
+			arg->backup_version = parse_program_version(backup->program_version);
+			/* By default there are some error */
+			threads_args[i].ret = 1;
+
+			pthread_create(&threads[i], NULL, pgBackupValidateFiles, arg);
+		}
 
-		pthread_join(threads[i], NULL);
-		if (arg->corrupted)
-			corrupted = true;
-		if (arg->ret == 1)
-			validation_isok = false;
+		/* Wait theads */
+		for (i = 0; i < num_threads; i++)
+		{
+			validate_files_arg *arg = &(threads_args[i]);
+
+			pthread_join(threads[i], NULL);
+			if (arg->corrupted)
+				corrupted = true;
+			if (arg->ret == 1)
+				validation_isok = false;
+		}
+		thread_tasks_free(tasks);
+		first_file += parray_num(files);
 	}
+	progress_stop();
 	if (!validation_isok)
 		elog(ERROR, "Data files validation failed");
 
@@ -154,8 +172,7 @@ pgBackupValidate(pgBackup *backup)
 	pfree(threads_args);
 
 	/* cleanup */
-	parray_walk(files, pgFileFree);
-	parray_free(files);
+	file_list_close(reader);
 
 	/* Update backup status */
 	write_backup_status(backup, corrupted ? BACKUP_STATUS_CORRUPT :
@@ -176,16 +193,20 @@ pgBackupValidate(pgBackup *backup)
 static void *
 pgBackupValidateFiles(void *arg)
 {
-	int			i;
+	int			i = -1;
 	validate_files_arg *arguments = (validate_files_arg *)arg;
 	int			num_files = parray_num(arguments->files);
 	pg_crc32	crc;
 
-	for (i = 0; i < num_files; i++)
+	progress_thread_init();
+
+	while ((i = thread_tasks_next(arguments->tasks, i)) >= 0)
 	{
 		struct stat st;
 		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
 
+		progress_file_start(file);
+
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during validate");
 
@@ -201,12 +222,10 @@ pgBackupValidateFiles(void *arg)
 		if (file->is_cfs)
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, num_files, file->path);
+				 arguments->first_file + i + 1,
+				 arguments->first_file + num_files, file->path);
 
 		/*
 		 * Skip files which has no data, because they
@@ -245,6 +264,8 @@ pgBackupValidateFiles(void *arg)
 			break;
 		}
 
+		progress_add(PROGRESS_READ_BYTES, st.st_size);
+
 		/*
 		 * If option skip-block-validation is set, compute only file-level CRC for
 		 * datafiles, otherwise check them block by block.
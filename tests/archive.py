@@ -1003,3 +1003,86 @@ class ArchiveTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         pg_receivexlog.kill()
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_archive_push_get_batch(self):
+        """
+        archive-push with --batch-size pushes other ready WAL segments,
+        archive-get with --batch-size prefetches following WAL segments
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # accumulate segments, which are ready to be archived
+        node.append_conf('postgresql.auto.conf', "archive_command = 'exit 1'")
+        node.reload()
+
+        for i in range(5):
+            node.safe_psql(
+                "postgres",
+                "create table t_{0} as select i as id, md5(i::text) as text "
+                "from generate_series(0,1000) i".format(i))
+            self.switch_wal_segment(node)
+
+        result = node.safe_psql(
+            "postgres", "select count(*) from t_0, t_4")
+
+        archive_command = (
+            '"{0}" archive-push -B {1} --instance=node -j 2 --batch-size=10 '
+            '--wal-file-path %p --wal-file-name %f'.format(
+                self.probackup_path, backup_dir))
+        if self.archive_compress:
+            archive_command += ' --compress'
+        node.append_conf(
+            'postgresql.auto.conf',
+            "archive_command = '{0}'".format(archive_command))
+        node.reload()
+
+        self.switch_wal_segment(node)
+        sleep(10)
+
+        log_file = os.path.join(node.logs_dir, 'postgresql.log')
+        with open(log_file, 'r') as f:
+            log_content = f.read()
+        self.assertIn(
+            'pg_probackup archive-push pushed', log_content)
+        self.assertNotIn(
+            'pg_probackup archive-push pushed 0 of', log_content)
+
+        node.stop()
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node)
+
+        # append restore_command with prefetch
+        restore_command = (
+            '"{0}" archive-get -B {1} --instance=node -j 2 --batch-size=3 '
+            '--wal-file-path %p --wal-file-name %f'.format(
+                self.probackup_path, backup_dir))
+        node.append_conf(
+            'recovery.conf',
+            "restore_command = '{0}'".format(restore_command))
+        node.slow_start()
+
+        self.assertEqual(
+            result, node.safe_psql(
+                "postgres", "select count(*) from t_0, t_4"))
+
+        with open(log_file, 'r') as f:
+            log_content = f.read()
+        self.assertIn(
+            'pg_probackup archive-get used prefetched WAL segment',
+            log_content)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
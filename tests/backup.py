@@ -1,6 +1,7 @@
 import unittest
 import os
-from time import sleep
+import json
+from time import sleep, time
 from .helpers.ptrack_helpers import ProbackupTest, ProbackupException
 
 
@@ -339,6 +340,74 @@ class BackupTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_page_corruption_heal_several_pages(self):
+        """
+        make node, corrupt several pages, check that only
+        corrupted pages are fetched via SQL and restored data is intact
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select 1 as id, md5(i::text) as text, "
+            "md5(repeat(i::text,10))::tsvector as tsvector "
+            "from generate_series(0,10000) i")
+        node.safe_psql(
+            "postgres",
+            "CHECKPOINT;")
+
+        heap_path = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").rstrip().decode('utf-8')
+
+        result = node.safe_psql("postgres", "select * from t_heap")
+
+        # Corrupt on disk copies of blocks 1 and 5, shared buffers are intact
+        with open(os.path.join(node.data_dir, heap_path), "rb+", 0) as f:
+                f.seek(8192 + 1000)
+                f.write(b"bla")
+                f.seek(8192 * 5 + 1000)
+                f.write(b"bla")
+                f.flush()
+                f.close
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type="full",
+            options=["-j", "4", "--stream", "--log-level-file=verbose"])
+
+        # open log file and check
+        with open(os.path.join(backup_dir, 'log', 'pg_probackup.log')) as f:
+            log_content = f.read()
+            self.assertIn('block 1, try to fetch via SQL', log_content)
+            self.assertIn('block 5, try to fetch via SQL', log_content)
+            self.assertNotIn('block 2, try to fetch via SQL', log_content)
+            f.close
+
+        self.assertTrue(
+            self.show_pb(backup_dir, 'node')[1]['status'] == 'OK',
+            "Backup Status should be OK")
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.assertEqual(
+            result, node.safe_psql("postgres", "select * from t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
     # @unittest.skip("skip")
     def test_page_corruption_heal_via_ptrack_2(self):
         """make node, corrupt some page, check that backup failed"""
@@ -1365,3 +1434,428 @@ class BackupTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_large_relation_multithreaded(self):
+        """
+        make node, create relation larger than several parts of data file,
+        take multithreaded FULL and DELTA compressed backups,
+        restore and compare data
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, md5(i::text) as text, "
+            "md5(repeat(i::text,10))::tsvector as tsvector "
+            "from generate_series(0,300000) i")
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j', '4', '--compress-algorithm=zlib'])
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set id = id + 1 where id % 100 = 0")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j', '4', '--compress-algorithm=zlib'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+        result = node.safe_psql("postgres", "SELECT * FROM t_heap")
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node_restored.append_conf(
+            "postgresql.auto.conf", "port = {0}".format(node_restored.port))
+        node_restored.slow_start()
+
+        self.assertEqual(
+            result,
+            node_restored.safe_psql("postgres", "SELECT * FROM t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_binary_filelist(self):
+        """
+        make node, take FULL backup, check that binary file list is
+        written and that restore falls back to the text file list
+        when the binary one is outdated or corrupted
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        backup_path = os.path.join(
+            backup_dir, 'backups', 'node', backup_id)
+        bin_path = os.path.join(backup_path, 'backup_content.bin')
+        txt_path = os.path.join(backup_path, 'backup_content.control')
+
+        self.assertTrue(os.path.isfile(bin_path))
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
+        # binary list no longer matches the text one of the same size
+        with open(txt_path, 'rb') as f:
+            lines = f.readlines()
+        with open(txt_path, 'wb') as f:
+            f.writelines(reversed(lines))
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
+        # corrupted binary list
+        with open(txt_path, 'wb') as f:
+            f.writelines(lines)
+        with open(bin_path, 'r+b') as f:
+            f.seek(-1, 2)
+            f.write(b'\xff')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(backup_dir, 'node', node_restored)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_block_map(self):
+        """
+        make node, take FULL and PAGE backups, check that block maps
+        are written for large data files and that restore ignores
+        outdated or corrupted block map
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, "
+            "md5(i::text) as text "
+            "from generate_series(0,100000) i")
+
+        relative_path = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").rstrip().decode('utf-8')
+
+        full_id = self.backup_node(
+            backup_dir, 'node', node, options=['--compress'])
+
+        full_map = os.path.join(
+            backup_dir, 'backups', 'node', full_id,
+            'database', relative_path + '.bmap')
+        self.assertTrue(os.path.isfile(full_map))
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = 'changed' where id % 10 = 0")
+
+        page_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--compress'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        page_map = os.path.join(
+            backup_dir, 'backups', 'node', page_id,
+            'database', relative_path + '.bmap')
+        self.assertTrue(os.path.isfile(page_map))
+
+        # corrupted block map
+        with open(page_map, 'r+b') as f:
+            f.seek(-1, 2)
+            f.write(b'\xff')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(backup_dir, 'node', node_restored)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # merged backup gets new block map
+        self.merge_backup(backup_dir, 'node', page_id)
+        self.assertTrue(os.path.isfile(page_map))
+
+        node_restored.cleanup()
+        self.restore_node(backup_dir, 'node', node_restored)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_dedup(self):
+        """
+        make node, take two FULL backups with --dedup, check that
+        unchanged data file is shared by both backups, restore them
+        and check that the page store is cleaned when backups are deleted
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={'autovacuum': 'off'})
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, "
+            "md5(i::text) as text "
+            "from generate_series(0,100000) i")
+        node.safe_psql("postgres", "vacuum freeze t_heap")
+        node.safe_psql("postgres", "checkpoint")
+
+        relative_path = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").rstrip().decode('utf-8')
+
+        first_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--dedup'])
+        second_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--dedup'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        first_file = os.path.join(
+            backup_dir, 'backups', 'node', first_id, 'database', relative_path)
+        second_file = os.path.join(
+            backup_dir, 'backups', 'node', second_id, 'database', relative_path)
+
+        self.assertEqual(
+            os.stat(first_file).st_ino, os.stat(second_file).st_ino)
+
+        self.validate_pb(backup_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, backup_id=second_id)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        self.delete_pb(backup_dir, 'node', first_id)
+
+        self.assertEqual(os.stat(second_file).st_nlink, 2)
+
+        self.delete_pb(backup_dir, 'node', second_id)
+
+        self.assertFalse(
+            os.path.exists(
+                os.path.join(backup_dir, 'backups', 'node', '.dedup')))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_drop_cache(self):
+        """
+        make node, take FULL and DELTA backups with --drop-cache,
+        restore with --drop-cache and check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--drop-cache', '-j', '4'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--drop-cache'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored,
+            options=['--drop-cache', '-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_max_rate(self):
+        """
+        make node, take FULL backup with --max-rate,
+        check that backup was throttled, restore it and check data
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        # about 80MB of data files are read at 10MB per second
+        start = time()
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--max-rate=10MB', '-j', '4'])
+        self.assertGreater(time() - start, 4)
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored,
+            options=['--max-rate=100MB', '-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_progress_file(self):
+        """Check statistics written to progress file and backup.control"""
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        progress_file = os.path.join(
+            self.tmp_path, module_name, fname, 'progress.json')
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '-j', '4', '--compress', '--no-validate',
+                '--progress-file={0}'.format(progress_file)])
+
+        with open(progress_file) as f:
+            stats = json.load(f)
+
+        self.assertEqual(stats['command'], 'backup')
+        self.assertEqual(stats['files'], stats['total-files'])
+        self.assertEqual(stats['processed-bytes'], stats['total-bytes'])
+        self.assertGreater(stats['read-bytes'], stats['written-bytes'])
+        self.assertGreater(stats['compress-ratio'], 1)
+        self.assertEqual(stats['eta'], 0)
+        self.assertEqual(len(stats['threads']), 5)
+        self.assertEqual(
+            sum(thread['read-bytes'] for thread in stats['threads']),
+            stats['read-bytes'])
+
+        control = {}
+        with open(os.path.join(
+                backup_dir, 'backups', 'node',
+                backup_id, 'backup.control')) as f:
+            for line in f:
+                if '=' in line:
+                    key, value = line.split('=', 1)
+                    control[key.strip()] = value.strip()
+
+        self.assertEqual(int(control['read-bytes']), stats['read-bytes'])
+        self.assertIn('compress-time', control)
+        self.assertIn('fsync-time', control)
+
+        # validation rewrites progress file with its own statistics
+        self.validate_pb(
+            backup_dir, 'node', backup_id,
+            options=['--progress-file={0}'.format(progress_file)])
+
+        with open(progress_file) as f:
+            stats = json.load(f)
+
+        self.assertEqual(stats['command'], 'validate')
+        self.assertEqual(stats['processed-bytes'], stats['total-bytes'])
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -0,0 +1,457 @@
+/*-------------------------------------------------------------------------
+ *
+ * bench.c: micro benchmarks of pg_probackup hot paths.
+ *
+ * Measures page compression, page checksum, parsing of the backup file
+ * list and page map operations on synthetic data.  The data is generated
+ * with a fixed seed, so results of different builds are comparable.  Every
+ * kernel is run for at least the given time and prints one JSON line:
+ *
+ *   {"kernel":"checksum", "iterations":..., "items":..., "bytes":...,
+ *    "seconds":..., "cpu-seconds":..., "mb-per-sec":..., "items-per-sec":...,
+ *    "max-rss-kb":...}
+ *
+ * Build and run with "make bench".
+ *
+ * Copyright (c) 2019, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage/checksum.h"
+
+/* Number of synthetic pages used by page kernels */
+#define BENCH_NPAGES		1024
+/* Default number of entries of the synthetic file list */
+#define BENCH_NFILES		100000
+/* Page map kernels map blocks of a 1GB segment */
+#define BENCH_PAGEMAP_BLOCKS	RELSEG_SIZE
+
+/* Amount of work done by one round of a kernel */
+typedef struct BenchCounters
+{
+	int64		items;
+	int64		bytes;
+	int64		out_bytes;	/* size of produced data, 0 if not applicable */
+} BenchCounters;
+
+typedef void (*bench_round_fn) (void *arg, BenchCounters *counters);
+
+typedef struct BenchCompressArg
+{
+	CompressAlg	alg;
+	char	   *pages;
+	char	   *out;
+} BenchCompressArg;
+
+typedef struct BenchFileListArg
+{
+	char		path[MAXPGPATH];
+} BenchFileListArg;
+
+static double bench_min_time = 1.0;
+static int	bench_nfiles = BENCH_NFILES;
+static char **bench_filters = NULL;
+static int	bench_nfilters = 0;
+
+/* Keeps results of kernels alive, so the compiler doesn't throw them away */
+static volatile uint64 bench_sink = 0;
+
+static uint64 bench_seed = 0x2545F4914F6CDD1DULL;
+
+/* xorshift64*, the same sequence on every platform */
+static uint64
+bench_random(void)
+{
+	bench_seed ^= bench_seed >> 12;
+	bench_seed ^= bench_seed << 25;
+	bench_seed ^= bench_seed >> 27;
+	return bench_seed * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+bench_cpu_time(long *max_rss_kb)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	if (max_rss_kb)
+		*max_rss_kb = ru.ru_maxrss;
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static bool
+bench_enabled(const char *kernel)
+{
+	int			i;
+
+	if (bench_nfilters == 0)
+		return true;
+
+	for (i = 0; i < bench_nfilters; i++)
+		if (strncmp(kernel, bench_filters[i], strlen(bench_filters[i])) == 0)
+			return true;
+	return false;
+}
+
+/*
+ * Run rounds of the kernel until bench_min_time passes and print the result.
+ */
+static void
+bench_run(const char *kernel, bench_round_fn round, void *arg)
+{
+	BenchCounters counters;
+	int64		iterations = 0;
+	double		start,
+				elapsed;
+	double		cpu_start,
+				cpu;
+	long		max_rss_kb;
+
+	if (!bench_enabled(kernel))
+		return;
+
+	MemSet(&counters, 0, sizeof(counters));
+
+	/* warm up caches and allocator */
+	round(arg, &counters);
+	MemSet(&counters, 0, sizeof(counters));
+
+	cpu_start = bench_cpu_time(NULL);
+	start = bench_now();
+	do
+	{
+		round(arg, &counters);
+		iterations++;
+		elapsed = bench_now() - start;
+	} while (elapsed < bench_min_time);
+	cpu = bench_cpu_time(&max_rss_kb) - cpu_start;
+
+	printf("{\"kernel\":\"%s\", \"iterations\":" INT64_FORMAT
+		   ", \"items\":" INT64_FORMAT ", \"bytes\":" INT64_FORMAT,
+		   kernel, iterations, counters.items, counters.bytes);
+	if (counters.out_bytes > 0)
+		printf(", \"out-bytes\":" INT64_FORMAT ", \"ratio\":%.3f",
+			   counters.out_bytes,
+			   (double) counters.bytes / counters.out_bytes);
+	printf(", \"seconds\":%.6f, \"cpu-seconds\":%.6f, \"mb-per-sec\":%.2f"
+		   ", \"items-per-sec\":%.0f, \"max-rss-kb\":%ld}\n",
+		   elapsed, cpu, counters.bytes / elapsed / (1024 * 1024),
+		   counters.items / elapsed, max_rss_kb);
+	fflush(stdout);
+}
+
+/*
+ * Fill pages looking like heap pages: a header, line pointers and tuples
+ * made of words from a small dictionary, 3/4 of the page is used.
+ */
+static char *
+bench_make_pages(void)
+{
+	static const char *words[] = {
+		"postgres", "backup", "restore", "page", "tuple", "index",
+		"relation", "segment", "archive", "wal", "0000", "1234567"
+	};
+	char	   *pages = pgut_malloc((size_t) BENCH_NPAGES * BLCKSZ);
+	int			i;
+
+	for (i = 0; i < BENCH_NPAGES; i++)
+	{
+		char	   *page = pages + (size_t) i * BLCKSZ;
+		PageHeader	header = (PageHeader) page;
+		int			ntuples = 40;
+		int			lower = SizeOfPageHeaderData + ntuples * sizeof(ItemIdData);
+		int			upper = BLCKSZ / 4;
+		int			pos;
+
+		MemSet(page, 0, BLCKSZ);
+		for (pos = upper; pos < BLCKSZ;)
+		{
+			const char *word = words[bench_random() % lengthof(words)];
+			int			len = Min((int) strlen(word), BLCKSZ - pos);
+
+			memcpy(page + pos, word, len);
+			pos += len;
+			/* some incompressible bytes, like xids and numeric values */
+			if (pos + 4 <= BLCKSZ && bench_random() % 4 == 0)
+			{
+				uint32		value = (uint32) bench_random();
+
+				memcpy(page + pos, &value, sizeof(value));
+				pos += sizeof(value);
+			}
+		}
+		memset(page + SizeOfPageHeaderData, 0x11, lower - SizeOfPageHeaderData);
+
+		PageXLogRecPtrSet(header->pd_lsn, (XLogRecPtr) 0x16000000 + i);
+		header->pd_lower = lower;
+		header->pd_upper = upper;
+		header->pd_special = BLCKSZ;
+		PageSetPageSizeAndVersion(page, BLCKSZ, PG_PAGE_LAYOUT_VERSION);
+	}
+	return pages;
+}
+
+static void
+bench_compress_round(void *arg, BenchCounters *counters)
+{
+	BenchCompressArg *carg = (BenchCompressArg *) arg;
+	int			i;
+
+	for (i = 0; i < BENCH_NPAGES; i++)
+	{
+		const char *errormsg = NULL;
+		int32		size;
+
+		size = do_compress(carg->out, BLCKSZ * 2,
+						   carg->pages + (size_t) i * BLCKSZ, BLCKSZ,
+						   carg->alg, 1, &errormsg);
+		if (size < 0)
+			elog(ERROR, "Compression with %s failed: %s",
+				 deparse_compress_alg(carg->alg),
+				 errormsg ? errormsg : "unknown error");
+
+		counters->out_bytes += (size > 0 && size < BLCKSZ) ? size : BLCKSZ;
+	}
+	counters->items += BENCH_NPAGES;
+	counters->bytes += (int64) BENCH_NPAGES * BLCKSZ;
+}
+
+static void
+bench_checksum_round(void *arg, BenchCounters *counters)
+{
+	char	   *pages = (char *) arg;
+	uint64		sum = 0;
+	int			i;
+
+	for (i = 0; i < BENCH_NPAGES; i++)
+		sum += pg_checksum_page(pages + (size_t) i * BLCKSZ, i);
+
+	bench_sink += sum;
+	counters->items += BENCH_NPAGES;
+	counters->bytes += (int64) BENCH_NPAGES * BLCKSZ;
+}
+
+/*
+ * Add blocks of a segment to page map as WAL parsing does and iterate over
+ * them. "arg" is the distance between added blocks: 1 looks like bulk load,
+ * larger values like sparse updates.
+ */
+static void
+bench_pagemap_round(void *arg, BenchCounters *counters)
+{
+	BlockNumber	step = *(BlockNumber *) arg;
+	PageMap		map;
+	PageMapIterator iter;
+	BlockNumber	blkno;
+	uint64		sum = 0;
+
+	MemSet(&map, 0, sizeof(map));
+
+	for (blkno = 0; blkno < BENCH_PAGEMAP_BLOCKS; blkno += step)
+		pagemap_add(&map, blkno);
+
+	pagemap_iterate(&iter, &map);
+	while (pagemap_next(&iter, &blkno))
+		sum += blkno;
+	pagemap_free(&map);
+
+	bench_sink += sum;
+	counters->items += BENCH_PAGEMAP_BLOCKS / step;
+	/* amount of data the map describes */
+	counters->bytes += (int64) BENCH_PAGEMAP_BLOCKS / step * BLCKSZ;
+}
+
+static void
+bench_filelist_round(void *arg, BenchCounters *counters)
+{
+	BenchFileListArg *farg = (BenchFileListArg *) arg;
+	parray	   *files;
+	struct stat	st;
+
+	files = dir_read_file_list(NULL, NULL, farg->path, FIO_BACKUP_HOST);
+	counters->items += parray_num(files);
+	parray_walk(files, pgFileFree);
+	parray_free(files);
+
+	if (stat(farg->path, &st) == 0)
+		counters->bytes += st.st_size;
+}
+
+/*
+ * Write a file list of a cluster with a few databases and many relations
+ * into a temporary backup catalog.
+ */
+static void
+bench_make_filelist(pgBackup *backup, BenchFileListArg *farg)
+{
+	char		backup_path[MAXPGPATH];
+	parray	   *files = parray_new();
+	int			i;
+
+	pgBackupInit(backup);
+	backup->start_time = (time_t) 1;
+	pgBackupGetPath(backup, backup_path, lengthof(backup_path), NULL);
+	if (fio_mkdir(backup_path, DIR_PERMISSION, FIO_BACKUP_HOST) != 0)
+		elog(ERROR, "Cannot create directory \"%s\": %s",
+			 backup_path, strerror(errno));
+
+	for (i = 0; i < bench_nfiles; i++)
+	{
+		char		rel_path[MAXPGPATH];
+		pgFile	   *file;
+		int			segno = (i % 10 == 0) ? (int) (bench_random() % 4) : 0;
+
+		if (segno > 0)
+			snprintf(rel_path, lengthof(rel_path), "base/%d/%d.%d",
+					 16384 + i % 5, 20000 + i, segno);
+		else
+			snprintf(rel_path, lengthof(rel_path), "base/%d/%d",
+					 16384 + i % 5, 20000 + i);
+
+		file = pgFileInit(rel_path, rel_path);
+		file->mode = S_IFREG | FILE_PERMISSION;
+		file->is_datafile = true;
+		file->segno = segno;
+		file->n_blocks = (BlockNumber) (bench_random() % RELSEG_SIZE);
+		file->write_size = (int64) file->n_blocks * BLCKSZ;
+		file->crc = (pg_crc32) bench_random();
+		file->compress_alg = ZLIB_COMPRESS;
+		parray_append(files, file);
+	}
+
+	write_backup_filelist(backup, files, NULL, NULL);
+	pgBackupGetPath(backup, farg->path, lengthof(farg->path), DATABASE_FILE_LIST);
+
+	parray_walk(files, pgFileFree);
+	parray_free(files);
+}
+
+static void
+bench_filelist(void)
+{
+	char		tmpdir[] = "/tmp/pg_probackup_bench_XXXXXX";
+	char		path[MAXPGPATH];
+	pgBackup	backup;
+	BenchFileListArg farg;
+
+	if (!bench_enabled("filelist"))
+		return;
+
+	if (mkdtemp(tmpdir) == NULL)
+		elog(ERROR, "Cannot create temporary directory: %s", strerror(errno));
+	strlcpy(backup_instance_path, tmpdir, lengthof(backup_instance_path));
+
+	bench_make_filelist(&backup, &farg);
+	bench_run("filelist-bin", bench_filelist_round, &farg);
+
+	/* without binary copy the text list is parsed */
+	pgBackupGetPath(&backup, path, lengthof(path), DATABASE_FILE_LIST_BIN);
+	fio_unlink(path, FIO_BACKUP_HOST);
+	bench_run("filelist-text", bench_filelist_round, &farg);
+
+	fio_unlink(farg.path, FIO_BACKUP_HOST);
+	pgBackupGetPath(&backup, path, lengthof(path), NULL);
+	rmdir(path);
+	rmdir(tmpdir);
+}
+
+static void
+bench_usage(const char *progname)
+{
+	printf("Usage: %s [-t SECONDS] [-n FILES] [KERNEL-PREFIX...]\n\n", progname);
+	printf("  -t SECONDS  minimal duration of every kernel (default: 1)\n");
+	printf("  -n FILES    number of entries of the file list (default: %d)\n",
+		   BENCH_NFILES);
+	printf("\nKernels: compress-pglz, compress-zlib, compress-zstd, compress-lz4,\n"
+		   "checksum, pagemap-runs, pagemap-sparse, filelist-bin, filelist-text\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static CompressAlg algs[] = {
+		PGLZ_COMPRESS,
+#ifdef HAVE_LIBZ
+		ZLIB_COMPRESS,
+#endif
+#ifdef HAVE_LIBZSTD
+		ZSTD_COMPRESS,
+#endif
+#ifdef HAVE_LIBLZ4
+		LZ4_COMPRESS,
+#endif
+	};
+	BlockNumber	pagemap_runs_step = 1;
+	BlockNumber	pagemap_sparse_step = 4;
+	char	   *pages;
+	int			c;
+	int			i;
+
+	main_tid = pthread_self();
+
+	while ((c = getopt(argc, argv, "t:n:h")) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				bench_min_time = atof(optarg);
+				break;
+			case 'n':
+				bench_nfiles = atoi(optarg);
+				break;
+			default:
+				bench_usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	bench_filters = argv + optind;
+	bench_nfilters = argc - optind;
+
+	if (bench_min_time <= 0 || bench_nfiles <= 0)
+	{
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	pages = bench_make_pages();
+
+	for (i = 0; i < lengthof(algs); i++)
+	{
+		BenchCompressArg carg;
+		char		kernel[64];
+
+		carg.alg = algs[i];
+		carg.pages = pages;
+		carg.out = pgut_malloc(BLCKSZ * 2);
+		snprintf(kernel, lengthof(kernel), "compress-%s",
+				 deparse_compress_alg(algs[i]));
+		bench_run(kernel, bench_compress_round, &carg);
+		pg_free(carg.out);
+	}
+
+	bench_run("checksum", bench_checksum_round, pages);
+	bench_run("pagemap-runs", bench_pagemap_round, &pagemap_runs_step);
+	bench_run("pagemap-sparse", bench_pagemap_round, &pagemap_sparse_step);
+	bench_filelist();
+
+	pg_free(pages);
+	return 0;
+}
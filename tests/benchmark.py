@@ -0,0 +1,174 @@
+import os
+import unittest
+import json
+import resource
+import time
+from .helpers.ptrack_helpers import ProbackupTest
+
+
+module_name = 'benchmark'
+
+# Size of generated datasets, may be changed to run heavier benchmarks
+SMALL_RELATIONS = int(os.environ.get('PG_PROBACKUP_BENCH_RELATIONS', '5000'))
+PGBENCH_SCALE = int(os.environ.get('PG_PROBACKUP_BENCH_SCALE', '50'))
+THREADS = os.environ.get('PG_PROBACKUP_BENCH_THREADS', '4')
+
+
+class BenchmarkTest(ProbackupTest, unittest.TestCase):
+    """
+    Macro benchmarks of backup and restore on synthetic clusters.
+    Not a part of the regular suite, run with:
+     python -m unittest -v tests.benchmark
+    Every measurement is appended as JSON line to file
+    PG_PROBACKUP_BENCH_OUTPUT (tmp_dirs/benchmark/results.json by default).
+    """
+
+    def make_many_small_relations(self, node):
+        """Create many tables a few pages in size each"""
+        node.safe_psql(
+            "postgres",
+            "do $$ begin "
+            "for i in 1..{0} loop "
+            "execute format('create table t_%s as select g as id, "
+            "md5(g::text) as payload from generate_series(1, 100) g', i); "
+            "end loop; end $$".format(SMALL_RELATIONS))
+
+    def change_many_small_relations(self, node, step):
+        """Update every tenth table"""
+        node.safe_psql(
+            "postgres",
+            "do $$ begin "
+            "for i in 1..{0} by 10 loop "
+            "execute format('update t_%s set payload = md5(payload) "
+            "where mod(id, 10) = {1}', i + {1}); "
+            "end loop; end $$".format(SMALL_RELATIONS - 10, step))
+        node.safe_psql("postgres", "checkpoint")
+
+    def make_large_relations(self, node):
+        """Create a few big pgbench tables"""
+        node.pgbench_init(scale=PGBENCH_SCALE)
+
+    def change_large_relations(self, node, step):
+        """Update every tenth row of the biggest table"""
+        node.safe_psql(
+            "postgres",
+            "update pgbench_accounts set abalance = abalance + 1 "
+            "where aid % 10 = {0}".format(step))
+        node.safe_psql("postgres", "checkpoint")
+
+    def measure(self, dataset, name, progress_file, func):
+        """
+        Run func and report its wall time and CPU time and peak memory
+        of child processes together with pg_probackup statistics
+        """
+        if os.path.exists(progress_file):
+            os.remove(progress_file)
+
+        usage_before = resource.getrusage(resource.RUSAGE_CHILDREN)
+        start = time.time()
+        func()
+        seconds = time.time() - start
+        usage_after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+        result = {
+            'benchmark': name,
+            'dataset': dataset,
+            'transport': 'ssh' if self.remote else 'local',
+            'threads': int(THREADS),
+            'seconds': round(seconds, 3),
+            'cpu-seconds': round(
+                usage_after.ru_utime + usage_after.ru_stime -
+                usage_before.ru_utime - usage_before.ru_stime, 3),
+            # peak of all child processes run so far
+            'max-rss-kb': usage_after.ru_maxrss}
+
+        if os.path.exists(progress_file):
+            with open(progress_file) as f:
+                stats = json.load(f)
+            for key in ['total-files', 'processed-bytes',
+                        'read-bytes', 'written-bytes']:
+                result[key] = stats[key]
+            result['mb-per-sec'] = round(
+                stats['processed-bytes'] / seconds / (1024 * 1024), 2)
+
+        output = self.test_env.get(
+            'PG_PROBACKUP_BENCH_OUTPUT',
+            os.path.join(self.tmp_path, module_name, 'results.json'))
+        with open(output, 'a') as f:
+            f.write(json.dumps(result, sort_keys=True) + '\n')
+
+        return result
+
+    def run_benchmark(self, fname, dataset, make_data, change_data):
+        """Take FULL, PAGE and DELTA backups and restore the last one"""
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={
+                'max_wal_size': '1GB',
+                'checkpoint_timeout': '30min'})
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        make_data(node)
+        node.safe_psql("postgres", "checkpoint")
+
+        progress_file = os.path.join(
+            self.tmp_path, module_name, fname, 'progress.json')
+        options = [
+            '-j', THREADS, '--no-validate',
+            '--progress-file={0}'.format(progress_file)]
+
+        self.measure(
+            dataset, 'full', progress_file,
+            lambda: self.backup_node(
+                backup_dir, 'node', node, options=options))
+
+        change_data(node, 1)
+        self.measure(
+            dataset, 'page', progress_file,
+            lambda: self.backup_node(
+                backup_dir, 'node', node,
+                backup_type='page', options=options))
+
+        change_data(node, 2)
+        self.measure(
+            dataset, 'delta', progress_file,
+            lambda: self.backup_node(
+                backup_dir, 'node', node,
+                backup_type='delta', options=options))
+
+        node.cleanup()
+        self.measure(
+            dataset, 'restore', progress_file,
+            lambda: self.restore_node(
+                backup_dir, 'node', node,
+                options=[
+                    '-j', THREADS, '--no-validate',
+                    '--progress-file={0}'.format(progress_file)]))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_benchmark_many_small_relations(self):
+        """Benchmark backups of a cluster with many small tables"""
+        fname = self.id().split('.')[3]
+        self.run_benchmark(
+            fname, 'small-relations',
+            self.make_many_small_relations,
+            self.change_many_small_relations)
+
+    # @unittest.skip("skip")
+    def test_benchmark_large_relations(self):
+        """Benchmark backups of a cluster with a few big tables"""
+        fname = self.id().split('.')[3]
+        self.run_benchmark(
+            fname, 'large-relations',
+            self.make_large_relations,
+            self.change_large_relations)
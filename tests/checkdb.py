@@ -350,6 +350,53 @@ class CheckdbTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_checkdb_amcheck_many_databases(self):
+        """
+        check indexes of several databases in parallel
+        together with validation of data files
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        dbnames = ['postgres', 'db1', 'db2', 'db3', 'db4']
+        for dbname in dbnames:
+            if dbname != 'postgres':
+                node.safe_psql(
+                    "postgres", "create database {0}".format(dbname))
+            try:
+                node.safe_psql(dbname, "create extension amcheck")
+            except QueryException as e:
+                node.safe_psql(dbname, "create extension amcheck_next")
+            node.pgbench_init(scale=1, dbname=dbname)
+
+        output = self.checkdb_node(
+            backup_dir, 'node',
+            options=[
+                '--amcheck', '-j', '4',
+                '-d', 'postgres', '-p', str(node.port)])
+
+        self.assertIn('INFO: Data files are valid', output)
+        for dbname in dbnames:
+            self.assertIn(
+                "INFO: Amcheck succeeded for database '{0}'".format(dbname),
+                output)
+        self.assertIn(
+            'INFO: checkdb --amcheck finished successfully',
+            output)
+        self.assertIn('All databases were amchecked', output)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
     # @unittest.skip("skip")
     def test_checkdb_block_validation_sanity(self):
         """make node, corrupt some pages, check that checkdb failed"""
@@ -541,3 +541,154 @@ class CompressionTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    def compression_stream_check(self, fname, compress_alg):
+        """
+        make node, make full and delta stream backups with
+        given compression algorithm, check data correctness
+        in restored instance
+        """
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        try:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=[
+                    '--stream', '-j', '2',
+                    '--compress-algorithm={0}'.format(compress_alg)])
+        except ProbackupException as e:
+            if 'This build does not support' in e.message:
+                self.del_test_dir(module_name, fname)
+                self.skipTest(
+                    '{0} compression is not supported'.format(compress_alg))
+            raise
+
+        node.safe_psql(
+            "postgres",
+            "update pgbench_accounts set abalance = abalance + 1 "
+            "where aid % 10 = 0")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=[
+                '--stream', '-j', '2',
+                '--compress-algorithm={0}'.format(compress_alg),
+                '--compress-level=3'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+        result = node.safe_psql(
+            "postgres", "SELECT * FROM pgbench_accounts")
+
+        self.validate_pb(backup_dir, 'node')
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+        self.assertEqual(
+            result,
+            node.safe_psql("postgres", "SELECT * FROM pgbench_accounts"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_stream_zstd(self):
+        self.compression_stream_check(self.id().split('.')[3], 'zstd')
+
+    # @unittest.skip("skip")
+    def test_compression_stream_lz4(self):
+        self.compression_stream_check(self.id().split('.')[3], 'lz4')
+
+    # @unittest.skip("skip")
+    def test_compression_stream_wal_zlib(self):
+        """
+        make node, make full stream backup with zlib compression while
+        several WAL segments are generated, check that streamed segments
+        are compressed and summarized, validate and restore backup
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=2)
+
+        gdb = self.backup_node(
+            backup_dir, 'node', node, gdb=True,
+            options=[
+                '--stream', '--wal-summary',
+                '--compress-algorithm=zlib', '-j', '4'])
+
+        gdb.set_breakpoint('backup_files')
+        gdb.run_until_break()
+
+        # Generate several WAL segments to be streamed
+        for i in range(3):
+            pgbench = node.pgbench(options=['-T', '3', '-c', '2'])
+            pgbench.wait()
+            self.switch_wal_segment(node)
+
+        gdb.remove_all_breakpoints()
+        gdb.continue_execution_until_exit()
+
+        backup_id = self.show_pb(backup_dir, 'node')[0]['id']
+        wal_dir = os.path.join(
+            backup_dir, 'backups', 'node', backup_id, 'database',
+            'pg_wal' if self.get_version(node) >= 100000 else 'pg_xlog')
+        wal_files = os.listdir(wal_dir)
+
+        self.assertTrue(
+            [f for f in wal_files if f.endswith('.gz')],
+            'Streamed WAL is not compressed: {0}'.format(wal_files))
+        self.assertTrue(
+            [f for f in wal_files if f.endswith('.summary')],
+            'Streamed WAL is not summarized: {0}'.format(wal_files))
+
+        self.validate_pb(
+            backup_dir, 'node', backup_id, options=['--log-level-file=log'])
+
+        with open(os.path.join(backup_dir, 'log', 'pg_probackup.log')) as f:
+            self.assertIn(
+                'WAL segments using their summaries', f.read())
+
+        result = node.safe_psql("postgres", "SELECT * FROM pgbench_accounts")
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        restored_wal_dir = os.path.join(
+            node.data_dir,
+            'pg_wal' if self.get_version(node) >= 100000 else 'pg_xlog')
+        restored_wal_files = os.listdir(restored_wal_dir)
+        self.assertFalse(
+            [f for f in restored_wal_files
+             if f.endswith('.gz') or f.endswith('.summary')],
+            'Compressed WAL is restored as is: {0}'.format(restored_wal_files))
+
+        node.slow_start()
+        self.assertEqual(
+            result,
+            node.safe_psql("postgres", "SELECT * FROM pgbench_accounts"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -4,6 +4,7 @@ from .helpers.ptrack_helpers import ProbackupTest, ProbackupException
 from datetime import datetime, timedelta
 from testgres import QueryException
 import subprocess
+import json
 import time
 from threading import Thread
 
@@ -1344,3 +1345,79 @@ class DeltaTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_delta_skip_rate(self):
+        """
+        Make DELTA backup of a few changed pages of big table,
+        check that unchanged pages are skipped and data is restored
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(backup_dir, 'node', node, options=['--stream'])
+
+        node.safe_psql(
+            "postgres",
+            "update pgbench_accounts set abalance = abalance + 1 "
+            "where aid % 5000 = 0")
+        node.safe_psql("postgres", "checkpoint")
+        result = node.safe_psql(
+            "postgres", "select sum(abalance) from pgbench_accounts")
+
+        progress_file = os.path.join(
+            self.tmp_path, module_name, fname, 'progress.json')
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=[
+                '--stream', '-j', '4', '--no-validate',
+                '--progress-file={0}'.format(progress_file)])
+
+        with open(progress_file) as f:
+            stats = json.load(f)
+
+        self.assertGreater(stats['scanned-pages'], 0)
+        self.assertGreater(stats['skip-rate'], 0.5)
+
+        control = {}
+        with open(os.path.join(
+                backup_dir, 'backups', 'node',
+                backup_id, 'backup.control')) as f:
+            for line in f:
+                if '=' in line:
+                    key, value = line.split('=', 1)
+                    control[key.strip()] = value.strip()
+
+        self.assertEqual(
+            int(control['scanned-pages']), stats['scanned-pages'])
+        self.assertEqual(
+            int(control['skipped-pages']), stats['skipped-pages'])
+
+        if self.paranoia:
+            pgdata = self.pgdata_content(node.data_dir)
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+        self.assertEqual(
+            result,
+            node.safe_psql(
+                "postgres", "select sum(abalance) from pgbench_accounts"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
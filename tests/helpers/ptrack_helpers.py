@@ -996,7 +996,8 @@ class ProbackupTest(object):
 
     def set_archiving(
             self, backup_dir, instance, node, replica=False,
-            overwrite=False, compress=False, old_binary=False):
+            overwrite=False, compress=False, old_binary=False,
+            wal_summary=False):
 
         if replica:
             archive_mode = 'always'
@@ -1028,6 +1029,9 @@ class ProbackupTest(object):
         if overwrite:
             archive_command = archive_command + '--overwrite '
 
+        if wal_summary:
+            archive_command = archive_command + '--wal-summary '
+
         if os.name == 'posix':
             archive_command = archive_command + '--wal-file-path %p --wal-file-name %f'
 
@@ -301,3 +301,41 @@ class LogTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_log_from_threads(self):
+        """
+        Messages of worker threads are written by the log writer thread,
+        check that none of them is lost
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j', '8', '--log-level-file=VERBOSE'])
+
+        with open(os.path.join(backup_dir, 'log', 'pg_probackup.log')) as f:
+            log_content = f.read()
+
+        for root, dirs, files in os.walk(os.path.join(node.data_dir, 'base')):
+            for file in files:
+                self.assertIn(
+                    'Copying file:  "{0}"'.format(os.path.join(root, file)),
+                    log_content)
+
+        # messages of threads precede the message of the main thread
+        self.assertGreater(
+            log_content.rfind('completed'),
+            log_content.rfind('Copying file:'))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
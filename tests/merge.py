@@ -1392,6 +1392,77 @@ class MergeTest(ProbackupTest, unittest.TestCase):
 
         self.del_test_dir(module_name, fname)
 
+    def merge_compressed_full_page_check(self, fname, compress_alg):
+        """
+        make FULL and PAGE backups compressed by given algorithm,
+        merge them and check that restored data is correct
+        """
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=2)
+
+        # FULL backup
+        try:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=['--compress-algorithm={0}'.format(compress_alg)])
+        except ProbackupException as e:
+            if 'This build does not support' in e.message:
+                self.del_test_dir(module_name, fname)
+                self.skipTest(
+                    '{0} compression is not supported'.format(compress_alg))
+            raise
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        # PAGE backup
+        page_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--compress-algorithm={0}'.format(compress_alg)])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        self.merge_backup(backup_dir, 'node', page_id)
+
+        show_backups = self.show_pb(backup_dir, 'node')
+        self.assertEqual(len(show_backups), 1)
+        self.assertEqual(show_backups[0]['status'], 'OK')
+        self.assertEqual(show_backups[0]['backup-mode'], 'FULL')
+        self.assertEqual(show_backups[0]['compress-alg'], compress_alg)
+
+        result = node.safe_psql("postgres", "SELECT * FROM pgbench_accounts")
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+        self.assertEqual(
+            result,
+            node.safe_psql("postgres", "SELECT * FROM pgbench_accounts"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_merge_compressed_zstd(self):
+        self.merge_compressed_full_page_check(self.id().split('.')[3], 'zstd')
+
+    # @unittest.skip("skip")
+    def test_merge_compressed_lz4(self):
+        self.merge_compressed_full_page_check(self.id().split('.')[3], 'lz4')
+
     def test_merge_different_wal_modes(self):
         """
         Check that backups with different wal modes can be merged
@@ -2144,3 +2215,82 @@ class MergeTest(ProbackupTest, unittest.TestCase):
 
 # 3. Need new test with corrupted FULL backup
 # 4. different compression levels
+
+    def test_merge_compressed_delta_truncate(self):
+        """
+        make node, create table, take compressed full backup,
+        update some pages, delete last pages, vacuum relation,
+        take compressed delta backup, merge full and delta,
+        restore merged backup and check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={
+                'checkpoint_timeout': '300s',
+                'autovacuum': 'off'
+            }
+        )
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node_restored.cleanup()
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, "
+            "md5(i::text) as text "
+            "from generate_series(0,10000) i;")
+
+        node.safe_psql(
+            "postgres",
+            "vacuum t_heap")
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--compress-algorithm=zlib'])
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = 'changed' where id % 500 = 0")
+        node.safe_psql(
+            "postgres",
+            "delete from t_heap where ctid >= '(50,0)'")
+        node.safe_psql(
+            "postgres",
+            "vacuum t_heap")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--compress-algorithm=zlib'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        delta_id = self.show_pb(backup_dir, "node")[1]["id"]
+        self.merge_backup(backup_dir, "node", delta_id)
+
+        self.validate_pb(backup_dir)
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=["-j", "4"])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node_restored.append_conf(
+            "postgresql.auto.conf", "port = {0}".format(node_restored.port))
+        node_restored.slow_start()
+
+        self.assertEqual(
+            node.safe_psql("postgres", "select * from t_heap"),
+            node_restored.safe_psql("postgres", "select * from t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -1124,3 +1124,60 @@ class PageBackupTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_page_backup_runs_of_blocks(self):
+        """
+        Make PAGE backup of table with both sparse changes and long
+        runs of changed blocks, restore and check data
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, md5(i::text) as text "
+            "from generate_series(0,100000) i")
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # sparse updates and bulk load at the end of the table
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = md5(text) where id % 500 = 0; "
+            "insert into t_heap select i, md5(i::text) "
+            "from generate_series(100001,200000) i")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='page', options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata = self.pgdata_content(node.data_dir)
+
+        result = node.safe_psql(
+            "postgres", "select md5(string_agg(text, ',' order by id)) from t_heap")
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+        self.assertEqual(
+            result,
+            node.safe_psql(
+                "postgres",
+                "select md5(string_agg(text, ',' order by id)) from t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -3484,3 +3484,64 @@ class PtrackTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+
+    # @unittest.skip("skip")
+    def test_ptrack_multiple_databases(self):
+        """
+        make node with several databases and many relations,
+        change scattered pages and check that ptrack maps and
+        blocks fetched by batches are backed up correctly
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={
+                'checkpoint_timeout': '300s',
+                'ptrack_enable': 'on'
+            }
+        )
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql("postgres", "create database db1")
+        for db in ['postgres', 'db1']:
+            for i in range(20):
+                node.safe_psql(
+                    db,
+                    "create table t_{0} as select i as id, "
+                    "md5(i::text) as text from generate_series(0,20000) i".format(i))
+
+        self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        # change every 7th page of relations, more than one batch of blocks
+        for db in ['postgres', 'db1']:
+            for i in range(0, 20, 3):
+                node.safe_psql(
+                    db,
+                    "update t_{0} set text = 'changed' "
+                    "where (ctid::text::point)[0]::int % 7 = 0".format(i))
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='ptrack',
+            options=['--stream', '-j', '4'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=["-j", "4"])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -42,3 +42,194 @@ class RemoteTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_remote_backup_large_relation(self):
+        """
+        make node, create relation larger than one page batch,
+        take FULL and DELTA compressed backups via ssh,
+        restore and compare data
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, md5(i::text) as text, "
+            "md5(repeat(i::text,10))::tsvector as tsvector "
+            "from generate_series(0,100000) i")
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--compress-algorithm=zlib'])
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set id = id + 1 where id % 10 = 0")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--compress-algorithm=zlib'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+        result = node.safe_psql("postgres", "SELECT * FROM t_heap")
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(backup_dir, 'node', node_restored)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node_restored.append_conf(
+            "postgresql.auto.conf", "port = {0}".format(node_restored.port))
+        node_restored.slow_start()
+
+        self.assertEqual(
+            result,
+            node_restored.safe_psql("postgres", "SELECT * FROM t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_remote_multiplexed_connection(self):
+        """
+        make node, take FULL backup via ssh with several threads,
+        check that threads share one connection with agent,
+        restore with several threads and compare data
+        """
+        if not self.remote:
+            return unittest.skip('Only in remote mode')
+
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j', '8', '--log-level-file=log'])
+
+        with open(os.path.join(backup_dir, 'log', 'pg_probackup.log')) as f:
+            log_content = f.read()
+            self.assertIn(
+                'Connection with agent is multiplexed', log_content)
+            self.assertEqual(1, log_content.count('Spawn agent'))
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '8'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_remote_list_dir(self):
+        """
+        make node with tablespace, excluded and nested directories,
+        take FULL and DELTA backups via ssh, check that content of
+        excluded directories is skipped, restore and compare data
+        """
+        if not self.remote:
+            return unittest.skip('Only in remote mode')
+
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.create_tblspace_in_node(node, 'tblspace')
+        node.safe_psql(
+            "postgres",
+            "create table t_heap tablespace tblspace as select i as id, "
+            "md5(i::text) as text from generate_series(0,10000) i")
+
+        nested_dir = os.path.join(node.data_dir, 'nested', 'a', 'b')
+        os.makedirs(nested_dir)
+        with open(os.path.join(nested_dir, 'file'), 'w') as f:
+            f.write('nested file')
+        with open(os.path.join(
+                node.data_dir, 'pg_stat_tmp', 'excluded_file'), 'w') as f:
+            f.write('excluded file')
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '-j', '4'])
+
+        database_dir = os.path.join(
+            backup_dir, 'backups', 'node', backup_id, 'database')
+        self.assertTrue(os.path.isdir(
+            os.path.join(database_dir, 'pg_stat_tmp')))
+        self.assertFalse(os.path.exists(
+            os.path.join(database_dir, 'pg_stat_tmp', 'excluded_file')))
+        self.assertTrue(os.path.isfile(
+            os.path.join(database_dir, 'nested', 'a', 'b', 'file')))
+
+        with open(os.path.join(nested_dir, 'file'), 'w') as f:
+            f.write('changed nested file')
+        node.safe_psql(
+            "postgres",
+            "insert into t_heap select i as id, md5(i::text) as text "
+            "from generate_series(10001,20000) i")
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            backup_type='delta', options=['--stream', '-j', '4'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        tblspc_path = self.get_tblspace_path(node, 'tblspace')
+        tblspc_path_new = self.get_tblspace_path(
+            node_restored, 'tblspace_restored')
+
+        self.restore_node(
+            backup_dir, 'node', node_restored,
+            options=[
+                '-j', '4',
+                '-T', '{0}={1}'.format(tblspc_path, tblspc_path_new)])
+
+        with open(os.path.join(
+                node_restored.data_dir, 'nested', 'a', 'b', 'file')) as f:
+            self.assertEqual('changed nested file', f.read())
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
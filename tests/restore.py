@@ -2340,3 +2340,282 @@ class RestoreTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_chain_with_truncation(self):
+        """
+        make node, take FULL, PAGE and DELTA backups with relation
+        growing, being truncated and growing again between them,
+        restore the whole chain and compare data
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={'autovacuum': 'off'})
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, md5(i::text) as text "
+            "from generate_series(0,100000) i")
+
+        self.backup_node(
+            backup_dir, 'node', node, options=['--compress'])
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = 'page' where id % 7 = 0")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        node.safe_psql(
+            "postgres",
+            "delete from t_heap where id > 20000; vacuum t_heap")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--compress'])
+
+        node.safe_psql(
+            "postgres",
+            "insert into t_heap select i as id, md5(i::text) as text "
+            "from generate_series(0,50000) i")
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = 'page2' where id % 11 = 0")
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        pgdata = self.pgdata_content(node.data_dir)
+        result = node.safe_psql("postgres", "SELECT * FROM t_heap")
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node_restored.append_conf(
+            "postgresql.auto.conf", "port = {0}".format(node_restored.port))
+        node_restored.slow_start()
+
+        self.assertEqual(
+            result,
+            node_restored.safe_psql("postgres", "SELECT * FROM t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_incremental(self):
+        """
+        make node, take FULL backup, change data and create new relation,
+        restore the backup into the same data directory with --incremental,
+        check that only changes are reverted and new relation is removed
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--compress'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+        result = node.safe_psql(
+            "postgres", "SELECT * FROM pgbench_accounts ORDER BY aid")
+
+        node.safe_psql(
+            "postgres",
+            "update pgbench_accounts set abalance = abalance + 1 "
+            "where aid % 100 = 0; "
+            "create table t_new as select i from generate_series(0,10000) i")
+        node.safe_psql("postgres", "checkpoint")
+
+        # restore into running instance is not allowed
+        try:
+            self.restore_node(
+                backup_dir, 'node', node, options=['--incremental'])
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because the server is running.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'postmaster.pid exists', e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        node.stop()
+
+        self.restore_node(
+            backup_dir, 'node', node,
+            options=['-j', '4', '--incremental'])
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+
+        self.assertEqual(
+            result,
+            node.safe_psql(
+                "postgres", "SELECT * FROM pgbench_accounts ORDER BY aid"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_incremental_tablespace_external(self):
+        """
+        make node with tablespace and external directory, take FULL backup,
+        change data in both of them, restore the backup into the same
+        directories with --incremental, check that stale files are removed
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        external_dir = self.get_tblspace_path(node, 'external_dir')
+        tblspc_dir = self.get_tblspace_path(node, 'tblspace')
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.create_tblspace_in_node(node, 'tblspace')
+        node.safe_psql(
+            "postgres",
+            "create table t_heap tablespace tblspace as select i, "
+            "md5(i::text) as text from generate_series(0,10000) i")
+
+        os.mkdir(external_dir)
+        with open(os.path.join(external_dir, 'file'), 'w') as f:
+            f.write('original')
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-E', external_dir])
+
+        pgdata = self.pgdata_content(node.data_dir)
+        tblspc_content = self.pgdata_content(tblspc_dir)
+        external_content = self.pgdata_content(external_dir)
+        result = node.safe_psql("postgres", "SELECT * FROM t_heap ORDER BY i")
+
+        node.safe_psql(
+            "postgres",
+            "update t_heap set text = 'changed' where i % 100 = 0; "
+            "create table t_new tablespace tblspace as select i "
+            "from generate_series(0,10000) i")
+        node.safe_psql("postgres", "checkpoint")
+        node.stop()
+
+        with open(os.path.join(external_dir, 'file'), 'w') as f:
+            f.write('changed')
+        with open(os.path.join(external_dir, 'stale_file'), 'w') as f:
+            f.write('stale')
+
+        self.restore_node(
+            backup_dir, 'node', node,
+            options=['-j', '4', '--incremental'])
+
+        self.compare_pgdata(pgdata, self.pgdata_content(node.data_dir))
+        self.compare_pgdata(tblspc_content, self.pgdata_content(tblspc_dir))
+        self.compare_pgdata(
+            external_content, self.pgdata_content(external_dir))
+
+        node.slow_start()
+
+        self.assertEqual(
+            result,
+            node.safe_psql("postgres", "SELECT * FROM t_heap ORDER BY i"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_sparse_zero_pages(self):
+        """
+        Zeroed tail of a relation is backed up with --omit-zero-pages
+        as page headers only and is restored as a hole
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i, md5(i::text) as payload "
+            "from generate_series(0,1000) i")
+        heap_path = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").rstrip().decode('utf-8')
+        result = node.safe_psql("postgres", "SELECT * FROM t_heap")
+        node.stop()
+
+        # Preallocate 8MB of zeroed pages at the end of relation
+        with open(os.path.join(node.data_dir, heap_path), "ab") as f:
+            f.write(b"\0" * 8192 * 1024)
+
+        node.slow_start()
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--omit-zero-pages', '-j', '4'])
+
+        # Zeroed pages take only their headers in backup
+        backup_file = os.path.join(
+            backup_dir, 'backups', 'node', backup_id, 'database', heap_path)
+        self.assertLess(os.path.getsize(backup_file), 2 * 1024 * 1024)
+
+        pgdata = self.pgdata_content(node.data_dir)
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Restored file is sparse
+        st = os.stat(os.path.join(node.data_dir, heap_path))
+        self.assertEqual(st.st_size % 8192, 0)
+        self.assertLess(st.st_blocks * 512, st.st_size)
+
+        node.slow_start()
+        self.assertEqual(
+            result, node.safe_psql("postgres", "SELECT * FROM t_heap"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -1202,6 +1202,100 @@ class RetentionTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_window_merge_and_purge_plan(self):
+        """
+        PAGE
+        -------window
+        FULL
+        PAGE
+        FULL
+        Check that retention plan is shown by dry run and then
+        carried out by parallel workers
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        backup_id_a = self.backup_node(backup_dir, 'node', node)
+        page_id_a1 = self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        backup_id_b = self.backup_node(backup_dir, 'node', node)
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '1'])
+        pgbench.wait()
+
+        page_id_b1 = self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        # Make all backups but the last one expired
+        backups = os.path.join(backup_dir, 'backups', 'node')
+        for backup in os.listdir(backups):
+            if backup in [page_id_b1, 'pg_probackup.conf']:
+                continue
+
+            with open(
+                    os.path.join(
+                        backups, backup, "backup.control"), "a") as conf:
+                conf.write("recovery_time='{:%Y-%m-%d %H:%M:%S}'\n".format(
+                    datetime.now() - timedelta(days=3)))
+
+        output = self.delete_expired(
+            backup_dir, 'node',
+            options=[
+                '--retention-window=1', '--expired', '--merge-expired',
+                '--wal', '--dry-run', '-j', '4'])
+
+        self.assertIn(
+            "Retention plan: merge 1 incremental chains, delete 2 backups",
+            output)
+        self.assertIn(
+            "Retention plan: remove WAL segments older than", output)
+        self.assertEqual(len(self.show_pb(backup_dir, 'node')), 4)
+
+        output = self.delete_expired(
+            backup_dir, 'node',
+            options=[
+                '--retention-window=1', '--expired', '--merge-expired',
+                '--wal', '-j', '4'])
+
+        self.assertIn(
+            "Merge incremental chain between FULL backup {0} and backup {1}".format(
+                backup_id_b, page_id_b1),
+            output)
+        self.assertIn("Delete: {0}".format(backup_id_a), output)
+        self.assertIn("Delete: {0}".format(page_id_a1), output)
+
+        show_backups = self.show_pb(backup_dir, 'node')
+        self.assertEqual(len(show_backups), 1)
+        self.assertEqual(show_backups[0]['id'], page_id_b1)
+        self.assertEqual(show_backups[0]['backup-mode'], 'FULL')
+
+        for backup_id in [backup_id_a, page_id_a1, backup_id_b]:
+            self.assertFalse(
+                os.path.exists(os.path.join(backups, backup_id)))
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
     # @unittest.skip("skip")
     def test_window_error_backups(self):
         """
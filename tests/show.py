@@ -207,3 +207,54 @@ class OptionTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_show_catalog_summary(self):
+        """
+        catalog summary is written by commands changing backup.control and is
+        not used for backups with changed control files
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node)
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        summary = os.path.join(
+            backup_dir, "backups", "node", "backups.summary")
+        self.assertTrue(os.path.isfile(summary))
+
+        show_before = self.show_pb(backup_dir, 'node')
+
+        # change status in place, so that inode is preserved
+        file = os.path.join(
+            backup_dir, "backups", "node",
+            backup_id, "backup.control")
+        with open(file, 'r+') as f:
+            content = f.read()
+            f.seek(0)
+            f.truncate()
+            f.write(content.replace('status = OK', 'status = ERROR'))
+
+        self.assertEqual(
+            self.show_pb(backup_dir, 'node', backup_id)['status'], 'ERROR')
+
+        # control files are read in parallel without the summary
+        os.remove(summary)
+        show_after = self.show_pb(backup_dir, 'node', options=['-j', '2'])
+
+        self.assertEqual(len(show_before), len(show_after))
+        self.assertEqual(show_after[0]['status'], 'ERROR')
+        self.assertEqual(show_after[1]['status'], 'OK')
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
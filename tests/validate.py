@@ -3455,3 +3455,159 @@ class ValidateTest(ProbackupTest, unittest.TestCase):
 # 716                     if (read_len != MAXALIGN(header.compressed_size))
 # -> 717                             elog(ERROR, "cannot read block %u of \"%s\" read %lu of %d",
 # 718                                     blknum, file->path, read_len, header.compressed_size);
+
+    # @unittest.skip("skip")
+    def test_validate_wal_summary(self):
+        """
+        make archive node, make full backup, generate several WAL segments,
+        validate to xid and check that summarized segments are skipped,
+        then corrupt skipped segment and check that it is detected
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node, wal_summary=True)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node)
+
+        node.safe_psql("postgres", "create table t_heap (id int)")
+        for i in range(5):
+            node.safe_psql("postgres", "insert into t_heap values (1)")
+            self.switch_wal_segment(node)
+
+        target_xid = node.safe_psql(
+            "postgres",
+            "insert into t_heap values (2) RETURNING (xmin)").decode('utf-8').rstrip()
+        self.switch_wal_segment(node)
+        self.switch_wal_segment(node)
+
+        wals_dir = os.path.join(backup_dir, 'wal', 'node')
+        summaries = [f for f in os.listdir(wals_dir) if f.endswith('.summary')]
+        self.assertTrue(len(summaries) > 0, "WAL segment summaries are absent")
+
+        output = self.validate_pb(
+            backup_dir, 'node',
+            options=["--xid={0}".format(target_xid), "--log-level-console=LOG"])
+        self.assertIn("INFO: Backup validation completed successfully", output)
+        self.assertIn("WAL segments using their summaries", output)
+
+        # Corrupt the oldest summarized segment, it must be decoded now
+        summaries.sort()
+        wal = os.path.join(wals_dir, summaries[0][:24])
+        if not os.path.exists(wal):
+            wal = wal + '.gz'
+        with open(wal, "rb+", 0) as f:
+            f.seek(8192 + 42)
+            f.write(b"blablablaadssaaaaaaaaaaaaaaa")
+            f.flush()
+            f.close
+
+        try:
+            self.validate_pb(
+                backup_dir, 'node',
+                options=["--xid={0}".format(target_xid)])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of wal segment corruption.\n"
+                " Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'WARNING', e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_validate_many_files_by_parts(self):
+        """
+        make backup with more files than validate reads at once,
+        corrupt files in the first and the last parts of the content list
+        and check that both are detected
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_first as select i as id "
+            "from generate_series(0,1000) i")
+        node.safe_psql(
+            "postgres",
+            "do $$ begin "
+            "for i in 1..12000 loop "
+            "execute 'create table t_' || i || ' (id int)'; "
+            "end loop; end $$")
+        node.safe_psql(
+            "postgres",
+            "create table t_last as select i as id "
+            "from generate_series(0,1000) i")
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '-j', '4'])
+
+        output = self.validate_pb(
+            backup_dir, 'node', backup_id=backup_id, options=['-j', '4'])
+        self.assertIn(
+            "INFO: Backup {0} data files are valid".format(backup_id),
+            output)
+
+        for table in ['t_first', 't_last']:
+            path = node.safe_psql(
+                "postgres",
+                "select pg_relation_filepath('{0}')".format(
+                    table)).rstrip().decode('utf-8')
+            file = os.path.join(
+                backup_dir, 'backups', 'node', backup_id, 'database', path)
+            with open(file, "rb+", 0) as f:
+                f.seek(42)
+                f.write(b"blah")
+                f.flush()
+                f.close
+
+        try:
+            self.validate_pb(
+                backup_dir, 'node', backup_id=backup_id,
+                options=['-j', '4', '--skip-block-validation'])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of data files corruption.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    self.output, self.cmd))
+        except ProbackupException as e:
+            for table in ['t_first', 't_last']:
+                path = node.safe_psql(
+                    "postgres",
+                    "select pg_relation_filepath('{0}')".format(
+                        table)).rstrip().decode('utf-8')
+                self.assertIn(
+                    'WARNING: Invalid CRC of backup file "{0}"'.format(
+                        os.path.join(
+                            backup_dir, 'backups', 'node', backup_id,
+                            'database', path)),
+                    e.message,
+                    '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                        repr(e.message), self.cmd))
+
+        self.assertEqual(
+            'CORRUPT',
+            self.show_pb(backup_dir, 'node', backup_id)['status'])
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)